@@ -0,0 +1,10 @@
+# Fails when the application image exceeds the size budget, a zero budget disables the check
+# Usage: cmake -D APP_BINARY=<path> -D BUDGET_KB=<size> -P CheckSizeBudget.cmake
+file(SIZE "${APP_BINARY}" APP_SIZE)
+math(EXPR APP_SIZE_KB "(${APP_SIZE} + 1023) / 1024")
+
+if(BUDGET_KB AND (APP_SIZE_KB GREATER BUDGET_KB))
+    message(FATAL_ERROR "Application image is ${APP_SIZE_KB} KB, over the budget of ${BUDGET_KB} KB")
+endif()
+
+message("Application image is ${APP_SIZE_KB} KB, the budget is ${BUDGET_KB} KB")
@@ -0,0 +1,16 @@
+#pragma once
+
+// Host build replacement of the GPIO driver - only the types used by the headers
+
+typedef enum {
+    GPIO_NUM_0 = 0,
+} gpio_num_t;
+
+typedef enum {
+    GPIO_INTR_DISABLE = 0,
+    GPIO_INTR_POSEDGE = 1,
+    GPIO_INTR_NEGEDGE = 2,
+    GPIO_INTR_ANYEDGE = 3,
+    GPIO_INTR_LOW_LEVEL = 4,
+    GPIO_INTR_HIGH_LEVEL = 5,
+} gpio_int_type_t;
@@ -0,0 +1,5 @@
+#pragma once
+
+// Host build replacement of the ESP-IDF event loop - only the types used by the headers
+
+typedef const char *esp_event_base_t;
@@ -0,0 +1,15 @@
+#pragma once
+
+// Host build replacement of the heap capabilities. The host models a single heap of a fixed size and it accounts
+// the allocations made with the operator new, so the heap metrics follow the memory use of the request path.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_DEFAULT  (1u << 12)
+#define MALLOC_CAP_INTERNAL (1u << 11)
+#define MALLOC_CAP_DMA      (1u << 3)
+
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
@@ -0,0 +1,3 @@
+#pragma once
+
+// Host build replacement of the ESP-IDF logging - the firmware logs with the Logger class
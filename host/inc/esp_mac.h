@@ -0,0 +1,3 @@
+#pragma once
+
+// Host build replacement of the esp_mac.h header - the network is not simulated
@@ -0,0 +1,5 @@
+#pragma once
+
+// Host build replacement of the power management - only the types used by the headers
+
+typedef struct esp_pm_lock *esp_pm_lock_handle_t;
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host build replacement of the high resolution timer
+
+#include <stdint.h>
+
+// Time since the start of the process in us
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,22 @@
+#pragma once
+
+// Host build replacement of the FAT file system - the storage partition is not simulated,
+// the mount succeeds but the files of the storage path do not exist
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "tusb_msc_storage.h"
+
+typedef struct {
+    bool format_if_mount_failed;
+    int max_files;
+    size_t allocation_unit_size;
+    bool disk_status_check_enable;
+    bool use_one_fat;
+} esp_vfs_fat_mount_config_t;
+
+esp_err_t esp_vfs_fat_spiflash_mount_rw_wl(const char *basePath, const char *partitionLabel,
+    const esp_vfs_fat_mount_config_t *mountConfig, wl_handle_t *wlHandle);
+esp_err_t esp_vfs_fat_spiflash_unmount_rw_wl(const char *basePath, wl_handle_t wlHandle);
@@ -0,0 +1,20 @@
+#pragma once
+
+// Host build replacement of the FreeRTOS kernel - the tasks are threads and the tick period is 1 ms
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE             ((BaseType_t)0)
+#define pdTRUE              ((BaseType_t)1)
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+
+#define portMAX_DELAY       ((TickType_t)UINT32_MAX)
+#define configTICK_RATE_HZ  1000u
+#define portTICK_PERIOD_MS  ((TickType_t)1000u / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000u))
@@ -0,0 +1,5 @@
+#pragma once
+
+// Host build replacement of the ESP-IDF ring buffer - only the handle type used by the headers
+
+typedef void *RingbufHandle_t;
@@ -0,0 +1,21 @@
+#pragma once
+
+// Host build replacement of the FreeRTOS tasks
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct HostTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+// The task is a detached thread, the priority and the stack depth are only recorded
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameters,
+    UBaseType_t priority, TaskHandle_t *createdTask);
+// The firmware tasks only delete themselves at the end of the task function, which also ends the thread
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+char *pcTaskGetName(TaskHandle_t task);
+// Not measured on the host, always zero
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host build replacement of the NVS - the storage is kept in the memory of the process
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
@@ -0,0 +1,70 @@
+#pragma once
+
+// Host build replacement of the NVS C++ interface. The items of all namespaces are kept in the memory of the process,
+// the integer items and the blobs share the same storage and the writes are visible before the commit.
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include "esp_err.h"
+#include "nvs.h"
+
+namespace nvs {
+
+enum class ItemType : uint8_t {
+    U8,
+    I8,
+    U16,
+    I16,
+    U32,
+    I32,
+    U64,
+    I64,
+    SZ,
+    BLOB,
+    ANY
+};
+
+class NVSHandle {
+public:
+    explicit NVSHandle(const char *nsName);
+    ~NVSHandle() = default;
+
+    template<typename T>
+    esp_err_t set_item(const char *key, T value) {
+        static_assert(std::is_integral_v<T>, "Only the integer items are supported");
+        return set_blob(key, &value, sizeof(value));
+    }
+
+    template<typename T>
+    esp_err_t get_item(const char *key, T &value) {
+        static_assert(std::is_integral_v<T>, "Only the integer items are supported");
+        std::size_t size = 0u;
+        esp_err_t ret = get_item_size(ItemType::ANY, key, size);
+        if (ESP_OK != ret) {
+            return ret;
+        }
+        if (size != sizeof(value)) {
+            return ESP_ERR_NVS_INVALID_LENGTH;
+        }
+        return get_blob(key, &value, sizeof(value));
+    }
+
+    esp_err_t set_blob(const char *key, const void *blob, std::size_t len);
+    esp_err_t get_blob(const char *key, void *out, std::size_t len);
+    esp_err_t get_item_size(ItemType datatype, const char *key, std::size_t &size);
+    esp_err_t erase_item(const char *key);
+    esp_err_t commit();
+
+private:
+    std::string nsName;
+
+    std::string getKey(const char *key) const;
+};
+
+std::unique_ptr<NVSHandle> open_nvs_handle(const char *nsName, nvs_open_mode_t openMode, esp_err_t *err = nullptr);
+
+} // namespace nvs
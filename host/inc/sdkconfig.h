@@ -0,0 +1,3 @@
+#pragma once
+
+// Host build replacement of the generated configuration - the options are defined by the CMake project
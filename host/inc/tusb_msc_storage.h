@@ -0,0 +1,12 @@
+#pragma once
+
+// Host build replacement of the TinyUSB MSC storage header
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef int32_t wl_handle_t;
+
+#define WL_INVALID_HANDLE -1
+
+bool tinyusb_msc_storage_in_use_by_usb_host(void);
@@ -0,0 +1,311 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Script.hpp"
+#include "KeyboardLayout.hpp"
+#include "ReportStream.hpp"
+#include "Logger.hpp"
+
+// Compiles a DuckyScript payload to the serialized format stored by the device,
+// so that it can be uploaded with the application/octet-stream request of the /script endpoint.
+// With the -r option it writes the C++ source of the payload ROM linked into the firmware instead.
+// With the -f option the script is flattened into the keyboard reports of the whole run.
+
+namespace {
+
+void printUsage(const char *program) {
+    std::fprintf(stderr,
+        "Usage: %s [-l LAYOUT] [-o OUTPUT] [-e] [-f] [-v] INPUT\n"
+        "       %s -r [-l LAYOUT] [-f] [-v] -o OUTPUT [INPUT...]\n"
+        "  -l LAYOUT  Keyboard layout of the USB host (US, DE, FR, PL), US by default\n"
+        "  -o OUTPUT  Path of the compiled script, INPUT with the .bin (.hid with -f) extension by default\n"
+        "  -e         Print the size and the estimated duration of the script\n"
+        "  -f         Flatten the script into the timed keyboard reports, the output is the report stream\n"
+        "             or the payload ROM slots with the reports played instead of the bytecode\n"
+        "  -r         Write the C++ source of the payload ROM with one slot per INPUT\n"
+        "  -v         Print the debug logs of the compiler\n",
+        program, program);
+}
+
+std::optional<KeyboardLayout::Id> findLayout(const std::string &name) {
+    for (std::size_t idx = 0u; idx < static_cast<std::size_t>(KeyboardLayout::Id::LayoutNum); idx++) {
+        auto id = static_cast<KeyboardLayout::Id>(idx);
+        if (name == KeyboardLayout::get(id)->getName()) {
+            return id;
+        }
+    }
+
+    return std::nullopt;
+}
+
+// Compiles the file and checks the result the same way the device does before it is stored
+std::optional<Script> compileFile(const std::string &inputPath, KeyboardLayout::Id layoutId) {
+    std::ifstream input(inputPath, std::ios::binary);
+    if (!input) {
+        std::fprintf(stderr, "Failed to open the input file: '%s'\n", inputPath.c_str());
+        return std::nullopt;
+    }
+    std::string source{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+
+    auto script = Script::parse(source, layoutId);
+    if (!script) {
+        std::fprintf(stderr, "Failed to compile the script: '%s'\n", inputPath.c_str());
+        return std::nullopt;
+    }
+
+    if (!Script::deserialize(script->serialize())) {
+        std::fprintf(stderr, "Serialized script is rejected by the validation: '%s'\n", inputPath.c_str());
+        return std::nullopt;
+    }
+
+    return script;
+}
+
+// Keyboard reports of the whole run with the default timing
+std::optional<std::vector<uint8_t>> flattenScript(const Script &script, const std::string &inputPath) {
+    ReportStream stream{};
+    if (script.flatten(stream) != ErrorCode::Success) {
+        std::fprintf(stderr, "Failed to flatten the script: '%s'\n", inputPath.c_str());
+        return std::nullopt;
+    }
+
+    const auto data = stream.getData();
+    return std::vector<uint8_t>(data.begin(), data.end());
+}
+
+std::string getStem(const std::string &path) {
+    std::size_t separatorIdx = path.find_last_of('/');
+    std::string name = (separatorIdx != std::string::npos) ? path.substr(separatorIdx + 1u) : path;
+    std::size_t extensionIdx = name.find_last_of('.');
+    if ((extensionIdx != std::string::npos) && (extensionIdx > 0u)) {
+        name.resize(extensionIdx);
+    }
+
+    return name;
+}
+
+std::string quote(const std::string &str) {
+    std::string quoted{"\""};
+    for (char chr : str) {
+        if ((chr == '"') || (chr == '\\')) {
+            quoted += '\\';
+        }
+        quoted += chr;
+    }
+    quoted += '"';
+
+    return quoted;
+}
+
+struct RomSlot {
+    std::string name;
+    Script script;
+    std::vector<uint8_t> reports;   // Empty if the slot is not flattened
+};
+
+// Writes the bytes as the initializer of the constant array
+void writeArray(std::ostringstream &source, const std::string &name, std::span<const uint8_t> data) {
+    source << "constexpr std::array<uint8_t, " << data.size() << "u> " << name << " = {";
+    for (std::size_t byteIdx = 0u; byteIdx < data.size(); byteIdx++) {
+        source << ((byteIdx % 16u) ? " " : "\n    ") << static_cast<unsigned int>(data[byteIdx]) << "u,";
+    }
+    source << "\n};\n";
+}
+
+// Source of the PayloadRom::slots table, the arrays are constant, so they are placed in the flash
+std::string generateRomSource(const std::vector<RomSlot> &slots) {
+    std::ostringstream source{};
+
+    source << "// Generated by ducky-compile from the payload ROM sources - do not edit\n"
+              "#include <array>\n\n"
+              "#include \"PayloadRom.hpp\"\n\n"
+              "namespace {\n";
+
+    for (std::size_t slotIdx = 0u; slotIdx < slots.size(); slotIdx++) {
+        const Script &script = slots[slotIdx].script;
+        const auto &variableNames = script.getVariableNames();
+        const auto &functions = script.getFunctions();
+
+        source << "\n// " << slots[slotIdx].name << "\n";
+        writeArray(source, "slot" + std::to_string(slotIdx) + "Code", script.getCode());
+        writeArray(source, "slot" + std::to_string(slotIdx) + "Reports", slots[slotIdx].reports);
+
+        source << "constexpr std::array<const char *, " << variableNames.size() << "u> slot" << slotIdx << "VariableNames = {";
+        for (const auto &name : variableNames) {
+            source << quote(name) << ", ";
+        }
+        source << "};\n";
+
+        source << "constexpr std::array<PayloadRom::Function, " << functions.size() << "u> slot" << slotIdx << "Functions = {{";
+        for (const auto &function : functions) {
+            source << "{" << quote(function.name) << ", " << function.address << "u}, ";
+        }
+        source << "}};\n";
+    }
+
+    source << "\nconstexpr std::array<PayloadRom::Slot, " << slots.size() << "u> slotTable = {{\n";
+    for (std::size_t slotIdx = 0u; slotIdx < slots.size(); slotIdx++) {
+        source << "    {" << quote(slots[slotIdx].name) << ", static_cast<KeyboardLayout::Id>("
+               << static_cast<unsigned int>(slots[slotIdx].script.getLayoutId()) << "u), slot" << slotIdx << "Code, slot"
+               << slotIdx << "VariableNames, slot" << slotIdx << "Functions, slot" << slotIdx << "Reports},\n";
+    }
+    source << "}};\n\n"
+              "} // namespace\n\n"
+              "const std::span<const PayloadRom::Slot> PayloadRom::slots = slotTable;\n";
+
+    return source.str();
+}
+
+int writeRom(const std::vector<std::string> &inputPaths, const std::string &outputPath, KeyboardLayout::Id layoutId, bool isFlattened) {
+    std::vector<RomSlot> slots{};
+    for (const auto &inputPath : inputPaths) {
+        auto script = compileFile(inputPath, layoutId);
+        if (!script) {
+            return 1;
+        }
+
+        std::vector<uint8_t> reports{};
+        if (isFlattened) {
+            auto flattened = flattenScript(*script, inputPath);
+            if (!flattened) {
+                return 1;
+            }
+            reports = std::move(*flattened);
+        }
+
+        std::printf("Payload ROM slot %zu: %s, %zu bytes of bytecode, %zu bytes of reports\n", slots.size(), inputPath.c_str(),
+            script->getCode().size(), reports.size());
+        slots.push_back({getStem(inputPath), std::move(*script), std::move(reports)});
+    }
+
+    const std::string source = generateRomSource(slots);
+    std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+    output.write(source.data(), static_cast<std::streamsize>(source.size()));
+    if (!output) {
+        std::fprintf(stderr, "Failed to write the output file: '%s'\n", outputPath.c_str());
+        return 1;
+    }
+
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    KeyboardLayout::Id layoutId = KeyboardLayout::Id::Us;
+    std::vector<std::string> inputPaths{};
+    std::string outputPath{};
+    bool printEstimate = false;
+    bool isRom = false;
+    bool isFlattened = false;
+
+    Logger::get().setLevel(Logger::Level::Warning);
+
+    for (int idx = 1; idx < argc; idx++) {
+        const std::string arg{argv[idx]};
+
+        if ((arg == "-l") && (idx + 1 < argc)) {
+            auto layout = findLayout(argv[++idx]);
+            if (!layout) {
+                std::fprintf(stderr, "Unknown keyboard layout: '%s'\n", argv[idx]);
+                return 1;
+            }
+            layoutId = *layout;
+        }
+        else if ((arg == "-o") && (idx + 1 < argc)) {
+            outputPath = argv[++idx];
+        }
+        else if (arg == "-e") {
+            printEstimate = true;
+        }
+        else if (arg == "-r") {
+            isRom = true;
+        }
+        else if (arg == "-f") {
+            isFlattened = true;
+        }
+        else if (arg == "-v") {
+            Logger::get().setLevel(Logger::Level::Debug);
+        }
+        else if (!arg.empty() && (arg[0] != '-')) {
+            inputPaths.push_back(arg);
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // The payload ROM may be empty, the table is still generated
+    if (isRom) {
+        if (outputPath.empty() || printEstimate) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        return writeRom(inputPaths, outputPath, layoutId, isFlattened);
+    }
+
+    if (inputPaths.size() != 1u) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    const std::string &inputPath = inputPaths.front();
+
+    if (outputPath.empty()) {
+        std::size_t extensionIdx = inputPath.find_last_of('.');
+        std::size_t separatorIdx = inputPath.find_last_of('/');
+        if ((extensionIdx != std::string::npos) && ((separatorIdx == std::string::npos) || (extensionIdx > separatorIdx))) {
+            outputPath = inputPath.substr(0u, extensionIdx);
+        }
+        else {
+            outputPath = inputPath;
+        }
+        outputPath += isFlattened ? ".hid" : ".bin";
+    }
+
+    auto script = compileFile(inputPath, layoutId);
+    if (!script) {
+        return 1;
+    }
+
+    std::vector<uint8_t> outputData{};
+    if (isFlattened) {
+        auto reports = flattenScript(*script, inputPath);
+        if (!reports) {
+            return 1;
+        }
+        outputData = std::move(*reports);
+    }
+    else {
+        outputData = script->serialize();
+    }
+
+    std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char *>(outputData.data()), static_cast<std::streamsize>(outputData.size()));
+    if (!output) {
+        std::fprintf(stderr, "Failed to write the output file: '%s'\n", outputPath.c_str());
+        return 1;
+    }
+
+    std::printf("%s: %zu bytes (%s layout)\n", outputPath.c_str(), outputData.size(), KeyboardLayout::get(layoutId)->getName());
+
+    if (printEstimate) {
+        Script::Estimate estimate{};
+        if (script->estimate(estimate) != ErrorCode::Success) {
+            std::fprintf(stderr, "Script fails during the dry run\n");
+            return 1;
+        }
+
+        std::printf("Commands: %zu, keystrokes: %zu, duration: %s%llu ms\n", estimate.commandCount, estimate.keystrokeCount,
+            estimate.isBounded ? "" : "over ", static_cast<unsigned long long>(estimate.duration));
+    }
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "esp_http_server.h"
+
+#include "EspDucky.hpp"
+#include "Logger.hpp"
+
+// Runs the HTTP server and the API handlers of the firmware on the host. The NVS is kept in the memory and the
+// USB device only records its state, so the API is served exactly like on the device without the hardware.
+
+namespace {
+
+constexpr uint16_t DEFAULT_PORT = 8080u;
+
+void printUsage(const char *program) {
+    std::fprintf(stderr,
+        "Usage: %s [-p PORT] [-v]\n"
+        "  -p PORT  Port of the HTTP server, %u by default\n"
+        "  -v       Print the debug logs of the firmware\n",
+        program, static_cast<unsigned int>(DEFAULT_PORT));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    httpd_host_port = DEFAULT_PORT;
+    Logger::get().setLevel(Logger::Level::Info);
+
+    for (int idx = 1; idx < argc; idx++) {
+        const std::string arg{argv[idx]};
+
+        if ((arg == "-p") && (idx + 1 < argc)) {
+            const unsigned long port = std::strtoul(argv[++idx], nullptr, 10);
+            if ((port == 0u) || (port > UINT16_MAX)) {
+                std::fprintf(stderr, "Invalid port: '%s'\n", argv[idx]);
+                return 1;
+            }
+            httpd_host_port = static_cast<uint16_t>(port);
+        }
+        else if (arg == "-v") {
+            Logger::get().setLevel(Logger::Level::Debug);
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // The firmware never returns from the main task
+    static EspDucky espDucky{};
+    if (ErrorCode::Success != espDucky.init()) {
+        std::fprintf(stderr, "Failed to initialize EspDucky\n");
+        return 1;
+    }
+
+    espDucky.run();
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include <chrono>
+#include <thread>
+
+#include "UsbDevice.hpp"
+#include "Button.hpp"
+#include "CdcChannel.hpp"
+#include "WiFiAccessPoint.hpp"
+#include "MdnsResponder.hpp"
+#include "PowerManager.hpp"
+#include "Logger.hpp"
+
+// Peripherals of the host server - the USB device only records its state, so that the API reports and
+// switches it like on the device, and the button, the radio and the power management do nothing
+
+std::vector<UsbDevice*> UsbDevice::instances{};
+
+UsbDevice::UsbDevice() :
+isStartedFlag(false),
+isJtagEnabledFlag(false),
+isCdcEnabledFlag(false),
+deviceClass(DeviceClass::SerialJtag),
+wl_handle(WL_INVALID_HANDLE),
+interfaceCount(0u),
+configurationDescriptorTotalLength(0u),
+deviceDescriptor(),
+reportDescriptors(),
+stringDescriptor(),
+configurationDescriptor(),
+hidLedState(0u),
+hidAbortFlag(false),
+cdcRxCallback()
+{
+    instances.push_back(this);
+}
+
+UsbDevice::~UsbDevice() {
+    std::erase(instances, this);
+}
+
+ErrorCode UsbDevice::start(UsbDevice::DeviceClass deviceClass) {
+    if (isStartedFlag) {
+        LOGE("USB device is already started");
+        return ErrorCode::GeneralError;
+    }
+
+    this->deviceClass = deviceClass;
+    isStartedFlag = (DeviceClass::SerialJtag != deviceClass);
+    LOGI("Host USB device started with class %u", static_cast<unsigned int>(deviceClass));
+    return ErrorCode::Success;
+}
+
+ErrorCode UsbDevice::stop() {
+    isStartedFlag = false;
+    deviceClass = DeviceClass::SerialJtag;
+    return ErrorCode::Success;
+}
+
+ErrorCode UsbDevice::restart(UsbDevice::DeviceClass deviceClass) {
+    (void)stop();
+    return start(deviceClass);
+}
+
+bool UsbDevice::isStarted() const {
+    return isStartedFlag;
+}
+
+bool UsbDevice::isMounted() const {
+    // The host is always connected to the started device
+    return isStartedFlag;
+}
+
+UsbDevice::DeviceClass UsbDevice::getDeviceClass() const {
+    return deviceClass;
+}
+
+const uint8_t *UsbDevice::getReportDescriptor(uint8_t) const {
+    return nullptr;
+}
+
+ErrorCode UsbDevice::enableJTAG() {
+    isJtagEnabledFlag = true;
+    return ErrorCode::Success;
+}
+
+bool UsbDevice::cdcIsConnected() const {
+    return false;
+}
+
+std::size_t UsbDevice::cdcRead(std::span<uint8_t>) {
+    return 0u;
+}
+
+bool UsbDevice::cdcWrite(std::span<const uint8_t>) {
+    return false;
+}
+
+void UsbDevice::cdcFlush() {}
+
+void UsbDevice::cdcSetRxCallback(std::function<void()> &&callback) {
+    cdcRxCallback = std::move(callback);
+}
+
+UsbDevice* UsbDevice::getInstance(uint8_t instanceIdx) {
+    return (instanceIdx < instances.size()) ? instances[instanceIdx] : nullptr;
+}
+
+CdcChannel::CdcChannel(UsbDevice &usb, std::unordered_map<Command, CommandCallback> &&callbacks)
+:usb(usb),
+callbacks(std::move(callbacks)),
+task(nullptr),
+rxFrame(),
+lastRxTicks(0u),
+upload(),
+uploadSize(0u),
+isUploading(false),
+pendingLog()
+{}
+
+ErrorCode CdcChannel::start() {
+    return ErrorCode::NotImplemented;
+}
+
+Button::Button(gpio_num_t gpio)
+:gpio(gpio),
+events(nullptr),
+isPressedState(false),
+lastChangeTime(0)
+{}
+
+Button::~Button() {}
+
+ErrorCode Button::init() {
+    return ErrorCode::Success;
+}
+
+bool Button::waitForEvent(Event &, TickType_t timeout) {
+    // The button is never pressed
+    if (portMAX_DELAY == timeout) {
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::hours(1));
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout * portTICK_PERIOD_MS));
+    return false;
+}
+
+bool Button::isPressed() const {
+    return false;
+}
+
+WiFiAccessPoint::WiFiAccessPoint(const std::string& ssid, const std::string& password, std::uint8_t channel, std::uint8_t maxConnections)
+:ssid(ssid), password(password), channel(channel), maxConnections(maxConnections) {}
+
+void WiFiAccessPoint::start() {}
+
+void WiFiAccessPoint::stop() {}
+
+void WiFiAccessPoint::eventHandler(void*, esp_event_base_t, std::int32_t, void*) {}
+
+MdnsResponder::MdnsResponder(std::string hostname)
+:hostname(hostname) {}
+
+ErrorCode MdnsResponder::start() {
+    return ErrorCode::Success;
+}
+
+std::array<esp_pm_lock_handle_t, static_cast<std::size_t>(PowerManager::Lock::LockNum)> PowerManager::locks = {};
+
+PowerManager::Scope::Scope(Lock lock)
+:lock(lock) {}
+
+PowerManager::Scope::~Scope() {}
+
+ErrorCode PowerManager::init() {
+    return ErrorCode::NotImplemented;
+}
+
+void PowerManager::acquire(Lock) {}
+
+void PowerManager::release(Lock) {}
+
+uint32_t PowerManager::getCpuFrequency() {
+    return MAX_CPU_FREQ_MHZ;
+}
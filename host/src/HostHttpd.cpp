@@ -0,0 +1,448 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_http_server.h"
+
+#include "Logger.hpp"
+
+// HTTP/1.1 server with the subset of the ESP-IDF API used by the firmware. The requests of all connections are
+// handled in one task, so the handlers see the same serialization as on the device. Only the exact URI matching
+// and the requests with the Content-Length body are supported.
+
+uint16_t httpd_host_port = 0u;
+
+namespace {
+
+constexpr int POLL_PERIOD = 100;    // ms, period of the stop request check
+
+struct Handler {
+    std::string uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *r);
+    void *user_ctx;
+};
+
+struct Server {
+    httpd_config_t config;
+    int listenSocket;
+    std::vector<Handler> handlers;
+    std::vector<int> sessions;
+    std::atomic<bool> isStopRequested;
+    std::atomic<bool> isStopped;
+};
+
+// State of the request, referenced by the aux pointer of httpd_req_t
+struct Request {
+    int socket;
+    std::string buffer;         // Part of the body received together with the headers
+    std::size_t bufferOffset;
+    std::size_t remaining;      // Length of the body not read by the handler yet
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string status;
+    std::string type;
+    bool isResponseSent;
+    bool isKeepAlive;
+};
+
+const std::array<std::pair<const char *, const char *>, HTTPD_ERR_CODE_MAX> errorStatus = {{
+    {"500 Internal Server Error", "Server has encountered an unexpected error"},
+    {"501 Method Not Implemented", "Server does not support this method"},
+    {"505 Version Not Supported", "HTTP version not supported by server"},
+    {"400 Bad Request", "Bad request syntax"},
+    {"401 Unauthorized", "No permission -- see authorization schemes"},
+    {"403 Forbidden", "Request forbidden -- authorization will not help"},
+    {"404 Not Found", "Nothing matches the given URI"},
+    {"405 Method Not Allowed", "Specified method is invalid for this resource"},
+    {"408 Request Timeout", "Server closed this connection"},
+    {"411 Length Required", "Client must specify Content-Length"},
+    {"413 Content Too Large", "Content is too large"},
+    {"414 URI Too Long", "URI is too long"},
+    {"431 Request Header Fields Too Large", "Header fields are too long"},
+}};
+
+bool sendAll(int socket, const char *data, std::size_t size) {
+    while (size > 0u) {
+        ssize_t ret = ::send(socket, data, size, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            if ((ret < 0) && (errno == EINTR)) {
+                continue;
+            }
+            return false;
+        }
+        data += ret;
+        size -= static_cast<std::size_t>(ret);
+    }
+
+    return true;
+}
+
+bool sendResponse(Request &request, std::string_view status, std::string_view type, std::string_view body) {
+    std::string header = "HTTP/1.1 " + std::string(status) + "\r\nContent-Type: " + std::string(type) +
+        "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+
+    request.isResponseSent = true;
+    return sendAll(request.socket, header.data(), header.size()) && sendAll(request.socket, body.data(), body.size());
+}
+
+std::optional<httpd_method_t> parseMethod(std::string_view method) {
+    constexpr std::array<std::pair<std::string_view, httpd_method_t>, 5u> methods = {{
+        {"DELETE", HTTP_DELETE}, {"GET", HTTP_GET}, {"HEAD", HTTP_HEAD}, {"POST", HTTP_POST}, {"PUT", HTTP_PUT}
+    }};
+    for (const auto &[name, value] : methods) {
+        if (name == method) {
+            return value;
+        }
+    }
+
+    return std::nullopt;
+}
+
+const std::string *findHeader(const Request &request, const char *field) {
+    for (const auto &[name, value] : request.headers) {
+        if (0 == strcasecmp(name.c_str(), field)) {
+            return &value;
+        }
+    }
+
+    return nullptr;
+}
+
+// Discards the part of the body which was not read by the handler, so that the next request can be parsed
+bool drainBody(Request &request) {
+    std::array<char, 512u> buffer{};
+    request.bufferOffset = request.buffer.size();
+    while (request.remaining > 0u) {
+        ssize_t ret = ::recv(request.socket, buffer.data(), std::min(buffer.size(), request.remaining), 0);
+        if (ret <= 0) {
+            return false;
+        }
+        request.remaining -= static_cast<std::size_t>(ret);
+    }
+
+    return true;
+}
+
+// Returns false if the connection is closed
+bool handleRequest(Server &server, int socket) {
+    Request request{socket, {}, 0u, 0u, {}, "200 OK", "text/html", false, true};
+
+    // Headers, the first part of the body may be received with them
+    std::size_t headerEnd = std::string::npos;
+    std::array<char, 512u> chunk{};
+    while (headerEnd == std::string::npos) {
+        ssize_t ret = ::recv(socket, chunk.data(), chunk.size(), 0);
+        if (ret <= 0) {
+            if ((ret < 0) && (errno == EAGAIN || errno == EWOULDBLOCK) && !request.buffer.empty()) {
+                (void)sendResponse(request, errorStatus[HTTPD_408_REQ_TIMEOUT].first, "text/html", errorStatus[HTTPD_408_REQ_TIMEOUT].second);
+            }
+            return false;
+        }
+        request.buffer.append(chunk.data(), static_cast<std::size_t>(ret));
+        headerEnd = request.buffer.find("\r\n\r\n");
+        if ((headerEnd == std::string::npos) && (request.buffer.size() > HTTPD_MAX_REQ_HDR_LEN)) {
+            (void)sendResponse(request, errorStatus[HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE].first, "text/html",
+                errorStatus[HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE].second);
+            return false;
+        }
+    }
+
+    // The header is copied, as the body is kept in the buffer
+    const std::string head = request.buffer.substr(0u, headerEnd);
+    const std::size_t lineEnd = head.find("\r\n");
+    const std::string_view requestLine = std::string_view(head).substr(0u, lineEnd);
+    const std::size_t methodEnd = requestLine.find(' ');
+    const std::size_t uriEnd = requestLine.rfind(' ');
+    if ((methodEnd == std::string_view::npos) || (uriEnd <= methodEnd)) {
+        (void)sendResponse(request, errorStatus[HTTPD_400_BAD_REQUEST].first, "text/html", errorStatus[HTTPD_400_BAD_REQUEST].second);
+        return false;
+    }
+    const std::string_view uri = requestLine.substr(methodEnd + 1u, uriEnd - methodEnd - 1u);
+    const std::string_view version = requestLine.substr(uriEnd + 1u);
+
+    if (lineEnd != std::string_view::npos) {
+        std::string_view lines = std::string_view(head).substr(lineEnd + 2u);
+        while (!lines.empty()) {
+            const std::size_t end = std::min(lines.find("\r\n"), lines.size());
+            const std::string_view line = lines.substr(0u, end);
+            const std::size_t colon = line.find(':');
+            if (colon != std::string_view::npos) {
+                const std::size_t valueStart = line.find_first_not_of(' ', colon + 1u);
+                request.headers.emplace_back(std::string(line.substr(0u, colon)),
+                    (valueStart == std::string_view::npos) ? std::string() : std::string(line.substr(valueStart)));
+            }
+            lines.remove_prefix(std::min(end + 2u, lines.size()));
+        }
+    }
+
+    const std::string *connection = findHeader(request, "Connection");
+    request.isKeepAlive = connection ? (0 != strcasecmp(connection->c_str(), "close")) : (version != "HTTP/1.0");
+
+    const std::string *contentLength = findHeader(request, "Content-Length");
+    request.remaining = contentLength ? std::strtoul(contentLength->c_str(), nullptr, 10) : 0u;
+    const std::size_t contentLen = request.remaining;
+    request.buffer.erase(0u, headerEnd + 4u);
+    if (request.buffer.size() > request.remaining) {
+        // Pipelined requests are not supported
+        request.buffer.resize(request.remaining);
+    }
+
+    if (uri.size() > HTTPD_MAX_URI_LEN) {
+        (void)sendResponse(request, errorStatus[HTTPD_414_URI_TOO_LONG].first, "text/html", errorStatus[HTTPD_414_URI_TOO_LONG].second);
+        return false;
+    }
+
+    auto method = parseMethod(requestLine.substr(0u, methodEnd));
+    const std::string_view path = uri.substr(0u, uri.find('?'));
+    const Handler *handler = nullptr;
+    bool isUriFound = false;
+    for (const auto &candidate : server.handlers) {
+        if (candidate.uri == path) {
+            isUriFound = true;
+            if (method && (candidate.method == *method)) {
+                handler = &candidate;
+                break;
+            }
+        }
+    }
+
+    if (!handler) {
+        const httpd_err_code_t error = isUriFound ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND;
+        return sendResponse(request, errorStatus[error].first, "text/html", errorStatus[error].second) &&
+            drainBody(request) && request.isKeepAlive;
+    }
+
+    httpd_req_t req{};
+    req.handle = &server;
+    req.method = *method;
+    std::memcpy(req.uri, uri.data(), uri.size());
+    req.uri[uri.size()] = '\0';
+    req.content_len = contentLen;
+    req.aux = &request;
+    req.user_ctx = handler->user_ctx;
+
+    if (ESP_OK != handler->handler(&req)) {
+        // The device closes the connection as well
+        return false;
+    }
+
+    // The firmware handlers always respond, the empty response keeps the client from waiting for the timeout
+    if (!request.isResponseSent && !sendResponse(request, request.status, request.type, {})) {
+        return false;
+    }
+
+    return drainBody(request) && request.isKeepAlive;
+}
+
+void serverTask(void *arg) {
+    Server &server = *static_cast<Server *>(arg);
+
+    while (!server.isStopRequested.load()) {
+        std::vector<pollfd> fds{};
+        // New connections wait in the backlog while all sessions are open
+        if (server.sessions.size() < server.config.max_open_sockets) {
+            fds.push_back({server.listenSocket, POLLIN, 0});
+        }
+        for (int socket : server.sessions) {
+            fds.push_back({socket, POLLIN, 0});
+        }
+
+        if (::poll(fds.data(), fds.size(), POLL_PERIOD) <= 0) {
+            continue;
+        }
+
+        for (const auto &fd : fds) {
+            if (!(fd.revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+
+            if (fd.fd == server.listenSocket) {
+                int socket = ::accept(server.listenSocket, nullptr, nullptr);
+                if (socket < 0) {
+                    continue;
+                }
+                const int flag = 1;
+                (void)::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+                const timeval recvTimeout = {static_cast<time_t>(server.config.recv_wait_timeout), 0};
+                (void)::setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout));
+                const timeval sendTimeout = {static_cast<time_t>(server.config.send_wait_timeout), 0};
+                (void)::setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+                server.sessions.push_back(socket);
+            }
+            else if (!handleRequest(server, fd.fd)) {
+                ::close(fd.fd);
+                server.sessions.erase(std::remove(server.sessions.begin(), server.sessions.end(), fd.fd), server.sessions.end());
+            }
+        }
+    }
+
+    for (int socket : server.sessions) {
+        ::close(socket);
+    }
+    ::close(server.listenSocket);
+    server.isStopped.store(true);
+    vTaskDelete(nullptr);
+}
+
+} // namespace
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config) {
+    if (!handle || !config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const uint16_t port = httpd_host_port ? httpd_host_port : config->server_port;
+    int listenSocket = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket < 0) {
+        return ESP_FAIL;
+    }
+
+    const int flag = 1;
+    (void)::setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if ((0 != ::bind(listenSocket, reinterpret_cast<sockaddr *>(&address), sizeof(address))) ||
+        (0 != ::listen(listenSocket, config->backlog_conn))) {
+        LOGE("Failed to listen on port %u: %s", static_cast<unsigned int>(port), std::strerror(errno));
+        ::close(listenSocket);
+        return ESP_FAIL;
+    }
+
+    auto *server = new Server{*config, listenSocket, {}, {}, false, false};
+    if (pdPASS != xTaskCreate(serverTask, "httpd", config->stack_size, server, config->task_priority, nullptr)) {
+        ::close(listenSocket);
+        delete server;
+        return ESP_FAIL;
+    }
+
+    LOGI("Host HTTP server listening on port %u", static_cast<unsigned int>(port));
+    *handle = server;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle) {
+    auto *server = static_cast<Server *>(handle);
+    if (!server) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    server->isStopRequested.store(true);
+    while (!server->isStopped.load()) {
+        vTaskDelay(pdMS_TO_TICKS(POLL_PERIOD));
+    }
+    delete server;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler) {
+    auto *server = static_cast<Server *>(handle);
+    if (!server || !uri_handler) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (const auto &handler : server->handlers) {
+        if ((handler.uri == uri_handler->uri) && (handler.method == uri_handler->method)) {
+            return ESP_ERR_HTTPD_HANDLER_EXISTS;
+        }
+    }
+    // The same limit as on the device, the handlers over it are not registered
+    if (server->handlers.size() >= server->config.max_uri_handlers) {
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+    }
+
+    server->handlers.push_back({uri_handler->uri, uri_handler->method, uri_handler->handler, uri_handler->user_ctx});
+    return ESP_OK;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len) {
+    auto &request = *static_cast<Request *>(r->aux);
+    const std::size_t length = std::min(buf_len, request.remaining);
+    if (length == 0u) {
+        return 0;
+    }
+
+    if (request.bufferOffset < request.buffer.size()) {
+        const std::size_t size = std::min(length, request.buffer.size() - request.bufferOffset);
+        std::memcpy(buf, request.buffer.data() + request.bufferOffset, size);
+        request.bufferOffset += size;
+        request.remaining -= size;
+        return static_cast<int>(size);
+    }
+
+    ssize_t ret = ::recv(request.socket, buf, length, 0);
+    if (ret < 0) {
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+    request.remaining -= static_cast<std::size_t>(ret);
+    return static_cast<int>(ret);
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field) {
+    const std::string *value = findHeader(*static_cast<Request *>(r->aux), field);
+    return value ? value->size() : 0u;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size) {
+    const std::string *value = findHeader(*static_cast<Request *>(r->aux), field);
+    if (!value) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (val_size == 0u) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const std::size_t size = std::min(value->size(), val_size - 1u);
+    std::memcpy(val, value->data(), size);
+    val[size] = '\0';
+    return (size < value->size()) ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) {
+    static_cast<Request *>(r->aux)->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) {
+    static_cast<Request *>(r->aux)->type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+    auto &request = *static_cast<Request *>(r->aux);
+    const std::size_t length = (buf_len == HTTPD_RESP_USE_STRLEN) ? std::strlen(buf) : static_cast<std::size_t>(buf_len);
+    return sendResponse(request, request.status, request.type, std::string_view(buf, length)) ? ESP_OK : ESP_ERR_HTTPD_RESP_SEND;
+}
+
+esp_err_t httpd_resp_sendstr(httpd_req_t *r, const char *str) {
+    return httpd_resp_send(r, str, str ? HTTPD_RESP_USE_STRLEN : 0);
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg) {
+    if (error >= HTTPD_ERR_CODE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    auto &request = *static_cast<Request *>(req->aux);
+    return sendResponse(request, errorStatus[error].first, "text/html", msg ? msg : errorStatus[error].second) ?
+        ESP_OK : ESP_ERR_HTTPD_RESP_SEND;
+}
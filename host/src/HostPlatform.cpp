@@ -0,0 +1,62 @@
+#include <chrono>
+#include <thread>
+
+#include "esp_timer.h"
+
+#include "UsbDevice.hpp"
+#include "Utils.hpp"
+
+// The host tools only compile and simulate the scripts - the USB device is never present
+
+namespace {
+const auto startTime = std::chrono::steady_clock::now();
+} // namespace
+
+namespace Utils
+{
+    void delay(uint32_t ms) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+}
+
+int64_t esp_timer_get_time(void) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void UsbDevice::hidSendKeyboardReport(std::span<const uint8_t>, uint8_t) {}
+
+void UsbDevice::hidKeyStroke(std::span<const uint8_t>, uint8_t, uint32_t) {}
+
+void UsbDevice::hidKeyPress(uint8_t, uint8_t, uint32_t) {}
+
+void UsbDevice::hidSendMouseReport(uint8_t, int8_t, int8_t, int8_t, int8_t) {}
+
+void UsbDevice::hidMouseMove(int8_t, int8_t, int8_t) {}
+
+void UsbDevice::hidMouseClick(uint8_t, uint32_t) {}
+
+void UsbDevice::hidSetLedState(uint8_t) {}
+
+uint8_t UsbDevice::hidGetLedState() const {
+    return 0u;
+}
+
+bool UsbDevice::hidWaitForLedState(uint8_t, uint8_t, uint32_t) {
+    return false;
+}
+
+bool UsbDevice::hidSyncHost(uint32_t, uint32_t) {
+    return false;
+}
+
+bool UsbDevice::hidDelay(uint32_t) {
+    return true;
+}
+
+void UsbDevice::hidAbort() {}
+
+void UsbDevice::hidClearAbort() {}
+
+bool UsbDevice::hidIsAborted() const {
+    return false;
+}
@@ -0,0 +1,426 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <malloc.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_vfs_fat.h"
+#include "esp_partition.h"
+#include "nvs_flash.h"
+#include "nvs_handle.hpp"
+
+// Host implementation of the ESP-IDF and FreeRTOS services used by the HTTP and API layer
+
+struct HostTask {
+    std::string name;
+    UBaseType_t priority;
+};
+
+struct HostQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+};
+
+namespace {
+
+// Internal RAM of the ESP32-S3 available to the application heap
+constexpr std::size_t HEAP_SIZE = 320u * 1024u;
+
+thread_local HostTask *currentTask = nullptr;
+
+std::atomic<std::size_t> heapUsed{0u};
+std::atomic<std::size_t> heapPeak{0u};
+
+std::mutex nvsMutex;
+std::map<std::string, std::vector<uint8_t>> nvsItems;
+
+// Script partition of the partition table, erased like a new flash
+const esp_partition_t scriptPartition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = static_cast<esp_partition_subtype_t>(0x40),
+    .address = 0x310000u,
+    .size = 128u * 1024u,
+    .erase_size = 4096u,
+    .label = "script",
+    .encrypted = false
+};
+std::mutex partitionMutex;
+std::vector<uint8_t> scriptPartitionData(scriptPartition.size, 0xFFu);
+
+bool isPartitionRange(const esp_partition_t *partition, std::size_t offset, std::size_t size) {
+    return (&scriptPartition == partition) && (offset <= partition->size) && (size <= partition->size - offset);
+}
+
+HostTask &getCurrentTask() {
+    // The threads not created by xTaskCreate are named like the main task of ESP-IDF
+    static thread_local HostTask mainTask{"main", 1u};
+    return currentTask ? *currentTask : mainTask;
+}
+
+void trackAllocation(void *ptr) {
+    if (ptr) {
+        const std::size_t used = heapUsed.fetch_add(malloc_usable_size(ptr)) + malloc_usable_size(ptr);
+        std::size_t peak = heapPeak.load();
+        while ((used > peak) && !heapPeak.compare_exchange_weak(peak, used)) {}
+    }
+}
+
+void trackDeallocation(void *ptr) {
+    if (ptr) {
+        heapUsed.fetch_sub(malloc_usable_size(ptr));
+    }
+}
+
+// Waits for the condition until the ticks elapse, portMAX_DELAY waits forever
+template<typename Predicate>
+bool waitFor(std::condition_variable &changed, std::unique_lock<std::mutex> &lock, TickType_t ticks, Predicate predicate) {
+    if (portMAX_DELAY == ticks) {
+        changed.wait(lock, predicate);
+        return true;
+    }
+    return changed.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), predicate);
+}
+
+} // namespace
+
+// Heap accounting - the C allocations are wrapped by the linker, the C++ allocations use them as well
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+    void *ptr = __real_malloc(size);
+    trackAllocation(ptr);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+    void *ptr = __real_calloc(num, size);
+    trackAllocation(ptr);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    trackDeallocation(ptr);
+    void *newPtr = __real_realloc(ptr, size);
+    // The original block is kept if the reallocation fails
+    trackAllocation(newPtr ? newPtr : ((size > 0u) ? ptr : nullptr));
+    return newPtr;
+}
+
+void __wrap_free(void *ptr) {
+    trackDeallocation(ptr);
+    __real_free(ptr);
+}
+}
+
+void *operator new(std::size_t size) {
+    void *ptr = std::malloc(size ? size : 1u);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return std::malloc(size ? size : 1u);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return std::malloc(size ? size : 1u);
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    std::free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t) {
+    const std::size_t used = heapUsed.load();
+    return (used < HEAP_SIZE) ? (HEAP_SIZE - used) : 0u;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t) {
+    const std::size_t peak = heapPeak.load();
+    return (peak < HEAP_SIZE) ? (HEAP_SIZE - peak) : 0u;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    // The host heap is not fragmented
+    return heap_caps_get_free_size(caps);
+}
+
+// Tasks and queues ===
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t, void *parameters,
+    UBaseType_t priority, TaskHandle_t *createdTask) {
+    auto *task = new HostTask{name ? name : "", priority};
+    if (createdTask) {
+        *createdTask = task;
+    }
+
+    std::thread([function, parameters, task]() {
+        currentTask = task;
+        function(parameters);
+        currentTask = nullptr;
+        delete task;
+    }).detach();
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t) {}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return static_cast<TickType_t>(esp_timer_get_time() / (1000 * portTICK_PERIOD_MS));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return &getCurrentTask();
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    return (task ? *task : getCurrentTask()).priority;
+}
+
+char *pcTaskGetName(TaskHandle_t task) {
+    return (task ? *task : getCurrentTask()).name.data();
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) {
+    return 0u;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    auto *queue = new HostQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitFor(queue->changed, lock, ticksToWait, [queue]() { return queue->items.size() < queue->length; })) {
+        return pdFAIL;
+    }
+
+    const auto *bytes = static_cast<const uint8_t *>(item);
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticksToWait) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitFor(queue->changed, lock, ticksToWait, [queue]() { return !queue->items.empty(); })) {
+        return pdFALSE;
+    }
+
+    std::memcpy(buffer, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+// NVS and storage ===
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    nvsItems.clear();
+    return ESP_OK;
+}
+
+namespace nvs {
+
+NVSHandle::NVSHandle(const char *nsName)
+:nsName(nsName) {}
+
+std::string NVSHandle::getKey(const char *key) const {
+    return nsName + '/' + key;
+}
+
+esp_err_t NVSHandle::set_blob(const char *key, const void *blob, std::size_t len) {
+    const auto *bytes = static_cast<const uint8_t *>(blob);
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    nvsItems[getKey(key)].assign(bytes, bytes + len);
+    return ESP_OK;
+}
+
+esp_err_t NVSHandle::get_blob(const char *key, void *out, std::size_t len) {
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    auto item = nvsItems.find(getKey(key));
+    if (item == nvsItems.end()) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (len < item->second.size()) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    std::memcpy(out, item->second.data(), item->second.size());
+    return ESP_OK;
+}
+
+esp_err_t NVSHandle::get_item_size(ItemType, const char *key, std::size_t &size) {
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    auto item = nvsItems.find(getKey(key));
+    if (item == nvsItems.end()) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    size = item->second.size();
+    return ESP_OK;
+}
+
+esp_err_t NVSHandle::erase_item(const char *key) {
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    return (0u != nvsItems.erase(getKey(key))) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t NVSHandle::commit() {
+    return ESP_OK;
+}
+
+std::unique_ptr<NVSHandle> open_nvs_handle(const char *nsName, nvs_open_mode_t, esp_err_t *err) {
+    if (err) {
+        *err = ESP_OK;
+    }
+    return std::make_unique<NVSHandle>(nsName);
+}
+
+} // namespace nvs
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    if (((ESP_PARTITION_TYPE_ANY != type) && (scriptPartition.type != type)) ||
+        ((ESP_PARTITION_SUBTYPE_ANY != subtype) && (scriptPartition.subtype != subtype)) ||
+        (label && (0 != std::strcmp(label, scriptPartition.label)))) {
+        return nullptr;
+    }
+    return &scriptPartition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t srcOffset, void *dst, size_t size) {
+    if (!isPartitionRange(partition, srcOffset, size)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    std::lock_guard<std::mutex> lock(partitionMutex);
+    std::memcpy(dst, &scriptPartitionData[srcOffset], size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dstOffset, const void *src, size_t size) {
+    if (!isPartitionRange(partition, dstOffset, size)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const auto *bytes = static_cast<const uint8_t *>(src);
+    std::lock_guard<std::mutex> lock(partitionMutex);
+    for (std::size_t byteIdx = 0u; byteIdx < size; ++byteIdx) {
+        scriptPartitionData[dstOffset + byteIdx] &= bytes[byteIdx];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (!isPartitionRange(partition, offset, size) || (0u != (offset % partition->erase_size)) ||
+        (0u != (size % partition->erase_size))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    std::lock_guard<std::mutex> lock(partitionMutex);
+    std::fill_n(scriptPartitionData.begin() + offset, size, 0xFFu);
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_spiflash_mount_rw_wl(const char *, const char *,
+    const esp_vfs_fat_mount_config_t *, wl_handle_t *wlHandle) {
+    *wlHandle = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_spiflash_unmount_rw_wl(const char *, wl_handle_t) {
+    return ESP_OK;
+}
+
+bool tinyusb_msc_storage_in_use_by_usb_host(void) {
+    return false;
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+        case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+        case ESP_ERR_HTTPD_HANDLERS_FULL: return "ESP_ERR_HTTPD_HANDLERS_FULL";
+        case ESP_ERR_HTTPD_HANDLER_EXISTS: return "ESP_ERR_HTTPD_HANDLER_EXISTS";
+        case ESP_ERR_HTTPD_INVALID_REQ: return "ESP_ERR_HTTPD_INVALID_REQ";
+        case ESP_ERR_HTTPD_RESULT_TRUNC: return "ESP_ERR_HTTPD_RESULT_TRUNC";
+        case ESP_ERR_HTTPD_RESP_SEND: return "ESP_ERR_HTTPD_RESP_SEND";
+        default: return "UNKNOWN ERROR";
+    }
+}
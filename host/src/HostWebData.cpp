@@ -0,0 +1,16 @@
+// Files of the web interface embedded like the objects generated by the firmware build,
+// WEB_DIR is the path of the main/web directory defined by the CMake project
+
+#define WEB_FILE(symbol, file)                          \
+    asm(".section .rodata\n"                            \
+        ".global _binary_" #symbol "_start\n"           \
+        ".global _binary_" #symbol "_end\n"             \
+        "_binary_" #symbol "_start:\n"                  \
+        ".incbin \"" WEB_DIR "/" file "\"\n"            \
+        "_binary_" #symbol "_end:\n"                    \
+        ".previous\n")
+
+WEB_FILE(index_html, "index.html");
+WEB_FILE(script_js, "script.js");
+WEB_FILE(style_css, "style.css");
+WEB_FILE(favicon_ico, "favicon.ico");
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Script.hpp"
+#include "KeyboardLayout.hpp"
+#include "Logger.hpp"
+
+// Checks the line cache of the compiler. The scripts are edited at random like in the web editor, every version
+// is compiled with the cache which was kept from the previous versions and without it, and the bytecode of both
+// compilations must be identical. The layout changes between the compilations, so the lines cached with another
+// layout must not be used, and the pool of the inserted lines contains REPEAT and the blocks, so the replayed
+// REPEAT target of the cached statements is checked as well.
+
+namespace {
+
+constexpr const char *DEFAULT_SCRIPT =
+    "REM Line cache check script\n"
+    "REM_BLOCK comment\n"
+    "STRING in the comment\n"
+    "END_REM\n"
+    "DEFAULT_DELAY 10\n"
+    "STRING_DELAY 5\n"
+    "VAR $count = 3\n"
+    "VAR $mask = 0x10 + 2 * ($count - 1)\n"
+    "FUNCTION greet()\n"
+    "    STRING Hello World!\n"
+    "    ENTER\n"
+    "    IF ($count == 2) THEN\n"
+    "        RETURN\n"
+    "    END_IF\n"
+    "END_FUNCTION\n"
+    "WHILE ($count > 0)\n"
+    "    greet()\n"
+    "    $count = $count - 1\n"
+    "    IF ($count == 1) THEN\n"
+    "        STRINGLN one\n"
+    "    ELSE\n"
+    "        STRINGLN other\n"
+    "    END_IF\n"
+    "END_WHILE\n"
+    "GUI r\n"
+    "REPEAT 2\n"
+    "CTRL ALT DELETE\n"
+    "  CTRL SHIFT ESCAPE  \n"
+    "STRING dead keys ^`~ of the DE and FR layouts\n"
+    "MOUSE_MOVE 300 -20\n"
+    "MOUSE_SCROLL -3\n"
+    "MOUSE_CLICK RIGHT\n"
+    "WAIT_FOR_CAPS_ON 500\n"
+    "SYNC_HOST 300\n"
+    "DELAY 250\n"
+    "STRING \ttabbed  spaces  \n"
+    "A B C D\n";
+
+// Inserted besides the lines of the scripts, they change the REPEAT target or the blocks of the following lines
+constexpr const char *EXTRA_LINES[] = {
+    "REPEAT 3",
+    "REPEAT 0",
+    "REM_BLOCK",
+    "END_REM",
+    "STRING x",
+    "STRINGLN y",
+    "DELAY 0",
+    "DEFAULT_DELAY 20",
+    "ENTER",
+    "END_WHILE",
+    "ELSE",
+    "",
+};
+
+// Every this inserted line is a line which does not compile on its own, e.g. a part of a block or a use of a variable,
+// the other ones are statements. Most of the scripts with such a line inserted at random do not compile.
+constexpr unsigned int BLOCK_LINE_PERIOD = 8u;
+
+struct LinePool {
+    std::vector<std::string> statements;
+    std::vector<std::string> blockLines;
+};
+
+struct Options {
+    unsigned int edits = 300u;      // Per script
+    unsigned int seed = 1u;
+    std::vector<std::string> inputPaths;
+};
+
+void printUsage(const char *program) {
+    std::fprintf(stderr,
+        "Usage: %s [-n EDITS] [-s SEED] [INPUT...]\n"
+        "  -n EDITS  Number of the edited versions of each script, 300 by default\n"
+        "  -s SEED   Seed of the random edits, 1 by default\n"
+        "  INPUT     DuckyScript files edited besides the built-in script, their lines are also inserted by the edits\n",
+        program);
+}
+
+bool parseCount(const char *text, unsigned int &count) {
+    char *end = nullptr;
+    const unsigned long value = std::strtoul(text, &end, 10);
+    if ((end == text) || (*end != '\0') || (value > 1000000u)) {
+        return false;
+    }
+    count = static_cast<unsigned int>(value);
+    return true;
+}
+
+std::vector<std::string> splitLines(std::string_view text) {
+    std::vector<std::string> lines{};
+    std::size_t start = 0u;
+    for (std::size_t end = text.find('\n'); end != std::string_view::npos; end = text.find('\n', start)) {
+        lines.emplace_back(text.substr(start, end - start));
+        start = end + 1u;
+    }
+    lines.emplace_back(text.substr(start));
+    return lines;
+}
+
+std::string joinLines(const std::vector<std::string> &lines) {
+    std::string text{};
+    for (std::size_t lineIdx = 0u; lineIdx < lines.size(); lineIdx++) {
+        if (lineIdx > 0u) {
+            text += '\n';
+        }
+        text += lines[lineIdx];
+    }
+    return text;
+}
+
+void addPoolLine(LinePool &pool, const std::string &line) {
+    // The line is compiled with the default layout, which contains all of the ASCII characters
+    auto &lines = Script::parse(line + '\n') ? pool.statements : pool.blockLines;
+    if (std::find(lines.begin(), lines.end(), line) == lines.end()) {
+        lines.push_back(line);
+    }
+}
+
+// Removes, inserts or replaces one to three lines
+std::string editScript(const std::string &source, const LinePool &pool, std::mt19937 &random) {
+    auto lines = splitLines(source);
+    const unsigned int editCount = 1u + (random() % 3u);
+    for (unsigned int editIdx = 0u; editIdx < editCount; editIdx++) {
+        const std::size_t lineIdx = random() % (lines.size() + 1u);
+        const auto &poolLines = (pool.blockLines.empty() || (0u != (random() % BLOCK_LINE_PERIOD))) ?
+            pool.statements : pool.blockLines;
+        const std::string &poolLine = poolLines[random() % poolLines.size()];
+        switch (random() % 3u) {
+            case 0u:
+                if (lineIdx < lines.size()) {
+                    lines.erase(lines.begin() + lineIdx);
+                }
+                break;
+            case 1u:
+                lines.insert(lines.begin() + lineIdx, poolLine);
+                break;
+            default:
+                if (lineIdx < lines.size()) {
+                    lines[lineIdx] = poolLine;
+                }
+                break;
+        }
+    }
+    return joinLines(lines);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options{};
+    for (int idx = 1; idx < argc; idx++) {
+        const std::string arg{argv[idx]};
+        if ((arg == "-n") && (idx + 1 < argc) && parseCount(argv[idx + 1], options.edits)) {
+            idx++;
+        }
+        else if ((arg == "-s") && (idx + 1 < argc) && parseCount(argv[idx + 1], options.seed)) {
+            idx++;
+        }
+        else if (!arg.empty() && (arg[0] != '-')) {
+            options.inputPaths.push_back(arg);
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Most of the edited scripts do not compile, e.g. the blocks do not match - only the result is compared
+    Logger::get().setLevel(Logger::Level::Critical);
+
+    std::vector<std::string> sources{DEFAULT_SCRIPT};
+    for (const auto &inputPath : options.inputPaths) {
+        std::ifstream input(inputPath, std::ios::binary);
+        if (!input) {
+            std::fprintf(stderr, "Failed to open the input file: '%s'\n", inputPath.c_str());
+            return 1;
+        }
+        sources.emplace_back(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+
+    LinePool pool{};
+    for (const char *line : EXTRA_LINES) {
+        addPoolLine(pool, line);
+    }
+    for (const auto &source : sources) {
+        for (const auto &line : splitLines(source)) {
+            addPoolLine(pool, line);
+        }
+    }
+
+    std::mt19937 random(options.seed);
+    Script::LineCache cache;
+    std::size_t checkCount = 0u;
+    std::size_t hitCount = 0u;
+    constexpr auto LAYOUT_NUM = static_cast<unsigned int>(KeyboardLayout::Id::LayoutNum);
+
+    for (std::size_t sourceIdx = 0u; sourceIdx < sources.size(); sourceIdx++) {
+        std::string source = sources[sourceIdx];
+        for (unsigned int editIdx = 0u; editIdx < options.edits; editIdx++) {
+            const std::string edited = editScript(source, pool, random);
+            bool isCompiled = false;
+
+            // Compiled twice, so the second compilation may use the lines cached by the first one
+            for (unsigned int compileIdx = 0u; compileIdx < 2u; compileIdx++) {
+                const auto layoutId = static_cast<KeyboardLayout::Id>(random() % LAYOUT_NUM);
+                const auto script = Script::parse(edited, layoutId);
+                const auto cachedScript = Script::parse(edited, layoutId, std::pmr::get_default_resource(), &cache);
+
+                const bool isMatching = (script.has_value() == cachedScript.has_value()) &&
+                    (!script || std::ranges::equal(script->getCode(), cachedScript->getCode()));
+                if (!isMatching) {
+                    std::fprintf(stderr, "Cached compilation (%s layout) differs for the edit %u of the script %zu:\n%s\n",
+                        KeyboardLayout::get(layoutId)->getName(), editIdx, sourceIdx, edited.c_str());
+                    return 1;
+                }
+
+                if (script) {
+                    isCompiled = true;
+                    checkCount++;
+                    hitCount += cache.getHitCount();
+                }
+            }
+
+            // Further edits continue from some of the compiled versions, like the editor continues from the script
+            // accepted by the device
+            if (isCompiled && (0u == (random() % 4u))) {
+                source = edited;
+            }
+        }
+    }
+
+    std::printf("Compilations: %zu, cache hits: %zu, cached lines: %zu\n", checkCount, hitCount, cache.size());
+
+    // Nothing is checked if no line was taken from the cache
+    if ((options.edits > 0u) && (0u == hitCount)) {
+        std::fprintf(stderr, "No line was taken from the cache\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Load generator of the HTTP API. The clients keep their connections open and send the GET and POST requests of
+// the /script and /config endpoints in turns, like the web interface does. The latency percentiles and the throughput
+// are reported per endpoint, the heap use of the server is read from the /metrics endpoint before and after the run.
+
+namespace {
+
+constexpr const char *DEFAULT_SCRIPT =
+    "REM Load test script\n"
+    "DELAY 100\n"
+    "STRING Hello, World!\n"
+    "ENTER\n"
+    "VAR $count = 0\n"
+    "WHILE ($count < 10)\n"
+    "STRING Line\n"
+    "ENTER\n"
+    "$count = ($count + 1)\n"
+    "END_WHILE\n";
+
+// Compile action of the /script endpoint, which parses the script without running or storing it
+constexpr int SCRIPT_COMPILE_ACTION = 3;
+
+struct Options {
+    std::string address = "127.0.0.1";
+    uint16_t port = 8080u;
+    unsigned int clients = 4u;
+    unsigned int requests = 250u;      // Per client
+    std::string script = DEFAULT_SCRIPT;
+};
+
+struct Response {
+    int status;
+    std::string body;
+};
+
+enum class Endpoint : uint8_t {
+    ScriptGet,
+    ScriptPost,
+    ConfigGet,
+    ConfigPost,
+    EndpointNum
+};
+
+constexpr std::size_t ENDPOINT_NUM = static_cast<std::size_t>(Endpoint::EndpointNum);
+constexpr std::array<const char *, ENDPOINT_NUM> endpointNames = {"GET /script", "POST /script", "GET /config", "POST /config"};
+
+struct ClientStats {
+    std::array<std::vector<double>, ENDPOINT_NUM> latencies;    // ms
+    std::array<std::size_t, ENDPOINT_NUM> errors{};
+};
+
+void printUsage(const char *program) {
+    std::fprintf(stderr,
+        "Usage: %s [-a ADDRESS] [-p PORT] [-c CLIENTS] [-n REQUESTS] [-s SCRIPT]\n"
+        "  -a ADDRESS   IPv4 address of the server, 127.0.0.1 by default\n"
+        "  -p PORT      Port of the server, 8080 by default\n"
+        "  -c CLIENTS   Number of the concurrent clients, 4 by default\n"
+        "  -n REQUESTS  Number of the requests sent by each client, 250 by default\n"
+        "  -s SCRIPT    DuckyScript file compiled by the POST /script requests, a built-in script by default\n",
+        program);
+}
+
+std::string escapeJson(std::string_view text) {
+    std::string escaped{};
+    escaped.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default: {
+                if (static_cast<unsigned char>(c) < 0x20u) {
+                    char code[8];
+                    std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned int>(c));
+                    escaped += code;
+                }
+                else {
+                    escaped += c;
+                }
+            }
+        }
+    }
+
+    return escaped;
+}
+
+// Keep-alive connection to the server, reopened after the server closes it
+class Connection {
+public:
+    explicit Connection(const Options &options)
+    :options(options),
+    socket(-1)
+    {}
+
+    ~Connection() {
+        close();
+    }
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    std::optional<Response> request(std::string_view method, std::string_view uri, std::string_view contentType = {},
+        std::string_view body = {}) {
+        // The request is sent again on the new connection if the server closed the idle one
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if ((socket < 0) && !open()) {
+                return std::nullopt;
+            }
+
+            std::string message = std::string(method) + " " + std::string(uri) + " HTTP/1.1\r\nHost: " + options.address +
+                "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+            if (!contentType.empty()) {
+                message += "Content-Type: " + std::string(contentType) + "\r\n";
+            }
+            message += "\r\n";
+            message += body;
+
+            std::optional<Response> response{};
+            if (sendAll(message)) {
+                response = receive();
+            }
+            if (response) {
+                return response;
+            }
+            close();
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    const Options &options;
+    int socket;
+    std::string buffer;
+
+    bool open() {
+        socket = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (socket < 0) {
+            return false;
+        }
+
+        const int flag = 1;
+        (void)::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options.port);
+        if ((1 != ::inet_pton(AF_INET, options.address.c_str(), &address.sin_addr)) ||
+            (0 != ::connect(socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)))) {
+            close();
+            return false;
+        }
+
+        buffer.clear();
+        return true;
+    }
+
+    void close() {
+        if (socket >= 0) {
+            ::close(socket);
+            socket = -1;
+        }
+    }
+
+    bool sendAll(std::string_view data) {
+        while (!data.empty()) {
+            ssize_t ret = ::send(socket, data.data(), data.size(), MSG_NOSIGNAL);
+            if (ret <= 0) {
+                return false;
+            }
+            data.remove_prefix(static_cast<std::size_t>(ret));
+        }
+
+        return true;
+    }
+
+    bool receiveMore() {
+        std::array<char, 4096u> chunk{};
+        ssize_t ret = ::recv(socket, chunk.data(), chunk.size(), 0);
+        if (ret <= 0) {
+            return false;
+        }
+        buffer.append(chunk.data(), static_cast<std::size_t>(ret));
+        return true;
+    }
+
+    std::optional<Response> receive() {
+        std::size_t headerEnd = std::string::npos;
+        while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+            if (!receiveMore()) {
+                return std::nullopt;
+            }
+        }
+
+        // The server always sends the Content-Length of the body
+        Response response{0, {}};
+        std::size_t contentLength = 0u;
+        const std::string head = buffer.substr(0u, headerEnd);
+        if (std::sscanf(head.c_str(), "HTTP/1.%*d %d", &response.status) != 1) {
+            return std::nullopt;
+        }
+        std::size_t position = 0u;
+        while ((position = head.find("\r\n", position)) != std::string::npos) {
+            position += 2u;
+            if (0 == strncasecmp(head.c_str() + position, "Content-Length:", 15u)) {
+                contentLength = std::strtoul(head.c_str() + position + 15u, nullptr, 10);
+            }
+        }
+
+        buffer.erase(0u, headerEnd + 4u);
+        while (buffer.size() < contentLength) {
+            if (!receiveMore()) {
+                return std::nullopt;
+            }
+        }
+
+        response.body = buffer.substr(0u, contentLength);
+        buffer.erase(0u, contentLength);
+        return response;
+    }
+};
+
+// Value of the Prometheus sample with the label of the default heap
+std::optional<uint64_t> findMetric(const std::string &metrics, const std::string &name) {
+    const std::string sample = name + "{caps=\"default\"} ";
+    const std::size_t position = metrics.find(sample);
+    if (position == std::string::npos) {
+        return std::nullopt;
+    }
+
+    return std::strtoull(metrics.c_str() + position + sample.size(), nullptr, 10);
+}
+
+double percentile(const std::vector<double> &sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+
+    const std::size_t idx = static_cast<std::size_t>(fraction * static_cast<double>(sorted.size() - 1u) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1u)];
+}
+
+void runClient(const Options &options, unsigned int clientIdx, const std::string &scriptBody, const std::string &configBody,
+    ClientStats &stats) {
+    Connection connection(options);
+
+    for (unsigned int requestIdx = 0u; requestIdx < options.requests; requestIdx++) {
+        // The clients start at the different endpoints, so that all of them are requested at the same time
+        const auto endpoint = static_cast<Endpoint>((requestIdx + clientIdx) % ENDPOINT_NUM);
+        const auto start = std::chrono::steady_clock::now();
+
+        std::optional<Response> response{};
+        switch (endpoint) {
+            case Endpoint::ScriptGet: response = connection.request("GET", "/script"); break;
+            case Endpoint::ScriptPost: response = connection.request("POST", "/script", "application/json", scriptBody); break;
+            case Endpoint::ConfigGet: response = connection.request("GET", "/config"); break;
+            default: response = connection.request("POST", "/config", "application/json", configBody); break;
+        }
+
+        const std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - start;
+        const auto endpointIdx = static_cast<std::size_t>(endpoint);
+        if (!response || (response->status != 200)) {
+            stats.errors[endpointIdx]++;
+            continue;
+        }
+        stats.latencies[endpointIdx].push_back(latency.count());
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options{};
+
+    for (int idx = 1; idx < argc; idx++) {
+        const std::string arg{argv[idx]};
+        const bool hasValue = (idx + 1 < argc);
+
+        if ((arg == "-a") && hasValue) {
+            options.address = argv[++idx];
+        }
+        else if ((arg == "-p") && hasValue) {
+            options.port = static_cast<uint16_t>(std::strtoul(argv[++idx], nullptr, 10));
+        }
+        else if ((arg == "-c") && hasValue) {
+            options.clients = static_cast<unsigned int>(std::strtoul(argv[++idx], nullptr, 10));
+        }
+        else if ((arg == "-n") && hasValue) {
+            options.requests = static_cast<unsigned int>(std::strtoul(argv[++idx], nullptr, 10));
+        }
+        else if ((arg == "-s") && hasValue) {
+            std::ifstream input(argv[++idx], std::ios::binary);
+            if (!input) {
+                std::fprintf(stderr, "Failed to open the script file: '%s'\n", argv[idx]);
+                return 1;
+            }
+            options.script.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ((options.port == 0u) || (options.clients == 0u) || (options.requests == 0u)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // The configuration read at the start is posted back, so the load does not change the state of the server
+    Connection control(options);
+    auto config = control.request("GET", "/config");
+    auto metricsBefore = control.request("GET", "/metrics");
+    if (!config || (config->status != 200) || !metricsBefore || (metricsBefore->status != 200)) {
+        std::fprintf(stderr, "Server is not available at %s:%u\n", options.address.c_str(), static_cast<unsigned int>(options.port));
+        return 1;
+    }
+
+    const std::string scriptBody = "{\"action\":" + std::to_string(SCRIPT_COMPILE_ACTION) + ",\"script\":\"" +
+        escapeJson(options.script) + "\"}";
+
+    std::vector<ClientStats> stats(options.clients);
+    std::vector<std::thread> clients{};
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int clientIdx = 0u; clientIdx < options.clients; clientIdx++) {
+        clients.emplace_back(runClient, std::cref(options), clientIdx, std::cref(scriptBody), std::cref(config->body),
+            std::ref(stats[clientIdx]));
+    }
+    for (auto &client : clients) {
+        client.join();
+    }
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+    auto metricsAfter = control.request("GET", "/metrics");
+
+    std::printf("%u clients, %u requests each, %.2f s\n\n", options.clients, options.requests, duration.count());
+    std::printf("%-14s %8s %7s %9s %9s %9s %9s\n", "endpoint", "requests", "errors", "p50 ms", "p90 ms", "p99 ms", "max ms");
+
+    std::size_t totalRequests = 0u;
+    std::size_t totalErrors = 0u;
+    for (std::size_t endpointIdx = 0u; endpointIdx < ENDPOINT_NUM; endpointIdx++) {
+        std::vector<double> latencies{};
+        std::size_t errors = 0u;
+        for (const auto &client : stats) {
+            latencies.insert(latencies.end(), client.latencies[endpointIdx].begin(), client.latencies[endpointIdx].end());
+            errors += client.errors[endpointIdx];
+        }
+        std::sort(latencies.begin(), latencies.end());
+
+        std::printf("%-14s %8zu %7zu %9.2f %9.2f %9.2f %9.2f\n", endpointNames[endpointIdx], latencies.size() + errors, errors,
+            percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99),
+            latencies.empty() ? 0.0 : latencies.back());
+        totalRequests += latencies.size() + errors;
+        totalErrors += errors;
+    }
+
+    std::printf("\nThroughput: %.1f requests/s\n", static_cast<double>(totalRequests) / duration.count());
+
+    // The lowest free heap is tracked by the server since its start, the peak of the run is its drop during the run
+    if (metricsAfter && (metricsAfter->status == 200)) {
+        auto freeBefore = findMetric(metricsBefore->body, "heap_free_bytes");
+        auto minFreeBefore = findMetric(metricsBefore->body, "heap_min_free_bytes");
+        auto freeAfter = findMetric(metricsAfter->body, "heap_free_bytes");
+        auto minFreeAfter = findMetric(metricsAfter->body, "heap_min_free_bytes");
+        if (freeBefore && minFreeBefore && freeAfter && minFreeAfter) {
+            std::printf("Heap free: %llu -> %llu bytes, minimum free: %llu -> %llu bytes, peak use of the run: %lld bytes\n",
+                static_cast<unsigned long long>(*freeBefore), static_cast<unsigned long long>(*freeAfter),
+                static_cast<unsigned long long>(*minFreeBefore), static_cast<unsigned long long>(*minFreeAfter),
+                static_cast<long long>(*freeBefore) - static_cast<long long>(*minFreeAfter));
+        }
+    }
+    else {
+        std::printf("Heap metrics are not available\n");
+    }
+
+    return (totalErrors == 0u) ? 0 : 1;
+}
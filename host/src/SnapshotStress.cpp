@@ -0,0 +1,191 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AtomicSnapshot.hpp"
+
+// Stress test of AtomicSnapshot. The readers load the published value and check that it is complete, one of them
+// holds its references for a while like a running payload, and the writers replace and clear the value at the same
+// time. Every value is counted while it is alive, so a value which is destroyed twice or never is reported as well.
+// Built with ESP_DUCKY_SANITIZER=thread or address it also reports the data races and the accesses to freed values.
+
+namespace {
+
+constexpr std::size_t VALUE_SIZE = 1000u;
+// Every this store of a writer clears the value instead of replacing it
+constexpr unsigned int CLEAR_PERIOD = 97u;
+constexpr auto HOLD_TIME = std::chrono::milliseconds(1);
+
+std::atomic<int> liveValueCount{0};
+
+// Value which can be checked for a torn or freed content, all of its items equal its ID
+struct Value {
+    std::vector<unsigned int> items;
+    unsigned int id;
+
+    explicit Value(unsigned int id)
+    :items(VALUE_SIZE, id),
+    id(id)
+    {
+        ++liveValueCount;
+    }
+
+    Value(Value &&other) noexcept
+    :items(std::move(other.items)),
+    id(other.id)
+    {
+        ++liveValueCount;
+    }
+
+    Value(const Value &) = delete;
+    Value &operator=(const Value &) = delete;
+
+    ~Value() {
+        --liveValueCount;
+    }
+
+    bool isValid() const {
+        if (items.size() != VALUE_SIZE) {
+            return false;
+        }
+        for (unsigned int item : items) {
+            if (item != id) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+struct Options {
+    unsigned int readers = 3u;
+    unsigned int writers = 2u;
+    unsigned int stores = 20000u;   // Per writer
+};
+
+void printUsage(const char *program) {
+    std::fprintf(stderr,
+        "Usage: %s [-r READERS] [-w WRITERS] [-n STORES]\n"
+        "  -r READERS  Number of the reader threads besides the one holding its references, 3 by default\n"
+        "  -w WRITERS  Number of the writer threads, 2 by default\n"
+        "  -n STORES   Number of the stores of each writer, 20000 by default\n",
+        program);
+}
+
+bool parseCount(const char *text, unsigned int &count) {
+    char *end = nullptr;
+    const unsigned long value = std::strtoul(text, &end, 10);
+    if ((end == text) || (*end != '\0') || (value == 0u) || (value > 1000000u)) {
+        return false;
+    }
+    count = static_cast<unsigned int>(value);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options{};
+    for (int idx = 1; idx < argc; idx++) {
+        const std::string arg{argv[idx]};
+        unsigned int *count = nullptr;
+        if (arg == "-r") {
+            count = &options.readers;
+        }
+        else if (arg == "-w") {
+            count = &options.writers;
+        }
+        else if (arg == "-n") {
+            count = &options.stores;
+        }
+
+        if (!count || (idx + 1 >= argc) || !parseCount(argv[++idx], *count)) {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::atomic<bool> isStopped{false};
+    std::atomic<unsigned long> loadCount{0u};
+    std::atomic<unsigned long> errorCount{0u};
+
+    {
+        AtomicSnapshot<Value> snapshot;
+
+        std::vector<std::thread> readers{};
+        for (unsigned int readerIdx = 0u; readerIdx < options.readers; readerIdx++) {
+            readers.emplace_back([&]() {
+                while (!isStopped) {
+                    auto reference = snapshot.load();
+                    if (reference) {
+                        if (!reference->isValid()) {
+                            ++errorCount;
+                        }
+                        // The moved reference keeps the value, the source is empty
+                        auto movedReference = std::move(reference);
+                        if (reference || !movedReference->isValid()) {
+                            ++errorCount;
+                        }
+                    }
+                    ++loadCount;
+                }
+            });
+        }
+        // Holds the value while it is replaced, like the payload task
+        readers.emplace_back([&]() {
+            while (!isStopped) {
+                auto reference = snapshot.load();
+                if (reference) {
+                    std::this_thread::sleep_for(HOLD_TIME);
+                    if (!reference->isValid()) {
+                        ++errorCount;
+                    }
+                }
+                ++loadCount;
+            }
+        });
+
+        std::vector<std::thread> writers{};
+        for (unsigned int writerIdx = 0u; writerIdx < options.writers; writerIdx++) {
+            writers.emplace_back([&, writerIdx]() {
+                for (unsigned int storeIdx = 1u; storeIdx <= options.stores; storeIdx++) {
+                    if (0u == (storeIdx % CLEAR_PERIOD)) {
+                        snapshot.store(std::nullopt);
+                    }
+                    else {
+                        snapshot.store(Value((writerIdx * options.stores) + storeIdx));
+                    }
+                }
+            });
+        }
+
+        for (auto &writer : writers) {
+            writer.join();
+        }
+        isStopped = true;
+        for (auto &reader : readers) {
+            reader.join();
+        }
+
+        // Only the published value is still alive once all references are released
+        if (liveValueCount > 1) {
+            std::fprintf(stderr, "%d values are alive after the references were released\n", liveValueCount.load());
+            ++errorCount;
+        }
+
+        snapshot.store(std::nullopt);
+    }
+
+    std::printf("Loads: %lu, stores: %u, errors: %lu\n", loadCount.load(), options.writers * options.stores, errorCount.load());
+
+    if (0 != liveValueCount) {
+        std::fprintf(stderr, "%d values are alive after the value was cleared\n", liveValueCount.load());
+        return 1;
+    }
+
+    return (0u == errorCount) ? 0 : 1;
+}
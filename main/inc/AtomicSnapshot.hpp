@@ -0,0 +1,177 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+#include "Utils.hpp"
+
+// Immutable value shared by the tasks and replaced by an atomic swap. The published word holds the slot of the
+// value and the number of the references taken from it (split reference count), so a reader takes its reference
+// with a single atomic increment and never waits for the writer. The replaced value stays valid until its last
+// reference is released, whoever releases it also destroys it, e.g. the task of a payload which was running while
+// the script was saved.
+template <typename T, std::size_t SLOT_NUM = 4u>
+class AtomicSnapshot
+{
+private:
+    // Constants ===
+
+    constexpr static uint32_t SLOT_BITS = 3u;
+    constexpr static uint32_t SLOT_MASK = (1u << SLOT_BITS) - 1u;
+    constexpr static uint32_t EMPTY_SLOT = SLOT_MASK;
+    // The counts are kept above the slot bits, so they wrap together with the count of the published word
+    constexpr static uint32_t REFERENCE = 1u << SLOT_BITS;
+
+    static_assert(SLOT_NUM < EMPTY_SLOT, "The slot index does not fit the published word");
+
+    // Types ===
+
+    struct Slot {
+        std::optional<T> value;
+        // References taken from the published word minus the released ones, it reaches zero only once retired
+        std::atomic<uint32_t> count;
+        std::atomic<bool> isRetired;
+        std::atomic<bool> isFree;
+    };
+
+    // Non-static members ===
+
+    std::array<Slot, SLOT_NUM> slots;
+    std::atomic<uint32_t> published;
+
+    void destroy(Slot &slot) {
+        slot.value.reset();
+        slot.isFree.store(true, std::memory_order_release);
+    }
+
+    void release(std::size_t slotIdx) {
+        Slot &slot = slots[slotIdx];
+        if ((REFERENCE == slot.count.fetch_sub(REFERENCE, std::memory_order_acq_rel)) &&
+            slot.isRetired.load(std::memory_order_acquire)) {
+            destroy(slot);
+        }
+    }
+
+    std::size_t claim() {
+        for (;;) {
+            for (std::size_t slotIdx = 0u; slotIdx < SLOT_NUM; ++slotIdx) {
+                bool isFree = true;
+                if (slots[slotIdx].isFree.compare_exchange_strong(isFree, false, std::memory_order_acquire)) {
+                    return slotIdx;
+                }
+            }
+
+            // Only the short readers may hold the other slots, e.g. a request in progress, a running payload holds
+            // one slot at most
+            Utils::delay(1u);
+        }
+    }
+
+public:
+    // Reference to the value published at the time of the load, which keeps the value alive
+    class Reference
+    {
+    private:
+        // Non-static members ===
+
+        AtomicSnapshot *owner;
+        std::size_t slotIdx;
+
+    public:
+        Reference(AtomicSnapshot *owner = nullptr, std::size_t slotIdx = 0u)
+        :owner(owner),
+        slotIdx(slotIdx)
+        {}
+
+        Reference(Reference &&other) noexcept
+        :owner(std::exchange(other.owner, nullptr)),
+        slotIdx(other.slotIdx)
+        {}
+
+        Reference &operator=(Reference &&other) noexcept {
+            if (this != &other) {
+                reset();
+                owner = std::exchange(other.owner, nullptr);
+                slotIdx = other.slotIdx;
+            }
+            return *this;
+        }
+
+        Reference(const Reference &) = delete;
+        Reference &operator=(const Reference &) = delete;
+
+        ~Reference() {
+            reset();
+        }
+
+        void reset() {
+            if (owner) {
+                std::exchange(owner, nullptr)->release(slotIdx);
+            }
+        }
+
+        explicit operator bool() const {
+            return nullptr != owner;
+        }
+
+        const T &operator*() const {
+            return *owner->slots[slotIdx].value;
+        }
+
+        const T *operator->() const {
+            return &*owner->slots[slotIdx].value;
+        }
+    };
+
+    AtomicSnapshot()
+    :slots(),
+    published(EMPTY_SLOT)
+    {
+        for (Slot &slot : slots) {
+            slot.isFree.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // The references must be released before the snapshot is destroyed
+    ~AtomicSnapshot() = default;
+
+    AtomicSnapshot(const AtomicSnapshot &) = delete;
+    AtomicSnapshot &operator=(const AtomicSnapshot &) = delete;
+
+    // Empty if no value is published
+    Reference load() {
+        const uint32_t word = published.fetch_add(REFERENCE, std::memory_order_acq_rel);
+        const uint32_t slotIdx = word & SLOT_MASK;
+        return (EMPTY_SLOT == slotIdx) ? Reference() : Reference(this, slotIdx);
+    }
+
+    // The value is complete before it is published, the empty value unpublishes the previous one
+    void store(std::optional<T> &&value) {
+        uint32_t word = EMPTY_SLOT;
+        if (value) {
+            const std::size_t slotIdx = claim();
+            Slot &slot = slots[slotIdx];
+            slot.value.emplace(std::move(*value));
+            slot.count.store(0u, std::memory_order_relaxed);
+            slot.isRetired.store(false, std::memory_order_relaxed);
+            word = static_cast<uint32_t>(slotIdx);
+        }
+
+        const uint32_t previous = published.exchange(word, std::memory_order_acq_rel);
+        const uint32_t previousIdx = previous & SLOT_MASK;
+        if (EMPTY_SLOT == previousIdx) {
+            return;
+        }
+
+        // References taken from the previous word are moved to its slot, the readers holding them release them there
+        Slot &slot = slots[previousIdx];
+        const uint32_t taken = previous & ~SLOT_MASK;
+        slot.isRetired.store(true, std::memory_order_release);
+        if (0u == slot.count.fetch_add(taken, std::memory_order_acq_rel) + taken) {
+            destroy(slot);
+        }
+    }
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+
+#include "Utils.hpp"
+
+// Timestamps of the startup of the device in us since the start of the ESP-IDF timer, kept in the memory for the
+// /boot endpoint. The phases of the initialization follow each other, every phase starts at the end of the last
+// phase which was reached before it, e.g. the USB mount is only waited for when the device is armed. The timeline is
+// closed once the startup and the payload armed at startup are over, the later marks and events are ignored.
+class BootTimeline
+{
+public:
+    // Public types ===
+
+    enum class Phase : uint8_t {
+        Startup,        // Startup of ESP-IDF up to EspDucky::init
+        PowerManager,
+        CdcChannel,
+        Button,
+        NvsInit,
+        NvsOpen,
+        ScriptStore,    // Selection of the valid script slot
+        Config,         // Including the start of the USB device and the storage mount
+        PayloadLoad,
+        UsbMount,       // Wait for the host to configure the armed device
+        AccessPoint,
+        Mdns,
+        HttpServer,     // The web interface is available at the end of the phase
+        PhaseNum
+    };
+
+    enum class Event : uint8_t {
+        FirstKeystroke, // First keyboard report sent to the host
+        EventNum
+    };
+
+    struct Entry {
+        const char *name;
+        uint32_t end;       // Time of the end of the phase or of the event
+        uint32_t duration;  // Zero for the events
+    };
+
+private:
+    // Constants ===
+
+    constexpr static std::size_t MAX_SUMMARY_LENGTH = 256u;
+
+    // Static members ===
+
+    static const std::array<const char *, static_cast<std::size_t>(Phase::PhaseNum)> phaseNames;
+    static const std::array<const char *, static_cast<std::size_t>(Event::EventNum)> eventNames;
+
+    // Zero until reached, the 32-bit times are lock-free on the device and they are only recorded until the timeline
+    // is closed, which is far less than their range
+    inline static std::array<std::atomic<uint32_t>, static_cast<std::size_t>(Phase::PhaseNum)> phaseEnds{};
+    inline static std::array<std::atomic<uint32_t>, static_cast<std::size_t>(Event::EventNum)> eventTimes{};
+    inline static std::atomic<bool> isClosed{false};
+
+    static uint32_t now();
+
+public:
+    // Ends the phase, only the first mark is kept
+    static void mark(Phase phase);
+    // Only the first occurrence of the event is kept, the later ones cost two loads
+    static void record(Event event) {
+        std::atomic<uint32_t> &time = eventTimes[static_cast<std::size_t>(event)];
+        if ((0u == time.load(std::memory_order_relaxed)) && !isClosed.load(std::memory_order_relaxed)) {
+            uint32_t expected = 0u;
+            (void)time.compare_exchange_strong(expected, now(), std::memory_order_relaxed);
+        }
+    }
+
+    // Ends the recording, e.g. the keystrokes of the scripts run through the web interface are not part of the startup
+    static void close();
+
+    // Empty if the phase or the event was not reached
+    static std::optional<Entry> get(Phase phase);
+    static std::optional<Entry> get(Event event);
+
+    // Single line with the durations of the phases in ms
+    static void logSummary();
+};
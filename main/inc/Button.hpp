@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+
+#include "Utils.hpp"
+
+// Active low push button handled by the GPIO interrupt. The debounced level changes are passed
+// through the event queue, so the user of the button blocks until the button is used. The interrupt waits
+// for the level opposite to the current one instead of an edge, because only a level wakes the chip from
+// the automatic light sleep.
+class Button
+{
+public:
+    // Public types ===
+
+    enum class Event : uint8_t {
+        Pressed,
+        Released
+    };
+
+private:
+    // Constants ===
+
+    // Level changes following the accepted change within this time are treated as contact bounces
+    constexpr static int64_t DEBOUNCE_TIME_US = 30000;
+    constexpr static UBaseType_t EVENT_QUEUE_LENGTH = 8u;
+
+    // Non-static members ===
+
+    gpio_num_t gpio;
+    QueueHandle_t events;
+    // State of the debouncing, only accessed by the interrupt handler after the initialization
+    bool isPressedState;
+    int64_t lastChangeTime;
+
+    static gpio_int_type_t getWaitedLevel(bool isPressed);
+    static void handleInterrupt(void *arg);
+
+public:
+    explicit Button(gpio_num_t gpio);
+    ~Button();
+
+    Button(const Button &) = delete;
+    Button &operator=(const Button &) = delete;
+
+    ErrorCode init();
+
+    // Returns false if no event was received within the timeout
+    bool waitForEvent(Event &event, TickType_t timeout = portMAX_DELAY);
+    // Current level of the button, without the debouncing
+    bool isPressed() const;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/ringbuf.h"
+
+#include "UsbDevice.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+
+// Framed binary protocol over the CDC-ACM interface of the USB device. It uploads the compiled scripts,
+// triggers the runs and streams the logs. Every frame is:
+//   sync (0xA5) | command | payload length (u16 LE) | payload | CRC-16/CCITT-FALSE of command..payload (u16 LE)
+// Each host command is answered with the Status frame. The logs are buffered and only sent when the host
+// has room for them, so a slow reader never blocks the logging tasks or the HID timing.
+class CdcChannel
+{
+public:
+    // Public types ===
+
+    enum class Command : uint8_t {
+        Ping = 0x01u,
+        UploadBegin = 0x02u,    // Total size of the serialized script (u32 LE)
+        UploadData = 0x03u,     // Next part of the serialized script
+        UploadEnd = 0x04u,      // The complete script is passed to the callback
+        Run = 0x05u,
+        Abort = 0x06u,
+        Status = 0x80u,         // Device to host: command, error code
+        Log = 0x81u,            // Device to host: level, message
+    };
+
+    // The payload is only valid in the callback
+    using CommandCallback = std::function<ErrorCode(std::span<const uint8_t>)>;
+
+    // Public constants ===
+
+    constexpr static uint8_t FRAME_SYNC = 0xA5u;
+    constexpr static std::size_t MAX_PAYLOAD_SIZE = 1024u;
+    constexpr static std::size_t MAX_UPLOAD_SIZE = 64u * 1024u;
+
+private:
+    // Constants ===
+
+    constexpr static std::size_t HEADER_SIZE = 4u;
+    constexpr static std::size_t CRC_SIZE = 2u;
+    constexpr static std::size_t MAX_FRAME_SIZE = HEADER_SIZE + MAX_PAYLOAD_SIZE + CRC_SIZE;
+    constexpr static std::size_t LOG_BUFFER_SIZE = 4096u;
+    constexpr static std::size_t MAX_LOG_MESSAGE_SIZE = 192u;
+    // Period of the log transmission while no data are received
+    constexpr static uint32_t LOG_FLUSH_PERIOD = 20u;
+    // Partial frame is dropped if the rest does not arrive within the timeout
+    constexpr static uint32_t FRAME_TIMEOUT = 200u;
+    // Longest wait for the room of the status frame in the transmit buffer
+    constexpr static uint32_t STATUS_TIMEOUT = 100u;
+    constexpr static uint32_t TASK_STACK_SIZE = 4096u;
+    // Below the TinyUSB and the payload tasks, so that the channel never delays the reports
+    constexpr static UBaseType_t TASK_PRIORITY = 3u;
+
+    // Static members ===
+
+    // The logger sink has no context, so the log buffer is shared by the channel instance
+    static std::atomic<RingbufHandle_t> logBuffer;
+
+    // Non-static members ===
+
+    UsbDevice &usb;
+    const std::unordered_map<Command, CommandCallback> callbacks;
+    std::atomic<TaskHandle_t> task;
+    std::vector<uint8_t> rxFrame;
+    TickType_t lastRxTicks;
+    std::vector<uint8_t> upload;
+    std::size_t uploadSize;
+    bool isUploading;
+    // Log frame received from the log buffer which did not fit into the transmit buffer yet
+    std::vector<uint8_t> pendingLog;
+
+    static void taskMain(void *arg);
+    void run();
+    void receive();
+    void handleFrame(Command command, std::span<const uint8_t> payload);
+    ErrorCode handleUpload(Command command, std::span<const uint8_t> payload);
+    void sendStatus(Command command, ErrorCode result);
+    void sendLogs();
+
+    static std::size_t buildFrame(std::span<uint8_t> frame, Command command, std::span<const uint8_t> payload);
+    static void logSink(Logger::Level level, std::string_view message);
+
+public:
+    CdcChannel(UsbDevice &usb, std::unordered_map<Command, CommandCallback> &&callbacks);
+    ~CdcChannel() = default;
+
+    CdcChannel(const CdcChannel &) = delete;
+    CdcChannel &operator=(const CdcChannel &) = delete;
+
+    ErrorCode start();
+};
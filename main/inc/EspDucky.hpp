@@ -1,5 +1,8 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+
 #include "nvs_handle.hpp"
 
 #include "WiFiAccessPoint.hpp"
@@ -7,7 +10,13 @@
 #include "MdnsResponder.hpp"
 #include "UsbDevice.hpp"
 #include "Utils.hpp"
+#include "AtomicSnapshot.hpp"
 #include "Script.hpp"
+#include "ScriptStream.hpp"
+#include "ScriptStore.hpp"
+#include "Button.hpp"
+#include "CdcChannel.hpp"
+#include "PayloadRom.hpp"
 
 class EspDucky
 {
@@ -22,41 +31,116 @@ private:
     enum class ScriptEndpointAction : uint8_t
     {
         Run,
-        Save
+        Save,
+        RunFile,
+        Compile
     };
 
     struct NvConfig 
     {
         ArmingState armingState;
         UsbDevice::DeviceClass usbDeviceType;
+        KeyboardLayout::Id keyboardLayout;
+        uint8_t payloadSlot;    // Payload ROM slot + 1, or the script of the script store
+    };
+
+    // Script of the selected payload slot, it is never modified once published
+    struct NvScript
+    {
+        Script script;
+        std::span<const uint8_t> reports;   // Flattened reports of the payload ROM slot, empty for the stored script
+    };
+
+    // Owned by the payload task, which also owns the claim of isScriptRunning
+    struct PayloadTaskArgs
+    {
+        EspDucky *espDucky;
+        bool isArmedRun;    // Stored script is run because the device is armed, not by the button press
     };
 
     static constexpr const char *NVS_NAMESPACE = "esp-ducky";
     static constexpr const char *NVS_NV_CONFIG_KEY = "nvConfig";
+    // Script saved by the older versions, it is moved to the script store at startup
     static constexpr const char *NVS_NV_SCRIPT_SIZE_KEY = "nvScriptSize";
     static constexpr const char *NVS_NV_SCRIPT_DATA_KEY = "nvScriptData";
 
+    static constexpr const char *STORAGE_PARTITION_LABEL = "storage";
+    static constexpr const char *SCRIPT_PARTITION_LABEL = "script";
+
+    static constexpr uint8_t NV_SCRIPT_SLOT = 0u;
+
+    // Holding the button for this time disables the USB device
+    static constexpr uint32_t LONG_PRESS_TIME = 3000u;
+    static constexpr uint32_t PAYLOAD_TASK_STACK_SIZE = 8192u;
+    static constexpr UBaseType_t PAYLOAD_TASK_PRIORITY = 5u;
+    // The armed payload starts at most this time after the host has configured the device
+    static constexpr uint32_t USB_MOUNT_POLL_PERIOD = 10u;
+
     NvConfig nvConfig;
-    std::optional<Script> nvScript;
+    // Held by the HTTP, CDC and payload tasks while nvConfig is read, modified and committed to NVS
+    std::mutex nvConfigMutex;
+    // Script of the selected payload slot - saved in the script store or linked in the payload ROM
+    // The readers and the running payload keep a reference to the snapshot, so they never see a partially written
+    // script and a save does not wait for the running payload
+    AtomicSnapshot<NvScript> nvScript;
+    // Last script compiled for the web editor with every line terminated, the diffs of the editor are applied to it
+    std::string editorSource;
+    Script::LineCache lineCache;
     WiFiAccessPoint ap;
     MdnsResponder mdns;
     HttpServer http;
     UsbDevice usb;
+    CdcChannel cdc;
+    // Storage mounted by the application, the MSC device classes mount it on their own
+    wl_handle_t storageWlHandle;
+    ScriptStore scriptStore;
+    Button button;
+    std::atomic<bool> isScriptRunning;
 
     void handleNvConfig(nvs::NVSHandle *handle);
-    void handleNvScript(nvs::NVSHandle *handle);
+    // Returns true if the armed payload was started
+    bool handleNvScript(nvs::NVSHandle *handle);
+    ErrorCode loadPayload(nvs::NVSHandle *handle);
+    // Moves the script saved in the NVS by the older versions to the script store, the data are kept if it fails
+    ErrorCode migrateNvScript(nvs::NVSHandle *handle, std::vector<uint8_t> &data);
     bool waitForUsbMount(uint32_t timeoutMs = 5000u);
+    void mountStorage();
+    void unmountStorage();
+    ErrorCode switchUsbDevice(UsbDevice::DeviceClass deviceClass);
+    // Writes and commits the config, nvConfig is assigned by the caller once it is stored
+    // The caller holds nvConfigMutex
+    ErrorCode storeNvConfig(nvs::NVSHandle &handle, const NvConfig &config);
+    NvConfig getNvConfig();
+
+    ErrorCode startPayload(bool isArmedRun);
+    static void payloadTask(void *arg);
+    void runPayload(bool isArmedRun);
 
-    ErrorCode handleScriptEndpoint(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode);
-    ErrorCode handleScriptEndpointGet(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode);
-    ErrorCode handleScriptEndpointPost(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode);
+    ErrorCode handleScriptEndpoint(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode);
+    ErrorCode handleScriptEndpointGet(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode);
+    ErrorCode handleScriptEndpointPost(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode);
+    ErrorCode handleScriptEndpointUpload(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode);
+    // Replaces a range of lines of the last script sent by the editor, so that only the changed lines are sent and parsed
+    ErrorCode handleScriptDiffEndpoint(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode);
+    ErrorCode handleScriptSource(std::string &&source, ScriptEndpointAction action, std::pmr::string &response, httpd_err_code_t &errCode);
+    ErrorCode scriptRespond(const std::optional<Script::Estimate> &estimate, std::pmr::string &response, httpd_err_code_t &errCode);
 
-    ErrorCode scriptRun(Script &script);
+    // The flattened reports, if there are any, are played instead of running the script
+    ErrorCode scriptRun(const Script &script, std::span<const uint8_t> reports = {});
+    // Same as scriptRun, the caller has already claimed isScriptRunning
+    ErrorCode scriptPlay(const Script &script, std::span<const uint8_t> reports);
+    ErrorCode scriptRunFile(const std::string &relativePath);
     ErrorCode scriptSave(Script &script);
+    // Validates the script compiled by the host and stores it
+    ErrorCode scriptUpload(std::span<const uint8_t> data);
+    ErrorCode scriptAbort();
     
-    ErrorCode handleConfigEndpoint(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode);
-    ErrorCode handleConfigEndpointGet(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode);
-    ErrorCode handleConfigEndpointPost(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode);
+    ErrorCode handleMetricsEndpoint(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode);
+    ErrorCode handleBootEndpoint(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode);
+
+    ErrorCode handleConfigEndpoint(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode);
+    ErrorCode handleConfigEndpointGet(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode);
+    ErrorCode handleConfigEndpointPost(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode);
 
 public:
     EspDucky();
@@ -2,18 +2,24 @@
 
 #include <unordered_map>
 #include <string>
+#include <string_view>
 #include <array>
 #include <functional>
 #include <memory>
+#include <memory_resource>
+#include <span>
 
 #include "esp_http_server.h"
 
+#include "RequestArena.hpp"
 #include "Utils.hpp"
 
 class HttpServer {
 public:
 
-    using EndpointCallback = std::function<ErrorCode(httpd_req_t &, const std::string&, std::string&, httpd_err_code_t&)>;
+    // The request and the response are allocated in the arena of the request, so they are only valid in the callback.
+    // The callback may modify the request content, e.g. to unescape the JSON strings in place.
+    using EndpointCallback = std::function<ErrorCode(httpd_req_t &, std::span<char>, std::pmr::string&, httpd_err_code_t&)>;
     struct StaticEndpoint {
         const char *respBuf;
         size_t respLen;
@@ -23,8 +29,13 @@ public:
     struct DynamicEndpoint {
         EndpointCallback callback;
         const std::string_view mime;
+        // Handles the POST requests with the binary content, which are rejected if the callback is empty
+        EndpointCallback uploadCallback = {};
     };
 
+    // Content type of the binary uploads, passed to the upload callback without any conversion
+    static constexpr std::string_view UPLOAD_MIME = "application/octet-stream";
+
     explicit HttpServer(std::unordered_map<std::string, StaticEndpoint> &&staticEndpoints, 
         std::unordered_map<std::string, DynamicEndpoint> &&dynamicEndpoints);
     ~HttpServer() = default;
@@ -36,7 +47,11 @@ public:
     static esp_err_t handleDynamicEndpoint(httpd_req_t *req);
 
 private:
+    static bool isUploadRequest(httpd_req_t &req);
+
     httpd_handle_t server;
     const std::unordered_map<std::string, StaticEndpoint> staticEndpoints;
     const std::unordered_map<std::string, DynamicEndpoint> dynamicEndpoints;
+    // Requests are handled one at a time by the server task, so they share the arena
+    RequestArena arena;
 };
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+
+#include "Utils.hpp"
+
+// In-place reader of the JSON request bodies. Only the members of the top-level object are recorded, the nested
+// objects and arrays are validated and skipped. The strings are unescaped into the buffer they are read from and
+// terminated by the null character, so the tokenizer does not allocate any memory and the values are valid as long
+// as the buffer is.
+class JsonTokenizer
+{
+public:
+    // Public constants ===
+
+    // Members of the top-level object over the limit are validated, but they can not be read
+    constexpr static std::size_t MAX_MEMBERS = 16u;
+    // Nesting depth of the objects and arrays, including the top-level object
+    constexpr static std::size_t MAX_DEPTH = 32u;
+
+private:
+    // Types ===
+
+    enum class Type : uint8_t {
+        String,
+        Number,
+        Other
+    };
+
+    struct Member {
+        std::string_view key;
+        std::string_view value;     // Unescaped string or the text of the number
+        Type type;
+    };
+
+    // Non-static members ===
+
+    std::span<char> json;
+    std::size_t position;
+    std::array<Member, MAX_MEMBERS> members;
+    std::size_t memberNum;
+
+    void skipWhitespace();
+    bool consume(char c);
+    std::optional<std::string_view> readString();
+    std::optional<std::string_view> readNumber();
+    bool readLiteral(std::string_view literal);
+    bool skipValue();
+    const Member *find(std::string_view key) const;
+
+public:
+    explicit JsonTokenizer(std::span<char> json);
+    ~JsonTokenizer() = default;
+
+    JsonTokenizer(const JsonTokenizer &) = delete;
+    JsonTokenizer &operator=(const JsonTokenizer &) = delete;
+
+    // Reads the top-level object, the buffer is modified even if it fails
+    ErrorCode parse();
+    // Offset of the first invalid character after a failed parse
+    std::size_t getErrorOffset() const;
+
+    bool contains(std::string_view key) const;
+    // Empty if the member does not exist or if it is not a string
+    std::optional<std::string_view> getString(std::string_view key) const;
+    // Empty if the member does not exist or if it is not a number with an integer value
+    std::optional<int32_t> getInt(std::string_view key) const;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Utils.hpp"
+
+class KeyboardLayout
+{
+public:
+    // Public types ===
+
+    enum class Id : std::uint8_t {
+        Us,
+        De,
+        Fr,
+        Pl,
+        LayoutNum
+    };
+
+    struct KeyReport {
+        uint8_t modifier;
+        uint8_t keyCode;
+
+        constexpr bool operator==(const KeyReport &other) const = default;
+    };
+
+    // Single entry of the lookup table - the key report required to type the code point
+    // Characters produced with dead keys are preceded by the dead key report
+    struct KeyMapping {
+        char32_t codePoint;
+        KeyReport deadKey;
+        KeyReport key;
+    };
+
+    // Characters produced by a single physical key on each of the modifier levels
+    // Zero code point marks an unused level
+    struct KeyDefinition {
+        uint8_t keyCode;
+        char32_t normal;
+        char32_t shift;
+        char32_t altGr;
+        char32_t shiftAltGr;
+        uint8_t deadLevels;
+    };
+
+    // Character produced by pressing the dead key followed by the base character
+    struct DeadKeyComposition {
+        char32_t deadKey;
+        char32_t base;
+        char32_t composed;
+    };
+
+    // Public constants ===
+
+    constexpr static uint8_t DEAD_NORMAL = 1u << 0u;
+    constexpr static uint8_t DEAD_SHIFT = 1u << 1u;
+    constexpr static uint8_t DEAD_ALTGR = 1u << 2u;
+    constexpr static uint8_t DEAD_SHIFT_ALTGR = 1u << 3u;
+
+private:
+    // Non-static members ===
+
+    const char *name;
+    std::span<const KeyMapping> mappings;
+
+public:
+    constexpr KeyboardLayout(const char *name, std::span<const KeyMapping> mappings)
+    :name(name), mappings(mappings) {}
+
+    const char *getName() const;
+
+    const KeyMapping *find(char32_t codePoint) const;
+    std::optional<char32_t> findCodePoint(const KeyReport &key) const;
+
+    ErrorCode encode(std::string_view utf8, std::pmr::vector<KeyReport> &reports) const;
+    ErrorCode decode(std::span<const KeyReport> reports, std::string &utf8) const;
+
+    static const KeyboardLayout *get(Id id);
+
+    static std::optional<char32_t> decodeUtf8(std::string_view input, std::size_t &idx);
+    static void encodeUtf8(char32_t codePoint, std::string &output);
+};
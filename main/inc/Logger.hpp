@@ -1,7 +1,9 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <string>
+#include <string_view>
 #include <cstdint>
 
 #define LOGD(...) Logger::get().log(Logger::Level::Debug, __VA_ARGS__)
@@ -21,6 +23,9 @@ public:
         LevelNum
     };
 
+    // Additional output of the messages, e.g. the USB channel. It is called by the logging task and it must not block.
+    using Sink = void (*)(Level level, std::string_view message);
+
     static const std::array<std::string, static_cast<size_t>(Level::LevelNum)> levelNames;
 
     Level level;
@@ -33,7 +38,14 @@ public:
 
     void setLevel(Level newLevel);
 
+    void setSink(Sink newSink);
+
 private:
+    // Longer messages are truncated in the sink output
+    static constexpr size_t SINK_MESSAGE_SIZE = 192u;
+
+    std::atomic<Sink> sink;
+
     Logger();
     Logger(const Logger&) = delete;
     ~Logger() = default;
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+
+#include "Utils.hpp"
+
+// Runtime statistics of the device, reported in the text format by the /metrics endpoint
+class Metrics
+{
+public:
+    // Public types ===
+
+    enum class Counter : std::uint8_t {
+        HttpRequests,
+        ScriptParses,
+        ScriptRuns,
+        ScriptParseTime,    // Sum of the parsing durations in us
+        CdcLogsDropped,     // Log messages not sent over the CDC channel, because the host did not read them
+        CounterNum
+    };
+
+private:
+    // Constants ===
+
+    constexpr static std::size_t HEAP_CAPS_NUM = 3u;
+    // Tasks which may be created between reading the number of tasks and their state
+    constexpr static std::size_t TASK_NUM_MARGIN = 4u;
+    constexpr static std::size_t MAX_LINE_LENGTH = 96u;
+
+    // Types ===
+
+    struct HeapCaps {
+        const char *name;
+        uint32_t caps;
+    };
+
+    // Static members ===
+
+    static const std::array<HeapCaps, HEAP_CAPS_NUM> heapCaps;
+    static const std::array<const char *, static_cast<std::size_t>(Counter::CounterNum)> counterNames;
+
+    // The counters are updated without the ESP-IDF dependencies, so that the host tools can use the same sources
+    inline static std::array<std::atomic<uint32_t>, static_cast<std::size_t>(Counter::CounterNum)> counters{};
+
+    static void printLine(std::pmr::string &output, const char *name, const char *labelName, const char *label, uint64_t value);
+
+public:
+    static void increment(Counter counter) {
+        add(counter, 1u);
+    }
+
+    static void add(Counter counter, uint32_t value) {
+        counters[static_cast<std::size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // Appends all metrics to the output, one "name{label="value"} value" line per metric
+    static ErrorCode print(std::pmr::string &output);
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Backtracking matcher of the regular expression subset used by the script parser, which replaces std::regex
+// in the lean build. The pattern is interpreted directly from its text, so it does not allocate any memory.
+// Supported syntax: literals, escapes (\n, \t, \s, \S, \d and the escaped special characters), '.', classes
+// with ranges and negation, capture groups with alternatives, the ^ anchor and the greedy and lazy quantifiers
+// (*, +, ?, {m}, {m,} and {m,n}).
+class Pattern
+{
+public:
+    // Public constants ===
+
+    constexpr static std::size_t MAX_GROUPS = 10u;
+
+    // Public types ===
+
+    // Mirrors the interface of std::csub_match used by the expression handlers
+    struct SubMatch {
+        const char *first;
+        const char *second;
+        bool matched;
+
+        std::size_t length() const;
+        std::string str() const;
+    };
+
+    // Mirrors the interface of std::cmatch used by the expression handlers
+    class Match {
+    public:
+        std::size_t size() const;
+        const SubMatch &operator[](std::size_t idx) const;
+
+    private:
+        friend class Pattern;
+
+        std::array<SubMatch, MAX_GROUPS> groups{};
+        std::size_t groupNum = 0u;
+    };
+
+private:
+    // Constants ===
+
+    constexpr static std::size_t MAX_DEPTH = 192u;
+    constexpr static uint16_t UNBOUNDED = UINT16_MAX;
+
+    // Types ===
+
+    struct Quantifier {
+        uint16_t min;
+        uint16_t max;
+        bool isLazy;
+    };
+
+    // Resumes the enclosing group once one of its alternatives is matched
+    struct Continuation {
+        const char *group;          // Opening parenthesis of the group
+        const char *next;           // Pattern after the quantifier of the group
+        Quantifier quantifier;
+        std::size_t count;          // Number of iterations including the current one
+        const char *iterationStart; // Input position where the current iteration started
+        const Continuation *parent;
+    };
+
+    // State of a single search
+    struct Matcher {
+        const char *begin;
+        const char *end;
+        const char *matchEnd;
+        std::array<SubMatch, MAX_GROUPS> groups;
+        std::size_t depth;
+    };
+
+    // Non-static members ===
+
+    const char *pattern;
+
+    static const char *skipAtom(const char *atom);
+    static const char *parseQuantifier(const char *quantifier, Quantifier &result);
+    static bool isSequenceEnd(const char *position);
+    static bool isCharacterAtom(const char *atom);
+    static bool isCharacterGroup(const char *group);
+    static bool matchCharacter(const char *atom, char chr);
+
+    std::size_t getGroupIndex(const char *group) const;
+    std::size_t getGroupNum() const;
+    std::size_t matchRepeated(const char *atom, const char *input, const char *end, std::size_t max) const;
+
+    bool matchSequence(Matcher &matcher, const char *position, const char *input, const Continuation *continuation) const;
+    bool matchGroup(Matcher &matcher, const char *group, const Quantifier &quantifier, const char *next,
+        std::size_t count, const char *input, const Continuation *parent) const;
+    bool resumeGroup(Matcher &matcher, const Continuation &continuation, const char *input) const;
+
+public:
+    constexpr Pattern(const char *pattern)
+    :pattern(pattern) {}
+
+    // Searches for the first match in the input, like std::regex_search
+    bool search(const char *begin, const char *end, Match &match) const;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+
+#include "sdkconfig.h"
+
+#include "KeyboardLayout.hpp"
+#include "Script.hpp"
+
+// Payloads compiled from the DuckyScript files at build time and linked into the flash. The table is
+// generated by the ducky-compile tool, which rejects the invalid scripts, so the slots are loaded
+// without reading the NVS and without validating the bytecode again. The slots compiled with the flattening
+// option also contain the keyboard reports of the whole run, which are played without executing the bytecode.
+class PayloadRom
+{
+public:
+    // Public types ===
+
+    struct Function {
+        const char *name;
+        uint16_t address;
+    };
+
+    struct Slot {
+        const char *name;               // Name of the source file without the extension
+        KeyboardLayout::Id layoutId;
+        std::span<const uint8_t> code;
+        std::span<const char *const> variableNames;
+        std::span<const Function> functions;
+        std::span<const uint8_t> reports;    // Flattened keyboard reports played instead of the bytecode, if not empty
+    };
+
+private:
+    // Static members ===
+
+    // Defined by the generated source, empty if the payload ROM is disabled
+    static const std::span<const Slot> slots;
+
+public:
+    static std::size_t count();
+    static const Slot *get(std::size_t slotIdx);
+    static std::optional<Script> load(std::size_t slotIdx);
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "sdkconfig.h"
+#include "esp_pm.h"
+
+#include "Utils.hpp"
+
+// Power profile of the device. When the power management is enabled, the CPU frequency is scaled down
+// and the automatic light sleep is entered while the device is idle. The activities which need the full
+// performance or the active links hold the locks, which are no-ops when the power management is disabled.
+class PowerManager
+{
+public:
+    // Public types ===
+
+    enum class Lock : uint8_t {
+        CpuFreqMax,     // Script parsing and execution
+        NoLightSleep,   // Active USB device, which stops responding to the host in the light sleep
+        LockNum
+    };
+
+    // Holds the lock until the end of the scope
+    class Scope {
+    public:
+        explicit Scope(Lock lock);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Lock lock;
+    };
+
+private:
+    // Constants ===
+
+    constexpr static int MAX_CPU_FREQ_MHZ = 240;
+
+    // Static members ===
+
+    static std::array<esp_pm_lock_handle_t, static_cast<std::size_t>(Lock::LockNum)> locks;
+
+public:
+    static ErrorCode init();
+
+    static void acquire(Lock lock);
+    static void release(Lock lock);
+
+    // Current frequency of the CPU in MHz
+    static uint32_t getCpuFrequency();
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "UsbDevice.hpp"
+#include "Utils.hpp"
+
+// Script flattened ahead of time into the final keyboard reports. Every record has 8 bytes:
+//   report         - u8 modifier, u8 reserved (zero), 6 x u8 key code, exactly as sent to the host
+//   delay marker   - u8 zero, u8 DELAY_MARKER, 2 x u8 zero, u32 delay in ms before the next report
+// The playback sends each report at its deadline measured from the start of the stream, so the timing does not
+// depend on the layout lookups or the bytecode, and two flattened runs can be compared byte by byte.
+class ReportStream
+{
+public:
+    // Public constants ===
+
+    constexpr static std::size_t RECORD_SIZE = 8u;
+    constexpr static uint8_t DELAY_MARKER = 0xFFu;
+    // Limit of the recorded stream, e.g. for the long loops
+    constexpr static std::size_t MAX_SIZE = 1024u * 1024u;
+
+private:
+    // Constants ===
+
+    constexpr static std::size_t KEY_CODE_NUM = 6u;
+
+    // Non-static members ===
+
+    std::vector<uint8_t> records;
+
+    static bool waitUntil(UsbDevice &usbDevice, int64_t deadline);
+
+public:
+    ReportStream();
+    ~ReportStream() = default;
+
+    // Recording of the simulated script, the consecutive delays are merged into a single marker
+    void addReport(std::span<const uint8_t> keyCodes, uint8_t modifier = 0u);
+    void addDelay(uint32_t delay);
+    // Press and release, like UsbDevice::hidKeyStroke
+    void addKeyStroke(std::span<const uint8_t> keyCodes, uint8_t modifier, uint32_t delay);
+    bool isFull() const;
+    std::span<const uint8_t> getData() const;
+
+    static bool isValid(std::span<const uint8_t> stream);
+    // Total of the delay markers in ms
+    static uint64_t getDuration(std::span<const uint8_t> stream);
+    static ErrorCode play(UsbDevice &usbDevice, std::span<const uint8_t> stream);
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Bounded monotonic memory of a single HTTP request. The request body, the JSON nodes, the response and the
+// temporary data of the script compiler are allocated here and released in one step when the request is handled,
+// so that the many short-lived allocations do not fragment the heap of the long-running device.
+class RequestArena : public std::pmr::memory_resource
+{
+public:
+    // Public constants ===
+
+    // Memory available to a single request, including the initial buffer
+    constexpr static std::size_t MAX_SIZE = 96u * 1024u;
+
+    // Public types ===
+
+    // Makes the arena active for the current task and releases all of its memory when the scope ends
+    class Scope {
+    public:
+        explicit Scope(RequestArena &arena);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        RequestArena &arena;
+    };
+
+private:
+    // Constants ===
+
+    // Kept for the lifetime of the server, so that the typical request does not use the heap at all
+    constexpr static std::size_t INITIAL_SIZE = 8u * 1024u;
+    constexpr static std::size_t MAX_CHUNKS = 16u;
+
+    // Types ===
+
+    // Heap memory requested once the initial buffer is used up, limited to MAX_SIZE in total
+    class Upstream : public std::pmr::memory_resource {
+    public:
+        bool owns(const void *ptr) const;
+
+    private:
+        struct Chunk {
+            std::byte *ptr;
+            std::size_t size;
+        };
+
+        std::array<Chunk, MAX_CHUNKS> chunks{};
+        std::size_t chunkNum = 0u;
+        std::size_t size = INITIAL_SIZE;
+
+        void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+        void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+    };
+
+    // Static members ===
+
+    // Arena of the request handled by the owner task, the other tasks use the heap
+    static std::atomic<RequestArena *> active;
+    static std::atomic<TaskHandle_t> activeTask;
+
+    // Non-static members ===
+
+    std::unique_ptr<std::byte[]> initialBuffer;
+    Upstream upstream;
+    std::pmr::monotonic_buffer_resource resource;
+    std::size_t usage;
+    std::size_t peakUsage;  // Largest number of bytes allocated by a single request
+
+    bool owns(const void *ptr) const;
+    void release();
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+public:
+    RequestArena();
+    ~RequestArena() = default;
+
+    RequestArena(const RequestArena &) = delete;
+    RequestArena &operator=(const RequestArena &) = delete;
+
+    // Memory of the request handled by the current task, or the default resource outside of the requests
+    static std::pmr::memory_resource *getResource();
+
+    // Allocation functions of the cJSON hooks, which fall back to the heap outside of the requests
+    static void *jsonAllocate(std::size_t size);
+    static void jsonDeallocate(void *ptr);
+};
@@ -1,15 +1,25 @@
 #pragma once
 
 #include <vector>
-#include <any>
 #include <tuple>
 #include <string>
-#include <regex>
+#include <string_view>
+#include <memory_resource>
 #include <functional>
 #include <optional>
 #include <span>
+#include <unordered_map>
+
+#include "sdkconfig.h"
+#if CONFIG_ESP_DUCKY_LEAN_BUILD
+#include "Pattern.hpp"
+#else
+#include <regex>
+#endif
 
 #include "UsbDevice.hpp"
+#include "KeyboardLayout.hpp"
+#include "ReportStream.hpp"
 #include "Utils.hpp"
 
 class Script
@@ -17,27 +27,157 @@ class Script
 public:
     // Public types ===
 
-    enum class Command : std::uint8_t {
-        StringWrite,
-        KeyStroke,
-        Delay
+    // Instructions of the script bytecode
+    // Operands are stored in little endian order directly after the opcode
+    // Binary operators pop the right operand first and push the result
+    enum class Opcode : std::uint8_t {
+        KeyReports,     // u16 count, count x (u8 modifier, u8 key code)
+        KeyStroke,      // u8 count, count x u8 key code
+        Delay,          // u32 delay in ms
+        PushByte,       // i8 value
+        Push,           // i32 value
+        Load,           // u8 variable index
+        Store,          // u8 variable index
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Modulo,
+        Equal,
+        NotEqual,
+        Less,
+        Greater,
+        LessEqual,
+        GreaterEqual,
+        LogicalAnd,
+        LogicalOr,
+        BitwiseAnd,
+        BitwiseOr,
+        BitwiseXor,
+        ShiftLeft,
+        ShiftRight,
+        LogicalNot,
+        Negate,
+        If,             // u16 address of the else branch or the end of the block, jumps if the popped value is zero
+        Else,           // u16 address of the end of the block
+        While,          // u16 address of the end of the loop, jumps if the popped value is zero
+        EndWhile,       // u16 address of the loop condition
+        Function,       // u16 address of the end of the function body
+        Call,           // u8 function index
+        Return,
+        Repeat,         // u16 address of the repeated statement, u32 repetition count
+        SetDefaultDelay,// Pops the delay after every typing instruction in ms
+        SetKeyDelay,    // Pops the delay after every key press and release in ms
+        MouseMove,      // u16 count, count x (i8 x, i8 y) relative movement
+        MouseScroll,    // u16 count, count x i8 vertical scroll
+        MouseClick,     // u8 buttons
+        WaitForLed,     // u8 LED mask, u8 condition (on, off, change), u32 timeout in ms (zero waits forever)
+        SyncHost,       // u32 timeout in ms
+        PackedText,     // u16 key report count, u16 text size, u16 packed size, text packed by TextCodec
+        OpcodeNum
     };
-                          
-    using CommandVector = std::vector<std::tuple<Command, std::any>>;
+
+    struct Function {
+        std::string name;
+        uint16_t address; // Address of the first instruction of the function body
+    };
+
+    // Typing rate, which may be changed by the script while it is running
+    struct Timing {
+        uint32_t defaultDelay;  // Delay after every STRING and key stroke in ms
+        uint32_t keyDelay;      // Delay after every key press and release in ms
+    };
+
+    // Static properties of the compiled script and its simulated duration
+    struct Estimate {
+        std::size_t codeSize;       // Size of the bytecode in bytes
+        std::size_t commandCount;
+        std::size_t keystrokeCount; // Key reports of the STRING commands without the repetitions, two per dead key character
+        uint64_t duration;          // Estimated duration in ms
+        bool isBounded;             // False if the script waits for the host without timeout or it does not end
+    };
+
+    // Bytecode of the statements, which do not depend on the rest of the script, e.g. STRING or DELAY, kept from
+    // the previous compilation and keyed by the hash of the line, so that only the changed lines are parsed again
+    class LineCache
+    {
+    private:
+        friend class Script;
+
+        // Types ===
+
+        struct Entry {
+            std::size_t lineSize;               // Compared together with the hash
+            std::vector<uint8_t> code;
+            std::optional<bool> isRepeatable;   // Empty if the statement does not change the target of REPEAT
+            bool isUsed;                        // Used by the last compilation, the other entries are removed
+        };
+
+        // Non-static members ===
+
+        std::unordered_map<uint64_t, Entry> entries;
+        std::size_t hitCount;
+        std::size_t missCount;
+
+    public:
+        LineCache();
+        ~LineCache() = default;
+
+        void clear();
+        std::size_t size() const;
+        // Statements of the last compilation taken from the cache and parsed by the expression handlers
+        std::size_t getHitCount() const;
+        std::size_t getMissCount() const;
+    };
+
+    // Public constants ===
+
+    constexpr static Timing DEFAULT_TIMING = {0u, 20u};
+    // Nine digits at most, so the count of the REPEAT command always fits its u32 operand
+    constexpr static uint32_t MAX_REPEAT_COUNT = 999999999u;
 
 private:
     // Constants ===
 
-    constexpr static std::size_t EXPRESSIONS_NUM = 10u;
+    constexpr static std::size_t EXPRESSIONS_NUM = 28u;
     constexpr static std::size_t SPECIAL_KEY_NUM = 50u;
-    constexpr static uint8_t ASCII_CHAR_NUM = 128u;
-    constexpr static uint8_t ASCII_CONV_TABLE_DIM_NUM = 2u;
+    constexpr static std::size_t MOUSE_BUTTON_NUM = 3u;
+    constexpr static std::size_t LOCK_LED_NUM = 3u;
+    constexpr static uint32_t DEFAULT_SYNC_TIMEOUT = 1000u;
+    constexpr static std::size_t MAX_CODE_SIZE = UINT16_MAX;
+    constexpr static std::size_t MAX_VARIABLES = 32u;
+    constexpr static std::size_t MAX_FUNCTIONS = UINT8_MAX;
+    // The names of the variables and functions are serialized with a one byte length
+    constexpr static std::size_t MAX_NAME_LENGTH = UINT8_MAX;
+    constexpr static std::size_t STACK_SIZE = 16u;
+    constexpr static std::size_t CALL_STACK_SIZE = 8u;
+    constexpr static int32_t MAX_MOUSE_DISTANCE = INT16_MAX;
+    constexpr static std::size_t MAX_SIMULATED_INSTRUCTIONS = 1000000u;
+    // Only one REPEAT per function call may be in progress
+    constexpr static std::size_t REPEAT_STACK_SIZE = CALL_STACK_SIZE + 1u;
 
+    constexpr static uint8_t SERIALIZED_MAGIC[] = {'D', 'K'};
+    constexpr static uint8_t SERIALIZED_VERSION = 1u;
 
     // Types ===
+
+    // Parsing state shared by the expression handlers
+    struct Compiler;
+
+    // Capture groups of the matched expression
+#if CONFIG_ESP_DUCKY_LEAN_BUILD
+    using Match = Pattern::Match;
+#else
+    using Match = std::cmatch;
+#endif
+
     struct ExpressionHandler {
+#if CONFIG_ESP_DUCKY_LEAN_BUILD
+        Pattern pattern;
+#else
         std::string regexStr;
-        std::function<ErrorCode(std::smatch&, CommandVector&)> process;
+#endif
+        std::function<ErrorCode(Match&, Compiler&)> process;
     };
     struct
      SpecialKey {
@@ -45,29 +185,65 @@ private:
         uint8_t keyCode;
     };
 
+    struct MouseButton {
+        std::string name;
+        uint8_t buttons;
+    };
+    struct LockLed {
+        std::string name;
+        uint8_t mask;
+    };
+
     // Static members ===
-    
+
     static std::array<ExpressionHandler, EXPRESSIONS_NUM> expressionHandlers;
     static std::array<SpecialKey, SPECIAL_KEY_NUM> specialKeys;
-    static const uint8_t asciiToKeycodeConvTable[ASCII_CHAR_NUM][ASCII_CONV_TABLE_DIM_NUM];
-    static const uint8_t keycodeToAsciiConvTable[ASCII_CHAR_NUM][ASCII_CONV_TABLE_DIM_NUM];
+    static std::array<MouseButton, MOUSE_BUTTON_NUM> mouseButtons;
+    static std::array<LockLed, LOCK_LED_NUM> lockLeds;
 
 
-    static ErrorCode parseAscii(const char chr, std::vector<uint8_t> &keyCodes);
-    static ErrorCode parseKeyStroke(const std::string &keyName, std::vector<uint8_t> &keyList);
+    static ErrorCode parseCharacter(const std::string &chr, std::vector<uint8_t> &keyCodes, const KeyboardLayout &layout);
+    static ErrorCode parseKeyStroke(const std::string &keyName, std::vector<uint8_t> &keyList, const KeyboardLayout &layout);
+
+    static std::optional<Script> compile(std::string_view input, KeyboardLayout::Id layoutId, std::pmr::memory_resource *resource,
+        LineCache *cache);
+    static std::optional<Script> deserializeLegacy(std::span<const uint8_t> input);
+    static std::size_t getInstructionSize(std::span<const uint8_t> code, std::size_t pc);
+    // True if the code neither jumps nor uses the variables, so it may be copied to any address of another script
+    static bool isContextFree(std::span<const uint8_t> code);
 
     // Non-static members ===
 
-    CommandVector commands;
+    std::vector<uint8_t> code;
+    std::vector<std::string> variableNames;
+    std::vector<Function> functions;
+    KeyboardLayout::Id layoutId;
+
+    bool isValid() const;
+    ErrorCode execute(UsbDevice *usbDevice, ReportStream *recorder, Timing &timing, uint64_t &duration, bool &isBounded) const;
+
 public:
-    Script(CommandVector &commands);
-    Script(CommandVector &&commands);
+    Script(std::vector<uint8_t> &&code, std::vector<std::string> &&variableNames, std::vector<Function> &&functions,
+        KeyboardLayout::Id layoutId = KeyboardLayout::Id::Us);
     ~Script() = default;
 
-    ErrorCode run(UsbDevice &usbDevice);
-    std::string toString();
-    std::vector<uint8_t> serialize();
+    ErrorCode run(UsbDevice &usbDevice) const;
+    ErrorCode run(UsbDevice &usbDevice, Timing &timing) const;
+    ErrorCode estimate(Estimate &estimate, Timing timing = DEFAULT_TIMING) const;
+    // Records the keyboard reports and the delays of the whole run, fails for the scripts using the mouse,
+    // waiting for the host or not ending within the limits
+    ErrorCode flatten(ReportStream &stream, Timing timing = DEFAULT_TIMING) const;
+    std::string toString() const;
+    std::vector<uint8_t> serialize() const;
+
+    KeyboardLayout::Id getLayoutId() const;
+    std::span<const uint8_t> getCode() const;
+    const std::vector<std::string> &getVariableNames() const;
+    const std::vector<Function> &getFunctions() const;
 
     static std::optional<Script> deserialize(std::span<const uint8_t> input);
-    static std::optional<Script> parse(std::string input);
+    // The temporary data of the compiler is allocated from the resource, the returned script uses the heap
+    // The unchanged lines are taken from the cache if given, which is then updated with the lines of the input
+    static std::optional<Script> parse(std::string_view input, KeyboardLayout::Id layoutId = KeyboardLayout::Id::Us,
+        std::pmr::memory_resource *resource = std::pmr::get_default_resource(), LineCache *cache = nullptr);
 };
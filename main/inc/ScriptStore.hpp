@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "esp_partition.h"
+
+#include "Utils.hpp"
+
+// Serialized script kept in a dedicated data partition split into two slots (A/B). Every slot is:
+//   header (u32 magic, u32 sequence, u32 data size, u32 CRC-32 of the data, 12 x u8 reserved, u32 CRC-32 of the header)
+//   data
+// The save writes the slot which is not active and programs its header last, after the data were read back and
+// verified. The slot with the newest valid header is the active one, so the header flips the script at once and a
+// power loss during the save keeps the previous script. Only the sectors whose content differs are erased, except
+// for the sector of the header which is erased by every save.
+class ScriptStore
+{
+public:
+    // Public constants ===
+
+    constexpr static std::size_t SLOT_NUM = 2u;
+
+private:
+    // Constants ===
+
+    constexpr static uint32_t MAGIC = 0x31435344u;    // "DSC1"
+    constexpr static std::size_t HEADER_SIZE = 32u;
+    constexpr static uint32_t NO_SLOT = SLOT_NUM;
+    // Chunk of the flash reads, kept on the stack
+    constexpr static std::size_t CHUNK_SIZE = 256u;
+
+    // Types ===
+
+    struct Header {
+        uint32_t magic;
+        uint32_t sequence;
+        uint32_t size;
+        uint32_t dataCrc;
+        uint8_t reserved[12u];
+        uint32_t headerCrc;
+    };
+
+    static_assert(sizeof(Header) == HEADER_SIZE, "The header layout is stored in the flash");
+
+    // Non-static members ===
+
+    const char *partitionLabel;
+    const esp_partition_t *partition;
+    std::size_t slotSize;
+    // Read by the loading tasks while the other slot is written
+    std::atomic<uint32_t> activeSlot;
+    uint32_t sequence;
+    std::atomic<bool> isWriting;
+
+    std::size_t getSlotOffset(std::size_t slotIdx) const;
+    std::optional<Header> readHeader(std::size_t slotIdx) const;
+    std::optional<uint32_t> readCrc(std::size_t offset, std::size_t size) const;
+    bool isProgrammed(std::size_t offset, std::span<const uint8_t> data) const;
+    ErrorCode writeSlot(std::size_t slotIdx, std::span<const uint8_t> data);
+
+public:
+    explicit ScriptStore(const char *partitionLabel);
+    ~ScriptStore() = default;
+
+    // Finds the partition and selects the newest slot whose data match the CRC
+    ErrorCode init();
+    bool isAvailable() const;
+    bool isEmpty() const;
+    std::size_t getCapacity() const;
+    // Data of the active slot, empty if nothing is stored or the partition is not available
+    ErrorCode read(std::vector<uint8_t> &data) const;
+    ErrorCode write(std::span<const uint8_t> data);
+};
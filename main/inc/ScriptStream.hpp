@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <optional>
+#include <string>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "UsbDevice.hpp"
+#include "KeyboardLayout.hpp"
+#include "Script.hpp"
+#include "Utils.hpp"
+
+class ScriptStream
+{
+public:
+    // Public constants ===
+
+    constexpr static const char *STORAGE_BASE_PATH = "/data";
+
+private:
+    // Constants ===
+
+    constexpr static std::size_t BLOCK_SIZE = 4096u;
+    constexpr static std::size_t BLOCK_NUM = 2u;
+    constexpr static std::size_t MAX_LINE_LENGTH = BLOCK_SIZE;
+    constexpr static uint32_t READER_TASK_STACK_SIZE = 4096u;
+
+    // Types ===
+
+    struct Block {
+        std::array<char, BLOCK_SIZE> data;
+        std::size_t length;
+    };
+
+    struct BlockMessage {
+        uint8_t blockIdx;
+        ErrorCode status;
+        bool endOfFile;
+    };
+
+    // Non-static members ===
+
+    std::string path;
+    KeyboardLayout::Id layoutId;
+    FILE *file;
+    std::array<Block, BLOCK_NUM> blocks;
+    QueueHandle_t freeBlocks;
+    QueueHandle_t filledBlocks;
+    std::atomic<bool> abortFlag;
+    std::string pendingLine;
+    std::size_t lineNumber;
+    bool isInRemBlock;
+    bool isReaderFinished;
+    // The lines are compiled separately, so the state shared between them is kept here
+    Script::Timing timing;
+    std::optional<Script> previousScript;
+
+    static void readerTask(void *arg);
+
+    ErrorCode processBlock(const Block &block, UsbDevice &usbDevice);
+    ErrorCode processLine(std::string &line, UsbDevice &usbDevice);
+    ErrorCode processRepeat(const std::string &line, std::size_t firstChrIdx, UsbDevice &usbDevice);
+    void drain();
+
+public:
+    ScriptStream(const std::string &relativePath, KeyboardLayout::Id layoutId = KeyboardLayout::Id::Us);
+    ~ScriptStream();
+
+    ScriptStream(const ScriptStream&) = delete;
+    ScriptStream& operator=(const ScriptStream&) = delete;
+
+    ErrorCode run(UsbDevice &usbDevice);
+
+    static bool isValidPath(const std::string &relativePath);
+};
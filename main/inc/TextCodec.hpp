@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Small LZ77 scheme for the text of the STRING commands. The packed data is a sequence of tokens:
+//   0LLLLLLL              - L + 1 literal bytes follow
+//   10LLLLLL DDDDDDDD     - L + 3 bytes copied from D + 1 bytes back in the decoded text
+//   11LLLLLL OOOO OOOO    - L + 4 bytes copied from the u16 offset in the shared dictionary
+// The window is small enough for the decoder to keep it on the stack and the text is decoded one byte at a time,
+// so the compressed strings are expanded while they are typed.
+class TextCodec
+{
+public:
+    // Public constants ===
+
+    constexpr static std::size_t WINDOW_SIZE = 256u;
+
+private:
+    // Constants ===
+
+    constexpr static std::size_t MAX_LITERAL_LENGTH = 128u;
+    constexpr static std::size_t MIN_WINDOW_MATCH = 3u;
+    constexpr static std::size_t MIN_DICTIONARY_MATCH = 4u;
+    constexpr static std::size_t MAX_MATCH_LENGTH = 64u;
+
+    // Static members ===
+
+    // Common fragments of the payloads, the compressed scripts refer to it, so it must never be changed
+    static const std::string_view dictionary;
+
+public:
+    // Streaming decoder of the packed text, which produces the empty value at the end or on the corrupted data
+    class Decoder
+    {
+    private:
+        // Types ===
+
+        enum class TokenType : uint8_t {
+            None,
+            Literal,
+            Window,
+            Dictionary
+        };
+
+        // Non-static members ===
+
+        std::span<const uint8_t> packed;
+        std::size_t packedIdx;
+        std::size_t remainingSize;
+        std::array<char, WINDOW_SIZE> window;
+        std::size_t decodedSize;
+        TokenType tokenType;
+        std::size_t tokenRemaining;
+        std::size_t copyIdx;
+        bool isCorrupted;
+
+        bool readToken();
+
+    public:
+        Decoder(std::span<const uint8_t> packed, std::size_t textSize);
+        ~Decoder() = default;
+
+        std::optional<char> next();
+        // True if the whole text was decoded and the packed data has no other bytes
+        bool isFinished() const;
+    };
+
+    // Appends the packed text to the output, the dictionary is only used if enabled
+    static void compress(std::string_view text, std::pmr::vector<uint8_t> &packed, bool useDictionary = true);
+};
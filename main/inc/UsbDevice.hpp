@@ -1,13 +1,21 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <initializer_list>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "sdkconfig.h"
 #include "tinyusb.h"
 #include "class/hid/hid_device.h"
 #include "tusb_msc_storage.h"
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+#include "tusb_cdc_acm.h"
+#endif
 
 #include "Utils.hpp"
 
@@ -17,44 +25,127 @@
 
 class UsbDevice
 {
+public:
+
+    enum class DeviceClass : uint8_t
+    {
+        SerialJtag,
+        Hid,
+        Msc,
+        HidMsc
+    };
+
 private:
+    // Time for the host to notice the detached device before it is attached with the new configuration
+    constexpr static uint32_t RESTART_DETACH_TIME = 100u;
+    // Longest wait for the host to poll the previous report, e.g. the suspended host never polls it
+    constexpr static uint32_t HID_READY_TIMEOUT = 50u;
+
+#if CONFIG_ESP_DUCKY_HID_BOOT_KEYBOARD
+    // The keyboard has its own boot protocol interface and endpoint, the mouse uses the second interface
+    constexpr static bool HID_BOOT_KEYBOARD = true;
+#else
+    // The keyboard and the mouse share one interface and endpoint, the reports are told apart by the report IDs
+    constexpr static bool HID_BOOT_KEYBOARD = false;
+#endif
+    constexpr static uint8_t HID_INSTANCE_NUM = HID_BOOT_KEYBOARD ? 2u : 1u;
+    constexpr static uint8_t HID_MOUSE_INSTANCE = HID_BOOT_KEYBOARD ? 1u : 0u;
+    constexpr static uint8_t HID_MOUSE_REPORT_ID = HID_BOOT_KEYBOARD ? 0u : static_cast<uint8_t>(HID_ITF_PROTOCOL_MOUSE);
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    constexpr static bool CDC_CHANNEL = true;
+#else
+    constexpr static bool CDC_CHANNEL = false;
+#endif
+
     bool isStartedFlag;
+    bool isJtagEnabledFlag;
+    bool isCdcEnabledFlag;
+    DeviceClass deviceClass;
     wl_handle_t wl_handle;
     uint8_t interfaceCount;
-    uint8_t configurationDescriptorTotalLength;
+    uint16_t configurationDescriptorTotalLength;
     tusb_desc_device_t deviceDescriptor;
-    std::vector<uint8_t> reportDescriptor;
+    std::array<std::vector<uint8_t>, HID_INSTANCE_NUM> reportDescriptors;
     std::vector<const char *> stringDescriptor;
     std::vector<uint8_t> configurationDescriptor;
+    // Lock key LED state reported by the host
+    std::atomic<uint8_t> hidLedState;
+    // Stop request of the running script, checked at least once per polling interval
+    std::atomic<bool> hidAbortFlag;
+    // Called by the TinyUSB task when the CDC-ACM interface receives data
+    std::function<void()> cdcRxCallback;
     static std::vector<UsbDevice*> instances;
 
     void enableHID();
-    void enableMSC();
+    // Waits until the host polled the previous report of the HID instance
+    bool hidWaitReady(uint8_t instance);
+    ErrorCode enableMSC();
+    void disableMSC();
+    void enableCDC();
+    ErrorCode startCDC();
+    void resetConfiguration();
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    static void handleCdcRx(int itf, cdcacm_event_t *event);
+#endif
 public:
-
-    enum class DeviceClass : uint8_t
-    {
-        SerialJtag,
-        Hid,
-        Msc,
-        HidMsc
-    };
+    // Interval of the HID endpoint polling by the host in ms
+    constexpr static uint8_t HID_POLLING_INTERVAL = CONFIG_ESP_DUCKY_HID_POLLING_INTERVAL;
+    // HID instance and report ID of the keyboard reports, also used by the LED output report of the host
+    constexpr static uint8_t HID_KEYBOARD_INSTANCE = 0u;
+    constexpr static uint8_t HID_KEYBOARD_REPORT_ID = HID_BOOT_KEYBOARD ? 0u : static_cast<uint8_t>(HID_ITF_PROTOCOL_KEYBOARD);
+    // Largest relative movement of a single mouse report
+    constexpr static int8_t HID_MOUSE_MAX_DELTA = INT8_MAX;
+    // Size of the CDC-ACM bulk endpoints
+    constexpr static uint16_t CDC_ENDPOINT_SIZE = 64u;
 
     UsbDevice();
     virtual ~UsbDevice();
 
+    // The USB-OTG supports 5 IN endpoints including EP0, the HID + MSC device with both the boot keyboard and
+    // the CDC channel would need 6
+    constexpr static bool isSupported(DeviceClass deviceClass) {
+        return !(HID_BOOT_KEYBOARD && CDC_CHANNEL && (DeviceClass::HidMsc == deviceClass));
+    }
+
     ErrorCode start(DeviceClass deviceClass);
     ErrorCode stop();
+    // Stops the current device and starts it again with the new class, without the reset of the SoC
+    ErrorCode restart(DeviceClass deviceClass);
 
     bool isStarted() const;
     bool isMounted() const;
+    DeviceClass getDeviceClass() const;
 
-    const uint8_t *getReportDescriptor() const;
+    const uint8_t *getReportDescriptor(uint8_t instance) const;
 
     ErrorCode enableJTAG();
 
-    void hidSendKeyboardReport(const std::vector<uint8_t> &keysList, uint8_t modifier = 0u);
-    void hidKeyStroke(const std::vector<uint8_t> &keysList, uint8_t modifier = 0u, uint32_t delay = 20u);
+    void hidSendKeyboardReport(std::span<const uint8_t> keysList, uint8_t modifier = 0u);
+    void hidKeyStroke(std::span<const uint8_t> keysList, uint8_t modifier = 0u, uint32_t delay = 20u);
+    void hidKeyPress(uint8_t keyCode, uint8_t modifier = 0u, uint32_t delay = 20u);
+    void hidSendMouseReport(uint8_t buttons, int8_t x, int8_t y, int8_t vertical = 0, int8_t horizontal = 0);
+    void hidMouseMove(int8_t x, int8_t y, int8_t vertical = 0);
+    void hidMouseClick(uint8_t buttons, uint32_t delay = 20u);
+
+    void hidSetLedState(uint8_t leds);
+    uint8_t hidGetLedState() const;
+    bool hidWaitForLedState(uint8_t mask, uint8_t state, uint32_t timeout);
+    bool hidSyncHost(uint32_t timeout, uint32_t delay = 20u);
+
+    // Waits for the delay in ms, returns false if it was interrupted by the abort request
+    bool hidDelay(uint32_t delay);
+    void hidAbort();
+    void hidClearAbort();
+    bool hidIsAborted() const;
+
+    // The CDC-ACM interface is added to the HID and MSC devices if the channel is enabled in the configuration
+    bool cdcIsConnected() const;
+    std::size_t cdcRead(std::span<uint8_t> buffer);
+    // Queues either all of the data or nothing, so that a slow reader never blocks the caller
+    bool cdcWrite(std::span<const uint8_t> data);
+    void cdcFlush();
+    // Must be set before the device is started
+    void cdcSetRxCallback(std::function<void()> &&callback);
 
     static UsbDevice* getInstance(uint8_t instanceIdx);
 };
@@ -1,14 +1,47 @@
 #pragma once
 
 #include <cstdint>
+#include <span>
 
 enum class ErrorCode : std::uint8_t {
     Success,
     GeneralError,
     InvalidArgument,
     NotImplemented,
+    Aborted,
 };
 
 namespace Utils {
     void delay(uint32_t ms);
+
+    // CRC-16/CCITT-FALSE (polynomial 0x1021), the previous result may be passed to continue the calculation
+    uint16_t crc16(std::span<const uint8_t> data, uint16_t crc = 0xFFFFu);
+
+    // FNV-1a hashes, the previous result may be passed to continue the calculation
+    // Defined here, so that the host tools do not need the FreeRTOS part of the utilities
+    inline uint32_t fnv1a32(std::span<const uint8_t> data, uint32_t hash = 0x811C9DC5u) {
+        for (uint8_t byte : data) {
+            hash = (hash ^ byte) * 0x01000193u;
+        }
+        return hash;
+    }
+
+    inline uint64_t fnv1a64(std::span<const uint8_t> data, uint64_t hash = 0xCBF29CE484222325u) {
+        for (uint8_t byte : data) {
+            hash = (hash ^ byte) * 0x00000100000001B3u;
+        }
+        return hash;
+    }
+
+    // CRC-32/ISO-HDLC (reflected polynomial 0xEDB88320), the previous result may be passed to continue the calculation
+    inline uint32_t crc32(std::span<const uint8_t> data, uint32_t crc = 0u) {
+        crc = ~crc;
+        for (uint8_t byte : data) {
+            crc ^= byte;
+            for (uint8_t bitIdx = 0u; bitIdx < 8u; bitIdx++) {
+                crc = (crc & 1u) ? ((crc >> 1u) ^ 0xEDB88320u) : (crc >> 1u);
+            }
+        }
+        return ~crc;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "esp_timer.h"
+
+#include "BootTimeline.hpp"
+#include "Logger.hpp"
+
+const std::array<const char *, static_cast<std::size_t>(BootTimeline::Phase::PhaseNum)> BootTimeline::phaseNames = {
+    "startup",
+    "power_manager",
+    "cdc_channel",
+    "button",
+    "nvs_init",
+    "nvs_open",
+    "script_store",
+    "config",
+    "payload_load",
+    "usb_mount",
+    "access_point",
+    "mdns",
+    "http_server"
+};
+
+const std::array<const char *, static_cast<std::size_t>(BootTimeline::Event::EventNum)> BootTimeline::eventNames = {
+    "first_keystroke"
+};
+
+uint32_t BootTimeline::now() {
+    // Zero is reserved for the times not reached yet
+    return std::max<uint32_t>(static_cast<uint32_t>(esp_timer_get_time()), 1u);
+}
+
+void BootTimeline::mark(Phase phase) {
+    if (isClosed.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    uint32_t expected = 0u;
+    (void)phaseEnds[static_cast<std::size_t>(phase)].compare_exchange_strong(expected, now(), std::memory_order_relaxed);
+}
+
+void BootTimeline::close() {
+    isClosed.store(true, std::memory_order_relaxed);
+}
+
+std::optional<BootTimeline::Entry> BootTimeline::get(Phase phase) {
+    const std::size_t phaseIdx = static_cast<std::size_t>(phase);
+    const uint32_t end = phaseEnds[phaseIdx].load(std::memory_order_relaxed);
+    if (0u == end) {
+        return std::nullopt;
+    }
+
+    // Start of the phase is the end of the last phase reached before it
+    uint32_t start = 0u;
+    for (std::size_t idx = phaseIdx; idx > 0u; --idx) {
+        start = phaseEnds[idx - 1u].load(std::memory_order_relaxed);
+        if (0u != start) {
+            break;
+        }
+    }
+
+    return Entry{phaseNames[phaseIdx], end, end - start};
+}
+
+std::optional<BootTimeline::Entry> BootTimeline::get(Event event) {
+    const std::size_t eventIdx = static_cast<std::size_t>(event);
+    const uint32_t time = eventTimes[eventIdx].load(std::memory_order_relaxed);
+    if (0u == time) {
+        return std::nullopt;
+    }
+
+    return Entry{eventNames[eventIdx], time, 0u};
+}
+
+void BootTimeline::logSummary() {
+    char summary[MAX_SUMMARY_LENGTH];
+    std::size_t length = 0u;
+    auto append = [&summary, &length](const char *name, uint32_t time) {
+        const int written = std::snprintf(&summary[length], sizeof(summary) - length, "%s%s %lu", (0u == length) ? "" : ", ",
+            name, static_cast<unsigned long>(time / 1000u));
+        length = std::min(length + static_cast<std::size_t>(std::max(written, 0)), sizeof(summary) - 1u);
+    };
+
+    for (std::size_t idx = 0u; idx < phaseNames.size(); ++idx) {
+        if (const auto entry = get(static_cast<Phase>(idx))) {
+            append(entry->name, entry->duration);
+        }
+    }
+    // The events are reported as the times since the start, e.g. the keystroke of the payload armed at startup
+    for (std::size_t idx = 0u; idx < eventNames.size(); ++idx) {
+        if (const auto entry = get(static_cast<Event>(idx))) {
+            append(entry->name, entry->end);
+        }
+    }
+
+    const auto ui = get(Phase::HttpServer);
+    LOGI("Boot timeline in ms: %s (web interface at %lu ms)", summary, static_cast<unsigned long>(ui ? ui->end / 1000u : 0u));
+}
@@ -0,0 +1,114 @@
+#include "esp_timer.h"
+#include "esp_sleep.h"
+#include "sdkconfig.h"
+
+#include "Button.hpp"
+#include "Logger.hpp"
+
+Button::Button(gpio_num_t gpio)
+:gpio(gpio),
+events(nullptr),
+isPressedState(false),
+lastChangeTime(0)
+{}
+
+Button::~Button() {
+    if (events) {
+        (void)gpio_isr_handler_remove(gpio);
+        (void)gpio_wakeup_disable(gpio);
+        vQueueDelete(events);
+    }
+}
+
+ErrorCode Button::init() {
+    events = xQueueCreate(EVENT_QUEUE_LENGTH, sizeof(Event));
+    if (!events) {
+        LOGE("Failed to create the button event queue");
+        return ErrorCode::GeneralError;
+    }
+
+    const gpio_config_t buttonConfig = {
+        .pin_bit_mask = BIT64(gpio),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    esp_err_t ret = gpio_config(&buttonConfig);
+    if (ret) {
+        LOGE("Failed to configure the button GPIO %d with error: %d", gpio, ret);
+        return ErrorCode::GeneralError;
+    }
+
+    // The press wakes the chip, the RTC capable pins keep this level for the wakeup. The interrupt of the pin
+    // then waits for the level opposite to the current one.
+    ret = gpio_wakeup_enable(gpio, GPIO_INTR_LOW_LEVEL);
+    if (!ret) {
+        ret = esp_sleep_enable_gpio_wakeup();
+    }
+#if CONFIG_PM_SLP_DISABLE_GPIO
+    // The pins are disconnected in the light sleep otherwise, including the pull-up of the button
+    if (!ret) {
+        ret = gpio_sleep_sel_dis(gpio);
+    }
+#endif
+    if (ret) {
+        LOGE("Failed to enable the wakeup by the button GPIO %d with error: %d", gpio, ret);
+        return ErrorCode::GeneralError;
+    }
+
+    isPressedState = isPressed();
+    ret = gpio_set_intr_type(gpio, getWaitedLevel(isPressedState));
+    if (ret) {
+        LOGE("Failed to set the interrupt type of the button GPIO %d with error: %d", gpio, ret);
+        return ErrorCode::GeneralError;
+    }
+
+    // The service may already be installed by another driver
+    ret = gpio_install_isr_service(0);
+    if (ret && (ret != ESP_ERR_INVALID_STATE)) {
+        LOGE("Failed to install the GPIO interrupt service with error: %d", ret);
+        return ErrorCode::GeneralError;
+    }
+
+    ret = gpio_isr_handler_add(gpio, handleInterrupt, this);
+    if (ret) {
+        LOGE("Failed to add the button interrupt handler with error: %d", ret);
+        return ErrorCode::GeneralError;
+    }
+
+    return ErrorCode::Success;
+}
+
+gpio_int_type_t Button::getWaitedLevel(bool isPressed) {
+    return isPressed ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL;
+}
+
+void Button::handleInterrupt(void *arg) {
+    Button *button = static_cast<Button *>(arg);
+    const bool isPressed = !gpio_get_level(button->gpio);
+    const int64_t now = esp_timer_get_time();
+
+    // Every change of the level raises a single interrupt, like an edge, including the rejected bounces
+    (void)gpio_set_intr_type(button->gpio, getWaitedLevel(isPressed));
+
+    if ((isPressed == button->isPressedState) || ((now - button->lastChangeTime) < DEBOUNCE_TIME_US)) {
+        return;
+    }
+    button->isPressedState = isPressed;
+    button->lastChangeTime = now;
+
+    const Event event = isPressed ? Event::Pressed : Event::Released;
+    BaseType_t isTaskWoken = pdFALSE;
+    // Events are dropped if the queue is full, the button is not used by anyone then
+    (void)xQueueSendFromISR(button->events, &event, &isTaskWoken);
+    portYIELD_FROM_ISR(isTaskWoken);
+}
+
+bool Button::waitForEvent(Event &event, TickType_t timeout) {
+    return pdTRUE == xQueueReceive(events, &event, timeout);
+}
+
+bool Button::isPressed() const {
+    return !gpio_get_level(gpio);
+}
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "CdcChannel.hpp"
+#include "Metrics.hpp"
+
+std::atomic<RingbufHandle_t> CdcChannel::logBuffer{nullptr};
+
+CdcChannel::CdcChannel(UsbDevice &usb, std::unordered_map<Command, CommandCallback> &&callbacks)
+:usb(usb),
+callbacks(std::move(callbacks)),
+task(nullptr),
+rxFrame(),
+lastRxTicks(0u),
+upload(),
+uploadSize(0u),
+isUploading(false),
+pendingLog()
+{
+    rxFrame.reserve(MAX_FRAME_SIZE);
+
+    // Registered before the USB device is started, the task is only notified once it exists
+    usb.cdcSetRxCallback([this]() {
+        TaskHandle_t handle = task.load(std::memory_order_acquire);
+        if (handle) {
+            xTaskNotifyGive(handle);
+        }
+    });
+}
+
+ErrorCode CdcChannel::start() {
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    RingbufHandle_t buffer = xRingbufferCreate(LOG_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+    if (!buffer) {
+        LOGE("Failed to create the CDC log buffer");
+        return ErrorCode::GeneralError;
+    }
+    logBuffer.store(buffer, std::memory_order_release);
+
+    TaskHandle_t handle = nullptr;
+    if (pdPASS != xTaskCreate(taskMain, "cdc", TASK_STACK_SIZE, this, TASK_PRIORITY, &handle)) {
+        LOGE("Failed to create the CDC channel task");
+        return ErrorCode::GeneralError;
+    }
+    task.store(handle, std::memory_order_release);
+
+    Logger::get().setSink(logSink);
+    LOGI("CDC channel started");
+#else
+    LOGD("CDC channel is disabled in the configuration");
+#endif
+
+    return ErrorCode::Success;
+}
+
+void CdcChannel::taskMain(void *arg) {
+    static_cast<CdcChannel *>(arg)->run();
+}
+
+void CdcChannel::run() {
+    for (;;) {
+        // Woken up by the received data, the logs are sent periodically
+        (void)ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_FLUSH_PERIOD));
+
+        receive();
+        sendLogs();
+        usb.cdcFlush();
+    }
+}
+
+void CdcChannel::receive() {
+    std::array<uint8_t, UsbDevice::CDC_ENDPOINT_SIZE> buffer{};
+    std::size_t readSize = 0u;
+
+    while ((readSize = usb.cdcRead(buffer)) > 0u) {
+        const TickType_t ticks = xTaskGetTickCount();
+        if (!rxFrame.empty() && ((ticks - lastRxTicks) >= pdMS_TO_TICKS(FRAME_TIMEOUT))) {
+            LOGW("Dropping incomplete CDC frame of %zu bytes", rxFrame.size());
+            rxFrame.clear();
+        }
+        lastRxTicks = ticks;
+
+        for (std::size_t byteIdx = 0u; byteIdx < readSize; byteIdx++) {
+            // Bytes outside of the frames are skipped until the next sync byte
+            if (rxFrame.empty() && (FRAME_SYNC != buffer[byteIdx])) {
+                continue;
+            }
+            rxFrame.push_back(buffer[byteIdx]);
+            if (rxFrame.size() < HEADER_SIZE) {
+                continue;
+            }
+
+            const Command command = static_cast<Command>(rxFrame[1u]);
+            const std::size_t payloadSize = rxFrame[2u] | (static_cast<std::size_t>(rxFrame[3u]) << 8u);
+            if (payloadSize > MAX_PAYLOAD_SIZE) {
+                LOGE("CDC frame payload is too long: %zu bytes", payloadSize);
+                sendStatus(command, ErrorCode::InvalidArgument);
+                rxFrame.clear();
+                continue;
+            }
+            if (rxFrame.size() < HEADER_SIZE + payloadSize + CRC_SIZE) {
+                continue;
+            }
+
+            const uint16_t crc = rxFrame[HEADER_SIZE + payloadSize] | (rxFrame[HEADER_SIZE + payloadSize + 1u] << 8u);
+            if (crc != Utils::crc16(std::span<const uint8_t>(&rxFrame[1u], HEADER_SIZE - 1u + payloadSize))) {
+                LOGE("CDC frame CRC mismatch");
+                sendStatus(command, ErrorCode::InvalidArgument);
+            }
+            else {
+                handleFrame(command, std::span<const uint8_t>(&rxFrame[HEADER_SIZE], payloadSize));
+            }
+            rxFrame.clear();
+        }
+    }
+}
+
+void CdcChannel::handleFrame(Command command, std::span<const uint8_t> payload) {
+    ErrorCode result = ErrorCode::NotImplemented;
+
+    switch (command) {
+        case Command::Ping:
+            result = ErrorCode::Success;
+            break;
+        case Command::UploadBegin:
+        case Command::UploadData:
+        case Command::UploadEnd:
+            result = handleUpload(command, payload);
+            break;
+        default: {
+            auto callback = callbacks.find(command);
+            if (callback != callbacks.end()) {
+                result = callback->second(payload);
+            }
+            else {
+                LOGE("Unsupported CDC command: 0x%02x", static_cast<unsigned int>(command));
+            }
+        }
+    }
+
+    sendStatus(command, result);
+}
+
+ErrorCode CdcChannel::handleUpload(Command command, std::span<const uint8_t> payload) {
+    switch (command) {
+        case Command::UploadBegin: {
+            if (payload.size() != sizeof(uint32_t)) {
+                LOGE("Invalid size of the upload begin command: %zu", payload.size());
+                return ErrorCode::InvalidArgument;
+            }
+
+            const std::size_t size = payload[0u] | (payload[1u] << 8u) | (payload[2u] << 16u) | (static_cast<std::size_t>(payload[3u]) << 24u);
+            if ((size == 0u) || (size > MAX_UPLOAD_SIZE)) {
+                LOGE("Invalid upload size: %zu bytes", size);
+                return ErrorCode::InvalidArgument;
+            }
+
+            upload.clear();
+            upload.reserve(size);
+            uploadSize = size;
+            isUploading = true;
+            return ErrorCode::Success;
+        }
+        case Command::UploadData: {
+            if (!isUploading || (payload.size() > uploadSize - upload.size())) {
+                LOGE("Unexpected upload data of %zu bytes", payload.size());
+                isUploading = false;
+                return ErrorCode::InvalidArgument;
+            }
+
+            upload.insert(upload.end(), payload.begin(), payload.end());
+            return ErrorCode::Success;
+        }
+        default: {
+            if (!isUploading || (upload.size() != uploadSize)) {
+                LOGE("Incomplete upload: %zu of %zu bytes", upload.size(), uploadSize);
+                isUploading = false;
+                return ErrorCode::InvalidArgument;
+            }
+            isUploading = false;
+
+            ErrorCode result = ErrorCode::NotImplemented;
+            auto callback = callbacks.find(Command::UploadEnd);
+            if (callback != callbacks.end()) {
+                result = callback->second(upload);
+            }
+
+            // The upload buffer is not kept between the uploads
+            std::vector<uint8_t>().swap(upload);
+            return result;
+        }
+    }
+}
+
+void CdcChannel::sendStatus(Command command, ErrorCode result) {
+    const std::array<uint8_t, 2u> payload = {static_cast<uint8_t>(command), static_cast<uint8_t>(result)};
+    std::array<uint8_t, HEADER_SIZE + payload.size() + CRC_SIZE> frame{};
+    const std::size_t frameSize = buildFrame(frame, Command::Status, payload);
+
+    // The host waits for the status, so unlike the logs it waits for the room in the transmit buffer
+    const TickType_t startTicks = xTaskGetTickCount();
+    while (!usb.cdcWrite(std::span<const uint8_t>(frame.data(), frameSize))) {
+        if (!usb.cdcIsConnected() || ((xTaskGetTickCount() - startTicks) >= pdMS_TO_TICKS(STATUS_TIMEOUT))) {
+            LOGW("Failed to send the CDC status of the command 0x%02x", static_cast<unsigned int>(command));
+            return;
+        }
+        vTaskDelay(1u);
+    }
+    usb.cdcFlush();
+}
+
+void CdcChannel::sendLogs() {
+    RingbufHandle_t buffer = logBuffer.load(std::memory_order_acquire);
+    if (!buffer) {
+        return;
+    }
+
+    for (;;) {
+        if (pendingLog.empty()) {
+            std::size_t itemSize = 0u;
+            auto *item = static_cast<const uint8_t *>(xRingbufferReceive(buffer, &itemSize, 0u));
+            if (!item) {
+                return;
+            }
+            pendingLog.assign(item, item + itemSize);
+            vRingbufferReturnItem(buffer, const_cast<uint8_t *>(item));
+        }
+
+        // The frame stays pending until the host reads enough of the previous data
+        if (!usb.cdcWrite(pendingLog)) {
+            return;
+        }
+        pendingLog.clear();
+    }
+}
+
+std::size_t CdcChannel::buildFrame(std::span<uint8_t> frame, Command command, std::span<const uint8_t> payload) {
+    frame[0u] = FRAME_SYNC;
+    frame[1u] = static_cast<uint8_t>(command);
+    frame[2u] = static_cast<uint8_t>(payload.size());
+    frame[3u] = static_cast<uint8_t>(payload.size() >> 8u);
+    std::copy(payload.begin(), payload.end(), frame.begin() + HEADER_SIZE);
+
+    const uint16_t crc = Utils::crc16(frame.subspan(1u, HEADER_SIZE - 1u + payload.size()));
+    frame[HEADER_SIZE + payload.size()] = static_cast<uint8_t>(crc);
+    frame[HEADER_SIZE + payload.size() + 1u] = static_cast<uint8_t>(crc >> 8u);
+
+    return HEADER_SIZE + payload.size() + CRC_SIZE;
+}
+
+void CdcChannel::logSink(Logger::Level level, std::string_view message) {
+    RingbufHandle_t buffer = logBuffer.load(std::memory_order_acquire);
+    if (!buffer) {
+        return;
+    }
+
+    std::array<uint8_t, MAX_LOG_MESSAGE_SIZE + 1u> payload{};
+    const std::size_t messageSize = std::min(message.size(), MAX_LOG_MESSAGE_SIZE);
+    payload[0u] = static_cast<uint8_t>(level);
+    std::memcpy(&payload[1u], message.data(), messageSize);
+
+    std::array<uint8_t, HEADER_SIZE + payload.size() + CRC_SIZE> frame{};
+    const std::size_t frameSize = buildFrame(frame, Command::Log, std::span<const uint8_t>(payload.data(), messageSize + 1u));
+
+    // Never waits for the room - the message is dropped if the host does not read the logs
+    if (pdTRUE != xRingbufferSend(buffer, frame.data(), frameSize, 0u)) {
+        Metrics::increment(Metrics::Counter::CdcLogsDropped);
+    }
+}
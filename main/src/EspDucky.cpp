@@ -8,17 +8,26 @@
 #include "lwip/err.h"
 #include "lwip/sys.h"
 #include "driver/gpio.h"
+#include "esp_vfs_fat.h"
+#include "esp_timer.h"
 #include <cJSON.h>
 
 #include "EspDucky.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "BootTimeline.hpp"
+#include "PowerManager.hpp"
 #include "StaticWebData.hpp"
+#include "JsonTokenizer.hpp"
 
 #define APP_BUTTON (GPIO_NUM_0) // Use BOOT signal by default
 
 EspDucky::EspDucky() :
-nvConfig(ArmingState::Unarmed, UsbDevice::DeviceClass::Hid), 
-nvScript(std::nullopt),
+nvConfig(ArmingState::Unarmed, UsbDevice::DeviceClass::Hid, KeyboardLayout::Id::Us, NV_SCRIPT_SLOT), 
+nvConfigMutex(),
+nvScript(),
+editorSource(),
+lineCache(),
 ap("esp-ducky", "ducky123"), 
 mdns("esp-ducky"), 
 http(std::unordered_map<std::string, HttpServer::StaticEndpoint>{
@@ -48,40 +57,87 @@ http(std::unordered_map<std::string, HttpServer::StaticEndpoint>{
     },
 },std::unordered_map<std::string, HttpServer::DynamicEndpoint>{
     {"/script", {
-            .callback = [this](httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode) {
+            .callback = [this](httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
                 return handleScriptEndpoint(http, request, response, errCode);
             },
-            .mime = "application/json"
+            .mime = "application/json",
+            .uploadCallback = [this](httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
+                return handleScriptEndpointUpload(http, request, response, errCode);
+            }
         }
     },
+    {"/script/diff", {
+        .callback = [this](httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
+            return handleScriptDiffEndpoint(http, request, response, errCode);
+        },
+        .mime = "application/json"
+    }
+},
     {"/config", {
-        .callback = [this](httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode) {
+        .callback = [this](httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
             return handleConfigEndpoint(http, request, response, errCode);
         },
         .mime = "application/json"
     }
+},
+    {"/boot", {
+        .callback = [this](httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
+            return handleBootEndpoint(http, request, response, errCode);
+        },
+        .mime = "application/json"
+    }
+},
+    {"/metrics", {
+        .callback = [this](httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
+            return handleMetricsEndpoint(http, request, response, errCode);
+        },
+        .mime = "text/plain"
+    }
 }
 }), 
-usb() {}
+usb(),
+cdc(usb, std::unordered_map<CdcChannel::Command, CdcChannel::CommandCallback>{
+    {CdcChannel::Command::UploadEnd, [this](std::span<const uint8_t> data) {
+            return scriptUpload(data);
+        }
+    },
+    {CdcChannel::Command::Run, [this](std::span<const uint8_t>) {
+            return startPayload(false);
+        }
+    },
+    {CdcChannel::Command::Abort, [this](std::span<const uint8_t>) {
+            return scriptAbort();
+        }
+    },
+}),
+storageWlHandle(WL_INVALID_HANDLE),
+scriptStore(SCRIPT_PARTITION_LABEL),
+button(APP_BUTTON),
+isScriptRunning(false) {}
 
 ErrorCode EspDucky::init() {
+    BootTimeline::mark(BootTimeline::Phase::Startup);
     LOGD("EspDucky initialization...");
 
+    if (ErrorCode::Success != PowerManager::init()) {
+        LOGW("Power management is not available. The CPU runs at the default frequency.");
+    }
+    BootTimeline::mark(BootTimeline::Phase::PowerManager);
+
+    // Started before the USB device, so that the logs of the armed payload are streamed as well
+    if (ErrorCode::Success != cdc.start()) {
+        LOGW("CDC channel is not available.");
+    }
+    BootTimeline::mark(BootTimeline::Phase::CdcChannel);
+
     // Initialize BOOT button 
-    const gpio_config_t boot_button_config = {
-        .pin_bit_mask = BIT64(APP_BUTTON),
-        .mode = GPIO_MODE_INPUT,
-        .pull_up_en = (gpio_pullup_t)true,
-        .pull_down_en = (gpio_pulldown_t)false,
-        .intr_type = GPIO_INTR_DISABLE,
-    };
-    esp_err_t ret = gpio_config(&boot_button_config);
-    if (ret) {
-        LOGC("Failed to configure BOOT button with error: %d. Aborting...", ret);
+    if (ErrorCode::Success != button.init()) {
+        LOGC("Failed to initialize BOOT button. Aborting...");
     }
+    BootTimeline::mark(BootTimeline::Phase::Button);
 
     //Initialize NVS
-    ret = nvs_flash_init();
+    esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         LOGW("Erasing NVS flash due to %s", ret == ESP_ERR_NVS_NO_FREE_PAGES ? "lack of free pages" : "new NVS version");
         ret = nvs_flash_erase();
@@ -93,20 +149,49 @@ ErrorCode EspDucky::init() {
     if(ret) {
         LOGC("Failed to initialize NVS flash with error: %d. Aborting...", ret);
     }
+    BootTimeline::mark(BootTimeline::Phase::NvsInit);
 
     // Open NVS handle
     std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READWRITE, &ret);
     if(ESP_OK != ret) {
         LOGC("Failed to open NVS handle with error: (%s). Aborting...", esp_err_to_name(ret));
     }
+    BootTimeline::mark(BootTimeline::Phase::NvsOpen);
+
+    // The stored script is loaded from the script store, the payload ROM slots are still available without it
+    if (ErrorCode::Success != scriptStore.init()) {
+        LOGW("Script store is not available. Scripts cannot be saved.");
+    }
+    BootTimeline::mark(BootTimeline::Phase::ScriptStore);
+
+    // Read and handle the nvConfig from NVS and the nvScript from the script store
+    {
+        // The CDC channel is already started, so an upload may save a script meanwhile
+        std::lock_guard<std::mutex> lock(nvConfigMutex);
+        handleNvConfig(handle.get());
+    }
+    BootTimeline::mark(BootTimeline::Phase::Config);
+    const bool isArmedRun = handleNvScript(handle.get());
 
-    // Read and handle the nvConfig and nvScript from NVS
-    handleNvConfig(handle.get());
-    handleNvScript(handle.get());
+    // JSON of the HTTP requests is allocated in the request arena
+    cJSON_Hooks jsonHooks = {
+        .malloc_fn = RequestArena::jsonAllocate,
+        .free_fn = RequestArena::jsonDeallocate
+    };
+    cJSON_InitHooks(&jsonHooks);
 
     ap.start();
+    BootTimeline::mark(BootTimeline::Phase::AccessPoint);
     mdns.start();
+    BootTimeline::mark(BootTimeline::Phase::Mdns);
     http.start();
+    BootTimeline::mark(BootTimeline::Phase::HttpServer);
+
+    BootTimeline::logSummary();
+    // Otherwise the armed payload closes the timeline after its run, so that its first keystroke is recorded
+    if (!isArmedRun) {
+        BootTimeline::close();
+    }
     
     return ErrorCode::Success;
 }
@@ -116,8 +201,22 @@ void EspDucky::handleNvConfig(nvs::NVSHandle *handle) {
         LOGC("Failed to read the nvConfig - NVS handle is null. Aborting...");
     }
 
-    // Read nvConfig from NVS
-    esp_err_t ret = handle->get_blob(NVS_NV_CONFIG_KEY, &nvConfig, sizeof(nvConfig));
+    // Read nvConfig size from NVS - configs stored by older versions do not contain the newer fields
+    size_t nvConfigSize = 0u;
+    esp_err_t ret = handle->get_item_size(nvs::ItemType::BLOB, NVS_NV_CONFIG_KEY, nvConfigSize);
+    if(ESP_OK == ret)
+    {
+        if(nvConfigSize > sizeof(nvConfig)) {
+            LOGC("Stored nvConfig is larger than expected (%zu > %zu). Aborting...", nvConfigSize, sizeof(nvConfig));
+        }
+        if(nvConfigSize < sizeof(nvConfig)) {
+            LOGW("Stored nvConfig is incomplete. Using default values for the missing fields.");
+        }
+
+        // Read nvConfig from NVS
+        ret = handle->get_blob(NVS_NV_CONFIG_KEY, &nvConfig, nvConfigSize);
+    }
+
     if(ESP_ERR_NVS_NOT_FOUND == ret)
     {
         LOGW("NVS data for nvConfig not found. Using default values.");
@@ -126,92 +225,247 @@ void EspDucky::handleNvConfig(nvs::NVSHandle *handle) {
         LOGC("Failed to retrieve NVS data with error: (%s). Aborting...", esp_err_to_name(ret));
     }
 
+    if(!KeyboardLayout::get(nvConfig.keyboardLayout)) {
+        LOGW("Invalid keyboard layout in nvConfig. Using the US layout.");
+        nvConfig.keyboardLayout = KeyboardLayout::Id::Us;
+    }
+
+    // The slots of the payload ROM depend on the flashed firmware
+    if(nvConfig.payloadSlot > PayloadRom::count()) {
+        LOGW("Payload ROM slot %d is not available in this firmware. Using the script stored in NVS.", nvConfig.payloadSlot - 1);
+        nvConfig.payloadSlot = NV_SCRIPT_SLOT;
+    }
+
+    // The stored class may not be supported by the USB options of this firmware
+    if(!UsbDevice::isSupported(nvConfig.usbDeviceType)) {
+        LOGW("USB device type %d is not supported by this firmware. Using the HID device.", static_cast<int>(nvConfig.usbDeviceType));
+        nvConfig.usbDeviceType = UsbDevice::DeviceClass::Hid;
+    }
+
     // Handle USB device configuration
     ErrorCode res = usb.start(nvConfig.usbDeviceType);
     if(ErrorCode::Success != res) {
         LOGC("Failed to start USB device with error: %d. Aborting...", res);
     }
+
+    // In MSC modes the storage is mounted by the USB device
+    if(UsbDevice::DeviceClass::Msc != nvConfig.usbDeviceType && UsbDevice::DeviceClass::HidMsc != nvConfig.usbDeviceType) {
+        mountStorage();
+    }
 }
 
-void EspDucky::handleNvScript(nvs::NVSHandle *handle) {
-    LOGI("Reading script from NVS...");
-    
-    // Read script size from NVS
-    uint32_t nvScriptSize = 0u;
-    std::unique_ptr<uint8_t[]> nvScriptData{nullptr};
+void EspDucky::mountStorage() {
+    const esp_vfs_fat_mount_config_t mountConfig = {
+        .format_if_mount_failed = false,
+        .max_files = 5,
+        .allocation_unit_size = 0,
+        .disk_status_check_enable = false,
+        .use_one_fat = false
+    };
 
-    esp_err_t ret = handle->get_item(NVS_NV_SCRIPT_SIZE_KEY, nvScriptSize);
-    if(ESP_OK == ret)
-    {
-        // Read script data from NVS
-        nvScriptData = std::make_unique<uint8_t[]>(nvScriptSize);
-        ret = handle->get_blob(NVS_NV_SCRIPT_DATA_KEY, nvScriptData.get(), nvScriptSize);
+    esp_err_t ret = esp_vfs_fat_spiflash_mount_rw_wl(ScriptStream::STORAGE_BASE_PATH, STORAGE_PARTITION_LABEL, &mountConfig, &storageWlHandle);
+    if(ESP_OK != ret) {
+        // Storage is optional - only the script file execution is not possible without it
+        LOGW("Failed to mount storage with error: (%s). Script files will not be available.", esp_err_to_name(ret));
+        storageWlHandle = WL_INVALID_HANDLE;
+        return;
     }
 
-    // Check if script size and data was found in the NVS
-    if(ESP_ERR_NVS_NOT_FOUND == ret) {
-        LOGW("Device is armed but no script was stored in the NVS. The armed state is ignored.");
+    LOGI("Storage mounted at '%s'", ScriptStream::STORAGE_BASE_PATH);
+}
+
+void EspDucky::unmountStorage() {
+    if(WL_INVALID_HANDLE == storageWlHandle) {
+        return;
     }
-    else if(ESP_OK != ret)
-    {
-        LOGC("Failed to retrieve script from NVS with error: (%s). Aborting...", esp_err_to_name(ret));
+
+    esp_err_t ret = esp_vfs_fat_spiflash_unmount_rw_wl(ScriptStream::STORAGE_BASE_PATH, storageWlHandle);
+    if(ESP_OK != ret) {
+        LOGW("Failed to unmount storage with error: (%s)", esp_err_to_name(ret));
     }
-    else {
-        // Parse the script
-        nvScript = Script::deserialize(std::span<const uint8_t>(nvScriptData.get(), nvScriptSize));
-        if (!nvScript) {
-            LOGE("Failed to deserialize script from NVS. The armed state is ignored.");
-            return;
-        }
-        else {
+    storageWlHandle = WL_INVALID_HANDLE;
 
-            if(nvConfig.armingState == ArmingState::Unarmed) {
-                LOGI("Device is unarmed. No script is executed at startup.");
-                return;
-            }
-        
-            if(UsbDevice::DeviceClass::Hid != nvConfig.usbDeviceType && UsbDevice::DeviceClass::HidMsc != nvConfig.usbDeviceType) {
-                LOGW("Device is not in HID mode. Script execution is not possible.");
-                return;
-            }
+    LOGI("Storage unmounted from '%s'", ScriptStream::STORAGE_BASE_PATH);
+}
 
-            // The device is armed, HID is enabled and the script is successfully deserialized
-            if(!waitForUsbMount()) {
-                LOGW("USB device not mounted during startup. The armed state is ignored.");
-                return;
-            }
+ErrorCode EspDucky::switchUsbDevice(UsbDevice::DeviceClass deviceClass) {
+    const UsbDevice::DeviceClass currentClass = usb.getDeviceClass();
+    if(deviceClass == currentClass) {
+        return ErrorCode::Success;
+    }
 
-            LOGD("Running deserialized script from NVS:\n%s", nvScript->toString().c_str());
+    // The flag also keeps the scripts from starting while the device is switched
+    if(isScriptRunning.exchange(true)) {
+        LOGE("USB device cannot be switched while a script is running");
+        return ErrorCode::GeneralError;
+    }
 
-            // Run the script
-            if (ErrorCode::Success != nvScript->run(usb)) {
-                LOGE("Failed to run script from NVS. The armed state is ignored.");
-                return;
-            }
+    const int64_t startTime = esp_timer_get_time();
+    const bool isNextMsc = (UsbDevice::DeviceClass::Msc == deviceClass) || (UsbDevice::DeviceClass::HidMsc == deviceClass);
 
-            LOGI("Script from NVS executed successfully.");
+    // The storage partition can be mounted by one owner only
+    if(isNextMsc) {
+        unmountStorage();
+    }
 
-            // Handle single run armed state
-            if(ArmingState::Persistent == nvConfig.armingState) {
-                LOGI("Device is armed in persistent mode. The armed state is not reset.");
-                return;
-            }
+    ErrorCode res = usb.restart(deviceClass);
+    if(ErrorCode::Success != res) {
+        LOGE("Failed to switch USB device with error: %d", res);
+    }
 
-            // Reset the armed state to unarmed
-            nvConfig.armingState = ArmingState::Unarmed;
-            ret = handle->set_blob(NVS_NV_CONFIG_KEY, &nvConfig, sizeof(nvConfig));
-            if(ESP_OK != ret) {
-                LOGC("Failed to update NVS data with error: (%s). Aborting...", esp_err_to_name(ret));
-            }
+    // In the other modes the storage is accessed by the application, the MSC device has released it when stopped
+    if(!isNextMsc && (WL_INVALID_HANDLE == storageWlHandle)) {
+        mountStorage();
+    }
 
-            ret = handle->commit();
-            if(ESP_OK != ret) {
-                LOGC("Failed to commit NVS data with error: (%s). Aborting...", esp_err_to_name(ret));
-            }
-            
-            LOGI("Device is unarmed after script execution. Config stored in NVS.");
+    isScriptRunning = false;
+
+    if(ErrorCode::Success == res) {
+        LOGI("USB device switched in %lld ms", (esp_timer_get_time() - startTime) / 1000);
+    }
+
+    return res;
+}
+
+ErrorCode EspDucky::storeNvConfig(nvs::NVSHandle &handle, const NvConfig &config) {
+    esp_err_t ret = handle.set_blob(NVS_NV_CONFIG_KEY, &config, sizeof(config));
+    if(ESP_OK != ret) {
+        LOGE("Failed to update NVS data with error: (%s)", esp_err_to_name(ret));
+        return ErrorCode::GeneralError;
+    }
+
+    ret = handle.commit();
+    if(ESP_OK != ret) {
+        LOGE("Failed to commit NVS data with error: (%s)", esp_err_to_name(ret));
+        return ErrorCode::GeneralError;
+    }
+
+    return ErrorCode::Success;
+}
+
+EspDucky::NvConfig EspDucky::getNvConfig() {
+    std::lock_guard<std::mutex> lock(nvConfigMutex);
+    return nvConfig;
+}
+
+bool EspDucky::handleNvScript(nvs::NVSHandle *handle) {
+    std::unique_lock<std::mutex> lock(nvConfigMutex);
+    if(ErrorCode::GeneralError == loadPayload(handle)) {
+        LOGC("Failed to load the payload. Aborting...");
+    }
+    const NvConfig config = nvConfig;
+    lock.unlock();
+    BootTimeline::mark(BootTimeline::Phase::PayloadLoad);
+
+    if(!nvScript.load()) {
+        LOGW("No valid script is available. The armed state is ignored.");
+        return false;
+    }
+
+    if(config.armingState == ArmingState::Unarmed) {
+        LOGI("Device is unarmed. No script is executed at startup.");
+        return false;
+    }
+
+    if(UsbDevice::DeviceClass::Hid != config.usbDeviceType && UsbDevice::DeviceClass::HidMsc != config.usbDeviceType) {
+        LOGW("Device is not in HID mode. Script execution is not possible.");
+        return false;
+    }
+
+    // The device is armed, HID is enabled and the script is loaded
+    if(!waitForUsbMount()) {
+        LOGW("USB device not mounted during startup. The armed state is ignored.");
+        return false;
+    }
+    BootTimeline::mark(BootTimeline::Phase::UsbMount);
+
+    // The script runs in its own task, so that it can be aborted with the button
+    return ErrorCode::Success == startPayload(true);
+}
+
+ErrorCode EspDucky::loadPayload(nvs::NVSHandle *handle) {
+    // The previous script stays published until the new one is complete
+    if(NV_SCRIPT_SLOT != nvConfig.payloadSlot) {
+        // Linked into the flash and validated at build time - neither the NVS read nor the deserialization is needed
+        const std::size_t slotIdx = nvConfig.payloadSlot - 1u;
+        auto script = PayloadRom::load(slotIdx);
+        if(!script) {
+            nvScript.store(std::nullopt);
+            return ErrorCode::InvalidArgument;
         }
+
+        nvScript.store(NvScript{std::move(*script), PayloadRom::get(slotIdx)->reports});
+        LOGI("Using payload ROM slot %zu '%s'", slotIdx, PayloadRom::get(slotIdx)->name);
+        return ErrorCode::Success;
+    }
+
+    LOGI("Reading script from the script store...");
+
+    std::vector<uint8_t> nvScriptData{};
+    ErrorCode err = scriptStore.read(nvScriptData);
+    if((ErrorCode::Success == err) && nvScriptData.empty()) {
+        err = migrateNvScript(handle, nvScriptData);
+    }
+
+    if(ErrorCode::Success != err) {
+        LOGE("Failed to retrieve the stored script");
+        nvScript.store(std::nullopt);
+        return ErrorCode::GeneralError;
+    }
+
+    if(nvScriptData.empty()) {
+        LOGW("No script was stored");
+        nvScript.store(std::nullopt);
+        return ErrorCode::Success;
     }
+
+    // Parse the script
+    auto script = Script::deserialize(nvScriptData);
+    if (!script) {
+        LOGE("Failed to deserialize the stored script");
+        nvScript.store(std::nullopt);
+        return ErrorCode::InvalidArgument;
+    }
+
+    nvScript.store(NvScript{std::move(*script), {}});
+    return ErrorCode::Success;
+}
+
+ErrorCode EspDucky::migrateNvScript(nvs::NVSHandle *handle, std::vector<uint8_t> &data) {
+    uint32_t nvScriptSize = 0u;
+    esp_err_t ret = handle->get_item(NVS_NV_SCRIPT_SIZE_KEY, nvScriptSize);
+    if(ESP_OK == ret)
+    {
+        data.resize(nvScriptSize);
+        ret = handle->get_blob(NVS_NV_SCRIPT_DATA_KEY, data.data(), data.size());
+    }
+
+    if(ESP_ERR_NVS_NOT_FOUND == ret) {
+        data.clear();
+        return ErrorCode::Success;
+    }
+    else if(ESP_OK != ret)
+    {
+        LOGE("Failed to retrieve script from NVS with error: (%s)", esp_err_to_name(ret));
+        data.clear();
+        return ErrorCode::GeneralError;
+    }
+
+    // The NVS items are only erased once the script store holds the script
+    if(ErrorCode::Success != scriptStore.write(data)) {
+        LOGW("Failed to move the script from NVS to the script store. It stays in NVS.");
+        return ErrorCode::Success;
+    }
+
+    (void)handle->erase_item(NVS_NV_SCRIPT_SIZE_KEY);
+    (void)handle->erase_item(NVS_NV_SCRIPT_DATA_KEY);
+    ret = handle->commit();
+    if(ESP_OK != ret) {
+        LOGW("Failed to commit NVS data with error: (%s)", esp_err_to_name(ret));
+    }
+
+    LOGI("Script moved from NVS to the script store");
+    return ErrorCode::Success;
 }
 
 bool EspDucky::waitForUsbMount(uint32_t timeoutMs) {
@@ -220,8 +474,8 @@ bool EspDucky::waitForUsbMount(uint32_t timeoutMs) {
     LOGI("Waiting for USB device to mount... (%d ms)", timeoutMs);
 
     while(!usb.isMounted() && (elapsedTime < timeoutMs)) {
-        Utils::delay(100u);
-        elapsedTime += 100u;
+        Utils::delay(USB_MOUNT_POLL_PERIOD);
+        elapsedTime += USB_MOUNT_POLL_PERIOD;
     }
 
     if(!usb.isMounted()) {
@@ -235,32 +489,120 @@ bool EspDucky::waitForUsbMount(uint32_t timeoutMs) {
 }
 
 void EspDucky::run() {
-    uint8_t usbDeviceDisableCountdown = 3;
-
-    // Infinite loop to keep the task running
+    // Block until the button is used
     for (;;) {
-        if(usb.isStarted()) {
-            if(!gpio_get_level(APP_BUTTON)){
-                if(usbDeviceDisableCountdown == 0) {
-                    LOGI("Disabling USB Device");
-                    usb.stop();
-                    LOGI("Enabling serial JTAG");
-                    usb.enableJTAG();
-                }
-                else{
-                    LOGI("USB will be disabled in %d seconds", usbDeviceDisableCountdown);
-                    usbDeviceDisableCountdown--;
-                }
-            } 
-            else {
-                usbDeviceDisableCountdown = 3;
-            }
+        Button::Event event{};
+        if (!button.waitForEvent(event) || (Button::Event::Pressed != event)) {
+            continue;
         }
-        Utils::delay(1000);
+
+        if (isScriptRunning) {
+            // Stop the script on press, without waiting for the release
+            (void)scriptAbort();
+            continue;
+        }
+
+        // The press is long if the button is still held after the time
+        const bool isReleased = button.waitForEvent(event, pdMS_TO_TICKS(LONG_PRESS_TIME)) || !button.isPressed();
+        if (isReleased) {
+            LOGI("Button pressed - running the stored script");
+            (void)startPayload(false);
+        }
+        else if (usb.isStarted()) {
+            LOGI("Disabling USB Device and enabling serial JTAG");
+            (void)switchUsbDevice(UsbDevice::DeviceClass::SerialJtag);
+        }
+    }
+}
+
+ErrorCode EspDucky::startPayload(bool isArmedRun) {
+    if (!nvScript.load()) {
+        LOGW("No script stored in the device");
+        return ErrorCode::InvalidArgument;
+    }
+    // Claimed before the task is created, the task releases it at the end of the run
+    if (isScriptRunning.exchange(true)) {
+        LOGW("Another script is already running");
+        return ErrorCode::GeneralError;
+    }
+
+    auto *taskArgs = new PayloadTaskArgs{this, isArmedRun};
+    if (pdPASS != xTaskCreate(payloadTask, "payload", PAYLOAD_TASK_STACK_SIZE, taskArgs, PAYLOAD_TASK_PRIORITY, nullptr)) {
+        LOGE("Failed to create the payload task");
+        delete taskArgs;
+        isScriptRunning = false;
+        return ErrorCode::GeneralError;
+    }
+
+    return ErrorCode::Success;
+}
+
+void EspDucky::payloadTask(void *arg) {
+    std::unique_ptr<PayloadTaskArgs> taskArgs(static_cast<PayloadTaskArgs *>(arg));
+    taskArgs->espDucky->runPayload(taskArgs->isArmedRun);
+    taskArgs.reset();
+    vTaskDelete(nullptr);
+}
+
+void EspDucky::runPayload(bool isArmedRun) {
+    // The stored script may be replaced through the API while this snapshot is running
+    const auto snapshot = nvScript.load();
+    if (!snapshot) {
+        LOGW("No script stored in the device");
+        isScriptRunning = false;
+        if (isArmedRun) {
+            BootTimeline::close();
+        }
+        return;
+    }
+
+    LOGD("Running script from NVS:\n%s", snapshot->script.toString().c_str());
+
+    PowerManager::Scope cpuFreqLock(PowerManager::Lock::CpuFreqMax);
+
+    const ErrorCode err = scriptPlay(snapshot->script, snapshot->reports);
+    isScriptRunning = false;
+    // The run of the armed payload is the end of the startup
+    if (isArmedRun) {
+        BootTimeline::close();
+    }
+
+    if (ErrorCode::Success != err) {
+        LOGE("Failed to run script from NVS.%s", isArmedRun ? " The armed state is ignored." : "");
+        return;
+    }
+
+    LOGI("Script from NVS executed successfully.");
+
+    if(!isArmedRun) {
+        return;
+    }
+
+    // Handle single run armed state
+    std::lock_guard<std::mutex> lock(nvConfigMutex);
+    if(ArmingState::SingleRun != nvConfig.armingState) {
+        return;
+    }
+
+    // Reset the armed state to unarmed
+    esp_err_t ret = 0;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READWRITE, &ret);
+    if(ESP_OK != ret) {
+        LOGE("Failed to open NVS handle with error: (%s)", esp_err_to_name(ret));
+        return;
+    }
+
+    NvConfig config = nvConfig;
+    config.armingState = ArmingState::Unarmed;
+    if(ErrorCode::Success != storeNvConfig(*handle, config)) {
+        LOGC("Failed to store the unarmed state. Aborting...");
     }
+    nvConfig = config;
+
+    LOGI("Device is unarmed after script execution. Config stored in NVS.");
 }
 
-ErrorCode EspDucky::handleScriptEndpoint(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode) {
+ErrorCode EspDucky::handleScriptEndpoint(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
     switch(http.method) {
         case HTTP_GET: {
             return handleScriptEndpointGet(http, request, response, errCode);
@@ -278,7 +620,7 @@ ErrorCode EspDucky::handleScriptEndpoint(httpd_req_t &http, const std::string &r
     return ErrorCode::InvalidArgument;
 }
 
-ErrorCode EspDucky::handleScriptEndpointGet(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode) {
+ErrorCode EspDucky::handleScriptEndpointGet(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
     cJSON *respJson = cJSON_CreateObject();
     if (!respJson) {
         LOGE("Failed to create JSON response object");
@@ -288,7 +630,8 @@ ErrorCode EspDucky::handleScriptEndpointGet(httpd_req_t &http, const std::string
     }
 
     // Ignore return value - the functions return pointer to the root object
-    (void)cJSON_AddStringToObject(respJson, "script", nvScript ? nvScript->toString().c_str() : "REM No script stored in the device\nREM Write your script here and press Run or Save button\n");
+    const auto snapshot = nvScript.load();
+    (void)cJSON_AddStringToObject(respJson, "script", snapshot ? snapshot->script.toString().c_str() : "REM No script stored in the device\nREM Write your script here and press Run or Save button\n");
 
     char *respJsonStr = cJSON_PrintUnformatted(respJson);
     if( !respJsonStr) {
@@ -301,47 +644,175 @@ ErrorCode EspDucky::handleScriptEndpointGet(httpd_req_t &http, const std::string
 
     response = respJsonStr;
 
-    std::free(respJsonStr); // Free the JSON string
+    cJSON_free(respJsonStr); // Free the JSON string
     cJSON_Delete(respJson); // Free the response json object
 
     return ErrorCode::Success;
 }
 
-ErrorCode EspDucky::handleScriptEndpointPost(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode) {
-    cJSON *reqJson = cJSON_Parse(request.c_str());
-    if (!reqJson) {
-        LOGE("Failed to parse JSON: %s", cJSON_GetErrorPtr());
+ErrorCode EspDucky::handleScriptEndpointPost(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
+    // Parsing and running the scripts uses the full CPU performance
+    PowerManager::Scope cpuFreqLock(PowerManager::Lock::CpuFreqMax);
+
+    // The script is unescaped in the request buffer, so the request is not copied
+    JsonTokenizer reqJson(request);
+    if (ErrorCode::Success != reqJson.parse()) {
+        LOGE("Failed to parse JSON at offset %zu", reqJson.getErrorOffset());
         errCode = HTTPD_400_BAD_REQUEST;
         response = "Invalid JSON format";
         return ErrorCode::InvalidArgument;
     }
 
-    cJSON *scriptJson = cJSON_GetObjectItemCaseSensitive(reqJson, "script");
-    if (!cJSON_IsString(scriptJson) || (scriptJson->valuestring == NULL)) {
-        LOGE("Invalid JSON format: 'script' is not a string");
-        cJSON_Delete(reqJson);
+    auto actionJson = reqJson.getInt("action");
+    if (!actionJson) {
+        LOGE("Invalid JSON format: 'action' is not a number");
         errCode = HTTPD_400_BAD_REQUEST;
-        response = "Invalid JSON format: 'script' is not a string";
+        response = "Invalid JSON format: 'action' is not a number";
         return ErrorCode::InvalidArgument;
     }
 
-    cJSON *actionJson = cJSON_GetObjectItemCaseSensitive(reqJson, "action");
-    if (!cJSON_IsNumber(actionJson)) {
-        LOGE("Invalid JSON format: 'action' is not a number");
-        cJSON_Delete(reqJson);
+    LOGD("Request action: '%d'", static_cast<int>(*actionJson));
+
+    ScriptEndpointAction action = static_cast<ScriptEndpointAction>(*actionJson);
+
+    if (ScriptEndpointAction::RunFile == action) {
+        auto pathJson = reqJson.getString("path");
+        if (!pathJson) {
+            LOGE("Invalid JSON format: 'path' is not a string");
+            errCode = HTTPD_400_BAD_REQUEST;
+            response = "Invalid JSON format: 'path' is not a string";
+            return ErrorCode::InvalidArgument;
+        }
+
+        // The unescaped strings are null-terminated
+        LOGD("Request path: '%s'", pathJson->data());
+
+        std::string path{*pathJson};
+
+        if (!ScriptStream::isValidPath(path)) {
+            LOGE("Invalid script file path: '%s'", path.c_str());
+            errCode = HTTPD_400_BAD_REQUEST;
+            response = "Invalid script file path";
+            return ErrorCode::InvalidArgument;
+        }
+
+        if (scriptRunFile(path) != ErrorCode::Success) {
+            LOGE("Failed to run script file");
+            errCode = HTTPD_500_INTERNAL_SERVER_ERROR;
+            response = "Failed to run script file";
+            return ErrorCode::GeneralError;
+        }
+    }
+    else {
+        auto scriptJson = reqJson.getString("script");
+        if (!scriptJson) {
+            LOGE("Invalid JSON format: 'script' is not a string");
+            errCode = HTTPD_400_BAD_REQUEST;
+            response = "Invalid JSON format: 'script' is not a string";
+            return ErrorCode::InvalidArgument;
+        }
+
+        LOGD("Request script: '%s'", scriptJson->data());
+
+        // Kept as the base of the following diffs from the editor
+        std::string source{*scriptJson};
+        source += '\n';
+        return handleScriptSource(std::move(source), action, response, errCode);
+    }
+
+    return scriptRespond(std::nullopt, response, errCode);
+}
+
+ErrorCode EspDucky::handleScriptDiffEndpoint(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
+    if (HTTP_POST != http.method) {
+        LOGE("Unsupported HTTP method: %d", http.method);
+        errCode = HTTPD_405_METHOD_NOT_ALLOWED;
+        response = "Method not allowed";
+        return ErrorCode::InvalidArgument;
+    }
+
+    PowerManager::Scope cpuFreqLock(PowerManager::Lock::CpuFreqMax);
+
+    JsonTokenizer reqJson(request);
+    if (ErrorCode::Success != reqJson.parse()) {
+        LOGE("Failed to parse JSON at offset %zu", reqJson.getErrorOffset());
         errCode = HTTPD_400_BAD_REQUEST;
-        response = "Invalid JSON format: 'action' is not a number";
+        response = "Invalid JSON format";
+        return ErrorCode::InvalidArgument;
+    }
+
+    auto actionJson = reqJson.getInt("action");
+    auto startJson = reqJson.getInt("start");
+    auto removeJson = reqJson.getInt("remove");
+    auto insertJson = reqJson.getString("insert");
+    auto hashJson = reqJson.getInt("hash");
+    if (!actionJson || !startJson || !removeJson || !insertJson || !hashJson || (*startJson < 0) || (*removeJson < 0) ||
+        (!insertJson->empty() && ('\n' != insertJson->back()))) {
+        LOGE("Invalid JSON format of the script diff");
+        errCode = HTTPD_400_BAD_REQUEST;
+        response = "Invalid JSON format of the script diff";
+        return ErrorCode::InvalidArgument;
+    }
+
+    const ScriptEndpointAction action = static_cast<ScriptEndpointAction>(*actionJson);
+    if (ScriptEndpointAction::RunFile == action) {
+        LOGE("Script file can not be run by the diff");
+        errCode = HTTPD_400_BAD_REQUEST;
+        response = "Invalid action";
+        return ErrorCode::InvalidArgument;
+    }
+
+    // Offset of the first byte of the line, every line of the source is terminated
+    auto findLine = [this](std::size_t lineIdx) -> std::optional<std::size_t> {
+        std::size_t offset = 0u;
+        for (; lineIdx > 0u; --lineIdx) {
+            const std::size_t lineEnd = editorSource.find('\n', offset);
+            if (std::string::npos == lineEnd) {
+                return std::nullopt;
+            }
+            offset = lineEnd + 1u;
+        }
+        return offset;
+    };
+
+    const auto startOffset = findLine(static_cast<std::size_t>(*startJson));
+    const auto endOffset = startOffset ? findLine(static_cast<std::size_t>(*startJson) + static_cast<std::size_t>(*removeJson)) :
+        std::nullopt;
+    if (!startOffset || !endOffset) {
+        // The device was restarted or the script was changed by another client, the editor sends the whole script
+        LOGW("Script diff does not match the last script of the editor");
+        errCode = HTTPD_404_NOT_FOUND;
+        response = "Base of the script diff not found";
         return ErrorCode::InvalidArgument;
     }
 
-    LOGD("Request script: '%s'", scriptJson->valuestring);
-    LOGD("Request action: '%d'", actionJson->valueint);
+    std::string source{};
+    source.reserve(*startOffset + insertJson->size() + (editorSource.size() - *endOffset));
+    source.append(editorSource, 0u, *startOffset);
+    source.append(*insertJson);
+    source.append(editorSource, *endOffset);
+
+    // The hash of the edited script without the terminating newline of the last line
+    const uint32_t hash = source.empty() ? 0u : Utils::fnv1a32({reinterpret_cast<const uint8_t *>(source.data()), source.size() - 1u});
+    if (source.empty() || (static_cast<uint32_t>(*hashJson) != hash)) {
+        LOGW("Hash of the patched script %08lx does not match the editor", static_cast<unsigned long>(hash));
+        errCode = HTTPD_404_NOT_FOUND;
+        response = "Base of the script diff not found";
+        return ErrorCode::InvalidArgument;
+    }
+
+    LOGD("Script diff: %d lines replaced by %zu bytes at line %d", static_cast<int>(*removeJson), insertJson->size(),
+        static_cast<int>(*startJson));
 
-    ScriptEndpointAction action = static_cast<ScriptEndpointAction>(actionJson->valueint);
+    return handleScriptSource(std::move(source), action, response, errCode);
+}
 
-    auto script = Script::parse(scriptJson->valuestring);
+ErrorCode EspDucky::handleScriptSource(std::string &&source, ScriptEndpointAction action, std::pmr::string &response,
+    httpd_err_code_t &errCode) {
+    // Result of the compile action, reported in the response
+    std::optional<Script::Estimate> estimate{};
 
-    cJSON_Delete(reqJson); // Free the request json object
+    auto script = Script::parse(source, getNvConfig().keyboardLayout, RequestArena::getResource(), &lineCache);
 
     if (!script) {
         LOGE("Failed to parse script");
@@ -371,13 +842,29 @@ ErrorCode EspDucky::handleScriptEndpointPost(httpd_req_t &http, const std::strin
             }
             break;
         }
+        case ScriptEndpointAction::Compile: {
+            // Only report the properties of the script - it is neither run nor saved
+            Script::Estimate scriptEstimate{};
+            if (script->estimate(scriptEstimate) != ErrorCode::Success) {
+                LOGE("Script failed during the dry run");
+                errCode = HTTPD_400_BAD_REQUEST;
+                response = "Script fails during execution";
+                return ErrorCode::InvalidArgument;
+            }
+            estimate = scriptEstimate;
+            break;
+        }
         default: {
             LOGE("Invalid action: %d", action);
             return ErrorCode::InvalidArgument;
         }
     }
 
+    editorSource = std::move(source);
+    return scriptRespond(estimate, response, errCode);
+}
 
+ErrorCode EspDucky::scriptRespond(const std::optional<Script::Estimate> &estimate, std::pmr::string &response, httpd_err_code_t &errCode) {
     // Prepare response
     cJSON *respJson = cJSON_CreateObject();
     if (!respJson) {
@@ -389,6 +876,14 @@ ErrorCode EspDucky::handleScriptEndpointPost(httpd_req_t &http, const std::strin
 
     cJSON_AddStringToObject(respJson, "status", "success");
 
+    if (estimate) {
+        (void)cJSON_AddNumberToObject(respJson, "size", static_cast<double>(estimate->codeSize));
+        (void)cJSON_AddNumberToObject(respJson, "commands", static_cast<double>(estimate->commandCount));
+        (void)cJSON_AddNumberToObject(respJson, "keystrokes", static_cast<double>(estimate->keystrokeCount));
+        (void)cJSON_AddNumberToObject(respJson, "duration", static_cast<double>(estimate->duration));
+        (void)cJSON_AddBoolToObject(respJson, "durationBounded", estimate->isBounded);
+    }
+
     char *respJsonStr = cJSON_PrintUnformatted(respJson);
     if (!respJsonStr) {
         LOGE("Failed to create JSON string from response object");
@@ -400,28 +895,126 @@ ErrorCode EspDucky::handleScriptEndpointPost(httpd_req_t &http, const std::strin
 
     response = respJsonStr;
 
-    std::free(respJsonStr); // Free the JSON string
+    cJSON_free(respJsonStr); // Free the JSON string
     cJSON_Delete(respJson); // Free the response json object
 
     return ErrorCode::Success;    
 }
 
-ErrorCode EspDucky::scriptRun(Script &script) {
-    if(usb.isMounted()) {
-        LOGD("Starting script execution...");
+ErrorCode EspDucky::handleScriptEndpointUpload(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
+    ErrorCode err = scriptUpload(std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(request.data()), request.size()));
+    if (ErrorCode::InvalidArgument == err) {
+        errCode = HTTPD_400_BAD_REQUEST;
+        response = "Invalid script data";
+        return err;
+    }
+
+    if (ErrorCode::Success != err) {
+        errCode = HTTPD_500_INTERNAL_SERVER_ERROR;
+        response = "Failed to save script";
+        return ErrorCode::GeneralError;
+    }
 
-        if (script.run(usb) != ErrorCode::Success) {
-            LOGE("Failed to run script");
-            return ErrorCode::GeneralError;
-        }
+    response = "{\"status\":\"success\"}";
 
-        LOGI("Script executed successfully");
+    return ErrorCode::Success;
+}
+
+ErrorCode EspDucky::scriptUpload(std::span<const uint8_t> data) {
+    // The script is compiled by the host - it is only validated before it is stored
+    auto script = Script::deserialize(data);
+    if (!script) {
+        LOGE("Failed to deserialize uploaded script");
+        return ErrorCode::InvalidArgument;
     }
-    else
-    {
+
+    LOGD("Script upload successful:\n%s", script->toString().c_str());
+
+    if (scriptSave(*script) != ErrorCode::Success) {
+        LOGE("Failed to save script");
+        return ErrorCode::GeneralError;
+    }
+
+    return ErrorCode::Success;
+}
+
+ErrorCode EspDucky::scriptAbort() {
+    if (!isScriptRunning) {
+        LOGW("No script is running");
+        return ErrorCode::InvalidArgument;
+    }
+
+    LOGI("Aborting the running script");
+    usb.hidAbort();
+    return ErrorCode::Success;
+}
+
+ErrorCode EspDucky::scriptRun(const Script &script, std::span<const uint8_t> reports) {
+    if (isScriptRunning.exchange(true)) {
+        LOGE("Another script is already running");
+        return ErrorCode::GeneralError;
+    }
+
+    const ErrorCode err = scriptPlay(script, reports);
+    isScriptRunning = false;
+
+    return err;
+}
+
+ErrorCode EspDucky::scriptPlay(const Script &script, std::span<const uint8_t> reports) {
+    if(!usb.isMounted()) {
         LOGW("USB device not mounted. Skipping script execution.");
+        return ErrorCode::Success;
+    }
+
+    LOGD("Starting script execution...");
+    Metrics::increment(Metrics::Counter::ScriptRuns);
+
+    // Abort requests received before the start are not related to this script
+    usb.hidClearAbort();
+    ErrorCode err = reports.empty() ? script.run(usb) : ReportStream::play(usb, reports);
+    if (err != ErrorCode::Success) {
+        LOGE("Failed to run script");
+        return err;
     }
 
+    LOGI("Script executed successfully");
+
+    return ErrorCode::Success;
+}
+
+ErrorCode EspDucky::scriptRunFile(const std::string &relativePath) {
+    if(!usb.isMounted()) {
+        LOGW("USB device not mounted. Skipping script file execution.");
+        return ErrorCode::Success;
+    }
+
+    if((UsbDevice::DeviceClass::HidMsc == usb.getDeviceClass()) && tinyusb_msc_storage_in_use_by_usb_host()) {
+        LOGE("Storage is exposed to the USB host and cannot be accessed by the device");
+        return ErrorCode::GeneralError;
+    }
+
+    if (isScriptRunning.exchange(true)) {
+        LOGE("Another script is already running");
+        return ErrorCode::GeneralError;
+    }
+
+    LOGD("Starting script file execution...");
+    Metrics::increment(Metrics::Counter::ScriptRuns);
+
+    // The stream holds its read buffers, so keep it off the task stack
+    auto stream = std::make_unique<ScriptStream>(relativePath, getNvConfig().keyboardLayout);
+    usb.hidClearAbort();
+    ErrorCode err = stream->run(usb);
+    isScriptRunning = false;
+
+    if (err != ErrorCode::Success) {
+        LOGE("Failed to run script file");
+        return err;
+    }
+
+    LOGI("Script file executed successfully");
+
     return ErrorCode::Success;
 }
 
@@ -432,44 +1025,117 @@ ErrorCode EspDucky::scriptSave(Script &script) {
         return ErrorCode::GeneralError;
     }
 
-    // Open NVS handle
-    esp_err_t ret = 0;
-    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READWRITE, &ret);
-    if(ESP_OK != ret) {
-        LOGE("Failed to open NVS handle with error: (%s)", esp_err_to_name(ret));
+    // The previous script stays in the other slot until the new one is complete
+    if (scriptStore.write(serializedScript) != ErrorCode::Success) {
+        LOGE("Failed to write the script to the script store");
         return ErrorCode::GeneralError;
     }
-    
-    // Write script size to NVS
-    uint32_t scriptSize = static_cast<uint32_t>(serializedScript.size());
-    ret = handle->set_item(NVS_NV_SCRIPT_SIZE_KEY, scriptSize);
-    if(ESP_OK != ret) {
-        LOGE("Failed to update nvScriptSize with error: (%s)", esp_err_to_name(ret));
+
+    // The saved script replaces the selected payload ROM slot
+    std::lock_guard<std::mutex> lock(nvConfigMutex);
+    if(NV_SCRIPT_SLOT != nvConfig.payloadSlot) {
+        // Open NVS handle
+        esp_err_t ret = 0;
+        std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READWRITE, &ret);
+        if(ESP_OK != ret) {
+            LOGE("Failed to open NVS handle with error: (%s)", esp_err_to_name(ret));
+            return ErrorCode::GeneralError;
+        }
+
+        NvConfig config = nvConfig;
+        config.payloadSlot = NV_SCRIPT_SLOT;
+        if(ErrorCode::Success != storeNvConfig(*handle, config)) {
+            return ErrorCode::GeneralError;
+        }
+        nvConfig = config;
+    }
+
+    // Published only after the header of the slot is written, the running payload keeps the previous snapshot
+    nvScript.store(NvScript{std::move(script), {}});
+
+    LOGI("New script successfully stored in the script store");
+
+    return ErrorCode::Success;
+}
+
+ErrorCode EspDucky::handleMetricsEndpoint(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
+    if (HTTP_GET != http.method) {
+        LOGE("Unsupported HTTP method: %d", http.method);
+        errCode = HTTPD_405_METHOD_NOT_ALLOWED;
+        response = "Method not allowed";
+        return ErrorCode::InvalidArgument;
+    }
+
+    if (Metrics::print(response) != ErrorCode::Success) {
+        LOGE("Failed to collect the metrics");
+        errCode = HTTPD_500_INTERNAL_SERVER_ERROR;
+        response = "Internal server error";
         return ErrorCode::GeneralError;
     }
 
-    // Write script data to NVS
-    ret = handle->set_blob(NVS_NV_SCRIPT_DATA_KEY, serializedScript.data(), scriptSize);
-    if(ESP_OK != ret) {
-        LOGE("Failed to update nvScriptData with error: (%s)", esp_err_to_name(ret));
+    return ErrorCode::Success;
+}
+
+ErrorCode EspDucky::handleBootEndpoint(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
+    if (HTTP_GET != http.method) {
+        LOGE("Unsupported HTTP method: %d", http.method);
+        errCode = HTTPD_405_METHOD_NOT_ALLOWED;
+        response = "Method not allowed";
+        return ErrorCode::InvalidArgument;
+    }
+
+    cJSON *respJson = cJSON_CreateObject();
+    cJSON *phasesJson = cJSON_AddArrayToObject(respJson, "phases");
+    cJSON *eventsJson = cJSON_AddArrayToObject(respJson, "events");
+    if (!respJson || !phasesJson || !eventsJson) {
+        LOGE("Failed to create JSON response object");
+        cJSON_Delete(respJson);
+        errCode = HTTPD_500_INTERNAL_SERVER_ERROR;
+        response = "Internal server error";
         return ErrorCode::GeneralError;
     }
 
-    ret = handle->commit();
-    if(ESP_OK != ret) {
-        LOGE("Failed to commit NVS data with error: (%s)", esp_err_to_name(ret));
+    // The phases which were not reached, e.g. the USB mount of the unarmed device, are not reported
+    for (std::size_t phaseIdx = 0u; phaseIdx < static_cast<std::size_t>(BootTimeline::Phase::PhaseNum); ++phaseIdx) {
+        const auto entry = BootTimeline::get(static_cast<BootTimeline::Phase>(phaseIdx));
+        cJSON *entryJson = entry ? cJSON_CreateObject() : nullptr;
+        if (!entryJson) {
+            continue;
+        }
+        (void)cJSON_AddStringToObject(entryJson, "name", entry->name);
+        (void)cJSON_AddNumberToObject(entryJson, "end", static_cast<double>(entry->end));
+        (void)cJSON_AddNumberToObject(entryJson, "duration", static_cast<double>(entry->duration));
+        (void)cJSON_AddItemToArray(phasesJson, entryJson);
+    }
+    for (std::size_t eventIdx = 0u; eventIdx < static_cast<std::size_t>(BootTimeline::Event::EventNum); ++eventIdx) {
+        const auto entry = BootTimeline::get(static_cast<BootTimeline::Event>(eventIdx));
+        cJSON *entryJson = entry ? cJSON_CreateObject() : nullptr;
+        if (!entryJson) {
+            continue;
+        }
+        (void)cJSON_AddStringToObject(entryJson, "name", entry->name);
+        (void)cJSON_AddNumberToObject(entryJson, "time", static_cast<double>(entry->end));
+        (void)cJSON_AddItemToArray(eventsJson, entryJson);
+    }
+
+    char *respJsonStr = cJSON_PrintUnformatted(respJson);
+    if (!respJsonStr) {
+        LOGE("Failed to create JSON string from response object");
+        cJSON_Delete(respJson); // Free the response json object
+        errCode = HTTPD_500_INTERNAL_SERVER_ERROR;
+        response = "Internal server error";
         return ErrorCode::GeneralError;
     }
 
-    // Store the script in nvScript variable
-    nvScript = std::move(script); 
+    response = respJsonStr;
 
-    LOGI("New script successfully stored in NVS");
+    cJSON_free(respJsonStr); // Free the JSON string
+    cJSON_Delete(respJson); // Free the response json object
 
     return ErrorCode::Success;
 }
 
-ErrorCode EspDucky::handleConfigEndpoint(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode) {
+ErrorCode EspDucky::handleConfigEndpoint(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
     switch(http.method) {
         case HTTP_GET: {
             return handleConfigEndpointGet(http, request, response, errCode);
@@ -487,7 +1153,7 @@ ErrorCode EspDucky::handleConfigEndpoint(httpd_req_t &http, const std::string &r
     return ErrorCode::InvalidArgument;
 }
 
-ErrorCode EspDucky::handleConfigEndpointGet(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode) {
+ErrorCode EspDucky::handleConfigEndpointGet(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
     cJSON *respJson = cJSON_CreateObject();
     if (!respJson) {
         LOGE("Failed to create JSON response object");
@@ -497,8 +1163,17 @@ ErrorCode EspDucky::handleConfigEndpointGet(httpd_req_t &http, const std::string
     }
 
     // Ignore return value - the functions return pointer to the root object
-    (void)cJSON_AddNumberToObject(respJson, "armingState", static_cast<int>(nvConfig.armingState));
-    (void)cJSON_AddNumberToObject(respJson, "usbDeviceType", static_cast<int>(nvConfig.usbDeviceType));
+    const NvConfig config = getNvConfig();
+    (void)cJSON_AddNumberToObject(respJson, "armingState", static_cast<int>(config.armingState));
+    (void)cJSON_AddNumberToObject(respJson, "usbDeviceType", static_cast<int>(config.usbDeviceType));
+    (void)cJSON_AddNumberToObject(respJson, "keyboardLayout", static_cast<int>(config.keyboardLayout));
+    (void)cJSON_AddNumberToObject(respJson, "payloadSlot", config.payloadSlot);
+
+    // Names of the payload ROM slots, the first one is selected with the payloadSlot of 1
+    cJSON *payloadRomJson = cJSON_AddArrayToObject(respJson, "payloadRom");
+    for (std::size_t slotIdx = 0u; payloadRomJson && (slotIdx < PayloadRom::count()); slotIdx++) {
+        (void)cJSON_AddItemToArray(payloadRomJson, cJSON_CreateString(PayloadRom::get(slotIdx)->name));
+    }
 
     char *respJsonStr = cJSON_PrintUnformatted(respJson);
     if( !respJsonStr) {
@@ -511,46 +1186,84 @@ ErrorCode EspDucky::handleConfigEndpointGet(httpd_req_t &http, const std::string
 
     response = respJsonStr;
 
-    std::free(respJsonStr); // Free the JSON string
+    cJSON_free(respJsonStr); // Free the JSON string
     cJSON_Delete(respJson); // Free the response json object
 
     return ErrorCode::Success;
 }
 
-ErrorCode EspDucky::handleConfigEndpointPost(httpd_req_t &http, const std::string &request, std::string &response, httpd_err_code_t &errCode) {
-    cJSON *reqJson = cJSON_Parse(request.c_str());
-    if (!reqJson) {
-        LOGE("Failed to parse JSON: %s", cJSON_GetErrorPtr());
+ErrorCode EspDucky::handleConfigEndpointPost(httpd_req_t &http, std::span<char> request, std::pmr::string &response, httpd_err_code_t &errCode) {
+    JsonTokenizer reqJson(request);
+    if (ErrorCode::Success != reqJson.parse()) {
+        LOGE("Failed to parse JSON at offset %zu", reqJson.getErrorOffset());
         errCode = HTTPD_400_BAD_REQUEST;
         response = "Invalid JSON format";
         return ErrorCode::InvalidArgument;
     }
 
-    cJSON *armingStateJson = cJSON_GetObjectItemCaseSensitive(reqJson, "armingState");
-    if (!cJSON_IsNumber(armingStateJson)) {
+    auto armingStateJson = reqJson.getInt("armingState");
+    if (!armingStateJson) {
         LOGE("Invalid JSON format: 'armingState' is not a number");
-        cJSON_Delete(reqJson);
         errCode = HTTPD_400_BAD_REQUEST;
         response = "Invalid JSON format: 'armingState' is not a number";
         return ErrorCode::InvalidArgument;
     }
 
-    cJSON *usbDeviceTypeJson = cJSON_GetObjectItemCaseSensitive(reqJson, "usbDeviceType");
-    if (!cJSON_IsNumber(usbDeviceTypeJson)) {
+    auto usbDeviceTypeJson = reqJson.getInt("usbDeviceType");
+    if (!usbDeviceTypeJson) {
         LOGE("Invalid JSON format: 'usbDeviceType' is not a number");
-        cJSON_Delete(reqJson);
         errCode = HTTPD_400_BAD_REQUEST;
         response = "Invalid JSON format: 'usbDeviceType' is not a number";
         return ErrorCode::InvalidArgument;
     }
 
-    LOGD("Request armingState: '%d'", armingStateJson->valueint);
-    LOGD("Request usbDeviceType: '%d'", usbDeviceTypeJson->valueint);
+    // The device is switched to the new class immediately, so reject the unknown classes before storing them
+    if ((*usbDeviceTypeJson < static_cast<int>(UsbDevice::DeviceClass::SerialJtag)) ||
+        (*usbDeviceTypeJson > static_cast<int>(UsbDevice::DeviceClass::HidMsc)) ||
+        !UsbDevice::isSupported(static_cast<UsbDevice::DeviceClass>(*usbDeviceTypeJson))) {
+        LOGE("Invalid JSON format: 'usbDeviceType' is not a valid device type");
+        errCode = HTTPD_400_BAD_REQUEST;
+        response = "Invalid JSON format: 'usbDeviceType' is not a valid device type";
+        return ErrorCode::InvalidArgument;
+    }
+
+    // Keyboard layout is optional to keep compatibility with the older clients
+    auto keyboardLayoutJson = reqJson.getInt("keyboardLayout");
+    if (reqJson.contains("keyboardLayout") && (!keyboardLayoutJson || (*keyboardLayoutJson < 0) ||
+        !KeyboardLayout::get(static_cast<KeyboardLayout::Id>(*keyboardLayoutJson)))) {
+        LOGE("Invalid JSON format: 'keyboardLayout' is not a valid layout");
+        errCode = HTTPD_400_BAD_REQUEST;
+        response = "Invalid JSON format: 'keyboardLayout' is not a valid layout";
+        return ErrorCode::InvalidArgument;
+    }
 
-    nvConfig.armingState = static_cast<ArmingState>(armingStateJson->valueint);
-    nvConfig.usbDeviceType = static_cast<UsbDevice::DeviceClass>(usbDeviceTypeJson->valueint);
+    // Payload slot is optional as well
+    auto payloadSlotJson = reqJson.getInt("payloadSlot");
+    if (reqJson.contains("payloadSlot") && (!payloadSlotJson || (*payloadSlotJson < NV_SCRIPT_SLOT) ||
+        (static_cast<std::size_t>(*payloadSlotJson) > PayloadRom::count()))) {
+        LOGE("Invalid JSON format: 'payloadSlot' is not a valid slot");
+        errCode = HTTPD_400_BAD_REQUEST;
+        response = "Invalid JSON format: 'payloadSlot' is not a valid slot";
+        return ErrorCode::InvalidArgument;
+    }
 
-    cJSON_Delete(reqJson); // Free the request json object
+    LOGD("Request armingState: '%d'", static_cast<int>(*armingStateJson));
+    LOGD("Request usbDeviceType: '%d'", static_cast<int>(*usbDeviceTypeJson));
+
+    // The new configuration is only applied once the device is switched and the configuration is stored
+    std::lock_guard<std::mutex> lock(nvConfigMutex);
+    NvConfig config = nvConfig;
+    config.armingState = static_cast<ArmingState>(*armingStateJson);
+    config.usbDeviceType = static_cast<UsbDevice::DeviceClass>(*usbDeviceTypeJson);
+    if (keyboardLayoutJson) {
+        LOGD("Request keyboardLayout: '%d'", static_cast<int>(*keyboardLayoutJson));
+        config.keyboardLayout = static_cast<KeyboardLayout::Id>(*keyboardLayoutJson);
+    }
+    if (payloadSlotJson) {
+        LOGD("Request payloadSlot: '%d'", static_cast<int>(*payloadSlotJson));
+        config.payloadSlot = static_cast<uint8_t>(*payloadSlotJson);
+    }
+    const bool isPayloadSlotChanged = config.payloadSlot != nvConfig.payloadSlot;
 
     // Open NVS handle
     esp_err_t ret = 0;
@@ -561,26 +1274,33 @@ ErrorCode EspDucky::handleConfigEndpointPost(httpd_req_t &http, const std::strin
         response = "Internal server error";
         return ErrorCode::GeneralError;
     }
-    
-    // Write nvConfig to NVS
-    ret = handle->set_blob(NVS_NV_CONFIG_KEY, &nvConfig, sizeof(nvConfig));
-    if(ESP_OK != ret) {
-        LOGE("Failed to update NVS data with error: (%s)", esp_err_to_name(ret));
+
+    // Apply the USB device type without the restart of the device - a refused switch keeps the stored configuration
+    const UsbDevice::DeviceClass previousClass = usb.getDeviceClass();
+    if (ErrorCode::Success != switchUsbDevice(config.usbDeviceType)) {
         errCode = HTTPD_500_INTERNAL_SERVER_ERROR;
-        response = "Internal server error";
+        response = "Failed to switch the USB device type";
         return ErrorCode::GeneralError;
     }
 
-    ret = handle->commit();
-    if(ESP_OK != ret) {
-        LOGE("Failed to commit NVS data with error: (%s)", esp_err_to_name(ret));
+    if (ErrorCode::Success != storeNvConfig(*handle, config)) {
+        // Nothing is stored, so the device class is switched back as well
+        (void)switchUsbDevice(previousClass);
         errCode = HTTPD_500_INTERNAL_SERVER_ERROR;
         response = "Internal server error";
         return ErrorCode::GeneralError;
     }
 
+    nvConfig = config;
     LOGI("New configuration successfully stored in NVS");
 
+    // The script of the selected slot is run by the next button press or API request
+    if (isPayloadSlotChanged && (ErrorCode::GeneralError == loadPayload(handle.get()))) {
+        errCode = HTTPD_500_INTERNAL_SERVER_ERROR;
+        response = "Failed to load the payload";
+        return ErrorCode::GeneralError;
+    }
+
     // Prepare response
     cJSON *respJson = cJSON_CreateObject();
     if (!respJson) {
@@ -603,7 +1323,7 @@ ErrorCode EspDucky::handleConfigEndpointPost(httpd_req_t &http, const std::strin
 
     response = respJsonStr;
 
-    std::free(respJsonStr); // Free the JSON string
+    cJSON_free(respJsonStr); // Free the JSON string
     cJSON_Delete(respJson); // Free the response json object
 
     return ErrorCode::Success;
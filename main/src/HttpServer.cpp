@@ -2,12 +2,14 @@
 
 #include "HttpServer.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
 
 HttpServer::HttpServer(std::unordered_map<std::string, StaticEndpoint> &&staticEndpoints, 
     std::unordered_map<std::string, DynamicEndpoint> &&dynamicEndpoints): 
 server(NULL), 
 staticEndpoints(std::move(staticEndpoints)),
-dynamicEndpoints(std::move(dynamicEndpoints))
+dynamicEndpoints(std::move(dynamicEndpoints)),
+arena()
 {}
 
 ErrorCode HttpServer::start(){
@@ -15,6 +17,8 @@ ErrorCode HttpServer::start(){
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 
     config.stack_size = 1u<<15u; // Increase stack size to 8KB to handle script execution in the task context
+    // Every static endpoint has the GET handler, every dynamic endpoint has the GET and the POST handler
+    config.max_uri_handlers = staticEndpoints.size() + 2u * dynamicEndpoints.size();
 
     /* Empty handle to esp_http_server */
     server = NULL;
@@ -49,7 +53,7 @@ ErrorCode HttpServer::start(){
         };
         esp_err_t err = httpd_register_uri_handler(server, &uriHandler);
         if(err) {
-            LOGE("Failed to register URI GET handler for '%s' with code: '%d'", err);
+            LOGE("Failed to register URI GET handler for '%s' with code: '%d'", uri.c_str(), err);
         }
 
         uriHandler.method = HTTP_POST;
@@ -79,6 +83,7 @@ esp_err_t HttpServer::handleStaticEndpoint(httpd_req_t *req)
     }
 
     LOGD("HTTP request received for static endpoint %s", req->uri);
+    Metrics::increment(Metrics::Counter::HttpRequests);
 
     HttpServer *httpServer = static_cast<HttpServer *>(req->user_ctx);
     const StaticEndpoint &endpoint = httpServer->staticEndpoints.at(req->uri);
@@ -95,46 +100,93 @@ esp_err_t HttpServer::handleDynamicEndpoint(httpd_req_t *req)
     }
 
     LOGD("HTTP request received for dynamic endpoint %s", req->uri);
+    Metrics::increment(Metrics::Counter::HttpRequests);
 
     HttpServer *httpServer = static_cast<HttpServer *>(req->user_ctx);
-    int ret, remaining = req->content_len;
-    std::unique_ptr<char[]> reqBuf = std::make_unique<char[]>(req->content_len + 1); // Reserve additional byte to ensure null-termination
-    reqBuf[remaining] = '\0'; // Null-terminate the buffer
-
-    while (remaining > 0) {
-        // Read the data for the request
-        if ((ret = httpd_req_recv(req, reqBuf.get(), remaining)) <= 0) {
-            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
-                continue;
+    if (req->content_len >= RequestArena::MAX_SIZE) {
+        LOGE("Request content of %zu bytes exceeds the limit", req->content_len);
+        httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LARGE, "Request is too large");
+        return ESP_OK;
+    }
+
+    // All memory allocated while the request is handled is released at once when the scope ends
+    RequestArena::Scope arenaScope(httpServer->arena);
+
+    try {
+        int ret, remaining = req->content_len;
+        std::pmr::string reqBuf(req->content_len, '\0', RequestArena::getResource()); // String keeps the buffer null-terminated
+
+        while (remaining > 0) {
+            // Read the data for the request
+            if ((ret = httpd_req_recv(req, reqBuf.data() + (req->content_len - remaining), remaining)) <= 0) {
+                if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                    continue;
+                }
+                return ESP_FAIL;
             }
-            return ESP_FAIL;
+            remaining -= ret;
         }
-        remaining -= ret;
-    }
 
-    LOGD("Request buffer content: '%s'", reqBuf.get());
+        // Binary uploads are passed to the separate callback, the other requests are handled as text
+        bool isUpload = (HTTP_POST == req->method) && isUploadRequest(*req);
+        if(!isUpload) {
+            LOGD("Request buffer content: '%s'", reqBuf.c_str());
+        }
+        else {
+            LOGD("Request buffer content: %d bytes of binary data", req->content_len);
+        }
+
+        // Call the dynamic endpoint callback
+        auto it = httpServer->dynamicEndpoints.find(req->uri);
+        if(it != httpServer->dynamicEndpoints.end()) {
+            const auto &endpoint = it->second;
+            const EndpointCallback &callback = isUpload ? endpoint.uploadCallback : endpoint.callback;
+            if(!callback) {
+                LOGE("Dynamic endpoint '%s' does not accept binary uploads", req->uri);
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unsupported content type");
+                return ESP_OK;
+            }
 
-    // Call the dynamic endpoint callback
-    auto it = httpServer->dynamicEndpoints.find(req->uri);
-    if(it != httpServer->dynamicEndpoints.end()) {
-        auto endpoint = it->second;
-        std::string response{};
-        httpd_err_code_t errCode = HTTPD_500_INTERNAL_SERVER_ERROR;
-        ErrorCode err = endpoint.callback(*req, reqBuf.get(), response, errCode);
+            std::pmr::string response(RequestArena::getResource());
+            httpd_err_code_t errCode = HTTPD_500_INTERNAL_SERVER_ERROR;
+            // Length is passed explicitly, as the binary content may contain null characters
+            ErrorCode err = callback(*req, std::span<char>(reqBuf), response, errCode);
 
-        if(err != ErrorCode::Success) {
-            LOGE("Failed to handle dynamic endpoint '%s' with error: %d, response: '%s'", req->uri, err, response.c_str());
-            httpd_resp_send_err(req, errCode, response.c_str());
+            if(err != ErrorCode::Success) {
+                LOGE("Failed to handle dynamic endpoint '%s' with error: %d, response: '%s'", req->uri, err, response.c_str());
+                httpd_resp_send_err(req, errCode, response.c_str());
 
-            // Return OK indicating that the request was handled successfully even if the response is an error
-            return ESP_OK;
+                // Return OK indicating that the request was handled successfully even if the response is an error
+                return ESP_OK;
+            }
+            
+            if(!response.empty()) {
+                httpd_resp_set_type(req, endpoint.mime.data());
+                httpd_resp_sendstr(req, response.c_str());
+            } 
         }
-        
-        if(!response.empty()) {
-            httpd_resp_set_type(req, endpoint.mime.data());
-            httpd_resp_sendstr(req, response.c_str());
-        } 
+    }
+    catch (const std::bad_alloc &) {
+        LOGE("Dynamic endpoint '%s' ran out of the request memory", req->uri);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Request exceeds the memory limit");
     }
 
     return ESP_OK;
+}
+
+bool HttpServer::isUploadRequest(httpd_req_t &req)
+{
+    size_t contentTypeLen = httpd_req_get_hdr_value_len(&req, "Content-Type");
+    if(contentTypeLen == 0u) {
+        return false;
+    }
+
+    std::pmr::string contentType(contentTypeLen + 1u, '\0', RequestArena::getResource()); // Reserve additional byte for the null-termination
+    if(ESP_OK != httpd_req_get_hdr_value_str(&req, "Content-Type", contentType.data(), contentType.size())) {
+        return false;
+    }
+    contentType.resize(contentTypeLen);
+
+    // Ignore the optional parameters of the media type
+    return std::string_view(contentType).substr(0u, contentType.find(';')) == UPLOAD_MIME;
 }
\ No newline at end of file
@@ -0,0 +1,399 @@
+#include <charconv>
+
+#include "JsonTokenizer.hpp"
+#include "Logger.hpp"
+
+namespace {
+
+constexpr bool isDigit(char c) {
+    return (c >= '0') && (c <= '9');
+}
+
+constexpr int hexValue(char c) {
+    if (isDigit(c)) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+} // namespace
+
+JsonTokenizer::JsonTokenizer(std::span<char> json)
+:json(json),
+position(0u),
+members(),
+memberNum(0u)
+{}
+
+void JsonTokenizer::skipWhitespace() {
+    while ((position < json.size()) &&
+        ((json[position] == ' ') || (json[position] == '\t') || (json[position] == '\n') || (json[position] == '\r'))) {
+        position++;
+    }
+}
+
+bool JsonTokenizer::consume(char c) {
+    if ((position < json.size()) && (json[position] == c)) {
+        position++;
+        return true;
+    }
+
+    return false;
+}
+
+std::optional<std::string_view> JsonTokenizer::readString() {
+    if (!consume('"')) {
+        return std::nullopt;
+    }
+
+    // The unescaped string is never longer than its escaped form, so it is written over the part already read
+    const std::size_t start = position;
+    std::size_t out = position;
+    while (position < json.size()) {
+        const char c = json[position];
+        if (c == '"') {
+            // The closing quote is at or after the end of the unescaped string
+            json[out] = '\0';
+            position++;
+            return std::string_view(&json[start], out - start);
+        }
+        if (static_cast<unsigned char>(c) < 0x20u) {
+            return std::nullopt;
+        }
+        if (c != '\\') {
+            json[out++] = c;
+            position++;
+            continue;
+        }
+
+        if (++position >= json.size()) {
+            return std::nullopt;
+        }
+        switch (json[position]) {
+            case '"': json[out++] = '"'; break;
+            case '\\': json[out++] = '\\'; break;
+            case '/': json[out++] = '/'; break;
+            case 'b': json[out++] = '\b'; break;
+            case 'f': json[out++] = '\f'; break;
+            case 'n': json[out++] = '\n'; break;
+            case 'r': json[out++] = '\r'; break;
+            case 't': json[out++] = '\t'; break;
+            case 'u': {
+                // Code point of the \uXXXX escape, the surrogate pair takes two escapes
+                auto readCodeUnit = [this]() -> std::optional<uint32_t> {
+                    if (position + 4u >= json.size()) {
+                        return std::nullopt;
+                    }
+                    uint32_t value = 0u;
+                    for (std::size_t idx = 1u; idx <= 4u; idx++) {
+                        const int digit = hexValue(json[position + idx]);
+                        if (digit < 0) {
+                            return std::nullopt;
+                        }
+                        value = (value << 4u) | static_cast<uint32_t>(digit);
+                    }
+                    position += 4u;
+                    return value;
+                };
+
+                auto codePoint = readCodeUnit();
+                if (!codePoint || ((*codePoint >= 0xDC00u) && (*codePoint <= 0xDFFFu))) {
+                    return std::nullopt;
+                }
+                if ((*codePoint >= 0xD800u) && (*codePoint <= 0xDBFFu)) {
+                    if ((position + 2u >= json.size()) || (json[position + 1u] != '\\') || (json[position + 2u] != 'u')) {
+                        return std::nullopt;
+                    }
+                    position += 2u;
+                    auto lowSurrogate = readCodeUnit();
+                    if (!lowSurrogate || (*lowSurrogate < 0xDC00u) || (*lowSurrogate > 0xDFFFu)) {
+                        return std::nullopt;
+                    }
+                    codePoint = 0x10000u + ((*codePoint - 0xD800u) << 10u) + (*lowSurrogate - 0xDC00u);
+                }
+
+                // UTF-8 encoding - at most 3 bytes of the 6 characters of the escape, 4 bytes of the 12 characters of the pair
+                if (*codePoint < 0x80u) {
+                    json[out++] = static_cast<char>(*codePoint);
+                }
+                else if (*codePoint < 0x800u) {
+                    json[out++] = static_cast<char>(0xC0u | (*codePoint >> 6u));
+                    json[out++] = static_cast<char>(0x80u | (*codePoint & 0x3Fu));
+                }
+                else if (*codePoint < 0x10000u) {
+                    json[out++] = static_cast<char>(0xE0u | (*codePoint >> 12u));
+                    json[out++] = static_cast<char>(0x80u | ((*codePoint >> 6u) & 0x3Fu));
+                    json[out++] = static_cast<char>(0x80u | (*codePoint & 0x3Fu));
+                }
+                else {
+                    json[out++] = static_cast<char>(0xF0u | (*codePoint >> 18u));
+                    json[out++] = static_cast<char>(0x80u | ((*codePoint >> 12u) & 0x3Fu));
+                    json[out++] = static_cast<char>(0x80u | ((*codePoint >> 6u) & 0x3Fu));
+                    json[out++] = static_cast<char>(0x80u | (*codePoint & 0x3Fu));
+                }
+                break;
+            }
+            default: {
+                return std::nullopt;
+            }
+        }
+        position++;
+    }
+
+    return std::nullopt;
+}
+
+std::optional<std::string_view> JsonTokenizer::readNumber() {
+    const std::size_t start = position;
+    auto skipDigits = [this]() {
+        const std::size_t digitsStart = position;
+        while ((position < json.size()) && isDigit(json[position])) {
+            position++;
+        }
+        return position - digitsStart;
+    };
+
+    (void)consume('-');
+    if (consume('0')) {
+        // Leading zeros are not allowed
+    }
+    else if (0u == skipDigits()) {
+        return std::nullopt;
+    }
+    if (consume('.') && (0u == skipDigits())) {
+        return std::nullopt;
+    }
+    if (consume('e') || consume('E')) {
+        if (!consume('+')) {
+            (void)consume('-');
+        }
+        if (0u == skipDigits()) {
+            return std::nullopt;
+        }
+    }
+
+    return std::string_view(&json[start], position - start);
+}
+
+bool JsonTokenizer::readLiteral(std::string_view literal) {
+    if (std::string_view(json.data() + position, json.size() - position).starts_with(literal)) {
+        position += literal.size();
+        return true;
+    }
+
+    return false;
+}
+
+bool JsonTokenizer::skipValue() {
+    // Kinds of the open containers, one bit per level, so the nesting needs no recursion
+    uint32_t arrayLevels = 0u;
+    std::size_t depth = 0u;
+
+    for (;;) {
+        skipWhitespace();
+        if (position >= json.size()) {
+            return false;
+        }
+
+        // Opening of the container is followed by its first value, unless it is empty
+        const char c = json[position];
+        bool isValueRead = true;
+        if ((c == '{') || (c == '[')) {
+            // The top-level object is the first level
+            if (depth + 1u >= MAX_DEPTH) {
+                return false;
+            }
+            position++;
+            const bool isArray = (c == '[');
+            arrayLevels = (arrayLevels & ~(1u << depth)) | (static_cast<uint32_t>(isArray) << depth);
+            depth++;
+
+            skipWhitespace();
+            if (consume(isArray ? ']' : '}')) {
+                depth--;
+            }
+            else if (isArray) {
+                isValueRead = false;
+            }
+            else {
+                skipWhitespace();
+                if (!readString()) {
+                    return false;
+                }
+                skipWhitespace();
+                if (!consume(':')) {
+                    return false;
+                }
+                isValueRead = false;
+            }
+        }
+        else if (c == '"') {
+            if (!readString()) {
+                return false;
+            }
+        }
+        else if ((c == '-') || isDigit(c)) {
+            if (!readNumber()) {
+                return false;
+            }
+        }
+        else if (!readLiteral("true") && !readLiteral("false") && !readLiteral("null")) {
+            return false;
+        }
+
+        // Separators and the ends of the containers up to the next value
+        while (isValueRead) {
+            if (depth == 0u) {
+                return true;
+            }
+
+            const bool isArray = (arrayLevels >> (depth - 1u)) & 1u;
+            skipWhitespace();
+            if (consume(',')) {
+                if (!isArray) {
+                    skipWhitespace();
+                    if (!readString()) {
+                        return false;
+                    }
+                    skipWhitespace();
+                    if (!consume(':')) {
+                        return false;
+                    }
+                }
+                isValueRead = false;
+            }
+            else if (consume(isArray ? ']' : '}')) {
+                depth--;
+            }
+            else {
+                return false;
+            }
+        }
+    }
+}
+
+ErrorCode JsonTokenizer::parse() {
+    position = 0u;
+    memberNum = 0u;
+
+    skipWhitespace();
+    if (!consume('{')) {
+        return ErrorCode::InvalidArgument;
+    }
+
+    skipWhitespace();
+    if (!consume('}')) {
+        for (;;) {
+            skipWhitespace();
+            auto key = readString();
+            if (!key) {
+                return ErrorCode::InvalidArgument;
+            }
+            skipWhitespace();
+            if (!consume(':')) {
+                return ErrorCode::InvalidArgument;
+            }
+            skipWhitespace();
+
+            Member member{*key, {}, Type::Other};
+            const char c = (position < json.size()) ? json[position] : '\0';
+            if (c == '"') {
+                auto value = readString();
+                if (!value) {
+                    return ErrorCode::InvalidArgument;
+                }
+                member.value = *value;
+                member.type = Type::String;
+            }
+            else if ((c == '-') || isDigit(c)) {
+                auto value = readNumber();
+                if (!value) {
+                    return ErrorCode::InvalidArgument;
+                }
+                member.value = *value;
+                member.type = Type::Number;
+            }
+            else if (!skipValue()) {
+                return ErrorCode::InvalidArgument;
+            }
+
+            if (memberNum < members.size()) {
+                members[memberNum++] = member;
+            }
+            else {
+                LOGW("JSON member '%.*s' over the limit of %zu members is ignored", static_cast<int>(key->size()), key->data(),
+                    MAX_MEMBERS);
+            }
+
+            skipWhitespace();
+            if (consume('}')) {
+                break;
+            }
+            if (!consume(',')) {
+                return ErrorCode::InvalidArgument;
+            }
+        }
+    }
+
+    // Only the whitespace may follow the object
+    skipWhitespace();
+    return (position == json.size()) ? ErrorCode::Success : ErrorCode::InvalidArgument;
+}
+
+std::size_t JsonTokenizer::getErrorOffset() const {
+    return position;
+}
+
+const JsonTokenizer::Member *JsonTokenizer::find(std::string_view key) const {
+    // The first of the duplicate members is used
+    for (std::size_t idx = 0u; idx < memberNum; idx++) {
+        if (members[idx].key == key) {
+            return &members[idx];
+        }
+    }
+
+    return nullptr;
+}
+
+bool JsonTokenizer::contains(std::string_view key) const {
+    return nullptr != find(key);
+}
+
+std::optional<std::string_view> JsonTokenizer::getString(std::string_view key) const {
+    const Member *member = find(key);
+    if (!member || (Type::String != member->type)) {
+        return std::nullopt;
+    }
+
+    return member->value;
+}
+
+std::optional<int32_t> JsonTokenizer::getInt(std::string_view key) const {
+    const Member *member = find(key);
+    if (!member || (Type::Number != member->type)) {
+        return std::nullopt;
+    }
+
+    int32_t value = 0;
+    const char *end = member->value.data() + member->value.size();
+    auto [next, ec] = std::from_chars(member->value.data(), end, value);
+    if (ec != std::errc()) {
+        return std::nullopt;
+    }
+
+    // The fraction of zeros keeps the integer value, e.g. 1.0
+    if ((next != end) && (*next == '.')) {
+        next++;
+        while ((next != end) && (*next == '0')) {
+            next++;
+        }
+    }
+
+    return (next == end) ? std::optional<int32_t>(value) : std::nullopt;
+}
@@ -0,0 +1,492 @@
+#include <algorithm>
+#include <array>
+
+#include "tinyusb.h"
+#include "class/hid/hid_device.h"
+
+#include "KeyboardLayout.hpp"
+#include "Logger.hpp"
+
+namespace {
+
+using KeyReport = KeyboardLayout::KeyReport;
+using KeyMapping = KeyboardLayout::KeyMapping;
+using KeyDefinition = KeyboardLayout::KeyDefinition;
+using DeadKeyComposition = KeyboardLayout::DeadKeyComposition;
+
+// Layout generation ===
+
+constexpr std::size_t LEVEL_NUM = 4u;
+
+constexpr std::array<uint8_t, LEVEL_NUM> LEVEL_MODIFIERS = {
+    0u,
+    KEYBOARD_MODIFIER_LEFTSHIFT,
+    KEYBOARD_MODIFIER_RIGHTALT,
+    KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTALT
+};
+
+constexpr std::array<uint8_t, LEVEL_NUM> LEVEL_DEAD_FLAGS = {
+    KeyboardLayout::DEAD_NORMAL,
+    KeyboardLayout::DEAD_SHIFT,
+    KeyboardLayout::DEAD_ALTGR,
+    KeyboardLayout::DEAD_SHIFT_ALTGR
+};
+
+constexpr KeyDefinition letter(uint8_t keyCode, char32_t lower, char32_t altGr = 0u, char32_t shiftAltGr = 0u) {
+    return {keyCode, lower, lower - U'a' + U'A', altGr, shiftAltGr, 0u};
+}
+
+constexpr char32_t levelCodePoint(const KeyDefinition &key, std::size_t level) {
+    constexpr std::array<char32_t KeyDefinition::*, LEVEL_NUM> levels = {
+        &KeyDefinition::normal, &KeyDefinition::shift, &KeyDefinition::altGr, &KeyDefinition::shiftAltGr
+    };
+    return key.*levels[level];
+}
+
+template<std::size_t KeyNum>
+constexpr std::optional<KeyReport> findKey(const std::array<KeyDefinition, KeyNum> &keys, char32_t codePoint, bool isDead) {
+    for (const auto &key : keys) {
+        for (std::size_t level = 0u; level < LEVEL_NUM; ++level) {
+            if ((levelCodePoint(key, level) == codePoint) && (((key.deadLevels & LEVEL_DEAD_FLAGS[level]) != 0u) == isDead)) {
+                return KeyReport{LEVEL_MODIFIERS[level], key.keyCode};
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+template<std::size_t Size>
+struct MappingDraft {
+    std::array<KeyMapping, Size> mappings{};
+    std::size_t size = 0u;
+
+    constexpr bool contains(char32_t codePoint) const {
+        return std::any_of(mappings.begin(), mappings.begin() + size, [codePoint](const KeyMapping &mapping) {
+            return mapping.codePoint == codePoint;
+        });
+    }
+
+    constexpr void add(const KeyMapping &mapping) {
+        // The first way of typing the character wins - direct keys are added before the dead key sequences
+        if (!contains(mapping.codePoint)) {
+            mappings[size++] = mapping;
+        }
+    }
+};
+
+template<std::size_t KeyNum, std::size_t CompositionNum>
+constexpr auto draftTable(const std::array<KeyDefinition, KeyNum> &keys, const std::array<DeadKeyComposition, CompositionNum> &compositions) {
+    MappingDraft<KeyNum * LEVEL_NUM + CompositionNum> draft{};
+
+    // Characters typed with a single key report
+    for (const auto &key : keys) {
+        for (std::size_t level = 0u; level < LEVEL_NUM; ++level) {
+            const char32_t codePoint = levelCodePoint(key, level);
+            if (codePoint && !(key.deadLevels & LEVEL_DEAD_FLAGS[level])) {
+                draft.add({codePoint, {}, {LEVEL_MODIFIERS[level], key.keyCode}});
+            }
+        }
+    }
+
+    // Dead key characters on their own - the dead key followed by space
+    for (const auto &key : keys) {
+        for (std::size_t level = 0u; level < LEVEL_NUM; ++level) {
+            const char32_t codePoint = levelCodePoint(key, level);
+            if (codePoint && (key.deadLevels & LEVEL_DEAD_FLAGS[level])) {
+                draft.add({codePoint, {LEVEL_MODIFIERS[level], key.keyCode}, {0u, HID_KEY_SPACE}});
+            }
+        }
+    }
+
+    // Characters composed from the dead key and the base character
+    for (const auto &composition : compositions) {
+        const auto deadKey = findKey(keys, composition.deadKey, true);
+        const auto baseKey = findKey(keys, composition.base, false);
+        if (deadKey && baseKey) {
+            draft.add({composition.composed, *deadKey, *baseKey});
+        }
+    }
+
+    std::sort(draft.mappings.begin(), draft.mappings.begin() + draft.size, [](const KeyMapping &lhs, const KeyMapping &rhs) {
+        return lhs.codePoint < rhs.codePoint;
+    });
+
+    return draft;
+}
+
+template<std::size_t KeyNum, std::size_t CompositionNum>
+constexpr bool isValidLayout(const std::array<KeyDefinition, KeyNum> &keys, const std::array<DeadKeyComposition, CompositionNum> &compositions) {
+    return std::all_of(compositions.begin(), compositions.end(), [&keys](const DeadKeyComposition &composition) {
+        return findKey(keys, composition.deadKey, true) && findKey(keys, composition.base, false);
+    });
+}
+
+template<std::size_t LhsNum, std::size_t RhsNum>
+constexpr auto concat(const std::array<DeadKeyComposition, LhsNum> &lhs, const std::array<DeadKeyComposition, RhsNum> &rhs) {
+    std::array<DeadKeyComposition, LhsNum + RhsNum> result{};
+    std::copy(rhs.begin(), rhs.end(), std::copy(lhs.begin(), lhs.end(), result.begin()));
+    return result;
+}
+
+// Expands the per-key definitions into the lookup table sorted by code point
+template<const auto &Keys, const auto &Compositions>
+consteval auto generateTable() {
+    static_assert(isValidLayout(Keys, Compositions), "Dead key composition refers to a character missing in the layout");
+
+    constexpr auto draft = draftTable(Keys, Compositions);
+    std::array<KeyMapping, draft.size> table{};
+    std::copy_n(draft.mappings.begin(), draft.size, table.begin());
+    return table;
+}
+
+// Common key definitions ===
+
+constexpr KeyDefinition KEY_ENTER = {HID_KEY_ENTER, U'\n', 0u, 0u, 0u, 0u};
+constexpr KeyDefinition KEY_TAB = {HID_KEY_TAB, U'\t', 0u, 0u, 0u, 0u};
+constexpr KeyDefinition KEY_SPACE = {HID_KEY_SPACE, U' ', 0u, 0u, 0u, 0u};
+
+constexpr std::array<DeadKeyComposition, 0u> NO_COMPOSITIONS{};
+
+constexpr auto CIRCUMFLEX_COMPOSITIONS = std::to_array<DeadKeyComposition>({
+    {U'^', U'a', U'â'}, {U'^', U'e', U'ê'}, {U'^', U'i', U'î'}, {U'^', U'o', U'ô'}, {U'^', U'u', U'û'},
+    {U'^', U'A', U'Â'}, {U'^', U'E', U'Ê'}, {U'^', U'I', U'Î'}, {U'^', U'O', U'Ô'}, {U'^', U'U', U'Û'},
+});
+
+// US ===
+
+constexpr auto US_KEYS = std::to_array<KeyDefinition>({
+    letter(HID_KEY_A, U'a'), letter(HID_KEY_B, U'b'), letter(HID_KEY_C, U'c'), letter(HID_KEY_D, U'd'),
+    letter(HID_KEY_E, U'e'), letter(HID_KEY_F, U'f'), letter(HID_KEY_G, U'g'), letter(HID_KEY_H, U'h'),
+    letter(HID_KEY_I, U'i'), letter(HID_KEY_J, U'j'), letter(HID_KEY_K, U'k'), letter(HID_KEY_L, U'l'),
+    letter(HID_KEY_M, U'm'), letter(HID_KEY_N, U'n'), letter(HID_KEY_O, U'o'), letter(HID_KEY_P, U'p'),
+    letter(HID_KEY_Q, U'q'), letter(HID_KEY_R, U'r'), letter(HID_KEY_S, U's'), letter(HID_KEY_T, U't'),
+    letter(HID_KEY_U, U'u'), letter(HID_KEY_V, U'v'), letter(HID_KEY_W, U'w'), letter(HID_KEY_X, U'x'),
+    letter(HID_KEY_Y, U'y'), letter(HID_KEY_Z, U'z'),
+    {HID_KEY_1, U'1', U'!', 0u, 0u, 0u},
+    {HID_KEY_2, U'2', U'@', 0u, 0u, 0u},
+    {HID_KEY_3, U'3', U'#', 0u, 0u, 0u},
+    {HID_KEY_4, U'4', U'$', 0u, 0u, 0u},
+    {HID_KEY_5, U'5', U'%', 0u, 0u, 0u},
+    {HID_KEY_6, U'6', U'^', 0u, 0u, 0u},
+    {HID_KEY_7, U'7', U'&', 0u, 0u, 0u},
+    {HID_KEY_8, U'8', U'*', 0u, 0u, 0u},
+    {HID_KEY_9, U'9', U'(', 0u, 0u, 0u},
+    {HID_KEY_0, U'0', U')', 0u, 0u, 0u},
+    {HID_KEY_MINUS, U'-', U'_', 0u, 0u, 0u},
+    {HID_KEY_EQUAL, U'=', U'+', 0u, 0u, 0u},
+    {HID_KEY_BRACKET_LEFT, U'[', U'{', 0u, 0u, 0u},
+    {HID_KEY_BRACKET_RIGHT, U']', U'}', 0u, 0u, 0u},
+    {HID_KEY_BACKSLASH, U'\\', U'|', 0u, 0u, 0u},
+    {HID_KEY_SEMICOLON, U';', U':', 0u, 0u, 0u},
+    {HID_KEY_APOSTROPHE, U'\'', U'"', 0u, 0u, 0u},
+    {HID_KEY_GRAVE, U'`', U'~', 0u, 0u, 0u},
+    {HID_KEY_COMMA, U',', U'<', 0u, 0u, 0u},
+    {HID_KEY_PERIOD, U'.', U'>', 0u, 0u, 0u},
+    {HID_KEY_SLASH, U'/', U'?', 0u, 0u, 0u},
+    KEY_ENTER, KEY_TAB, KEY_SPACE,
+});
+
+// DE (QWERTZ) ===
+
+constexpr auto DE_KEYS = std::to_array<KeyDefinition>({
+    letter(HID_KEY_A, U'a'), letter(HID_KEY_B, U'b'), letter(HID_KEY_C, U'c'), letter(HID_KEY_D, U'd'),
+    letter(HID_KEY_E, U'e', U'€'), letter(HID_KEY_F, U'f'), letter(HID_KEY_G, U'g'), letter(HID_KEY_H, U'h'),
+    letter(HID_KEY_I, U'i'), letter(HID_KEY_J, U'j'), letter(HID_KEY_K, U'k'), letter(HID_KEY_L, U'l'),
+    letter(HID_KEY_M, U'm', U'µ'), letter(HID_KEY_N, U'n'), letter(HID_KEY_O, U'o'), letter(HID_KEY_P, U'p'),
+    letter(HID_KEY_Q, U'q', U'@'), letter(HID_KEY_R, U'r'), letter(HID_KEY_S, U's'), letter(HID_KEY_T, U't'),
+    letter(HID_KEY_U, U'u'), letter(HID_KEY_V, U'v'), letter(HID_KEY_W, U'w'), letter(HID_KEY_X, U'x'),
+    letter(HID_KEY_Z, U'y'), letter(HID_KEY_Y, U'z'),
+    {HID_KEY_1, U'1', U'!', 0u, 0u, 0u},
+    {HID_KEY_2, U'2', U'"', U'²', 0u, 0u},
+    {HID_KEY_3, U'3', U'§', U'³', 0u, 0u},
+    {HID_KEY_4, U'4', U'$', 0u, 0u, 0u},
+    {HID_KEY_5, U'5', U'%', 0u, 0u, 0u},
+    {HID_KEY_6, U'6', U'&', 0u, 0u, 0u},
+    {HID_KEY_7, U'7', U'/', U'{', 0u, 0u},
+    {HID_KEY_8, U'8', U'(', U'[', 0u, 0u},
+    {HID_KEY_9, U'9', U')', U']', 0u, 0u},
+    {HID_KEY_0, U'0', U'=', U'}', 0u, 0u},
+    {HID_KEY_MINUS, U'ß', U'?', U'\\', 0u, 0u},
+    {HID_KEY_EQUAL, U'´', U'`', 0u, 0u, KeyboardLayout::DEAD_NORMAL | KeyboardLayout::DEAD_SHIFT},
+    {HID_KEY_BRACKET_LEFT, U'ü', U'Ü', 0u, 0u, 0u},
+    {HID_KEY_BRACKET_RIGHT, U'+', U'*', U'~', 0u, 0u},
+    {HID_KEY_EUROPE_1, U'#', U'\'', 0u, 0u, 0u},
+    {HID_KEY_SEMICOLON, U'ö', U'Ö', 0u, 0u, 0u},
+    {HID_KEY_APOSTROPHE, U'ä', U'Ä', 0u, 0u, 0u},
+    {HID_KEY_GRAVE, U'^', U'°', 0u, 0u, KeyboardLayout::DEAD_NORMAL},
+    {HID_KEY_COMMA, U',', U';', 0u, 0u, 0u},
+    {HID_KEY_PERIOD, U'.', U':', 0u, 0u, 0u},
+    {HID_KEY_SLASH, U'-', U'_', 0u, 0u, 0u},
+    {HID_KEY_EUROPE_2, U'<', U'>', U'|', 0u, 0u},
+    KEY_ENTER, KEY_TAB, KEY_SPACE,
+});
+
+constexpr auto DE_COMPOSITIONS = concat(CIRCUMFLEX_COMPOSITIONS, std::to_array<DeadKeyComposition>({
+    {U'´', U'a', U'á'}, {U'´', U'e', U'é'}, {U'´', U'i', U'í'}, {U'´', U'o', U'ó'}, {U'´', U'u', U'ú'}, {U'´', U'y', U'ý'},
+    {U'´', U'A', U'Á'}, {U'´', U'E', U'É'}, {U'´', U'I', U'Í'}, {U'´', U'O', U'Ó'}, {U'´', U'U', U'Ú'}, {U'´', U'Y', U'Ý'},
+    {U'`', U'a', U'à'}, {U'`', U'e', U'è'}, {U'`', U'i', U'ì'}, {U'`', U'o', U'ò'}, {U'`', U'u', U'ù'},
+    {U'`', U'A', U'À'}, {U'`', U'E', U'È'}, {U'`', U'I', U'Ì'}, {U'`', U'O', U'Ò'}, {U'`', U'U', U'Ù'},
+}));
+
+// FR (AZERTY) ===
+
+constexpr auto FR_KEYS = std::to_array<KeyDefinition>({
+    letter(HID_KEY_Q, U'a'), letter(HID_KEY_B, U'b'), letter(HID_KEY_C, U'c'), letter(HID_KEY_D, U'd'),
+    letter(HID_KEY_E, U'e', U'€'), letter(HID_KEY_F, U'f'), letter(HID_KEY_G, U'g'), letter(HID_KEY_H, U'h'),
+    letter(HID_KEY_I, U'i'), letter(HID_KEY_J, U'j'), letter(HID_KEY_K, U'k'), letter(HID_KEY_L, U'l'),
+    letter(HID_KEY_SEMICOLON, U'm'), letter(HID_KEY_N, U'n'), letter(HID_KEY_O, U'o'), letter(HID_KEY_P, U'p'),
+    letter(HID_KEY_A, U'q'), letter(HID_KEY_R, U'r'), letter(HID_KEY_S, U's'), letter(HID_KEY_T, U't'),
+    letter(HID_KEY_U, U'u'), letter(HID_KEY_V, U'v'), letter(HID_KEY_Z, U'w'), letter(HID_KEY_X, U'x'),
+    letter(HID_KEY_Y, U'y'), letter(HID_KEY_W, U'z'),
+    {HID_KEY_GRAVE, U'²', 0u, 0u, 0u, 0u},
+    {HID_KEY_1, U'&', U'1', 0u, 0u, 0u},
+    {HID_KEY_2, U'é', U'2', U'~', 0u, KeyboardLayout::DEAD_ALTGR},
+    {HID_KEY_3, U'"', U'3', U'#', 0u, 0u},
+    {HID_KEY_4, U'\'', U'4', U'{', 0u, 0u},
+    {HID_KEY_5, U'(', U'5', U'[', 0u, 0u},
+    {HID_KEY_6, U'-', U'6', U'|', 0u, 0u},
+    {HID_KEY_7, U'è', U'7', U'`', 0u, KeyboardLayout::DEAD_ALTGR},
+    {HID_KEY_8, U'_', U'8', U'\\', 0u, 0u},
+    {HID_KEY_9, U'ç', U'9', U'^', 0u, 0u},
+    {HID_KEY_0, U'à', U'0', U'@', 0u, 0u},
+    {HID_KEY_MINUS, U')', U'°', U']', 0u, 0u},
+    {HID_KEY_EQUAL, U'=', U'+', U'}', 0u, 0u},
+    {HID_KEY_BRACKET_LEFT, U'^', U'¨', 0u, 0u, KeyboardLayout::DEAD_NORMAL | KeyboardLayout::DEAD_SHIFT},
+    {HID_KEY_BRACKET_RIGHT, U'$', U'£', U'¤', 0u, 0u},
+    {HID_KEY_APOSTROPHE, U'ù', U'%', 0u, 0u, 0u},
+    {HID_KEY_EUROPE_1, U'*', U'µ', 0u, 0u, 0u},
+    {HID_KEY_M, U',', U'?', 0u, 0u, 0u},
+    {HID_KEY_COMMA, U';', U'.', 0u, 0u, 0u},
+    {HID_KEY_PERIOD, U':', U'/', 0u, 0u, 0u},
+    {HID_KEY_SLASH, U'!', U'§', 0u, 0u, 0u},
+    {HID_KEY_EUROPE_2, U'<', U'>', 0u, 0u, 0u},
+    KEY_ENTER, KEY_TAB, KEY_SPACE,
+});
+
+constexpr auto FR_COMPOSITIONS = concat(CIRCUMFLEX_COMPOSITIONS, std::to_array<DeadKeyComposition>({
+    {U'¨', U'a', U'ä'}, {U'¨', U'e', U'ë'}, {U'¨', U'i', U'ï'}, {U'¨', U'o', U'ö'}, {U'¨', U'u', U'ü'}, {U'¨', U'y', U'ÿ'},
+    {U'¨', U'A', U'Ä'}, {U'¨', U'E', U'Ë'}, {U'¨', U'I', U'Ï'}, {U'¨', U'O', U'Ö'}, {U'¨', U'U', U'Ü'}, {U'¨', U'Y', U'Ÿ'},
+    {U'~', U'a', U'ã'}, {U'~', U'n', U'ñ'}, {U'~', U'o', U'õ'}, {U'~', U'A', U'Ã'}, {U'~', U'N', U'Ñ'}, {U'~', U'O', U'Õ'},
+    {U'`', U'a', U'à'}, {U'`', U'e', U'è'}, {U'`', U'i', U'ì'}, {U'`', U'o', U'ò'}, {U'`', U'u', U'ù'},
+    {U'`', U'A', U'À'}, {U'`', U'E', U'È'}, {U'`', U'I', U'Ì'}, {U'`', U'O', U'Ò'}, {U'`', U'U', U'Ù'},
+}));
+
+// PL (Polish programmer's) ===
+
+constexpr auto PL_KEYS = [] {
+    auto keys = US_KEYS;
+    for (auto &key : keys) {
+        switch (key.keyCode) {
+            case HID_KEY_A: key = letter(HID_KEY_A, U'a', U'ą', U'Ą'); break;
+            case HID_KEY_C: key = letter(HID_KEY_C, U'c', U'ć', U'Ć'); break;
+            case HID_KEY_E: key = letter(HID_KEY_E, U'e', U'ę', U'Ę'); break;
+            case HID_KEY_L: key = letter(HID_KEY_L, U'l', U'ł', U'Ł'); break;
+            case HID_KEY_N: key = letter(HID_KEY_N, U'n', U'ń', U'Ń'); break;
+            case HID_KEY_O: key = letter(HID_KEY_O, U'o', U'ó', U'Ó'); break;
+            case HID_KEY_S: key = letter(HID_KEY_S, U's', U'ś', U'Ś'); break;
+            case HID_KEY_U: key = letter(HID_KEY_U, U'u', U'€'); break;
+            case HID_KEY_X: key = letter(HID_KEY_X, U'x', U'ź', U'Ź'); break;
+            case HID_KEY_Z: key = letter(HID_KEY_Z, U'z', U'ż', U'Ż'); break;
+            default: break;
+        }
+    }
+    return keys;
+}();
+
+// Generated lookup tables ===
+
+constexpr auto US_TABLE = generateTable<US_KEYS, NO_COMPOSITIONS>();
+constexpr auto DE_TABLE = generateTable<DE_KEYS, DE_COMPOSITIONS>();
+constexpr auto FR_TABLE = generateTable<FR_KEYS, FR_COMPOSITIONS>();
+constexpr auto PL_TABLE = generateTable<PL_KEYS, NO_COMPOSITIONS>();
+
+// The US layout must type exactly the same keys as the TinyUSB conversion table used previously
+constexpr bool isMatchingTinyUsbTable() {
+    constexpr uint8_t asciiToKeycode[128][2] = { HID_ASCII_TO_KEYCODE };
+
+    for (char32_t chr = U' '; chr < U'\x7F'; ++chr) {
+        const auto mapping = std::lower_bound(US_TABLE.begin(), US_TABLE.end(), chr, [](const KeyMapping &lhs, char32_t rhs) {
+            return lhs.codePoint < rhs;
+        });
+        if ((mapping == US_TABLE.end()) || (mapping->codePoint != chr) ||
+            (mapping->key.keyCode != asciiToKeycode[chr][1u]) || ((mapping->key.modifier != 0u) != (asciiToKeycode[chr][0u] != 0u))) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(isMatchingTinyUsbTable(), "US layout does not match the TinyUSB ASCII conversion table");
+
+constexpr std::array<KeyboardLayout, static_cast<std::size_t>(KeyboardLayout::Id::LayoutNum)> layouts = {{
+    {"US", US_TABLE},
+    {"DE", DE_TABLE},
+    {"FR", FR_TABLE},
+    {"PL", PL_TABLE},
+}};
+
+} // namespace
+
+const KeyboardLayout *KeyboardLayout::get(KeyboardLayout::Id id) {
+    if (id >= Id::LayoutNum) {
+        return nullptr;
+    }
+
+    return &layouts[static_cast<std::size_t>(id)];
+}
+
+const char *KeyboardLayout::getName() const {
+    return name;
+}
+
+const KeyboardLayout::KeyMapping *KeyboardLayout::find(char32_t codePoint) const {
+    // Mappings are sorted by code point during the table generation
+    auto it = std::lower_bound(mappings.begin(), mappings.end(), codePoint, [](const KeyMapping &lhs, char32_t rhs) {
+        return lhs.codePoint < rhs;
+    });
+
+    if (it == mappings.end() || it->codePoint != codePoint) {
+        return nullptr;
+    }
+
+    return &(*it);
+}
+
+std::optional<char32_t> KeyboardLayout::findCodePoint(const KeyReport &key) const {
+    auto it = std::find_if(mappings.begin(), mappings.end(), [&key](const KeyMapping &mapping) {
+        return (0u == mapping.deadKey.keyCode) && (mapping.key == key);
+    });
+
+    if (it == mappings.end()) {
+        return std::nullopt;
+    }
+
+    return it->codePoint;
+}
+
+ErrorCode KeyboardLayout::encode(std::string_view utf8, std::pmr::vector<KeyReport> &reports) const {
+    std::size_t idx = 0u;
+
+    while (idx < utf8.size()) {
+        auto codePoint = decodeUtf8(utf8, idx);
+        if (!codePoint) {
+            LOGE("Invalid UTF-8 sequence at byte %zu", idx);
+            return ErrorCode::InvalidArgument;
+        }
+
+        const KeyMapping *mapping = find(*codePoint);
+        if (!mapping) {
+            LOGE("Character U+%04X is not available in the %s keyboard layout", static_cast<unsigned int>(*codePoint), name);
+            return ErrorCode::InvalidArgument;
+        }
+
+        if (mapping->deadKey.keyCode) {
+            reports.push_back(mapping->deadKey);
+        }
+        reports.push_back(mapping->key);
+    }
+
+    return ErrorCode::Success;
+}
+
+ErrorCode KeyboardLayout::decode(std::span<const KeyReport> reports, std::string &utf8) const {
+    std::size_t idx = 0u;
+
+    while (idx < reports.size()) {
+        // Check the dead key sequences first, as the dead key on its own does not produce any character
+        if (idx + 1u < reports.size()) {
+            auto it = std::find_if(mappings.begin(), mappings.end(), [&reports, idx](const KeyMapping &mapping) {
+                return (mapping.deadKey.keyCode != 0u) && (mapping.deadKey == reports[idx]) && (mapping.key == reports[idx + 1u]);
+            });
+
+            if (it != mappings.end()) {
+                encodeUtf8(it->codePoint, utf8);
+                idx += 2u;
+                continue;
+            }
+        }
+
+        auto codePoint = findCodePoint(reports[idx]);
+        if (!codePoint) {
+            LOGE("Key report (modifier: 0x%02X, key code: 0x%02X) does not produce a character in the %s keyboard layout",
+                reports[idx].modifier, reports[idx].keyCode, name);
+            return ErrorCode::InvalidArgument;
+        }
+
+        encodeUtf8(*codePoint, utf8);
+        ++idx;
+    }
+
+    return ErrorCode::Success;
+}
+
+std::optional<char32_t> KeyboardLayout::decodeUtf8(std::string_view input, std::size_t &idx) {
+    const uint8_t leadByte = static_cast<uint8_t>(input[idx++]);
+
+    if (leadByte < 0x80u) {
+        return leadByte;
+    }
+
+    std::size_t continuationNum = 0u;
+    char32_t codePoint = 0u;
+    char32_t minCodePoint = 0u;
+
+    if ((leadByte & 0xE0u) == 0xC0u) {
+        continuationNum = 1u;
+        codePoint = leadByte & 0x1Fu;
+        minCodePoint = 0x80u;
+    }
+    else if ((leadByte & 0xF0u) == 0xE0u) {
+        continuationNum = 2u;
+        codePoint = leadByte & 0x0Fu;
+        minCodePoint = 0x800u;
+    }
+    else if ((leadByte & 0xF8u) == 0xF0u) {
+        continuationNum = 3u;
+        codePoint = leadByte & 0x07u;
+        minCodePoint = 0x10000u;
+    }
+    else {
+        return std::nullopt;
+    }
+
+    for (std::size_t byteIdx = 0u; byteIdx < continuationNum; ++byteIdx) {
+        if (idx >= input.size()) {
+            return std::nullopt;
+        }
+
+        const uint8_t continuationByte = static_cast<uint8_t>(input[idx++]);
+        if ((continuationByte & 0xC0u) != 0x80u) {
+            return std::nullopt;
+        }
+
+        codePoint = (codePoint << 6u) | (continuationByte & 0x3Fu);
+    }
+
+    // Reject overlong encodings, surrogates and values outside of the Unicode range
+    if ((codePoint < minCodePoint) || (codePoint > 0x10FFFFu) || ((codePoint >= 0xD800u) && (codePoint <= 0xDFFFu))) {
+        return std::nullopt;
+    }
+
+    return codePoint;
+}
+
+void KeyboardLayout::encodeUtf8(char32_t codePoint, std::string &output) {
+    if (codePoint < 0x80u) {
+        output += static_cast<char>(codePoint);
+    }
+    else if (codePoint < 0x800u) {
+        output += static_cast<char>(0xC0u | (codePoint >> 6u));
+        output += static_cast<char>(0x80u | (codePoint & 0x3Fu));
+    }
+    else if (codePoint < 0x10000u) {
+        output += static_cast<char>(0xE0u | (codePoint >> 12u));
+        output += static_cast<char>(0x80u | ((codePoint >> 6u) & 0x3Fu));
+        output += static_cast<char>(0x80u | (codePoint & 0x3Fu));
+    }
+    else {
+        output += static_cast<char>(0xF0u | (codePoint >> 18u));
+        output += static_cast<char>(0x80u | ((codePoint >> 12u) & 0x3Fu));
+        output += static_cast<char>(0x80u | ((codePoint >> 6u) & 0x3Fu));
+        output += static_cast<char>(0x80u | (codePoint & 0x3Fu));
+    }
+}
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <ctime>
+#include <algorithm>
 
 #include "Logger.hpp"
 #include "Utils.hpp"
@@ -20,7 +21,7 @@ const std::array<std::string, static_cast<size_t>(Logger::Level::LevelNum)> Logg
     MAG "CRI" RESET
 };
 
-Logger::Logger() : level(Logger::Level::Debug) {}
+Logger::Logger() : level(Logger::Level::Debug), sink(nullptr) {}
 
 Logger& Logger::get() {
     static Logger *instance = new Logger();
@@ -61,6 +62,17 @@ void Logger::log(Logger::Level level, const char *fmt, ...) {
     vprintf(fmt, args);
     va_end(args);
     printf("\n");
+
+    Sink currentSink = sink.load(std::memory_order_acquire);
+    if(currentSink != nullptr) {
+        char message[SINK_MESSAGE_SIZE];
+        va_start(args, fmt);
+        int length = vsnprintf(message, sizeof(message), fmt, args);
+        va_end(args);
+        if(length > 0) {
+            currentSink(level, std::string_view(message, std::min(static_cast<size_t>(length), sizeof(message) - 1u)));
+        }
+    }
 }
 
 void Logger::setLevel(Logger::Level newLevel) {
@@ -71,3 +83,7 @@ void Logger::setLevel(Logger::Level newLevel) {
 
     level = newLevel;
 }
+
+void Logger::setSink(Sink newSink) {
+    sink.store(newSink, std::memory_order_release);
+}
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include "Metrics.hpp"
+#include "PowerManager.hpp"
+#include "Logger.hpp"
+
+const std::array<Metrics::HeapCaps, Metrics::HEAP_CAPS_NUM> Metrics::heapCaps = {{
+    {"default", MALLOC_CAP_DEFAULT},
+    {"internal", MALLOC_CAP_INTERNAL},
+    {"dma", MALLOC_CAP_DMA},
+}};
+
+const std::array<const char *, static_cast<std::size_t>(Metrics::Counter::CounterNum)> Metrics::counterNames = {
+    "http_requests_total",
+    "script_parses_total",
+    "script_runs_total",
+    "script_parse_time_us_total",
+    "cdc_logs_dropped_total"
+};
+
+void Metrics::printLine(std::pmr::string &output, const char *name, const char *labelName, const char *label, uint64_t value) {
+    char line[MAX_LINE_LENGTH];
+    int length = 0;
+
+    if (labelName) {
+        length = std::snprintf(line, sizeof(line), "%s{%s=\"%s\"} %" PRIu64 "\n", name, labelName, label, value);
+    }
+    else {
+        length = std::snprintf(line, sizeof(line), "%s %" PRIu64 "\n", name, value);
+    }
+
+    if (length > 0) {
+        output.append(line, std::min(static_cast<std::size_t>(length), sizeof(line) - 1u));
+    }
+}
+
+ErrorCode Metrics::print(std::pmr::string &output) {
+    printLine(output, "uptime_us", nullptr, nullptr, static_cast<uint64_t>(esp_timer_get_time()));
+    printLine(output, "cpu_freq_mhz", nullptr, nullptr, PowerManager::getCpuFrequency());
+
+    for (const auto &heap : heapCaps) {
+        const std::size_t freeSize = heap_caps_get_free_size(heap.caps);
+        const std::size_t largestBlock = heap_caps_get_largest_free_block(heap.caps);
+        printLine(output, "heap_free_bytes", "caps", heap.name, freeSize);
+        printLine(output, "heap_min_free_bytes", "caps", heap.name, heap_caps_get_minimum_free_size(heap.caps));
+        printLine(output, "heap_largest_block_bytes", "caps", heap.name, largestBlock);
+        if (freeSize > 0u) {
+            // Share of the free memory which is not available for the largest allocation
+            printLine(output, "heap_fragmentation_percent", "caps", heap.name, 100u - (static_cast<uint64_t>(largestBlock) * 100u) / freeSize);
+        }
+    }
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    UBaseType_t taskNum = uxTaskGetNumberOfTasks() + TASK_NUM_MARGIN;
+    auto tasks = std::make_unique<TaskStatus_t[]>(taskNum);
+    configRUN_TIME_COUNTER_TYPE totalRunTime = 0u;
+
+    taskNum = uxTaskGetSystemState(tasks.get(), taskNum, &totalRunTime);
+    if (taskNum == 0u) {
+        LOGE("Failed to read the state of the tasks");
+        return ErrorCode::GeneralError;
+    }
+
+    for (UBaseType_t idx = 0u; idx < taskNum; idx++) {
+        const TaskStatus_t &task = tasks[idx];
+        // The stack depth of the ESP-IDF tasks is specified in bytes
+        printLine(output, "task_stack_free_min_bytes", "task", task.pcTaskName, task.usStackHighWaterMark);
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        printLine(output, "task_runtime_us", "task", task.pcTaskName, task.ulRunTimeCounter);
+        if (totalRunTime > 0u) {
+            // The total run time is measured per core, while the tasks may run on any of them
+            printLine(output, "task_cpu_percent", "task", task.pcTaskName,
+                (static_cast<uint64_t>(task.ulRunTimeCounter) * 100u) / (static_cast<uint64_t>(totalRunTime) * CONFIG_FREERTOS_NUMBER_OF_CORES));
+        }
+#endif
+    }
+#else
+    // Only the current task can be reported without the trace facility
+    printLine(output, "task_stack_free_min_bytes", "task", pcTaskGetName(nullptr), uxTaskGetStackHighWaterMark(nullptr));
+#endif
+
+    for (std::size_t idx = 0u; idx < counters.size(); idx++) {
+        printLine(output, counterNames[idx], nullptr, nullptr, counters[idx].load(std::memory_order_relaxed));
+    }
+
+    return ErrorCode::Success;
+}
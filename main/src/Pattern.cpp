@@ -0,0 +1,400 @@
+#include <algorithm>
+
+#include "Pattern.hpp"
+
+namespace {
+    bool isSpace(char chr) {
+        return (chr == ' ') || (chr == '\t') || (chr == '\n') || (chr == '\r') || (chr == '\f') || (chr == '\v');
+    }
+
+    bool isDigit(char chr) {
+        return (chr >= '0') && (chr <= '9');
+    }
+
+    // Matches the character against the escape sequence following the backslash
+    bool matchEscape(char escape, char chr) {
+        switch (escape) {
+            case 's': return isSpace(chr);
+            case 'S': return !isSpace(chr);
+            case 'd': return isDigit(chr);
+            case 'D': return !isDigit(chr);
+            case 'n': return chr == '\n';
+            case 't': return chr == '\t';
+            case 'r': return chr == '\r';
+            default:  return chr == escape;
+        }
+    }
+
+    const char *skipClass(const char *position) {
+        position++;
+        if (*position == '^') {
+            position++;
+        }
+        while ((*position != '\0') && (*position != ']')) {
+            position += ((position[0] == '\\') && (position[1] != '\0')) ? 2u : 1u;
+        }
+        return (*position == ']') ? position + 1u : position;
+    }
+
+    bool matchClass(const char *position, char chr) {
+        position++;
+        bool isNegated = false;
+        if (*position == '^') {
+            isNegated = true;
+            position++;
+        }
+
+        bool isMatched = false;
+        while ((*position != '\0') && (*position != ']')) {
+            if ((position[0] == '\\') && (position[1] != '\0')) {
+                isMatched = isMatched || matchEscape(position[1], chr);
+                position += 2u;
+            }
+            else if ((position[1] == '-') && (position[2] != ']') && (position[2] != '\0')) {
+                isMatched = isMatched || ((chr >= position[0]) && (chr <= position[2]));
+                position += 3u;
+            }
+            else {
+                isMatched = isMatched || (chr == position[0]);
+                position++;
+            }
+        }
+
+        return isMatched != isNegated;
+    }
+}
+
+std::size_t Pattern::SubMatch::length() const {
+    return matched ? static_cast<std::size_t>(second - first) : 0u;
+}
+
+std::string Pattern::SubMatch::str() const {
+    return matched ? std::string(first, second) : std::string();
+}
+
+std::size_t Pattern::Match::size() const {
+    return groupNum;
+}
+
+const Pattern::SubMatch &Pattern::Match::operator[](std::size_t idx) const {
+    static const SubMatch unmatched{nullptr, nullptr, false};
+    return (idx < groupNum) ? groups[idx] : unmatched;
+}
+
+const char *Pattern::skipAtom(const char *atom) {
+    switch (*atom) {
+        case '(': {
+            const char *position = atom + 1u;
+            std::size_t level = 1u;
+            while ((*position != '\0') && (level > 0u)) {
+                if ((position[0] == '\\') && (position[1] != '\0')) {
+                    position += 2u;
+                }
+                else if (*position == '[') {
+                    position = skipClass(position);
+                }
+                else {
+                    level += (*position == '(') ? 1u : 0u;
+                    level -= (*position == ')') ? 1u : 0u;
+                    position++;
+                }
+            }
+            return position;
+        }
+        case '[': {
+            return skipClass(atom);
+        }
+        case '\\': {
+            return (atom[1] != '\0') ? atom + 2u : atom + 1u;
+        }
+        default: {
+            return atom + 1u;
+        }
+    }
+}
+
+const char *Pattern::parseQuantifier(const char *quantifier, Quantifier &result) {
+    result = {1u, 1u, false};
+
+    switch (*quantifier) {
+        case '*': {
+            result = {0u, UNBOUNDED, false};
+            quantifier++;
+            break;
+        }
+        case '+': {
+            result = {1u, UNBOUNDED, false};
+            quantifier++;
+            break;
+        }
+        case '?': {
+            result = {0u, 1u, false};
+            quantifier++;
+            break;
+        }
+        case '{': {
+            const char *position = quantifier + 1u;
+            uint32_t min = 0u;
+            uint32_t max = 0u;
+            while (isDigit(*position)) {
+                min = std::min<uint32_t>(min * 10u + static_cast<uint32_t>(*position - '0'), UNBOUNDED);
+                position++;
+            }
+            if (*position == ',') {
+                position++;
+                if (*position == '}') {
+                    max = UNBOUNDED;
+                }
+                while (isDigit(*position)) {
+                    max = std::min<uint32_t>(max * 10u + static_cast<uint32_t>(*position - '0'), UNBOUNDED);
+                    position++;
+                }
+            }
+            else {
+                max = min;
+            }
+            if ((*position != '}') || (max < min)) {
+                // Not a quantifier - the brace is matched as a literal
+                return quantifier;
+            }
+
+            result = {static_cast<uint16_t>(min), static_cast<uint16_t>(max), false};
+            quantifier = position + 1u;
+            break;
+        }
+        default: {
+            return quantifier;
+        }
+    }
+
+    if (*quantifier == '?') {
+        result.isLazy = true;
+        quantifier++;
+    }
+
+    return quantifier;
+}
+
+bool Pattern::isSequenceEnd(const char *position) {
+    return (*position == '\0') || (*position == ')') || (*position == '|');
+}
+
+bool Pattern::isCharacterAtom(const char *atom) {
+    return (*atom != '(') && (*atom != '^') && !isSequenceEnd(atom);
+}
+
+bool Pattern::isCharacterGroup(const char *group) {
+    // Each alternative of the group has to be a single character atom without a quantifier
+    const char *position = group + 1u;
+    while (isCharacterAtom(position)) {
+        position = skipAtom(position);
+        if (*position == ')') {
+            return true;
+        }
+        if (*position != '|') {
+            return false;
+        }
+        position++;
+    }
+    return false;
+}
+
+bool Pattern::matchCharacter(const char *atom, char chr) {
+    switch (*atom) {
+        case '(': {
+            // Group of single character alternatives
+            const char *position = atom + 1u;
+            while (isCharacterAtom(position)) {
+                if (matchCharacter(position, chr)) {
+                    return true;
+                }
+                position = skipAtom(position);
+                position += (*position == '|') ? 1u : 0u;
+            }
+            return false;
+        }
+        case '[': {
+            return matchClass(atom, chr);
+        }
+        case '\\': {
+            return matchEscape(atom[1], chr);
+        }
+        case '.': {
+            return chr != '\n';
+        }
+        default: {
+            return chr == *atom;
+        }
+    }
+}
+
+std::size_t Pattern::getGroupIndex(const char *group) const {
+    std::size_t groupIdx = 0u;
+    const char *position = pattern;
+    while ((*position != '\0') && (position <= group)) {
+        if ((position[0] == '\\') && (position[1] != '\0')) {
+            position += 2u;
+        }
+        else if (*position == '[') {
+            position = skipClass(position);
+        }
+        else {
+            if (*position == '(') {
+                groupIdx++;
+            }
+            position++;
+        }
+    }
+    return groupIdx;
+}
+
+std::size_t Pattern::getGroupNum() const {
+    return getGroupIndex(pattern + std::char_traits<char>::length(pattern));
+}
+
+std::size_t Pattern::matchRepeated(const char *atom, const char *input, const char *end, std::size_t max) const {
+    std::size_t count = 0u;
+    while ((count < max) && (input + count < end) && matchCharacter(atom, input[count])) {
+        count++;
+    }
+    return count;
+}
+
+bool Pattern::matchSequence(Matcher &matcher, const char *position, const char *input, const Continuation *continuation) const {
+    if (matcher.depth >= MAX_DEPTH) {
+        // Too complex input for the stack - treated as a mismatch
+        return false;
+    }
+
+    if (isSequenceEnd(position)) {
+        if (!continuation) {
+            matcher.matchEnd = input;
+            return true;
+        }
+        return resumeGroup(matcher, *continuation, input);
+    }
+
+    if (*position == '^') {
+        return (input == matcher.begin) && matchSequence(matcher, position + 1u, input, continuation);
+    }
+
+    Quantifier quantifier{};
+    const char *next = parseQuantifier(skipAtom(position), quantifier);
+
+    matcher.depth++;
+    bool isMatched = false;
+
+    if ((*position == '(') && !isCharacterGroup(position)) {
+        isMatched = matchGroup(matcher, position, quantifier, next, 0u, input, continuation);
+    }
+    else {
+        // Single character atoms are repeated in place, so that the recursion does not depend on the input length
+        const std::size_t groupIdx = (*position == '(') ? getGroupIndex(position) : 0u;
+        const std::size_t count = matchRepeated(position, input, matcher.end, quantifier.max);
+
+        for (std::size_t idx = 0u; !isMatched && (idx + quantifier.min <= count); idx++) {
+            const std::size_t repetitions = quantifier.isLazy ? (quantifier.min + idx) : (count - idx);
+            SubMatch saved{};
+            if ((groupIdx > 0u) && (groupIdx < MAX_GROUPS)) {
+                saved = matcher.groups[groupIdx];
+                if (repetitions > 0u) {
+                    // The group captures its last iteration
+                    matcher.groups[groupIdx] = {input + repetitions - 1u, input + repetitions, true};
+                }
+            }
+
+            isMatched = matchSequence(matcher, next, input + repetitions, continuation);
+
+            if (!isMatched && (groupIdx > 0u) && (groupIdx < MAX_GROUPS)) {
+                matcher.groups[groupIdx] = saved;
+            }
+        }
+    }
+
+    matcher.depth--;
+    return isMatched;
+}
+
+bool Pattern::matchGroup(Matcher &matcher, const char *group, const Quantifier &quantifier, const char *next,
+    std::size_t count, const char *input, const Continuation *parent) const {
+    auto iterate = [&]() {
+        if (count >= quantifier.max) {
+            return false;
+        }
+
+        const Continuation continuation{group, next, quantifier, count + 1u, input, parent};
+        const char *alternative = group + 1u;
+        for (;;) {
+            if (matchSequence(matcher, alternative, input, &continuation)) {
+                return true;
+            }
+
+            while (!isSequenceEnd(alternative)) {
+                alternative = skipAtom(alternative);
+            }
+            if (*alternative != '|') {
+                return false;
+            }
+            alternative++;
+        }
+    };
+    auto leave = [&]() {
+        return (count >= quantifier.min) && matchSequence(matcher, next, input, parent);
+    };
+
+    return quantifier.isLazy ? (leave() || iterate()) : (iterate() || leave());
+}
+
+bool Pattern::resumeGroup(Matcher &matcher, const Continuation &continuation, const char *input) const {
+    const std::size_t groupIdx = getGroupIndex(continuation.group);
+    SubMatch saved{};
+    if (groupIdx < MAX_GROUPS) {
+        saved = matcher.groups[groupIdx];
+        matcher.groups[groupIdx] = {continuation.iterationStart, input, true};
+    }
+
+    // An empty iteration would repeat forever - the group is left instead
+    const bool isMatched = (input == continuation.iterationStart) ?
+        matchSequence(matcher, continuation.next, input, continuation.parent) :
+        matchGroup(matcher, continuation.group, continuation.quantifier, continuation.next, continuation.count, input, continuation.parent);
+
+    if (!isMatched && (groupIdx < MAX_GROUPS)) {
+        matcher.groups[groupIdx] = saved;
+    }
+    return isMatched;
+}
+
+bool Pattern::search(const char *begin, const char *end, Match &match) const {
+    Matcher matcher{begin, end, nullptr, {}, 0u};
+
+    for (const char *start = begin; start <= end; start++) {
+        // Alternatives of the whole pattern
+        const char *alternative = pattern;
+        for (;;) {
+            matcher.groups = {};
+            matcher.depth = 0u;
+            if (matchSequence(matcher, alternative, start, nullptr)) {
+                match.groups = matcher.groups;
+                match.groups[0u] = {start, matcher.matchEnd, true};
+                match.groupNum = std::min(getGroupNum() + 1u, MAX_GROUPS);
+                return true;
+            }
+
+            while (!isSequenceEnd(alternative)) {
+                alternative = skipAtom(alternative);
+            }
+            if (*alternative != '|') {
+                break;
+            }
+            alternative++;
+        }
+
+        if (*pattern == '^') {
+            // Anchored pattern may only match at the beginning
+            break;
+        }
+    }
+
+    match.groupNum = 0u;
+    return false;
+}
@@ -0,0 +1,45 @@
+#include <array>
+#include <string>
+#include <vector>
+
+#include "PayloadRom.hpp"
+#include "Logger.hpp"
+
+#if !CONFIG_ESP_DUCKY_PAYLOAD_ROM
+namespace {
+constexpr std::array<PayloadRom::Slot, 0u> slotTable{};
+} // namespace
+
+const std::span<const PayloadRom::Slot> PayloadRom::slots = slotTable;
+#endif
+
+std::size_t PayloadRom::count() {
+    return slots.size();
+}
+
+const PayloadRom::Slot *PayloadRom::get(std::size_t slotIdx) {
+    if (slotIdx >= slots.size()) {
+        return nullptr;
+    }
+
+    return &slots[slotIdx];
+}
+
+std::optional<Script> PayloadRom::load(std::size_t slotIdx) {
+    const Slot *slot = get(slotIdx);
+    if (!slot) {
+        LOGE("Payload ROM slot %zu does not exist (%zu slots)", slotIdx, slots.size());
+        return std::nullopt;
+    }
+
+    std::vector<std::string> variableNames(slot->variableNames.begin(), slot->variableNames.end());
+    std::vector<Script::Function> functions{};
+    functions.reserve(slot->functions.size());
+    for (const auto &function : slot->functions) {
+        functions.push_back({function.name, function.address});
+    }
+
+    // The bytecode was validated by the compiler, only the copy to the RAM remains
+    return Script(std::vector<uint8_t>(slot->code.begin(), slot->code.end()), std::move(variableNames), std::move(functions),
+        slot->layoutId);
+}
@@ -0,0 +1,78 @@
+#include <cinttypes>
+#include <utility>
+
+#include "soc/rtc.h"
+
+#include "PowerManager.hpp"
+#include "Logger.hpp"
+
+std::array<esp_pm_lock_handle_t, static_cast<std::size_t>(PowerManager::Lock::LockNum)> PowerManager::locks = {};
+
+PowerManager::Scope::Scope(Lock lock)
+:lock(lock)
+{
+    acquire(lock);
+}
+
+PowerManager::Scope::~Scope() {
+    release(lock);
+}
+
+ErrorCode PowerManager::init() {
+#if CONFIG_ESP_DUCKY_POWER_MANAGEMENT
+    const esp_pm_config_t config = {
+        .max_freq_mhz = MAX_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_ESP_DUCKY_MIN_CPU_FREQ_MHZ,
+#if CONFIG_ESP_DUCKY_LIGHT_SLEEP
+        .light_sleep_enable = true
+#else
+        .light_sleep_enable = false
+#endif
+    };
+    esp_err_t ret = esp_pm_configure(&config);
+    if (ESP_OK != ret) {
+        LOGE("Failed to configure the power management with error: (%s)", esp_err_to_name(ret));
+        return ErrorCode::GeneralError;
+    }
+
+    const std::array<std::pair<esp_pm_lock_type_t, const char *>, static_cast<std::size_t>(Lock::LockNum)> lockTypes = {{
+        {ESP_PM_CPU_FREQ_MAX, "cpu_freq_max"},
+        {ESP_PM_NO_LIGHT_SLEEP, "no_light_sleep"},
+    }};
+    for (std::size_t lockIdx = 0u; lockIdx < locks.size(); lockIdx++) {
+        ret = esp_pm_lock_create(lockTypes[lockIdx].first, 0, lockTypes[lockIdx].second, &locks[lockIdx]);
+        if (ESP_OK != ret) {
+            LOGE("Failed to create the '%s' power management lock with error: (%s)", lockTypes[lockIdx].second, esp_err_to_name(ret));
+            return ErrorCode::GeneralError;
+        }
+    }
+
+    LOGI("Power management enabled: %d - %d MHz, light sleep %s", CONFIG_ESP_DUCKY_MIN_CPU_FREQ_MHZ, MAX_CPU_FREQ_MHZ,
+        config.light_sleep_enable ? "enabled" : "disabled");
+#else
+    LOGI("Power management disabled, the CPU runs at %" PRIu32 " MHz", getCpuFrequency());
+#endif
+
+    return ErrorCode::Success;
+}
+
+void PowerManager::acquire(Lock lock) {
+    // The locks are not created if the power management is disabled
+    esp_pm_lock_handle_t handle = locks[static_cast<std::size_t>(lock)];
+    if (handle) {
+        (void)esp_pm_lock_acquire(handle);
+    }
+}
+
+void PowerManager::release(Lock lock) {
+    esp_pm_lock_handle_t handle = locks[static_cast<std::size_t>(lock)];
+    if (handle) {
+        (void)esp_pm_lock_release(handle);
+    }
+}
+
+uint32_t PowerManager::getCpuFrequency() {
+    rtc_cpu_freq_config_t config{};
+    rtc_clk_cpu_freq_get_config(&config);
+    return config.freq_mhz;
+}
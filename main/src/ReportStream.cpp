@@ -0,0 +1,132 @@
+#include <algorithm>
+
+#include "esp_timer.h"
+
+#include "ReportStream.hpp"
+#include "Logger.hpp"
+
+namespace {
+    uint32_t readDelay(const uint8_t *record) {
+        return static_cast<uint32_t>(record[4u]) | (static_cast<uint32_t>(record[5u]) << 8u) |
+            (static_cast<uint32_t>(record[6u]) << 16u) | (static_cast<uint32_t>(record[7u]) << 24u);
+    }
+}
+
+ReportStream::ReportStream()
+:records()
+{}
+
+void ReportStream::addReport(std::span<const uint8_t> keyCodes, uint8_t modifier) {
+    records.push_back(modifier);
+    records.push_back(0u);
+    for (std::size_t keyIdx = 0u; keyIdx < KEY_CODE_NUM; ++keyIdx) {
+        records.push_back((keyIdx < keyCodes.size()) ? keyCodes[keyIdx] : 0u);
+    }
+}
+
+void ReportStream::addDelay(uint32_t delay) {
+    if (0u == delay) {
+        return;
+    }
+
+    // Extend the previous marker unless its delay would overflow
+    if (!records.empty()) {
+        uint8_t *last = &records[records.size() - RECORD_SIZE];
+        const uint32_t lastDelay = readDelay(last);
+        if ((DELAY_MARKER == last[1u]) && (delay <= UINT32_MAX - lastDelay)) {
+            delay += lastDelay;
+            records.resize(records.size() - RECORD_SIZE);
+        }
+    }
+
+    records.insert(records.end(), {0u, DELAY_MARKER, 0u, 0u});
+    for (std::size_t byteIdx = 0u; byteIdx < sizeof(delay); ++byteIdx) {
+        records.push_back(static_cast<uint8_t>(delay >> (8u * byteIdx)));
+    }
+}
+
+void ReportStream::addKeyStroke(std::span<const uint8_t> keyCodes, uint8_t modifier, uint32_t delay) {
+    addReport(keyCodes, modifier);
+    addDelay(delay);
+    addReport({});
+    addDelay(delay);
+}
+
+bool ReportStream::isFull() const {
+    return records.size() >= MAX_SIZE;
+}
+
+std::span<const uint8_t> ReportStream::getData() const {
+    return records;
+}
+
+bool ReportStream::isValid(std::span<const uint8_t> stream) {
+    if (0u != (stream.size() % RECORD_SIZE)) {
+        return false;
+    }
+
+    for (std::size_t offset = 0u; offset < stream.size(); offset += RECORD_SIZE) {
+        const uint8_t *record = &stream[offset];
+        if ((0u != record[1u]) && ((DELAY_MARKER != record[1u]) || (0u != record[0u]) || (0u != record[2u]) || (0u != record[3u]))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint64_t ReportStream::getDuration(std::span<const uint8_t> stream) {
+    uint64_t duration = 0u;
+    for (std::size_t offset = 0u; offset + RECORD_SIZE <= stream.size(); offset += RECORD_SIZE) {
+        if (DELAY_MARKER == stream[offset + 1u]) {
+            duration += readDelay(&stream[offset]);
+        }
+    }
+
+    return duration;
+}
+
+bool ReportStream::waitUntil(UsbDevice &usbDevice, int64_t deadline) {
+    // Sleep in the polling interval steps, so that the abort request is handled before the next report
+    for (int64_t now = esp_timer_get_time(); now < deadline; now = esp_timer_get_time()) {
+        if (usbDevice.hidIsAborted()) {
+            return false;
+        }
+        Utils::delay(static_cast<uint32_t>(std::min<int64_t>((deadline - now) / 1000, UsbDevice::HID_POLLING_INTERVAL)));
+    }
+
+    return !usbDevice.hidIsAborted();
+}
+
+ErrorCode ReportStream::play(UsbDevice &usbDevice, std::span<const uint8_t> stream) {
+    if (!isValid(stream)) {
+        LOGE("Invalid report stream of %zu bytes", stream.size());
+        return ErrorCode::InvalidArgument;
+    }
+
+    // The deadlines are measured from the start, so the time spent sending a report does not delay the following ones
+    int64_t deadline = esp_timer_get_time();
+    for (std::size_t offset = 0u; offset < stream.size(); offset += RECORD_SIZE) {
+        const uint8_t *record = &stream[offset];
+        if (DELAY_MARKER == record[1u]) {
+            deadline += 1000 * static_cast<int64_t>(readDelay(record));
+            continue;
+        }
+
+        if (!waitUntil(usbDevice, deadline)) {
+            // No key may stay pressed after the stream is stopped
+            usbDevice.hidSendKeyboardReport({});
+            LOGW("Report stream aborted by the user at offset %zu", offset);
+            return ErrorCode::Aborted;
+        }
+        usbDevice.hidSendKeyboardReport(std::span<const uint8_t>(&record[2u], KEY_CODE_NUM), record[0u]);
+    }
+
+    // The delay after the last report, e.g. the DEFAULT_DELAY, is part of the stream as well
+    if (!waitUntil(usbDevice, deadline)) {
+        usbDevice.hidSendKeyboardReport({});
+        return ErrorCode::Aborted;
+    }
+
+    return ErrorCode::Success;
+}
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include "RequestArena.hpp"
+#include "Logger.hpp"
+
+std::atomic<RequestArena *> RequestArena::active{nullptr};
+std::atomic<TaskHandle_t> RequestArena::activeTask{nullptr};
+
+RequestArena::Scope::Scope(RequestArena &arena)
+:arena(arena)
+{
+    activeTask.store(xTaskGetCurrentTaskHandle(), std::memory_order_relaxed);
+    active.store(&arena, std::memory_order_release);
+}
+
+RequestArena::Scope::~Scope() {
+    active.store(nullptr, std::memory_order_release);
+    activeTask.store(nullptr, std::memory_order_relaxed);
+    arena.release();
+}
+
+bool RequestArena::Upstream::owns(const void *ptr) const {
+    const auto *bytePtr = static_cast<const std::byte *>(ptr);
+    return std::any_of(chunks.begin(), chunks.begin() + chunkNum, [bytePtr](const Chunk &chunk) {
+        return (bytePtr >= chunk.ptr) && (bytePtr < chunk.ptr + chunk.size);
+    });
+}
+
+void *RequestArena::Upstream::do_allocate(std::size_t bytes, std::size_t alignment) {
+    if ((chunkNum >= MAX_CHUNKS) || (bytes > MAX_SIZE - size)) {
+        LOGE("Request exceeds the arena limit of %zu bytes", MAX_SIZE);
+        throw std::bad_alloc();
+    }
+
+    auto *ptr = static_cast<std::byte *>(::operator new(bytes, std::align_val_t(alignment)));
+    chunks[chunkNum++] = {ptr, bytes};
+    size += bytes;
+    return ptr;
+}
+
+void RequestArena::Upstream::do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) {
+    auto chunk = std::find_if(chunks.begin(), chunks.begin() + chunkNum, [ptr](const Chunk &chunk) {
+        return chunk.ptr == ptr;
+    });
+    if (chunk != chunks.begin() + chunkNum) {
+        *chunk = chunks[--chunkNum];
+        size -= bytes;
+    }
+
+    ::operator delete(ptr, bytes, std::align_val_t(alignment));
+}
+
+bool RequestArena::Upstream::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+RequestArena::RequestArena()
+:initialBuffer(std::make_unique<std::byte[]>(INITIAL_SIZE)),
+upstream(),
+resource(initialBuffer.get(), INITIAL_SIZE, &upstream),
+usage(0u),
+peakUsage(0u)
+{}
+
+bool RequestArena::owns(const void *ptr) const {
+    const auto *bytePtr = static_cast<const std::byte *>(ptr);
+    return ((bytePtr >= initialBuffer.get()) && (bytePtr < initialBuffer.get() + INITIAL_SIZE)) || upstream.owns(ptr);
+}
+
+void RequestArena::release() {
+    LOGD("Releasing %zu bytes of the request arena, peak usage: %zu bytes", usage, peakUsage);
+    resource.release();
+    usage = 0u;
+}
+
+void *RequestArena::do_allocate(std::size_t bytes, std::size_t alignment) {
+    void *ptr = resource.allocate(bytes, alignment);
+    usage += bytes;
+    peakUsage = std::max(peakUsage, usage);
+    return ptr;
+}
+
+void RequestArena::do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) {
+    // The memory is only released with the whole arena
+    (void)ptr;
+    (void)bytes;
+    (void)alignment;
+}
+
+bool RequestArena::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+std::pmr::memory_resource *RequestArena::getResource() {
+    RequestArena *arena = active.load(std::memory_order_acquire);
+    if (arena && (activeTask.load(std::memory_order_relaxed) == xTaskGetCurrentTaskHandle())) {
+        return arena;
+    }
+    return std::pmr::get_default_resource();
+}
+
+void *RequestArena::jsonAllocate(std::size_t size) {
+    std::pmr::memory_resource *resource = getResource();
+    if (resource == std::pmr::get_default_resource()) {
+        return std::malloc(size);
+    }
+
+    try {
+        return resource->allocate(size, alignof(std::max_align_t));
+    }
+    catch (const std::bad_alloc &) {
+        // cJSON reports the allocation failures with the null pointer
+        return nullptr;
+    }
+}
+
+void RequestArena::jsonDeallocate(void *ptr) {
+    RequestArena *arena = active.load(std::memory_order_acquire);
+    if (!ptr || (arena && arena->owns(ptr))) {
+        return;
+    }
+    std::free(ptr);
+}
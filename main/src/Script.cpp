@@ -1,11 +1,577 @@
-#include <bits/stdc++.h>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "Script.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "ReportStream.hpp"
+#include "TextCodec.hpp"
+
+namespace {
+    // Records of the serialized format used before the bytecode was introduced
+    enum class LegacyCommand : std::uint8_t {
+        StringWrite,
+        KeyStroke,
+        Delay,
+        KeyReportWrite,
+        Layout
+    };
+
+    // Conditions of the WAIT_FOR_<LED>_<CONDITION> commands
+    enum class LedCondition : std::uint8_t {
+        On,
+        Off,
+        Change,
+        ConditionNum
+    };
+
+    constexpr std::array<const char *, static_cast<std::size_t>(LedCondition::ConditionNum)> ledConditionNames = {
+        "ON",
+        "OFF",
+        "CHANGE"
+    };
+
+    struct OperatorInfo {
+        Script::Opcode opcode;
+        const char *token;
+        uint8_t precedence;
+    };
+
+    // Binary operators with C-like precedence - the higher value binds stronger
+    constexpr std::array<OperatorInfo, 18u> binaryOperators = {{
+        {Script::Opcode::LogicalOr, "||", 1u},
+        {Script::Opcode::LogicalAnd, "&&", 2u},
+        {Script::Opcode::BitwiseOr, "|", 3u},
+        {Script::Opcode::BitwiseXor, "^", 4u},
+        {Script::Opcode::BitwiseAnd, "&", 5u},
+        {Script::Opcode::Equal, "==", 6u},
+        {Script::Opcode::NotEqual, "!=", 6u},
+        {Script::Opcode::Less, "<", 7u},
+        {Script::Opcode::Greater, ">", 7u},
+        {Script::Opcode::LessEqual, "<=", 7u},
+        {Script::Opcode::GreaterEqual, ">=", 7u},
+        {Script::Opcode::ShiftLeft, "<<", 8u},
+        {Script::Opcode::ShiftRight, ">>", 8u},
+        {Script::Opcode::Add, "+", 9u},
+        {Script::Opcode::Subtract, "-", 9u},
+        {Script::Opcode::Multiply, "*", 10u},
+        {Script::Opcode::Divide, "/", 10u},
+        {Script::Opcode::Modulo, "%", 10u},
+    }};
+
+    constexpr uint8_t UNARY_PRECEDENCE = 11u;
+    constexpr uint8_t PRIMARY_PRECEDENCE = 12u;
+
+    const OperatorInfo *findBinaryOperator(Script::Opcode opcode) {
+        const auto it = std::find_if(binaryOperators.begin(), binaryOperators.end(), [opcode](const OperatorInfo &op) {
+            return op.opcode == opcode;
+        });
+        return (it != binaryOperators.end()) ? &(*it) : nullptr;
+    }
+
+    uint16_t readU16(const uint8_t *data) {
+        return static_cast<uint16_t>(data[0u] | (data[1u] << 8u));
+    }
+
+    uint32_t readU32(const uint8_t *data) {
+        return static_cast<uint32_t>(data[0u]) | (static_cast<uint32_t>(data[1u]) << 8u) |
+            (static_cast<uint32_t>(data[2u]) << 16u) | (static_cast<uint32_t>(data[3u]) << 24u);
+    }
+
+    // Reads the next UTF-8 character of the packed text - empty at the end of the text or on the invalid sequence
+    std::optional<char32_t> readCodePoint(TextCodec::Decoder &decoder) {
+        std::array<char, 4u> sequence{};
+        const auto leadByte = decoder.next();
+        if (!leadByte) {
+            return std::nullopt;
+        }
+
+        sequence[0u] = *leadByte;
+        const uint8_t lead = static_cast<uint8_t>(*leadByte);
+        const std::size_t length = (lead < 0xC0u) ? 1u : ((lead < 0xE0u) ? 2u : ((lead < 0xF0u) ? 3u : 4u));
+        for (std::size_t byteIdx = 1u; byteIdx < length; ++byteIdx) {
+            const auto continuationByte = decoder.next();
+            if (!continuationByte) {
+                return std::nullopt;
+            }
+            sequence[byteIdx] = *continuationByte;
+        }
+
+        std::size_t idx = 0u;
+        return KeyboardLayout::decodeUtf8(std::string_view(sequence.data(), length), idx);
+    }
+
+    bool isIdentifierStart(char chr) {
+        return std::isalpha(static_cast<unsigned char>(chr)) || (chr == '_');
+    }
+
+    bool isIdentifierChar(char chr) {
+        return std::isalnum(static_cast<unsigned char>(chr)) || (chr == '_');
+    }
+
+    // Evaluates the binary operator - returns nothing if the result is undefined
+    std::optional<int32_t> evaluate(Script::Opcode opcode, int32_t lhs, int32_t rhs) {
+        // Wrap around on overflow like the unsigned arithmetic does
+        const uint32_t ulhs = static_cast<uint32_t>(lhs);
+        const uint32_t urhs = static_cast<uint32_t>(rhs);
+
+        switch (opcode) {
+            case Script::Opcode::Add: return static_cast<int32_t>(ulhs + urhs);
+            case Script::Opcode::Subtract: return static_cast<int32_t>(ulhs - urhs);
+            case Script::Opcode::Multiply: return static_cast<int32_t>(ulhs * urhs);
+            case Script::Opcode::Divide: {
+                if (rhs == 0) {
+                    return std::nullopt;
+                }
+                return ((lhs == INT32_MIN) && (rhs == -1)) ? INT32_MIN : (lhs / rhs);
+            }
+            case Script::Opcode::Modulo: {
+                if (rhs == 0) {
+                    return std::nullopt;
+                }
+                return ((lhs == INT32_MIN) && (rhs == -1)) ? 0 : (lhs % rhs);
+            }
+            case Script::Opcode::Equal: return lhs == rhs;
+            case Script::Opcode::NotEqual: return lhs != rhs;
+            case Script::Opcode::Less: return lhs < rhs;
+            case Script::Opcode::Greater: return lhs > rhs;
+            case Script::Opcode::LessEqual: return lhs <= rhs;
+            case Script::Opcode::GreaterEqual: return lhs >= rhs;
+            case Script::Opcode::LogicalAnd: return (lhs != 0) && (rhs != 0);
+            case Script::Opcode::LogicalOr: return (lhs != 0) || (rhs != 0);
+            case Script::Opcode::BitwiseAnd: return lhs & rhs;
+            case Script::Opcode::BitwiseOr: return lhs | rhs;
+            case Script::Opcode::BitwiseXor: return lhs ^ rhs;
+            case Script::Opcode::ShiftLeft: return static_cast<int32_t>(ulhs << (urhs & 31u));
+            case Script::Opcode::ShiftRight: return lhs >> (urhs & 31u);
+            default: return std::nullopt;
+        }
+    }
+}
+
+struct Script::Compiler {
+    enum class BlockType : uint8_t {
+        If,
+        Else,
+        While,
+        Function
+    };
+
+    struct Block {
+        BlockType type;
+        std::size_t jumpIdx;                    // Index of the address operand patched when the block ends
+        uint16_t loopAddress;                   // Address of the WHILE condition
+        std::vector<std::size_t> endJumpIdxs;   // ELSE jumps of the ELSE IF chain patched at END_IF
+    };
+
+    const KeyboardLayout &layout;
+    // Memory of the temporary data, which is released together with the compiler
+    std::pmr::memory_resource *resource;
+    std::pmr::vector<uint8_t> code;
+    std::vector<std::string> variableNames;
+    std::vector<Function> functions;
+    std::vector<bool> isFunctionDefined;
+    std::pmr::vector<Block> blocks;
+
+    // Address of the statement being compiled and of the last statement which may be repeated
+    uint16_t statementAddress;
+    std::optional<uint16_t> repeatAddress;
+    // Last value passed to setRepeatable by the statement being compiled
+    std::optional<bool> repeatableChange;
+
+    // State of the expression being compiled
+    std::string_view expression;
+    std::size_t expressionIdx;
+    std::size_t stackDepth;
+    std::size_t maxStackDepth;
+
+    Compiler(const KeyboardLayout &layout, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+    :layout(layout),
+    resource(resource),
+    code(resource),
+    variableNames(),
+    functions(),
+    isFunctionDefined(),
+    blocks(resource),
+    statementAddress(0u),
+    repeatAddress(std::nullopt),
+    repeatableChange(std::nullopt),
+    expression(),
+    expressionIdx(0u),
+    stackDepth(0u),
+    maxStackDepth(0u)
+    {}
+
+    uint16_t getAddress() const {
+        // Scripts exceeding the address range are rejected at the end of parsing
+        return static_cast<uint16_t>(code.size());
+    }
+
+    // REPEAT may follow only simple statements, so the repeated code never jumps out of the loop
+    void setRepeatable(bool isRepeatable) {
+        repeatAddress = isRepeatable ? std::optional<uint16_t>(statementAddress) : std::nullopt;
+        repeatableChange = isRepeatable;
+    }
+
+    void emit(Opcode opcode) {
+        code.push_back(static_cast<uint8_t>(opcode));
+    }
+
+    void emitU8(uint8_t value) {
+        code.push_back(value);
+    }
+
+    void emitU16(uint16_t value) {
+        code.push_back(static_cast<uint8_t>(value));
+        code.push_back(static_cast<uint8_t>(value >> 8u));
+    }
+
+    void emitU32(uint32_t value) {
+        for (std::size_t byteIdx = 0u; byteIdx < sizeof(value); ++byteIdx) {
+            code.push_back(static_cast<uint8_t>(value >> (8u * byteIdx)));
+        }
+    }
+
+    // Emits the jump instruction and returns the index of its address operand
+    std::size_t emitJump(Opcode opcode, uint16_t address = 0u) {
+        emit(opcode);
+        const std::size_t jumpIdx = code.size();
+        emitU16(address);
+        return jumpIdx;
+    }
+
+    void patchJump(std::size_t jumpIdx, uint16_t address) {
+        code[jumpIdx] = static_cast<uint8_t>(address);
+        code[jumpIdx + 1u] = static_cast<uint8_t>(address >> 8u);
+    }
+
+    void emitPush(int32_t value) {
+        if ((value >= INT8_MIN) && (value <= INT8_MAX)) {
+            emit(Opcode::PushByte);
+            emitU8(static_cast<uint8_t>(value));
+        }
+        else {
+            emit(Opcode::Push);
+            emitU32(static_cast<uint32_t>(value));
+        }
+    }
+
+    void emitKeyReports(std::span<const KeyboardLayout::KeyReport> reports) {
+        // Split very long strings, so the count fits into the operand
+        while (!reports.empty()) {
+            const auto chunk = reports.first(std::min<std::size_t>(reports.size(), UINT16_MAX));
+            emit(Opcode::KeyReports);
+            emitU16(static_cast<uint16_t>(chunk.size()));
+            for (const auto &report : chunk) {
+                emitU8(report.modifier);
+                emitU8(report.keyCode);
+            }
+            reports = reports.subspan(chunk.size());
+        }
+    }
+
+    // Emits the text of STRING packed if it is enabled and smaller than its key reports
+    void emitText(std::string_view text, std::span<const KeyboardLayout::KeyReport> reports) {
+#if CONFIG_ESP_DUCKY_STRING_COMPRESSION
+        if ((text.size() <= UINT16_MAX) && (reports.size() <= UINT16_MAX)) {
+            std::pmr::vector<uint8_t> packed(resource);
+            TextCodec::compress(text, packed);
+            if ((packed.size() <= UINT16_MAX) && (7u + packed.size() < 3u + (2u * reports.size()))) {
+                emit(Opcode::PackedText);
+                emitU16(static_cast<uint16_t>(reports.size()));
+                emitU16(static_cast<uint16_t>(text.size()));
+                emitU16(static_cast<uint16_t>(packed.size()));
+                code.insert(code.end(), packed.begin(), packed.end());
+                return;
+            }
+        }
+#endif
+        emitKeyReports(reports);
+    }
+
+    void emitKeyStroke(std::span<const uint8_t> keyCodes) {
+        emit(Opcode::KeyStroke);
+        emitU8(static_cast<uint8_t>(keyCodes.size()));
+        code.insert(code.end(), keyCodes.begin(), keyCodes.end());
+    }
+
+    // Splits the movement into reports within the delta limit, keeping the path straight
+    void emitMouseMove(int32_t x, int32_t y) {
+        const int32_t stepNum = std::max(getMouseStepNum(x), getMouseStepNum(y));
+        emit(Opcode::MouseMove);
+        emitU16(static_cast<uint16_t>(stepNum));
+        for (int32_t stepIdx = 1; stepIdx <= stepNum; ++stepIdx) {
+            emitU8(static_cast<uint8_t>(((x * stepIdx) / stepNum) - ((x * (stepIdx - 1)) / stepNum)));
+            emitU8(static_cast<uint8_t>(((y * stepIdx) / stepNum) - ((y * (stepIdx - 1)) / stepNum)));
+        }
+    }
+
+    void emitMouseScroll(int32_t distance) {
+        const int32_t stepNum = getMouseStepNum(distance);
+        emit(Opcode::MouseScroll);
+        emitU16(static_cast<uint16_t>(stepNum));
+        for (int32_t stepIdx = 1; stepIdx <= stepNum; ++stepIdx) {
+            emitU8(static_cast<uint8_t>(((distance * stepIdx) / stepNum) - ((distance * (stepIdx - 1)) / stepNum)));
+        }
+    }
+
+    static int32_t getMouseStepNum(int32_t distance) {
+        return (std::abs(distance) + UsbDevice::HID_MOUSE_MAX_DELTA - 1) / UsbDevice::HID_MOUSE_MAX_DELTA;
+    }
+
+    void emitDelay(uint32_t delay) {
+        emit(Opcode::Delay);
+        emitU32(delay);
+    }
+
+    std::optional<uint8_t> findVariable(std::string_view name) const {
+        const auto it = std::find(variableNames.begin(), variableNames.end(), name);
+        if (it == variableNames.end()) {
+            return std::nullopt;
+        }
+        return static_cast<uint8_t>(std::distance(variableNames.begin(), it));
+    }
+
+    std::optional<uint8_t> declareVariable(const std::string &name) {
+        if (findVariable(name)) {
+            LOGE("Variable '$%s' is already declared", name.c_str());
+            return std::nullopt;
+        }
+        if (variableNames.size() >= MAX_VARIABLES) {
+            LOGE("Too many variables - at most %zu are supported", MAX_VARIABLES);
+            return std::nullopt;
+        }
+        if (name.size() > MAX_NAME_LENGTH) {
+            LOGE("Variable name '$%.32s...' is longer than %zu characters", name.c_str(), MAX_NAME_LENGTH);
+            return std::nullopt;
+        }
+
+        variableNames.push_back(name);
+        return static_cast<uint8_t>(variableNames.size() - 1u);
+    }
+
+    // Returns the index of the function, adding it to the table if it is called before the definition
+    std::optional<uint8_t> getFunction(const std::string &name) {
+        const auto it = std::find_if(functions.begin(), functions.end(), [&name](const Function &function) {
+            return function.name == name;
+        });
+        if (it != functions.end()) {
+            return static_cast<uint8_t>(std::distance(functions.begin(), it));
+        }
+        if (functions.size() >= MAX_FUNCTIONS) {
+            LOGE("Too many functions - at most %zu are supported", MAX_FUNCTIONS);
+            return std::nullopt;
+        }
+        if (name.size() > MAX_NAME_LENGTH) {
+            LOGE("Function name '%.32s...' is longer than %zu characters", name.c_str(), MAX_NAME_LENGTH);
+            return std::nullopt;
+        }
+
+        functions.push_back({name, 0u});
+        isFunctionDefined.push_back(false);
+        return static_cast<uint8_t>(functions.size() - 1u);
+    }
+
+    // Compiles the integer expression, which leaves its value on the operand stack
+    ErrorCode compileExpression(std::string_view input) {
+        expression = input;
+        expressionIdx = 0u;
+        stackDepth = 0u;
+        maxStackDepth = 0u;
+
+        auto errorCode = compileBinary(0u);
+        if (errorCode != ErrorCode::Success) {
+            return errorCode;
+        }
+
+        skipWhitespace();
+        if (expressionIdx < expression.size()) {
+            LOGE("Unexpected character '%c' in expression '%.*s'", expression[expressionIdx], static_cast<int>(expression.size()), expression.data());
+            return ErrorCode::InvalidArgument;
+        }
+        if (maxStackDepth > STACK_SIZE) {
+            LOGE("Expression '%.*s' is too complex", static_cast<int>(expression.size()), expression.data());
+            return ErrorCode::InvalidArgument;
+        }
+
+        return ErrorCode::Success;
+    }
+
+private:
+    void skipWhitespace() {
+        while ((expressionIdx < expression.size()) && ((expression[expressionIdx] == ' ') || (expression[expressionIdx] == '\t'))) {
+            ++expressionIdx;
+        }
+    }
+
+    void pushOperand() {
+        maxStackDepth = std::max(maxStackDepth, ++stackDepth);
+    }
+
+    const OperatorInfo *peekBinaryOperator() {
+        skipWhitespace();
+
+        // Prefer the longest matching token, so '<<' is not taken for '<'
+        const OperatorInfo *found = nullptr;
+        for (const auto &op : binaryOperators) {
+            const std::string_view token(op.token);
+            if ((expression.substr(expressionIdx, token.size()) == token) &&
+                (!found || (token.size() > std::strlen(found->token)))) {
+                found = &op;
+            }
+        }
+
+        return found;
+    }
+
+    ErrorCode compileBinary(uint8_t minPrecedence) {
+        auto errorCode = compileUnary();
+        if (errorCode != ErrorCode::Success) {
+            return errorCode;
+        }
+
+        for (const OperatorInfo *op = peekBinaryOperator(); op && (op->precedence >= minPrecedence); op = peekBinaryOperator()) {
+            expressionIdx += std::strlen(op->token);
+
+            // Operators with the same precedence are left associative
+            errorCode = compileBinary(op->precedence + 1u);
+            if (errorCode != ErrorCode::Success) {
+                return errorCode;
+            }
+
+            emit(op->opcode);
+            --stackDepth;
+        }
+
+        return ErrorCode::Success;
+    }
+
+    std::optional<uint32_t> parseNumber() {
+        int base = 10;
+        if ((expression.substr(expressionIdx, 2u) == "0x") || (expression.substr(expressionIdx, 2u) == "0X")) {
+            base = 16;
+            expressionIdx += 2u;
+        }
+
+        uint64_t value = 0u;
+        const char *begin = expression.data() + expressionIdx;
+        const auto result = std::from_chars(begin, expression.data() + expression.size(), value, base);
+        if ((result.ec != std::errc()) || (value > UINT32_MAX)) {
+            LOGE("Invalid number in expression '%.*s'", static_cast<int>(expression.size()), expression.data());
+            return std::nullopt;
+        }
+
+        expressionIdx += static_cast<std::size_t>(result.ptr - begin);
+        return static_cast<uint32_t>(value);
+    }
 
-const uint8_t Script::asciiToKeycodeConvTable[ASCII_CHAR_NUM][ASCII_CONV_TABLE_DIM_NUM] = { HID_ASCII_TO_KEYCODE };
-const uint8_t Script::keycodeToAsciiConvTable[ASCII_CHAR_NUM][ASCII_CONV_TABLE_DIM_NUM] = { HID_KEYCODE_TO_ASCII };
+    ErrorCode compileUnary() {
+        skipWhitespace();
+        if (expressionIdx >= expression.size()) {
+            LOGE("Unexpected end of expression '%.*s'", static_cast<int>(expression.size()), expression.data());
+            return ErrorCode::InvalidArgument;
+        }
+
+        const char chr = expression[expressionIdx];
+
+        if ((chr == '!') || (chr == '-')) {
+            ++expressionIdx;
+            skipWhitespace();
+
+            if ((chr == '-') && (expressionIdx < expression.size()) && std::isdigit(static_cast<unsigned char>(expression[expressionIdx]))) {
+                // Negative literals are folded into a single constant
+                auto value = parseNumber();
+                if (!value) {
+                    return ErrorCode::InvalidArgument;
+                }
+                emitPush(static_cast<int32_t>(0u - *value));
+                pushOperand();
+                return ErrorCode::Success;
+            }
+
+            auto errorCode = compileUnary();
+            if (errorCode != ErrorCode::Success) {
+                return errorCode;
+            }
+            emit((chr == '!') ? Opcode::LogicalNot : Opcode::Negate);
+            return ErrorCode::Success;
+        }
+
+        if (chr == '(') {
+            ++expressionIdx;
+            auto errorCode = compileBinary(0u);
+            if (errorCode != ErrorCode::Success) {
+                return errorCode;
+            }
+
+            skipWhitespace();
+            if ((expressionIdx >= expression.size()) || (expression[expressionIdx] != ')')) {
+                LOGE("Missing ')' in expression '%.*s'", static_cast<int>(expression.size()), expression.data());
+                return ErrorCode::InvalidArgument;
+            }
+            ++expressionIdx;
+            return ErrorCode::Success;
+        }
+
+        if (std::isdigit(static_cast<unsigned char>(chr))) {
+            auto value = parseNumber();
+            if (!value) {
+                return ErrorCode::InvalidArgument;
+            }
+            emitPush(static_cast<int32_t>(*value));
+            pushOperand();
+            return ErrorCode::Success;
+        }
+
+        // Variables start with '$', the other identifiers are the boolean constants
+        const bool isVariable = (chr == '$');
+        const std::size_t nameIdx = expressionIdx + (isVariable ? 1u : 0u);
+        std::size_t nameEndIdx = nameIdx;
+        if ((nameEndIdx < expression.size()) && isIdentifierStart(expression[nameEndIdx])) {
+            while ((nameEndIdx < expression.size()) && isIdentifierChar(expression[nameEndIdx])) {
+                ++nameEndIdx;
+            }
+        }
+
+        const std::string_view name = expression.substr(nameIdx, nameEndIdx - nameIdx);
+        if (name.empty()) {
+            LOGE("Unexpected character '%c' in expression '%.*s'", chr, static_cast<int>(expression.size()), expression.data());
+            return ErrorCode::InvalidArgument;
+        }
+        expressionIdx = nameEndIdx;
+
+        if (isVariable) {
+            auto variableIdx = findVariable(name);
+            if (!variableIdx) {
+                LOGE("Variable '$%.*s' is not declared", static_cast<int>(name.size()), name.data());
+                return ErrorCode::InvalidArgument;
+            }
+            emit(Opcode::Load);
+            emitU8(*variableIdx);
+        }
+        else if ((name == "TRUE") || (name == "FALSE")) {
+            emitPush((name == "TRUE") ? 1 : 0);
+        }
+        else {
+            LOGE("Unknown identifier '%.*s' in expression", static_cast<int>(name.size()), name.data());
+            return ErrorCode::InvalidArgument;
+        }
 
+        pushOperand();
+        return ErrorCode::Success;
+    }
+};
 
 std::array<Script::SpecialKey, Script::SPECIAL_KEY_NUM> Script::specialKeys = {{
     {"UP", HID_KEY_ARROW_UP},//
@@ -52,39 +618,52 @@ std::array<Script::SpecialKey, Script::SPECIAL_KEY_NUM> Script::specialKeys = {{
     {"CONTROL", HID_KEY_CONTROL_LEFT},
     {"SHIFT", HID_KEY_SHIFT_LEFT},
     {"ALT", HID_KEY_ALT_LEFT},
+    {"ALTGR", HID_KEY_ALT_RIGHT},
     {"GUI", HID_KEY_GUI_LEFT},
     {"WINDOWS", HID_KEY_GUI_LEFT},
     {"COMMAND", HID_KEY_GUI_LEFT},
 }};
 
+std::array<Script::MouseButton, Script::MOUSE_BUTTON_NUM> Script::mouseButtons = {{
+    {"LEFT", MOUSE_BUTTON_LEFT},
+    {"RIGHT", MOUSE_BUTTON_RIGHT},
+    {"MIDDLE", MOUSE_BUTTON_MIDDLE},
+}};
+
+std::array<Script::LockLed, Script::LOCK_LED_NUM> Script::lockLeds = {{
+    {"CAPS", KEYBOARD_LED_CAPSLOCK},
+    {"NUM", KEYBOARD_LED_NUMLOCK},
+    {"SCROLL", KEYBOARD_LED_SCROLLLOCK},
+}};
+
 std::array<Script::ExpressionHandler, Script::EXPRESSIONS_NUM> Script::expressionHandlers = {{
     { // EMPTY LINE
-        R"(^( |\t)*?\n)", 
-        [](std::smatch &match, Script::CommandVector &commands) {
+        R"(^( |\t)*?\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
             // Do nothing - empty line is ignored
             LOGD("=== Processing empty line ===");
             return ErrorCode::Success;
         }
     },
     { // REM
-        R"(^( |\t)*?REM ([\s\S]*?)\n)", 
-        [](std::smatch &match, Script::CommandVector &commands) {
+        R"(^( |\t)*?REM ([\s\S]*?)\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
             // Do nothing - comment is ignored
             LOGD("=== Processing REM expression ===");
             return ErrorCode::Success;
         }
     },
     { // REM_BLOCK
-        R"(^( |\t)*?REM_BLOCK ([\s\S]*?)END_REM( |\t)*\n)", 
-        [](std::smatch &match, Script::CommandVector &commands) {
+        R"(^( |\t)*?REM_BLOCK ([\s\S]*?)END_REM( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
             // Do nothing - comment is ignored
             LOGD("=== Processing REM_BLOCK expression ===");
             return ErrorCode::Success;
         }
     },
     { // STRING
-        R"(^( |\t)*?STRING ([\s\S]+?)\n)", 
-        [](std::smatch &match, Script::CommandVector &commands) {
+        R"(^( |\t)*?STRING ([\s\S]+?)\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
             // The regex should match the string command and parameter without ignoring leading and trailing spaces
             // The parameter should be available in the match group with index 2
             LOGD("=== Processing STRING expression ===");
@@ -94,13 +673,21 @@ std::array<Script::ExpressionHandler, Script::EXPRESSIONS_NUM> Script::expressio
             }
 
             LOGD("STRING parameter: '%s'", match[2u].str().c_str());
-            commands.emplace_back(Script::Command::StringWrite, std::string(match[2u].str()));
+            const std::string_view text(match[2u].first, match[2u].length());
+            std::pmr::vector<KeyboardLayout::KeyReport> reports(compiler.resource);
+            if (compiler.layout.encode(text, reports) != ErrorCode::Success) {
+                LOGE("Failed to encode STRING parameter with the %s keyboard layout", compiler.layout.getName());
+                return ErrorCode::InvalidArgument;
+            }
+
+            compiler.emitText(text, reports);
+            compiler.setRepeatable(true);
             return ErrorCode::Success;
         }
     },
     { // STRINGLN
-        R"(^( |\t)*?STRINGLN ([\s\S]+?)\n)", 
-        [](std::smatch &match, Script::CommandVector &commands) {
+        R"(^( |\t)*?STRINGLN ([\s\S]+?)\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
             // The regex should match the stringln command and parameter without ignoring leading and trailing spaces
             // The parameter should be available in the match group with index 2
             LOGD("=== Processing STRINGLN expression ===");
@@ -110,14 +697,23 @@ std::array<Script::ExpressionHandler, Script::EXPRESSIONS_NUM> Script::expressio
             }
 
             LOGD("STRINGLN parameter: '%s'", match[2u].str().c_str());
-            commands.emplace_back(Script::Command::StringWrite, std::string(match[2u].str()));
-            commands.emplace_back(Script::Command::KeyStroke, std::vector<uint8_t>{HID_KEY_ENTER});
+            const std::string_view text(match[2u].first, match[2u].length());
+            std::pmr::vector<KeyboardLayout::KeyReport> reports(compiler.resource);
+            if (compiler.layout.encode(text, reports) != ErrorCode::Success) {
+                LOGE("Failed to encode STRINGLN parameter with the %s keyboard layout", compiler.layout.getName());
+                return ErrorCode::InvalidArgument;
+            }
+
+            const uint8_t enterKeyCode = HID_KEY_ENTER;
+            compiler.emitText(text, reports);
+            compiler.emitKeyStroke({&enterKeyCode, 1u});
+            compiler.setRepeatable(true);
             return ErrorCode::Success;
         }
     },
     { // DELAY
-        R"(^( |\t)*?DELAY (([1-9]+[0-9]*)|0)( |\t)*?\n)", 
-        [](std::smatch &match, Script::CommandVector &commands) {
+        R"(^( |\t)*?DELAY (([1-9][0-9]{0,8})|0)( |\t)*?\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
             // The regex should match the delay command and parameter and ignore leading and trailing spaces
             // The parameter should be available in the match group with index 2
             LOGD("=== Processing DELAY expression ===");
@@ -127,120 +723,583 @@ std::array<Script::ExpressionHandler, Script::EXPRESSIONS_NUM> Script::expressio
             }
 
             LOGD("DELAY parameter: '%s'", match[2u].str().c_str());
-            commands.emplace_back(Script::Command::Delay, static_cast<uint32_t>(std::stoul(match[2u].str())));
+            compiler.emitDelay(static_cast<uint32_t>(std::stoul(match[2u].str())));
+            compiler.setRepeatable(true);
             return ErrorCode::Success;
         }
     },
-    { // KEYSTROKE - SINGLE KEY
-        R"(^( |\t)*?([\S]+)( |\t)*?\n)", 
-        [](std::smatch &match, Script::CommandVector &commands) {
-            // The regex should match a single key and ignore leading and trailing spaces
-            // The key should be available in the match group with index 2
-            LOGD("=== Processing single key expression ===");
-            if (match.size() < 3u) {
-                LOGE("Invalid number of match groups for single key expression: %zu", match.size());
+    { // DEFAULT_DELAY
+        R"(^( |\t)*?(DEFAULT_DELAY|DEFAULTDELAY)( |\t)+([^\n]+)\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The delay expression should be available in the match group with index 4
+            LOGD("=== Processing DEFAULT_DELAY expression ===");
+            if (match.size() < 5u) {
+                LOGE("Invalid number of match groups for DEFAULT_DELAY expression: %zu", match.size());
                 return ErrorCode::GeneralError;
             }
 
-            LOGD("Single key parameter: '%s'", match[2u].str().c_str());
-            std::vector<uint8_t> keyCodes{};
-            auto errorCode = Script::parseKeyStroke(match[2u].str(), keyCodes);
+            LOGD("DEFAULT_DELAY parameter: '%s'", match[4u].str().c_str());
+            // The delay is evaluated at run time, so it may be changed by the script
+            auto errorCode = compiler.compileExpression(match[4u].str());
+            if (errorCode != ErrorCode::Success) {
+                return errorCode;
+            }
+
+            compiler.emit(Script::Opcode::SetDefaultDelay);
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+    { // STRING_DELAY
+        R"(^( |\t)*?(STRING_DELAY|STRINGDELAY)( |\t)+([^\n]+)\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The delay expression should be available in the match group with index 4
+            LOGD("=== Processing STRING_DELAY expression ===");
+            if (match.size() < 5u) {
+                LOGE("Invalid number of match groups for STRING_DELAY expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
 
+            LOGD("STRING_DELAY parameter: '%s'", match[4u].str().c_str());
+            auto errorCode = compiler.compileExpression(match[4u].str());
             if (errorCode != ErrorCode::Success) {
-                LOGE("Failed to parse key stroke: '%s'", match[2u].str().c_str());
                 return errorCode;
             }
-            if (keyCodes.empty()) {
-                // Should never happen...
-                LOGE("No key codes found for key: '%s'", match[2u].str().c_str());
+
+            compiler.emit(Script::Opcode::SetKeyDelay);
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+    { // REPEAT
+        R"(^( |\t)*?REPEAT( |\t)+(([1-9][0-9]{0,8})|0)( |\t)*?\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The repetition count should be available in the match group with index 3
+            LOGD("=== Processing REPEAT expression ===");
+            if (match.size() < 4u) {
+                LOGE("Invalid number of match groups for REPEAT expression: %zu", match.size());
                 return ErrorCode::GeneralError;
             }
+            if (!compiler.repeatAddress) {
+                LOGE("REPEAT must follow a command which can be repeated");
+                return ErrorCode::InvalidArgument;
+            }
 
-            // Add the key code to the command vector
-            commands.emplace_back(Script::Command::KeyStroke, std::move(keyCodes));
+            LOGD("REPEAT parameter: '%s'", match[3u].str().c_str());
+            // The previous statement is not duplicated - the loop jumps back to it instead
+            (void)compiler.emitJump(Script::Opcode::Repeat, *compiler.repeatAddress);
+            compiler.emitU32(static_cast<uint32_t>(std::stoul(match[3u].str())));
+            compiler.setRepeatable(false);
             return ErrorCode::Success;
         }
     },
-    { // KEYSTROKE - MULTIPLE KEYS
-        R"(^( |\t)*?(([\S]+ )+[\S]+)( |\t)*?\n)", 
-        [](std::smatch &match, Script::CommandVector &commands) {
-            // The regex should match a line containing multiple keys and ignore leading and trailing spaces
-            // The keys should be available in the match group with index 2
-            LOGD("=== Processing multiple keys expression ===");
-            if (match.size() < 3u) {
-                LOGE("Invalid number of match groups for multiple keys expression: %zu", match.size());
+    { // MOUSE_MOVE
+        R"(^( |\t)*?MOUSE_MOVE( |\t)+(-?[0-9]{1,5})( |\t)+(-?[0-9]{1,5})( |\t)*?\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The horizontal and vertical distance should be available in the match groups with index 3 and 5
+            LOGD("=== Processing MOUSE_MOVE expression ===");
+            if (match.size() < 6u) {
+                LOGE("Invalid number of match groups for MOUSE_MOVE expression: %zu", match.size());
                 return ErrorCode::GeneralError;
             }
 
-            LOGD("Multiple keys parameter: '%s'", match[2u].str().c_str());
-            std::vector<uint8_t> keyCodes{};
+            LOGD("MOUSE_MOVE parameters: '%s' '%s'", match[3u].str().c_str(), match[5u].str().c_str());
+            const int32_t x = std::stoi(match[3u].str());
+            const int32_t y = std::stoi(match[5u].str());
+            if ((std::abs(x) > Script::MAX_MOUSE_DISTANCE) || (std::abs(y) > Script::MAX_MOUSE_DISTANCE)) {
+                LOGE("MOUSE_MOVE distance exceeds %d", static_cast<int>(Script::MAX_MOUSE_DISTANCE));
+                return ErrorCode::InvalidArgument;
+            }
 
-            // Create a string stream from the matched string for parsing
-            std::stringstream keyStream(match[2u].str());
-            std::string keyName;
+            compiler.emitMouseMove(x, y);
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+    { // MOUSE_SCROLL
+        R"(^( |\t)*?MOUSE_SCROLL( |\t)+(-?[0-9]{1,5})( |\t)*?\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The scroll distance should be available in the match group with index 3, positive values scroll up
+            LOGD("=== Processing MOUSE_SCROLL expression ===");
+            if (match.size() < 4u) {
+                LOGE("Invalid number of match groups for MOUSE_SCROLL expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
 
-            while(keyCodes.size() < 6u)
-            {
+            LOGD("MOUSE_SCROLL parameter: '%s'", match[3u].str().c_str());
+            const int32_t distance = std::stoi(match[3u].str());
+            if (std::abs(distance) > Script::MAX_MOUSE_DISTANCE) {
+                LOGE("MOUSE_SCROLL distance exceeds %d", static_cast<int>(Script::MAX_MOUSE_DISTANCE));
+                return ErrorCode::InvalidArgument;
+            }
 
-                // Split the matched line by spaces
-                if(!getline(keyStream, keyName, ' '))
-                {
-                    // No more keys to process
-                    break;
-                }
+            compiler.emitMouseScroll(distance);
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+    { // MOUSE_CLICK
+        R"(^( |\t)*?MOUSE_CLICK( |\t)+(LEFT|RIGHT|MIDDLE)( |\t)*?\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The button name should be available in the match group with index 3
+            LOGD("=== Processing MOUSE_CLICK expression ===");
+            if (match.size() < 4u) {
+                LOGE("Invalid number of match groups for MOUSE_CLICK expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
 
-                LOGD("Parsing key: '%s'", keyName.c_str());
-                auto errorCode = Script::parseKeyStroke(keyName, keyCodes);
-                
-                if (errorCode != ErrorCode::Success) {
-                    LOGE("Failed to parse key stroke: '%s'", keyName.c_str());
-                    return errorCode;
-                }
-                if (keyCodes.empty()) {
-                    // Should never happen...
-                    LOGE("No key codes found for key: '%s'", keyName.c_str());
-                    return ErrorCode::GeneralError;
-                }
+            LOGD("MOUSE_CLICK parameter: '%s'", match[3u].str().c_str());
+            auto it = std::find_if(Script::mouseButtons.begin(), Script::mouseButtons.end(), [&match](const Script::MouseButton &button) {
+                return button.name == match[3u].str();
+            });
+            if (it == Script::mouseButtons.end()) {
+                // Should never happen...
+                LOGE("Unknown mouse button: '%s'", match[3u].str().c_str());
+                return ErrorCode::GeneralError;
             }
 
-            // Add the key code to the command vector
-            commands.emplace_back(Script::Command::KeyStroke, std::move(keyCodes));
+            compiler.emit(Script::Opcode::MouseClick);
+            compiler.emitU8(it->buttons);
+            compiler.setRepeatable(true);
             return ErrorCode::Success;
         }
     },
-}};
+    { // WAIT_FOR_<LED>_<CONDITION>
+        R"(^( |\t)*?WAIT_FOR_(CAPS|NUM|SCROLL)_(ON|OFF|CHANGE)(( |\t)+([1-9][0-9]{0,8}))?( |\t)*?\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The LED name should be available in the match group with index 2, the condition with index 3
+            // and the optional timeout with index 6
+            LOGD("=== Processing WAIT_FOR expression ===");
+            if (match.size() < 7u) {
+                LOGE("Invalid number of match groups for WAIT_FOR expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
 
-ErrorCode Script::parseAscii(const char chr, std::vector<uint8_t> &keyCodes) {
-    uint8_t chrIdx = static_cast<uint8_t>(chr);
-    // Check if the key is mappable to a ASCII character
-    if (chrIdx >= ASCII_CHAR_NUM) {
-        // Character is not mappable to a key code
-        LOGE("Character '%c' is not mappable to a key code", chr);
-        return ErrorCode::GeneralError;
-    }
-    // Check if it is an uppercase letter
-    if(asciiToKeycodeConvTable[chrIdx][0u]) {
-        // Check if the shift key is already in the vector
-        if (std::find(keyCodes.begin(), keyCodes.end(), HID_KEY_SHIFT_LEFT) == keyCodes.end()) {
-            // Add shift key code for uppercase
-            keyCodes.push_back(HID_KEY_SHIFT_LEFT);
-        }
-    }
+            LOGD("WAIT_FOR parameters: '%s' '%s' '%s'", match[2u].str().c_str(), match[3u].str().c_str(), match[6u].str().c_str());
+            auto ledIt = std::find_if(Script::lockLeds.begin(), Script::lockLeds.end(), [&match](const Script::LockLed &led) {
+                return led.name == match[2u].str();
+            });
+            auto conditionIt = std::find(ledConditionNames.begin(), ledConditionNames.end(), match[3u].str());
+            if ((ledIt == Script::lockLeds.end()) || (conditionIt == ledConditionNames.end())) {
+                // Should never happen...
+                LOGE("Unknown WAIT_FOR parameters: '%s' '%s'", match[2u].str().c_str(), match[3u].str().c_str());
+                return ErrorCode::GeneralError;
+            }
 
-    // Add the mapped key code
-    keyCodes.push_back(asciiToKeycodeConvTable[chrIdx][1u]);
-    return ErrorCode::Success;
+            compiler.emit(Script::Opcode::WaitForLed);
+            compiler.emitU8(ledIt->mask);
+            compiler.emitU8(static_cast<uint8_t>(std::distance(ledConditionNames.begin(), conditionIt)));
+            compiler.emitU32(match[6u].matched ? static_cast<uint32_t>(std::stoul(match[6u].str())) : 0u);
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+    { // SYNC_HOST
+        R"(^( |\t)*?SYNC_HOST(( |\t)+([1-9][0-9]{0,8}))?( |\t)*?\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The optional timeout should be available in the match group with index 4
+            LOGD("=== Processing SYNC_HOST expression ===");
+            if (match.size() < 5u) {
+                LOGE("Invalid number of match groups for SYNC_HOST expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
 
-}
+            LOGD("SYNC_HOST parameter: '%s'", match[4u].str().c_str());
+            compiler.emit(Script::Opcode::SyncHost);
+            compiler.emitU32(match[4u].matched ? static_cast<uint32_t>(std::stoul(match[4u].str())) : Script::DEFAULT_SYNC_TIMEOUT);
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+    { // VAR
+        R"(^( |\t)*?VAR( |\t)+\$([A-Za-z_][A-Za-z0-9_]*)( |\t)*=([^\n]+)\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The variable name should be available in the match group with index 3 and the initial value with index 5
+            LOGD("=== Processing VAR expression ===");
+            if (match.size() < 6u) {
+                LOGE("Invalid number of match groups for VAR expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
 
-ErrorCode Script::parseKeyStroke(const std::string &keyName, std::vector<uint8_t> &keyCodes) {
+            LOGD("VAR parameters: '%s' = '%s'", match[3u].str().c_str(), match[5u].str().c_str());
+            // The initial value is compiled first, so it cannot refer to the declared variable
+            auto errorCode = compiler.compileExpression(match[5u].str());
+            if (errorCode != ErrorCode::Success) {
+                return errorCode;
+            }
+
+            auto variableIdx = compiler.declareVariable(match[3u].str());
+            if (!variableIdx) {
+                return ErrorCode::InvalidArgument;
+            }
+
+            compiler.emit(Script::Opcode::Store);
+            compiler.emitU8(*variableIdx);
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+    { // ASSIGNMENT
+        R"(^( |\t)*?\$([A-Za-z_][A-Za-z0-9_]*)( |\t)*=([^\n]+)\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The variable name should be available in the match group with index 2 and the value with index 4
+            LOGD("=== Processing assignment expression ===");
+            if (match.size() < 5u) {
+                LOGE("Invalid number of match groups for assignment expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
+
+            LOGD("Assignment parameters: '%s' = '%s'", match[2u].str().c_str(), match[4u].str().c_str());
+            auto variableIdx = compiler.findVariable(match[2u].str());
+            if (!variableIdx) {
+                LOGE("Variable '$%s' is not declared", match[2u].str().c_str());
+                return ErrorCode::InvalidArgument;
+            }
+
+            auto errorCode = compiler.compileExpression(match[4u].str());
+            if (errorCode != ErrorCode::Success) {
+                return errorCode;
+            }
+
+            compiler.emit(Script::Opcode::Store);
+            compiler.emitU8(*variableIdx);
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+    { // ELSE IF
+        R"(^( |\t)*?ELSE( |\t)+IF( |\t)*(\([^\n]*\))( |\t)*THEN( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The condition should be available in the match group with index 4
+            LOGD("=== Processing ELSE IF expression ===");
+            if (match.size() < 5u) {
+                LOGE("Invalid number of match groups for ELSE IF expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
+            if (compiler.blocks.empty() || (compiler.blocks.back().type != Script::Compiler::BlockType::If)) {
+                LOGE("ELSE IF without matching IF");
+                return ErrorCode::InvalidArgument;
+            }
+
+            LOGD("ELSE IF condition: '%s'", match[4u].str().c_str());
+            auto &block = compiler.blocks.back();
+
+            // Leave the previous branch at the end of the block and continue with the next condition otherwise
+            block.endJumpIdxs.push_back(compiler.emitJump(Script::Opcode::Else));
+            compiler.patchJump(block.jumpIdx, compiler.getAddress());
+
+            auto errorCode = compiler.compileExpression(match[4u].str());
+            if (errorCode != ErrorCode::Success) {
+                return errorCode;
+            }
+
+            block.jumpIdx = compiler.emitJump(Script::Opcode::If);
+            compiler.setRepeatable(false);
+            return ErrorCode::Success;
+        }
+    },
+    { // IF
+        R"(^( |\t)*?IF( |\t)*(\([^\n]*\))( |\t)*THEN( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The condition should be available in the match group with index 3
+            LOGD("=== Processing IF expression ===");
+            if (match.size() < 4u) {
+                LOGE("Invalid number of match groups for IF expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
+
+            LOGD("IF condition: '%s'", match[3u].str().c_str());
+            auto errorCode = compiler.compileExpression(match[3u].str());
+            if (errorCode != ErrorCode::Success) {
+                return errorCode;
+            }
+
+            compiler.blocks.push_back({Script::Compiler::BlockType::If, compiler.emitJump(Script::Opcode::If), 0u, {}});
+            compiler.setRepeatable(false);
+            return ErrorCode::Success;
+        }
+    },
+    { // ELSE
+        R"(^( |\t)*?ELSE( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            LOGD("=== Processing ELSE expression ===");
+            if (compiler.blocks.empty() || (compiler.blocks.back().type != Script::Compiler::BlockType::If)) {
+                LOGE("ELSE without matching IF");
+                return ErrorCode::InvalidArgument;
+            }
+
+            auto &block = compiler.blocks.back();
+            const std::size_t jumpIdx = compiler.emitJump(Script::Opcode::Else);
+            compiler.patchJump(block.jumpIdx, compiler.getAddress());
+
+            block.type = Script::Compiler::BlockType::Else;
+            block.jumpIdx = jumpIdx;
+            compiler.setRepeatable(false);
+            return ErrorCode::Success;
+        }
+    },
+    { // END_IF
+        R"(^( |\t)*?END_IF( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            LOGD("=== Processing END_IF expression ===");
+            if (compiler.blocks.empty() ||
+                ((compiler.blocks.back().type != Script::Compiler::BlockType::If) && (compiler.blocks.back().type != Script::Compiler::BlockType::Else))) {
+                LOGE("END_IF without matching IF");
+                return ErrorCode::InvalidArgument;
+            }
+
+            const auto &block = compiler.blocks.back();
+            compiler.patchJump(block.jumpIdx, compiler.getAddress());
+            for (const std::size_t jumpIdx : block.endJumpIdxs) {
+                compiler.patchJump(jumpIdx, compiler.getAddress());
+            }
+
+            compiler.blocks.pop_back();
+            compiler.setRepeatable(false);
+            return ErrorCode::Success;
+        }
+    },
+    { // WHILE
+        R"(^( |\t)*?WHILE( |\t)*(\([^\n]*\))( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The condition should be available in the match group with index 3
+            LOGD("=== Processing WHILE expression ===");
+            if (match.size() < 4u) {
+                LOGE("Invalid number of match groups for WHILE expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
+
+            LOGD("WHILE condition: '%s'", match[3u].str().c_str());
+            const uint16_t loopAddress = compiler.getAddress();
+            auto errorCode = compiler.compileExpression(match[3u].str());
+            if (errorCode != ErrorCode::Success) {
+                return errorCode;
+            }
+
+            compiler.blocks.push_back({Script::Compiler::BlockType::While, compiler.emitJump(Script::Opcode::While), loopAddress, {}});
+            compiler.setRepeatable(false);
+            return ErrorCode::Success;
+        }
+    },
+    { // END_WHILE
+        R"(^( |\t)*?END_WHILE( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            LOGD("=== Processing END_WHILE expression ===");
+            if (compiler.blocks.empty() || (compiler.blocks.back().type != Script::Compiler::BlockType::While)) {
+                LOGE("END_WHILE without matching WHILE");
+                return ErrorCode::InvalidArgument;
+            }
+
+            const auto &block = compiler.blocks.back();
+            (void)compiler.emitJump(Script::Opcode::EndWhile, block.loopAddress);
+            compiler.patchJump(block.jumpIdx, compiler.getAddress());
+
+            compiler.blocks.pop_back();
+            compiler.setRepeatable(false);
+            return ErrorCode::Success;
+        }
+    },
+    { // FUNCTION
+        R"(^( |\t)*?FUNCTION( |\t)+([A-Za-z_][A-Za-z0-9_]*)\(\)( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The function name should be available in the match group with index 3
+            LOGD("=== Processing FUNCTION expression ===");
+            if (match.size() < 4u) {
+                LOGE("Invalid number of match groups for FUNCTION expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
+            if (!compiler.blocks.empty()) {
+                LOGE("Function '%s' must be defined outside of other blocks", match[3u].str().c_str());
+                return ErrorCode::InvalidArgument;
+            }
+
+            LOGD("FUNCTION name: '%s'", match[3u].str().c_str());
+            auto functionIdx = compiler.getFunction(match[3u].str());
+            if (!functionIdx) {
+                return ErrorCode::InvalidArgument;
+            }
+            if (compiler.isFunctionDefined[*functionIdx]) {
+                LOGE("Function '%s' is already defined", match[3u].str().c_str());
+                return ErrorCode::InvalidArgument;
+            }
+
+            // The body is skipped when the definition is reached during execution
+            const std::size_t jumpIdx = compiler.emitJump(Script::Opcode::Function);
+            compiler.functions[*functionIdx].address = compiler.getAddress();
+            compiler.isFunctionDefined[*functionIdx] = true;
+
+            compiler.blocks.push_back({Script::Compiler::BlockType::Function, jumpIdx, 0u, {}});
+            compiler.setRepeatable(false);
+            return ErrorCode::Success;
+        }
+    },
+    { // END_FUNCTION
+        R"(^( |\t)*?END_FUNCTION( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            LOGD("=== Processing END_FUNCTION expression ===");
+            if (compiler.blocks.empty() || (compiler.blocks.back().type != Script::Compiler::BlockType::Function)) {
+                LOGE("END_FUNCTION without matching FUNCTION");
+                return ErrorCode::InvalidArgument;
+            }
+
+            compiler.emit(Script::Opcode::Return);
+            compiler.patchJump(compiler.blocks.back().jumpIdx, compiler.getAddress());
+
+            compiler.blocks.pop_back();
+            compiler.setRepeatable(false);
+            return ErrorCode::Success;
+        }
+    },
+    { // RETURN
+        R"(^( |\t)*?RETURN( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // Return outside of a function ends the script
+            LOGD("=== Processing RETURN expression ===");
+            compiler.emit(Script::Opcode::Return);
+            compiler.setRepeatable(false);
+            return ErrorCode::Success;
+        }
+    },
+    { // FUNCTION CALL
+        R"(^( |\t)*?([A-Za-z_][A-Za-z0-9_]*)\(\)( |\t)*\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The function name should be available in the match group with index 2
+            LOGD("=== Processing function call expression ===");
+            if (match.size() < 3u) {
+                LOGE("Invalid number of match groups for function call expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
+
+            LOGD("Function call name: '%s'", match[2u].str().c_str());
+            // Functions may be called before they are defined - the definition is checked at the end of parsing
+            auto functionIdx = compiler.getFunction(match[2u].str());
+            if (!functionIdx) {
+                return ErrorCode::InvalidArgument;
+            }
+
+            compiler.emit(Script::Opcode::Call);
+            compiler.emitU8(*functionIdx);
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+    { // KEYSTROKE - SINGLE KEY
+        R"(^( |\t)*?([\S]+)( |\t)*?\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The regex should match a single key and ignore leading and trailing spaces
+            // The key should be available in the match group with index 2
+            LOGD("=== Processing single key expression ===");
+            if (match.size() < 3u) {
+                LOGE("Invalid number of match groups for single key expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
+
+            LOGD("Single key parameter: '%s'", match[2u].str().c_str());
+            std::vector<uint8_t> keyCodes{};
+            auto errorCode = Script::parseKeyStroke(match[2u].str(), keyCodes, compiler.layout);
+
+            if (errorCode != ErrorCode::Success) {
+                LOGE("Failed to parse key stroke: '%s'", match[2u].str().c_str());
+                return errorCode;
+            }
+            if (keyCodes.empty()) {
+                // Should never happen...
+                LOGE("No key codes found for key: '%s'", match[2u].str().c_str());
+                return ErrorCode::GeneralError;
+            }
+
+            // Add the key stroke to the bytecode
+            compiler.emitKeyStroke(keyCodes);
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+    { // KEYSTROKE - MULTIPLE KEYS
+        R"(^( |\t)*?(([\S]+ )+[\S]+)( |\t)*?\n)",
+        [](Script::Match &match, Script::Compiler &compiler) {
+            // The regex should match a line containing multiple keys and ignore leading and trailing spaces
+            // The keys should be available in the match group with index 2
+            LOGD("=== Processing multiple keys expression ===");
+            if (match.size() < 3u) {
+                LOGE("Invalid number of match groups for multiple keys expression: %zu", match.size());
+                return ErrorCode::GeneralError;
+            }
+
+            LOGD("Multiple keys parameter: '%s'", match[2u].str().c_str());
+            std::vector<uint8_t> keyCodes{};
+
+            const std::string keys = match[2u].str();
+            std::size_t keyIdx = 0u;
+
+            while((keyCodes.size() < 6u) && (keyIdx < keys.size()))
+            {
+                // Split the matched line by spaces
+                const std::size_t separatorIdx = std::min(keys.find(' ', keyIdx), keys.size());
+                const std::string keyName = keys.substr(keyIdx, separatorIdx - keyIdx);
+                keyIdx = separatorIdx + 1u;
+
+                LOGD("Parsing key: '%s'", keyName.c_str());
+                auto errorCode = Script::parseKeyStroke(keyName, keyCodes, compiler.layout);
+
+                if (errorCode != ErrorCode::Success) {
+                    LOGE("Failed to parse key stroke: '%s'", keyName.c_str());
+                    return errorCode;
+                }
+                if (keyCodes.empty()) {
+                    // Should never happen...
+                    LOGE("No key codes found for key: '%s'", keyName.c_str());
+                    return ErrorCode::GeneralError;
+                }
+            }
+
+            // Add the key stroke to the bytecode
+            compiler.emitKeyStroke(std::span<const uint8_t>(keyCodes).first(std::min<std::size_t>(keyCodes.size(), 6u)));
+            compiler.setRepeatable(true);
+            return ErrorCode::Success;
+        }
+    },
+}};
+
+ErrorCode Script::parseCharacter(const std::string &chr, std::vector<uint8_t> &keyCodes, const KeyboardLayout &layout) {
+    std::size_t chrIdx = 0u;
+    auto codePoint = KeyboardLayout::decodeUtf8(chr, chrIdx);
+    if (!codePoint || chrIdx != chr.size()) {
+        // Not a single UTF-8 character
+        return ErrorCode::InvalidArgument;
+    }
+
+    const KeyboardLayout::KeyMapping *mapping = layout.find(*codePoint);
+    if (!mapping || mapping->deadKey.keyCode) {
+        // Character is not mappable to a single key in the current layout
+        LOGE("Character '%s' is not mappable to a key code in the %s keyboard layout", chr.c_str(), layout.getName());
+        return ErrorCode::GeneralError;
+    }
+
+    // Add the modifiers required by the layout as key codes, unless they are already pressed
+    if ((mapping->key.modifier & KEYBOARD_MODIFIER_LEFTSHIFT) && 
+        (std::find(keyCodes.begin(), keyCodes.end(), HID_KEY_SHIFT_LEFT) == keyCodes.end())) {
+        keyCodes.push_back(HID_KEY_SHIFT_LEFT);
+    }
+    if ((mapping->key.modifier & KEYBOARD_MODIFIER_RIGHTALT) && 
+        (std::find(keyCodes.begin(), keyCodes.end(), HID_KEY_ALT_RIGHT) == keyCodes.end())) {
+        keyCodes.push_back(HID_KEY_ALT_RIGHT);
+    }
+
+    // Add the mapped key code
+    keyCodes.push_back(mapping->key.keyCode);
+    return ErrorCode::Success;
+
+}
+
+ErrorCode Script::parseKeyStroke(const std::string &keyName, std::vector<uint8_t> &keyCodes, const KeyboardLayout &layout) {
     // Check if the key is a single character
-    if (keyName.length() == 1u) {
-        return parseAscii(keyName[0u], keyCodes);
+    auto errorCode = parseCharacter(keyName, keyCodes, layout);
+    if (errorCode != ErrorCode::InvalidArgument) {
+        return errorCode;
     }
     else
     {
-        // Key is not a single ASCII character, check if it is a special key
+        // Key is not a single character, check if it is a special key
         auto it = std::find_if(specialKeys.begin(), specialKeys.end(), [&keyName](const SpecialKey &key) {
             return key.name == keyName;
         });
@@ -257,20 +1316,230 @@ ErrorCode Script::parseKeyStroke(const std::string &keyName, std::vector<uint8_t
     return ErrorCode::Success;
 }
 
-std::optional<Script> Script::deserialize(std::span<const uint8_t> input) {
-    Script::CommandVector commands{};
+std::size_t Script::getInstructionSize(std::span<const uint8_t> code, std::size_t pc) {
+    // Returns zero for unknown or truncated instructions
+    if (pc >= code.size()) {
+        return 0u;
+    }
+
+    const std::size_t available = code.size() - pc;
+    std::size_t size = 0u;
+
+    switch (static_cast<Opcode>(code[pc])) {
+        case Opcode::KeyReports: {
+            if (available < 3u) {
+                return 0u;
+            }
+            size = 3u + (2u * static_cast<std::size_t>(readU16(&code[pc + 1u])));
+            break;
+        }
+        case Opcode::KeyStroke: {
+            if (available < 2u) {
+                return 0u;
+            }
+            size = 2u + code[pc + 1u];
+            break;
+        }
+        case Opcode::PackedText: {
+            if (available < 7u) {
+                return 0u;
+            }
+            size = 7u + static_cast<std::size_t>(readU16(&code[pc + 5u]));
+            break;
+        }
+        case Opcode::MouseMove:
+        case Opcode::MouseScroll: {
+            if (available < 3u) {
+                return 0u;
+            }
+            const std::size_t stepSize = (static_cast<Opcode>(code[pc]) == Opcode::MouseMove) ? 2u : 1u;
+            size = 3u + (stepSize * static_cast<std::size_t>(readU16(&code[pc + 1u])));
+            break;
+        }
+        case Opcode::Delay:
+        case Opcode::Push:
+        case Opcode::SyncHost:
+            size = 5u;
+            break;
+        case Opcode::Repeat:
+            size = 7u;
+            break;
+        case Opcode::WaitForLed:
+            size = 7u;
+            break;
+        case Opcode::PushByte:
+        case Opcode::Load:
+        case Opcode::Store:
+        case Opcode::Call:
+        case Opcode::MouseClick:
+            size = 2u;
+            break;
+        case Opcode::If:
+        case Opcode::Else:
+        case Opcode::While:
+        case Opcode::EndWhile:
+        case Opcode::Function:
+            size = 3u;
+            break;
+        default: {
+            if (static_cast<uint8_t>(code[pc]) >= static_cast<uint8_t>(Opcode::OpcodeNum)) {
+                return 0u;
+            }
+            // Operators and RETURN have no operands
+            size = 1u;
+        }
+    }
+
+    return (size <= available) ? size : 0u;
+}
+
+bool Script::isContextFree(std::span<const uint8_t> code) {
+    for (std::size_t pc = 0u; pc < code.size();) {
+        const std::size_t size = getInstructionSize(code, pc);
+        if (0u == size) {
+            return false;
+        }
+
+        switch (static_cast<Opcode>(code[pc])) {
+            case Opcode::Load:
+            case Opcode::Store:
+            case Opcode::If:
+            case Opcode::Else:
+            case Opcode::While:
+            case Opcode::EndWhile:
+            case Opcode::Function:
+            case Opcode::Call:
+            case Opcode::Return:
+            case Opcode::Repeat: {
+                return false;
+            }
+            default: {
+                break;
+            }
+        }
+        pc += size;
+    }
+
+    return true;
+}
+
+bool Script::isValid() const {
+    if ((code.size() > MAX_CODE_SIZE) || (variableNames.size() > MAX_VARIABLES) || (functions.size() > MAX_FUNCTIONS)) {
+        return false;
+    }
+
+    // Find the instruction boundaries first, so the jump targets can be verified
+    std::vector<bool> isBoundary(code.size() + 1u, false);
+    for (std::size_t pc = 0u; pc < code.size();) {
+        const std::size_t size = getInstructionSize(code, pc);
+        if (size == 0u) {
+            LOGE("Invalid instruction at address %zu", pc);
+            return false;
+        }
+        isBoundary[pc] = true;
+        pc += size;
+    }
+    isBoundary[code.size()] = true;
+
+    for (std::size_t pc = 0u; pc < code.size(); pc += getInstructionSize(code, pc)) {
+        const Opcode opcode = static_cast<Opcode>(code[pc]);
+        switch (opcode) {
+            case Opcode::KeyStroke: {
+                if (code[pc + 1u] > 6u) {
+                    LOGE("Too many keys in key stroke at address %zu", pc);
+                    return false;
+                }
+                break;
+            }
+            case Opcode::PackedText: {
+                // Every character must be typeable with the script layout, which also gives the count of the key reports
+                const KeyboardLayout *layout = KeyboardLayout::get(layoutId);
+                TextCodec::Decoder decoder(std::span<const uint8_t>(&code[pc + 7u], readU16(&code[pc + 5u])), readU16(&code[pc + 3u]));
+                std::size_t reportsLen = 0u;
+                while (const auto codePoint = readCodePoint(decoder)) {
+                    const KeyboardLayout::KeyMapping *mapping = layout ? layout->find(*codePoint) : nullptr;
+                    if (!mapping) {
+                        LOGE("Packed text with a character missing in the layout at address %zu", pc);
+                        return false;
+                    }
+                    reportsLen += mapping->deadKey.keyCode ? 2u : 1u;
+                }
+                if (!decoder.isFinished() || (reportsLen != readU16(&code[pc + 1u]))) {
+                    LOGE("Invalid packed text at address %zu", pc);
+                    return false;
+                }
+                break;
+            }
+            case Opcode::WaitForLed: {
+                if (code[pc + 2u] >= static_cast<uint8_t>(LedCondition::ConditionNum)) {
+                    LOGE("Invalid LED condition at address %zu", pc);
+                    return false;
+                }
+                break;
+            }
+            case Opcode::Load:
+            case Opcode::Store: {
+                if (code[pc + 1u] >= variableNames.size()) {
+                    LOGE("Invalid variable index at address %zu", pc);
+                    return false;
+                }
+                break;
+            }
+            case Opcode::Call: {
+                if (code[pc + 1u] >= functions.size()) {
+                    LOGE("Invalid function index at address %zu", pc);
+                    return false;
+                }
+                break;
+            }
+            case Opcode::If:
+            case Opcode::Else:
+            case Opcode::While:
+            case Opcode::Function:
+            case Opcode::EndWhile:
+            case Opcode::Repeat: {
+                // Only the loops jump backwards
+                const std::size_t address = readU16(&code[pc + 1u]);
+                const bool isForward = (address > pc);
+                const bool isLoop = (opcode == Opcode::EndWhile) || (opcode == Opcode::Repeat);
+                if ((address > code.size()) || !isBoundary[address] || (isForward == isLoop)) {
+                    LOGE("Invalid jump address at address %zu", pc);
+                    return false;
+                }
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+
+    for (const auto &function : functions) {
+        if ((function.address >= code.size()) || !isBoundary[function.address]) {
+            LOGE("Invalid address of function '%s'", function.name.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::optional<Script> Script::deserializeLegacy(std::span<const uint8_t> input) {
+    // Serialized data without the layout record was created with the US layout
+    KeyboardLayout::Id layoutId = KeyboardLayout::Id::Us;
+    Compiler compiler(*KeyboardLayout::get(layoutId));
 
     size_t inputByteIdx = 0u;
     while(inputByteIdx < input.size()) {
-        Command command = static_cast<Command>(input[inputByteIdx]);
+        LegacyCommand command = static_cast<LegacyCommand>(input[inputByteIdx]);
         switch (command) {
-            case Command::StringWrite: {
+            case LegacyCommand::StringWrite: {
                 if(++inputByteIdx >= input.size()){
                     return std::nullopt;
                 }
                 uint8_t strLen = input[inputByteIdx];
                 std::string str{};
-                
+
                 for(uint8_t strIdx = 0u; strIdx < strLen; ++strIdx) {
                     if(++inputByteIdx >= input.size()){
                         return std::nullopt;
@@ -278,17 +1547,55 @@ std::optional<Script> Script::deserialize(std::span<const uint8_t> input) {
                     str += static_cast<char>(input[inputByteIdx]);
                 }
 
-                commands.emplace_back(command, std::move(str));
+                // Convert the legacy ASCII string to the key reports
+                std::pmr::vector<KeyboardLayout::KeyReport> reports{};
+                if(KeyboardLayout::get(layoutId)->encode(str, reports) != ErrorCode::Success) {
+                    return std::nullopt;
+                }
+
+                compiler.emitText(str, reports);
+
+                break;
+            }
+            case LegacyCommand::KeyReportWrite: {
+                if(inputByteIdx + 2u >= input.size()){
+                    return std::nullopt;
+                }
+                const uint16_t reportsLen = readU16(&input[inputByteIdx + 1u]);
+                inputByteIdx += 2u;
+
+                if(inputByteIdx + (2u * static_cast<std::size_t>(reportsLen)) >= input.size()){
+                    return std::nullopt;
+                }
+
+                // The record has the same layout as the instruction
+                compiler.emit(Opcode::KeyReports);
+                compiler.emitU16(reportsLen);
+                compiler.code.insert(compiler.code.end(), input.begin() + inputByteIdx + 1u, input.begin() + inputByteIdx + 1u + (2u * reportsLen));
+                inputByteIdx += 2u * reportsLen;
+
+                break;
+            }
+            case LegacyCommand::Layout: {
+                if(++inputByteIdx >= input.size()){
+                    return std::nullopt;
+                }
+
+                layoutId = static_cast<KeyboardLayout::Id>(input[inputByteIdx]);
+                if(!KeyboardLayout::get(layoutId)) {
+                    LOGE("Unknown keyboard layout in serialized data: %d", input[inputByteIdx]);
+                    return std::nullopt;
+                }
 
                 break;
             }
-            case Command::KeyStroke: {
+            case LegacyCommand::KeyStroke: {
                 if(++inputByteIdx >= input.size()){
                     return std::nullopt;
                 }
                 uint8_t keyCodesLen = input[inputByteIdx];
                 std::vector<uint8_t> keyCodes{};
-                
+
                 for(uint8_t keyCodeIdx = 0u; keyCodeIdx < keyCodesLen; ++keyCodeIdx) {
                     if(++inputByteIdx >= input.size()){
                         return std::nullopt;
@@ -296,54 +1603,215 @@ std::optional<Script> Script::deserialize(std::span<const uint8_t> input) {
                     keyCodes.push_back(input[inputByteIdx]);
                 }
 
-                commands.emplace_back(command, std::move(keyCodes));
+                compiler.emitKeyStroke(std::span<const uint8_t>(keyCodes).first(std::min<std::size_t>(keyCodes.size(), 6u)));
+
+                break;
+            }
+            case LegacyCommand::Delay: {
+                if(inputByteIdx + sizeof(uint32_t) >= input.size()){
+                    return std::nullopt;
+                }
+
+                compiler.emitDelay(readU32(&input[inputByteIdx + 1u]));
+                inputByteIdx += sizeof(uint32_t);
+
+                break;
+            }
+            default: {
+                LOGE("Unknown command in serialized data - it will not be included in the script");
+            }
+        }
+
+        // Continue with next command in the next iteration
+        ++inputByteIdx;
+    }
+
+    if (compiler.code.size() > MAX_CODE_SIZE) {
+        LOGE("Serialized script exceeds the maximum size of %zu bytes", MAX_CODE_SIZE);
+        return std::nullopt;
+    }
+
+    return Script(std::vector<uint8_t>(compiler.code.begin(), compiler.code.end()), {}, {}, layoutId);
+}
+
+std::optional<Script> Script::deserialize(std::span<const uint8_t> input) {
+    if ((input.size() < sizeof(SERIALIZED_MAGIC)) || !std::equal(std::begin(SERIALIZED_MAGIC), std::end(SERIALIZED_MAGIC), input.begin())) {
+        // Data stored before the bytecode format was introduced
+        return deserializeLegacy(input);
+    }
+
+    std::size_t inputByteIdx = sizeof(SERIALIZED_MAGIC);
+    auto readBytes = [&input, &inputByteIdx](std::size_t size) -> std::optional<std::span<const uint8_t>> {
+        if (inputByteIdx + size > input.size()) {
+            return std::nullopt;
+        }
+        auto bytes = input.subspan(inputByteIdx, size);
+        inputByteIdx += size;
+        return bytes;
+    };
+    auto readString = [&readBytes]() -> std::optional<std::string> {
+        auto length = readBytes(1u);
+        if (!length) {
+            return std::nullopt;
+        }
+        auto bytes = readBytes((*length)[0u]);
+        if (!bytes) {
+            return std::nullopt;
+        }
+        return std::string(bytes->begin(), bytes->end());
+    };
+
+    // Header: version, layout and code size
+    auto header = readBytes(4u);
+    if (!header) {
+        LOGE("Serialized script is truncated");
+        return std::nullopt;
+    }
+    if ((*header)[0u] != SERIALIZED_VERSION) {
+        LOGE("Unsupported serialized script version: %d", (*header)[0u]);
+        return std::nullopt;
+    }
+
+    const KeyboardLayout::Id layoutId = static_cast<KeyboardLayout::Id>((*header)[1u]);
+    if (!KeyboardLayout::get(layoutId)) {
+        LOGE("Unknown keyboard layout in serialized data: %d", (*header)[1u]);
+        return std::nullopt;
+    }
 
-                break;
-            }
-            case Command::Delay: {
-                uint32_t delay = 0u;
+    auto codeBytes = readBytes(readU16(&(*header)[2u]));
+    auto variableNum = readBytes(1u);
+    if (!codeBytes || !variableNum) {
+        LOGE("Serialized script is truncated");
+        return std::nullopt;
+    }
 
-                uint8_t *bytePtr = reinterpret_cast<uint8_t*>(&delay);
-                for(size_t byteIdx = 0u; byteIdx < sizeof(delay); ++byteIdx){
-                    if(++inputByteIdx >= input.size()){
-                        return std::nullopt;
-                    }
-                    bytePtr[byteIdx] = input[inputByteIdx];
-                }
+    // Symbols are kept only to print the script back in the source form
+    std::vector<std::string> variableNames{};
+    for (uint8_t variableIdx = 0u; variableIdx < (*variableNum)[0u]; ++variableIdx) {
+        auto name = readString();
+        if (!name) {
+            LOGE("Serialized script is truncated");
+            return std::nullopt;
+        }
+        variableNames.push_back(std::move(*name));
+    }
 
-                commands.emplace_back(command, delay);
+    auto functionNum = readBytes(1u);
+    if (!functionNum) {
+        LOGE("Serialized script is truncated");
+        return std::nullopt;
+    }
 
-                break;
-            }
-            default: {
-                LOGE("Unknown command in serialized data - it will not be included in command vector");
-            }
+    std::vector<Function> functions{};
+    for (uint8_t functionIdx = 0u; functionIdx < (*functionNum)[0u]; ++functionIdx) {
+        auto address = readBytes(2u);
+        auto name = readString();
+        if (!address || !name) {
+            LOGE("Serialized script is truncated");
+            return std::nullopt;
         }
+        functions.push_back({std::move(*name), readU16(address->data())});
+    }
 
-        // Continue with next command in the next iteration
-        ++inputByteIdx;
+    Script script(std::vector<uint8_t>(codeBytes->begin(), codeBytes->end()), std::move(variableNames), std::move(functions), layoutId);
+    if (!script.isValid()) {
+        LOGE("Serialized script contains invalid bytecode");
+        return std::nullopt;
     }
 
-    return Script(commands);
+    return script;
+}
+
+std::optional<Script> Script::parse(std::string_view input, KeyboardLayout::Id layoutId, std::pmr::memory_resource *resource,
+    LineCache *cache){
+    Metrics::increment(Metrics::Counter::ScriptParses);
+
+    // The parsing time depends on the CPU frequency, so it is reported for the power profiles
+    const auto startTime = std::chrono::steady_clock::now();
+    auto script = compile(input, layoutId, resource, cache);
+    const auto parseTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+
+    Metrics::add(Metrics::Counter::ScriptParseTime, static_cast<uint32_t>(parseTime.count()));
+    LOGD("Script parsed in %lld us", static_cast<long long>(parseTime.count()));
+
+    return script;
 }
 
-std::optional<Script> Script::parse(std::string input){
-    Script::CommandVector commands{};
+std::optional<Script> Script::compile(std::string_view input, KeyboardLayout::Id layoutId, std::pmr::memory_resource *resource,
+    LineCache *cache){
+    const KeyboardLayout *layout = KeyboardLayout::get(layoutId);
+    if (!layout) {
+        LOGE("Unknown keyboard layout: %d", static_cast<int>(layoutId));
+        return std::nullopt;
+    }
+
+    Compiler compiler(*layout, resource);
 
-    // Ensure there is a newline at the end of the input string
-    if (input.back() != '\n') {
-        input += '\n';
+    // Ensure there is a newline at the end of the input string - the input is only copied if it is missing
+    std::pmr::string terminatedInput(resource);
+    if (input.empty() || input.back() != '\n') {
+        terminatedInput.reserve(input.size() + 1u);
+        terminatedInput.append(input);
+        terminatedInput += '\n';
+        input = terminatedInput;
     }
 
-    while(input.size() > 0){
-        std::smatch match;
+    const char *position = input.data();
+    const char *end = input.data() + input.size();
+
+    if (cache) {
+        for (auto &[hash, entry] : cache->entries) {
+            entry.isUsed = false;
+        }
+        cache->hitCount = 0u;
+        cache->missCount = 0u;
+    }
+
+    while(position < end){
+        Match match;
         bool found = false;
 
+        // The lines inside of a REM_BLOCK are matched together with the block, so they are never looked up
+        const char *lineEnd = static_cast<const char *>(std::memchr(position, '\n', end - position)) + 1;
+        uint64_t lineHash = 0u;
+        if (cache) {
+            const uint8_t layoutByte = static_cast<uint8_t>(layoutId);
+            lineHash = Utils::fnv1a64({reinterpret_cast<const uint8_t *>(position), static_cast<std::size_t>(lineEnd - position)},
+                Utils::fnv1a64({&layoutByte, 1u}));
+
+            auto entryIt = cache->entries.find(lineHash);
+            if ((entryIt != cache->entries.end()) && (entryIt->second.lineSize == static_cast<std::size_t>(lineEnd - position))) {
+                LineCache::Entry &entry = entryIt->second;
+                compiler.statementAddress = compiler.getAddress();
+                compiler.code.insert(compiler.code.end(), entry.code.begin(), entry.code.end());
+                if (entry.isRepeatable) {
+                    compiler.setRepeatable(*entry.isRepeatable);
+                }
+                entry.isUsed = true;
+                ++cache->hitCount;
+                position = lineEnd;
+                continue;
+            }
+            ++cache->missCount;
+        }
+
+        const std::size_t statementStart = compiler.code.size();
+        const std::size_t blockNum = compiler.blocks.size();
+        const std::size_t variableNum = compiler.variableNames.size();
+        const std::size_t functionNum = compiler.functions.size();
+
         // Iterate through the expression handlers
         for (const auto &handler : expressionHandlers) {
-            if (std::regex_search(input, match, std::regex(handler.regexStr))) {
+#if CONFIG_ESP_DUCKY_LEAN_BUILD
+            const bool isMatched = handler.pattern.search(position, end, match);
+#else
+            const bool isMatched = std::regex_search(position, end, match, std::regex(handler.regexStr));
+#endif
+            if (isMatched) {
                 // Call the process function of the matched handler
-                auto errorCode = handler.process(match, commands);
+                compiler.statementAddress = compiler.getAddress();
+                compiler.repeatableChange = std::nullopt;
+                auto errorCode = handler.process(match, compiler);
                 if (errorCode != ErrorCode::Success) {
                     return std::nullopt; // Parsing failed
                 }
@@ -357,116 +1825,710 @@ std::optional<Script> Script::parse(std::string input){
             return std::nullopt;
         }
 
-        // Remove the matched part from the input string
-        input = match.suffix().str();
+        // Only the single line statements, which do not change the blocks, variables or functions are stored
+        const std::span<const uint8_t> statementCode = std::span<const uint8_t>(compiler.code).subspan(statementStart);
+        if (cache && (match[0u].second == lineEnd) && (compiler.blocks.size() == blockNum) &&
+            (compiler.variableNames.size() == variableNum) && (compiler.functions.size() == functionNum) &&
+            isContextFree(statementCode)) {
+            cache->entries.insert_or_assign(lineHash, LineCache::Entry{static_cast<std::size_t>(lineEnd - position),
+                std::vector<uint8_t>(statementCode.begin(), statementCode.end()), compiler.repeatableChange, true});
+        }
+
+        // Continue after the matched part of the input string
+        position = match[0u].second;
+    }
+
+    if (!compiler.blocks.empty()) {
+        LOGE("Script ends inside of an unterminated IF, WHILE or FUNCTION block");
+        return std::nullopt;
+    }
+    for (std::size_t functionIdx = 0u; functionIdx < compiler.functions.size(); ++functionIdx) {
+        if (!compiler.isFunctionDefined[functionIdx]) {
+            LOGE("Function '%s' is called but never defined", compiler.functions[functionIdx].name.c_str());
+            return std::nullopt;
+        }
+    }
+    if (compiler.code.size() > MAX_CODE_SIZE) {
+        LOGE("Compiled script exceeds the maximum size of %zu bytes", MAX_CODE_SIZE);
+        return std::nullopt;
+    }
+
+    if (cache) {
+        // Only the lines of the last script are kept, so the cache does not grow with the edits
+        std::erase_if(cache->entries, [](const auto &item) { return !item.second.isUsed; });
+        LOGD("Line cache: %zu statements reused, %zu parsed", cache->hitCount, cache->missCount);
     }
 
-    return Script(std::move(commands));
+    // Copied with the exact size, so that the stored script does not keep the spare capacity or the arena memory
+    return Script(std::vector<uint8_t>(compiler.code.begin(), compiler.code.end()), std::move(compiler.variableNames),
+        std::move(compiler.functions), layoutId);
 }
 
-Script::Script(Script::CommandVector &commands)
-:commands(commands)
+Script::LineCache::LineCache()
+:entries(),
+hitCount(0u),
+missCount(0u)
 {}
 
+void Script::LineCache::clear() {
+    entries.clear();
+    hitCount = 0u;
+    missCount = 0u;
+}
+
+std::size_t Script::LineCache::size() const {
+    return entries.size();
+}
+
+std::size_t Script::LineCache::getHitCount() const {
+    return hitCount;
+}
+
+std::size_t Script::LineCache::getMissCount() const {
+    return missCount;
+}
 
-Script::Script(Script::CommandVector &&commands)
-:commands(std::move(commands))
+Script::Script(std::vector<uint8_t> &&code, std::vector<std::string> &&variableNames, std::vector<Function> &&functions, KeyboardLayout::Id layoutId)
+:code(std::move(code)),
+variableNames(std::move(variableNames)),
+functions(std::move(functions)),
+layoutId(layoutId)
 {}
 
-ErrorCode Script::run(UsbDevice &usbDevice) {
-    for (const auto &command : commands) {
-        switch (std::get<0>(command)) {
-            case Command::StringWrite: {
-                const std::string &str = std::any_cast<std::string>(std::get<1>(command));
-                for(const char &chr : str) {
-                    std::vector<uint8_t> keyCodes{};
-                    auto errorCode = Script::parseAscii(chr, keyCodes);
-                    if (errorCode != ErrorCode::Success) {
-                        LOGE("Failed to parse ASCII character: '%c'", chr);
-                        return errorCode;
+KeyboardLayout::Id Script::getLayoutId() const {
+    return layoutId;
+}
+
+std::span<const uint8_t> Script::getCode() const {
+    return code;
+}
+
+const std::vector<std::string> &Script::getVariableNames() const {
+    return variableNames;
+}
+
+const std::vector<Script::Function> &Script::getFunctions() const {
+    return functions;
+}
+
+ErrorCode Script::run(UsbDevice &usbDevice) const {
+    Timing timing = DEFAULT_TIMING;
+    return run(usbDevice, timing);
+}
+
+ErrorCode Script::run(UsbDevice &usbDevice, Timing &timing) const {
+    uint64_t duration = 0u;
+    bool isBounded = true;
+    return execute(&usbDevice, nullptr, timing, duration, isBounded);
+}
+
+ErrorCode Script::estimate(Estimate &estimate, Timing timing) const {
+    estimate.codeSize = code.size();
+    estimate.commandCount = 0u;
+    estimate.keystrokeCount = 0u;
+
+    for (std::size_t pc = 0u; pc < code.size(); pc += getInstructionSize(code, pc)) {
+        const Opcode opcode = static_cast<Opcode>(code[pc]);
+        if ((opcode == Opcode::KeyReports) || (opcode == Opcode::PackedText)) {
+            estimate.keystrokeCount += readU16(&code[pc + 1u]);
+        }
+
+        // Parts of the expressions and the ends of the blocks are not counted as commands
+        const bool isExpression = (opcode == Opcode::PushByte) || (opcode == Opcode::Push) || (opcode == Opcode::Load) ||
+            (opcode == Opcode::LogicalNot) || (opcode == Opcode::Negate) || findBinaryOperator(opcode);
+        const bool isBlockEnd = (opcode == Opcode::Else) || (opcode == Opcode::EndWhile);
+        if (!isExpression && !isBlockEnd) {
+            ++estimate.commandCount;
+        }
+    }
+
+    // The duration is measured by running the script without the USB device
+    estimate.duration = 0u;
+    estimate.isBounded = true;
+    return execute(nullptr, nullptr, timing, estimate.duration, estimate.isBounded);
+}
+
+ErrorCode Script::flatten(ReportStream &stream, Timing timing) const {
+    uint64_t duration = 0u;
+    bool isBounded = true;
+    const ErrorCode err = execute(nullptr, &stream, timing, duration, isBounded);
+    if ((ErrorCode::Success == err) && (!isBounded || stream.isFull())) {
+        LOGE("Script does not end within the limits of the report stream");
+        return ErrorCode::InvalidArgument;
+    }
+
+    return err;
+}
+
+ErrorCode Script::execute(UsbDevice *usbDevice, ReportStream *recorder, Timing &timing, uint64_t &duration, bool &isBounded) const {
+    struct RepeatState {
+        std::size_t address;
+        std::size_t callStackSize;
+        uint32_t remaining;
+    };
+
+    // The whole execution state has a fixed size, so running the script does not allocate any memory
+    std::array<int32_t, STACK_SIZE> stack{};
+    std::array<uint16_t, CALL_STACK_SIZE> callStack{};
+    std::array<int32_t, MAX_VARIABLES> variables{};
+    std::array<RepeatState, REPEAT_STACK_SIZE> repeatStack{};
+    std::size_t stackSize = 0u;
+    std::size_t callStackSize = 0u;
+    std::size_t repeatStackSize = 0u;
+
+    // Without the USB device the script is only simulated and the delays are summed up,
+    // the recorder receives the reports the device would send
+    auto wait = [usbDevice, recorder, &duration](uint64_t delay) {
+        if (usbDevice) {
+            (void)usbDevice->hidDelay(static_cast<uint32_t>(delay));
+        }
+        else if (recorder) {
+            recorder->addDelay(static_cast<uint32_t>(std::min<uint64_t>(delay, UINT32_MAX)));
+        }
+        duration += delay;
+    };
+    auto keyPress = [usbDevice, recorder, &timing](uint8_t keyCode, uint8_t modifier) {
+        if (usbDevice) {
+            usbDevice->hidKeyPress(keyCode, modifier, timing.keyDelay);
+        }
+        else if (recorder) {
+            recorder->addKeyStroke({&keyCode, 1u}, modifier, timing.keyDelay);
+        }
+    };
+    const bool isTyping = usbDevice || recorder;
+    std::size_t simulatedNum = 0u;
+
+    std::size_t pc = 0u;
+    while (pc < code.size()) {
+        if (!usbDevice && ((++simulatedNum > MAX_SIMULATED_INSTRUCTIONS) || (recorder && recorder->isFull()))) {
+            // The script is too long or it never ends
+            isBounded = false;
+            return ErrorCode::Success;
+        }
+
+        if (usbDevice && usbDevice->hidIsAborted()) {
+            // No key or button may stay pressed after the script is stopped
+            usbDevice->hidSendKeyboardReport({});
+            usbDevice->hidSendMouseReport(0u, 0, 0);
+            LOGW("Script execution aborted by the user at address %zu", pc);
+            return ErrorCode::Aborted;
+        }
+
+        const std::size_t size = getInstructionSize(code, pc);
+        if (size == 0u) {
+            LOGE("Invalid instruction at address %zu - script execution aborted", pc);
+            return ErrorCode::GeneralError;
+        }
+
+        const Opcode opcode = static_cast<Opcode>(code[pc]);
+        const uint8_t *operands = &code[pc + 1u];
+        std::size_t nextPc = pc + size;
+
+        // Check the operand stack before the instruction is executed
+        std::size_t popNum = 0u;
+        std::size_t pushNum = 0u;
+        if ((opcode == Opcode::PushByte) || (opcode == Opcode::Push) || (opcode == Opcode::Load)) {
+            pushNum = 1u;
+        }
+        else if ((opcode == Opcode::Store) || (opcode == Opcode::If) || (opcode == Opcode::While) ||
+            (opcode == Opcode::SetDefaultDelay) || (opcode == Opcode::SetKeyDelay)) {
+            popNum = 1u;
+        }
+        else if ((opcode == Opcode::LogicalNot) || (opcode == Opcode::Negate)) {
+            popNum = 1u;
+            pushNum = 1u;
+        }
+        else if (findBinaryOperator(opcode)) {
+            popNum = 2u;
+            pushNum = 1u;
+        }
+        if ((stackSize < popNum) || (stackSize - popNum + pushNum > STACK_SIZE)) {
+            LOGE("Operand stack %s at address %zu - script execution aborted", (stackSize < popNum) ? "underflow" : "overflow", pc);
+            return ErrorCode::GeneralError;
+        }
+
+        // Only the keyboard output is flattened, the rest depends on the host or it is sent as the mouse reports
+        if (recorder && ((opcode == Opcode::MouseMove) || (opcode == Opcode::MouseScroll) || (opcode == Opcode::MouseClick) ||
+            (opcode == Opcode::WaitForLed) || (opcode == Opcode::SyncHost))) {
+            LOGE("Instruction at address %zu can not be flattened into the keyboard reports", pc);
+            return ErrorCode::NotImplemented;
+        }
+
+        switch (opcode) {
+            case Opcode::KeyReports: {
+                // The key reports were created with the script layout during parsing
+                const uint16_t reportsLen = readU16(operands);
+                if (isTyping) {
+                    for (uint16_t reportIdx = 0u; (reportIdx < reportsLen) && !(usbDevice && usbDevice->hidIsAborted()); ++reportIdx) {
+                        keyPress(operands[2u + (2u * reportIdx) + 1u], operands[2u + (2u * reportIdx)]);
                     }
-                    if (keyCodes.empty()) {
-                        // Should never happen...
-                        LOGE("No key codes found for character: '%c'", chr);
-                        return ErrorCode::GeneralError;
+                }
+                // Every key is pressed and released
+                duration += 2u * static_cast<uint64_t>(reportsLen) * timing.keyDelay;
+                wait(timing.defaultDelay);
+                break;
+            }
+            case Opcode::PackedText: {
+                // The text is decoded while it is typed, its characters were checked with the script layout
+                const uint16_t reportsLen = readU16(operands);
+                if (isTyping) {
+                    const KeyboardLayout *layout = KeyboardLayout::get(layoutId);
+                    TextCodec::Decoder decoder(std::span<const uint8_t>(&operands[6u], readU16(&operands[4u])), readU16(&operands[2u]));
+                    while (!(usbDevice && usbDevice->hidIsAborted())) {
+                        const auto codePoint = readCodePoint(decoder);
+                        if (!codePoint) {
+                            break;
+                        }
+                        const KeyboardLayout::KeyMapping *mapping = layout ? layout->find(*codePoint) : nullptr;
+                        if (!mapping) {
+                            LOGE("Character U+%04X missing in the layout at address %zu - script execution aborted",
+                                static_cast<unsigned int>(*codePoint), pc);
+                            return ErrorCode::GeneralError;
+                        }
+                        if (mapping->deadKey.keyCode) {
+                            keyPress(mapping->deadKey.keyCode, mapping->deadKey.modifier);
+                        }
+                        keyPress(mapping->key.keyCode, mapping->key.modifier);
+                    }
+                }
+                duration += 2u * static_cast<uint64_t>(reportsLen) * timing.keyDelay;
+                wait(timing.defaultDelay);
+                break;
+            }
+            case Opcode::KeyStroke: {
+                if (usbDevice) {
+                    usbDevice->hidKeyStroke(std::span<const uint8_t>(&operands[1u], operands[0u]), 0u, timing.keyDelay);
+                }
+                else if (recorder) {
+                    recorder->addKeyStroke(std::span<const uint8_t>(&operands[1u], operands[0u]), 0u, timing.keyDelay);
+                }
+                duration += 2u * static_cast<uint64_t>(timing.keyDelay);
+                wait(timing.defaultDelay);
+                break;
+            }
+            case Opcode::MouseMove: {
+                // The movement was split into the reports during parsing, each is sent in its own polling interval
+                const uint16_t stepNum = readU16(operands);
+                if (usbDevice) {
+                    for (uint16_t stepIdx = 0u; (stepIdx < stepNum) && !usbDevice->hidIsAborted(); ++stepIdx) {
+                        usbDevice->hidMouseMove(static_cast<int8_t>(operands[2u + (2u * stepIdx)]), static_cast<int8_t>(operands[2u + (2u * stepIdx) + 1u]));
+                    }
+                }
+                duration += static_cast<uint64_t>(stepNum) * UsbDevice::HID_POLLING_INTERVAL;
+                wait(timing.defaultDelay);
+                break;
+            }
+            case Opcode::MouseScroll: {
+                const uint16_t stepNum = readU16(operands);
+                if (usbDevice) {
+                    for (uint16_t stepIdx = 0u; (stepIdx < stepNum) && !usbDevice->hidIsAborted(); ++stepIdx) {
+                        usbDevice->hidMouseMove(0, 0, static_cast<int8_t>(operands[2u + stepIdx]));
                     }
-                    usbDevice.hidKeyStroke(keyCodes);
                 }
+                duration += static_cast<uint64_t>(stepNum) * UsbDevice::HID_POLLING_INTERVAL;
+                wait(timing.defaultDelay);
+                break;
+            }
+            case Opcode::MouseClick: {
+                if (usbDevice) {
+                    usbDevice->hidMouseClick(operands[0u], timing.keyDelay);
+                }
+                duration += 2u * static_cast<uint64_t>(timing.keyDelay);
+                wait(timing.defaultDelay);
+                break;
+            }
+            case Opcode::Delay: {
+                wait(readU32(operands));
+                break;
+            }
+            case Opcode::WaitForLed: {
+                const uint32_t timeout = readU32(&operands[2u]);
+                if (!usbDevice) {
+                    // The host reaction is unknown, so assume the worst case
+                    duration += timeout;
+                    isBounded = isBounded && (timeout != 0u);
+                    break;
+                }
+
+                const uint8_t mask = operands[0u];
+                uint8_t state = 0u;
+                switch (static_cast<LedCondition>(operands[1u])) {
+                    case LedCondition::On: state = mask; break;
+                    case LedCondition::Off: state = 0u; break;
+                    default: state = (usbDevice->hidGetLedState() & mask) ^ mask; break;
+                }
+
+                // Continue with the script on timeout, like after a fixed delay
+                if (!usbDevice->hidWaitForLedState(mask, state, timeout)) {
+                    LOGW("Timeout while waiting for the LED state at address %zu", pc);
+                }
+                break;
+            }
+            case Opcode::SyncHost: {
+                if (usbDevice && !usbDevice->hidSyncHost(readU32(operands), timing.keyDelay)) {
+                    LOGW("Host synchronization at address %zu timed out", pc);
+                }
+                // Two CAPS LOCK strokes, the host reaction itself is not known
+                duration += 4u * static_cast<uint64_t>(timing.keyDelay);
+                break;
+            }
+            case Opcode::PushByte: {
+                stack[stackSize++] = static_cast<int8_t>(operands[0u]);
+                break;
+            }
+            case Opcode::Push: {
+                stack[stackSize++] = static_cast<int32_t>(readU32(operands));
+                break;
+            }
+            case Opcode::Load: {
+                stack[stackSize++] = variables[operands[0u]];
+                break;
+            }
+            case Opcode::Store: {
+                variables[operands[0u]] = stack[--stackSize];
+                break;
+            }
+            case Opcode::LogicalNot: {
+                stack[stackSize - 1u] = (stack[stackSize - 1u] == 0);
+                break;
+            }
+            case Opcode::Negate: {
+                stack[stackSize - 1u] = static_cast<int32_t>(0u - static_cast<uint32_t>(stack[stackSize - 1u]));
+                break;
+            }
+            case Opcode::If:
+            case Opcode::While: {
+                if (stack[--stackSize] == 0) {
+                    nextPc = readU16(operands);
+                }
+                break;
+            }
+            case Opcode::Else:
+            case Opcode::EndWhile:
+            case Opcode::Function: {
+                nextPc = readU16(operands);
+                break;
+            }
+            case Opcode::Call: {
+                if (callStackSize >= CALL_STACK_SIZE) {
+                    LOGE("Call stack overflow at address %zu - script execution aborted", pc);
+                    return ErrorCode::GeneralError;
+                }
+                callStack[callStackSize++] = static_cast<uint16_t>(nextPc);
+                nextPc = functions[operands[0u]].address;
+                break;
+            }
+            case Opcode::Return: {
+                if (callStackSize == 0u) {
+                    // Return from the top level ends the script
+                    return ErrorCode::Success;
+                }
+                nextPc = callStack[--callStackSize];
                 break;
             }
-            case Command::KeyStroke: {
-                const std::vector<uint8_t> &keyCodes = std::any_cast<std::vector<uint8_t>>(std::get<1>(command));
-                usbDevice.hidKeyStroke(keyCodes);
+            case Opcode::Repeat: {
+                // The repeated statement was already executed once before the loop is reached
+                const bool isInProgress = (repeatStackSize > 0u) && (repeatStack[repeatStackSize - 1u].address == pc) &&
+                    (repeatStack[repeatStackSize - 1u].callStackSize == callStackSize);
+                if (!isInProgress) {
+                    if (repeatStackSize >= REPEAT_STACK_SIZE) {
+                        LOGE("Too many nested REPEAT commands at address %zu - script execution aborted", pc);
+                        return ErrorCode::GeneralError;
+                    }
+                    repeatStack[repeatStackSize++] = {pc, callStackSize, readU32(&operands[2u])};
+                }
+
+                RepeatState &state = repeatStack[repeatStackSize - 1u];
+                if (state.remaining == 0u) {
+                    --repeatStackSize;
+                }
+                else {
+                    --state.remaining;
+                    nextPc = readU16(operands);
+                }
                 break;
             }
-            case Command::Delay: {
-                uint32_t delay = std::any_cast<uint32_t>(std::get<1>(command));
-                Utils::delay(delay);
+            case Opcode::SetDefaultDelay:
+            case Opcode::SetKeyDelay: {
+                // Negative delays are treated as no delay
+                const uint32_t delay = static_cast<uint32_t>(std::max(stack[--stackSize], 0));
+                ((opcode == Opcode::SetDefaultDelay) ? timing.defaultDelay : timing.keyDelay) = delay;
                 break;
             }
             default: {
-                LOGE("Unknown command in command vector - will not be executed.");
-                return ErrorCode::GeneralError;
+                const int32_t rhs = stack[--stackSize];
+                const int32_t lhs = stack[--stackSize];
+                auto result = evaluate(opcode, lhs, rhs);
+                if (!result) {
+                    LOGE("Division by zero at address %zu - script execution aborted", pc);
+                    return ErrorCode::GeneralError;
+                }
+                stack[stackSize++] = *result;
             }
         }
+
+        pc = nextPc;
     }
 
     return ErrorCode::Success;
 }
 
-std::string Script::toString() {
+std::string Script::toString() const {
+    struct Operand {
+        std::string text;
+        uint8_t precedence;
+    };
+    struct Block {
+        std::size_t endAddress;
+        const char *endKeyword;
+    };
+
     std::string scriptStr{};
+    const KeyboardLayout *layout = KeyboardLayout::get(layoutId);
+
+    std::vector<Operand> operands{};
+    std::vector<Block> blocks{};
+    std::vector<bool> isVariableDeclared(variableNames.size(), false);
+
+    auto popOperand = [&operands]() {
+        if (operands.empty()) {
+            LOGE("Missing operand in bytecode - it will not be printed correctly");
+            return Operand{"0", PRIMARY_PRECEDENCE};
+        }
+        Operand operand = std::move(operands.back());
+        operands.pop_back();
+        return operand;
+    };
+    auto wrap = [](const Operand &operand, bool isWrapped) {
+        return isWrapped ? ("(" + operand.text + ")") : operand.text;
+    };
+    auto addLine = [&scriptStr, &blocks](const std::string &line) {
+        // Indent the lines by the depth of the blocks
+        scriptStr.append(4u * blocks.size(), ' ');
+        scriptStr += line;
+        scriptStr += "\n";
+    };
+
+    for (std::size_t pc = 0u; pc <= code.size(); pc += getInstructionSize(code, pc)) {
+        // Close all of the blocks ending at this instruction
+        while (!blocks.empty() && (blocks.back().endAddress <= pc)) {
+            const char *endKeyword = blocks.back().endKeyword;
+            blocks.pop_back();
+            addLine(endKeyword);
+        }
+        if (pc == code.size()) {
+            break;
+        }
+
+        const Opcode opcode = static_cast<Opcode>(code[pc]);
+        const uint8_t *instructionOperands = &code[pc + 1u];
 
-    for (const auto &command : commands) {
-        switch (std::get<0>(command)) {
-            case Command::StringWrite: {
-                const std::string &str = std::any_cast<std::string>(std::get<1>(command));
+        switch (opcode) {
+            case Opcode::KeyReports: {
+                const uint16_t reportsLen = readU16(instructionOperands);
+                std::vector<KeyboardLayout::KeyReport> reports{};
+                reports.reserve(reportsLen);
+                for (uint16_t reportIdx = 0u; reportIdx < reportsLen; ++reportIdx) {
+                    reports.push_back({instructionOperands[2u + (2u * reportIdx)], instructionOperands[2u + (2u * reportIdx) + 1u]});
+                }
+
+                std::string line = "STRING ";
+                if (layout->decode(reports, line) != ErrorCode::Success) {
+                    LOGE("Failed to decode key reports - the string will not be printed completely");
+                }
+                addLine(line);
 
-                scriptStr += "STRING ";
-                scriptStr += str;
+                break;
+            }
+            case Opcode::PackedText: {
+                TextCodec::Decoder decoder(std::span<const uint8_t>(&instructionOperands[6u], readU16(&instructionOperands[4u])),
+                    readU16(&instructionOperands[2u]));
+                std::string line = "STRING ";
+                while (const auto chr = decoder.next()) {
+                    line += *chr;
+                }
+                addLine(line);
 
                 break;
             }
-            case Command::KeyStroke: {
-                const std::vector<uint8_t> &keyCodes = std::any_cast<std::vector<uint8_t>>(std::get<1>(command));
+            case Opcode::KeyStroke: {
+                std::string line{};
+                for (uint8_t keyIdx = 0u; keyIdx < instructionOperands[0u]; ++keyIdx) {
+                    const uint8_t keyCode = instructionOperands[1u + keyIdx];
 
-                for(const uint8_t &keyCode : keyCodes){
                     // Check if the keycode belongs to one of the special keys
                     const auto specialKeyIt = std::find_if(specialKeys.begin(), specialKeys.end(), [&keyCode](const auto& specialKey) {return specialKey.keyCode == keyCode;});
                     if(specialKeyIt != specialKeys.end()) {
                         // The keycode is a special key
-                        scriptStr += specialKeyIt->name + " ";
+                        line += specialKeyIt->name + " ";
                     }
-                    else if(keyCode < ASCII_CHAR_NUM) {
-                        // The keycode is an ASCII character
-                        // Use the "lower-case" version of the keycode for printing
-                        // Shift key is added separately as a special key
-                        char ascii = keycodeToAsciiConvTable[keyCode][0];
-                        scriptStr += ascii;
-                        scriptStr += " ";
+                    else if(auto codePoint = layout->findCodePoint({0u, keyCode})) {
+                        // The keycode is a character key
+                        // Use the unmodified character of the key for printing
+                        // Modifier keys are added separately as special keys
+                        KeyboardLayout::encodeUtf8(*codePoint, line);
+                        line += " ";
                     }
                     else {
-                        LOGE("Unknown keycode in command vector - will not be printed");
+                        LOGE("Unknown keycode in bytecode - will not be printed");
                     }
                 }
+                addLine(line);
 
                 break;
             }
-            case Command::Delay: {
-                uint32_t delay = std::any_cast<uint32_t>(std::get<1>(command));
-
-                scriptStr += "DELAY ";
-                scriptStr += std::to_string(delay);
+            case Opcode::Delay: {
+                addLine("DELAY " + std::to_string(readU32(instructionOperands)));
+                break;
+            }
+            case Opcode::WaitForLed: {
+                const auto ledIt = std::find_if(lockLeds.begin(), lockLeds.end(), [&instructionOperands](const LockLed &led) {
+                    return led.mask == instructionOperands[0u];
+                });
+                if (ledIt == lockLeds.end()) {
+                    LOGE("Unknown LED in bytecode - will not be printed");
+                    break;
+                }
 
+                std::string line = "WAIT_FOR_" + ledIt->name + "_" + ledConditionNames[instructionOperands[1u]];
+                const uint32_t timeout = readU32(&instructionOperands[2u]);
+                if (timeout != 0u) {
+                    line += " " + std::to_string(timeout);
+                }
+                addLine(line);
+                break;
+            }
+            case Opcode::SyncHost: {
+                addLine("SYNC_HOST " + std::to_string(readU32(instructionOperands)));
+                break;
+            }
+            case Opcode::MouseMove: {
+                int32_t x = 0;
+                int32_t y = 0;
+                for (uint16_t stepIdx = 0u; stepIdx < readU16(instructionOperands); ++stepIdx) {
+                    x += static_cast<int8_t>(instructionOperands[2u + (2u * stepIdx)]);
+                    y += static_cast<int8_t>(instructionOperands[2u + (2u * stepIdx) + 1u]);
+                }
+                addLine("MOUSE_MOVE " + std::to_string(x) + " " + std::to_string(y));
+                break;
+            }
+            case Opcode::MouseScroll: {
+                int32_t distance = 0;
+                for (uint16_t stepIdx = 0u; stepIdx < readU16(instructionOperands); ++stepIdx) {
+                    distance += static_cast<int8_t>(instructionOperands[2u + stepIdx]);
+                }
+                addLine("MOUSE_SCROLL " + std::to_string(distance));
+                break;
+            }
+            case Opcode::MouseClick: {
+                const auto buttonIt = std::find_if(mouseButtons.begin(), mouseButtons.end(), [&instructionOperands](const MouseButton &button) {
+                    return button.buttons == instructionOperands[0u];
+                });
+                if (buttonIt != mouseButtons.end()) {
+                    addLine("MOUSE_CLICK " + buttonIt->name);
+                }
+                else {
+                    LOGE("Unknown mouse button in bytecode - will not be printed");
+                }
+                break;
+            }
+            case Opcode::PushByte: {
+                operands.push_back({std::to_string(static_cast<int8_t>(instructionOperands[0u])), PRIMARY_PRECEDENCE});
+                break;
+            }
+            case Opcode::Push: {
+                operands.push_back({std::to_string(static_cast<int32_t>(readU32(instructionOperands))), PRIMARY_PRECEDENCE});
+                break;
+            }
+            case Opcode::Load: {
+                operands.push_back({"$" + variableNames[instructionOperands[0u]], PRIMARY_PRECEDENCE});
+                break;
+            }
+            case Opcode::Store: {
+                // The first assignment in the code order is the declaration of the variable
+                const uint8_t variableIdx = instructionOperands[0u];
+                const std::string prefix = isVariableDeclared[variableIdx] ? "$" : "VAR $";
+                isVariableDeclared[variableIdx] = true;
+                addLine(prefix + variableNames[variableIdx] + " = " + popOperand().text);
+                break;
+            }
+            case Opcode::LogicalNot:
+            case Opcode::Negate: {
+                const Operand operand = popOperand();
+                const std::string token = (opcode == Opcode::LogicalNot) ? "!" : "-";
+                operands.push_back({token + wrap(operand, operand.precedence < UNARY_PRECEDENCE), UNARY_PRECEDENCE});
+                break;
+            }
+            case Opcode::If: {
+                addLine("IF (" + popOperand().text + ") THEN");
+                blocks.push_back({readU16(instructionOperands), "END_IF"});
+                break;
+            }
+            case Opcode::Else: {
+                // The IF block jumps right behind its ELSE instruction
+                if (!blocks.empty() && (blocks.back().endAddress == pc + 3u)) {
+                    blocks.pop_back();
+                    addLine("ELSE");
+                    blocks.push_back({readU16(instructionOperands), "END_IF"});
+                }
+                else {
+                    LOGE("ELSE without matching IF in bytecode - it will not be printed");
+                }
+                break;
+            }
+            case Opcode::While: {
+                addLine("WHILE (" + popOperand().text + ")");
+                blocks.push_back({readU16(instructionOperands), "END_WHILE"});
+                break;
+            }
+            case Opcode::EndWhile: {
+                // Printed when the loop block is closed
+                break;
+            }
+            case Opcode::Function: {
+                const auto functionIt = std::find_if(functions.begin(), functions.end(), [pc](const Function &function) {
+                    return function.address == pc + 3u;
+                });
+                addLine("FUNCTION " + ((functionIt != functions.end()) ? functionIt->name : std::string("UNKNOWN")) + "()");
+                blocks.push_back({readU16(instructionOperands), "END_FUNCTION"});
+                break;
+            }
+            case Opcode::Call: {
+                addLine(functions[instructionOperands[0u]].name + "()");
+                break;
+            }
+            case Opcode::Repeat: {
+                addLine("REPEAT " + std::to_string(readU32(&instructionOperands[2u])));
+                break;
+            }
+            case Opcode::SetDefaultDelay: {
+                addLine("DEFAULT_DELAY " + popOperand().text);
+                break;
+            }
+            case Opcode::SetKeyDelay: {
+                addLine("STRING_DELAY " + popOperand().text);
+                break;
+            }
+            case Opcode::Return: {
+                // The last RETURN of the function is implied by END_FUNCTION
+                if (blocks.empty() || (blocks.back().endAddress != pc + 1u) || (std::strcmp(blocks.back().endKeyword, "END_FUNCTION") != 0)) {
+                    addLine("RETURN");
+                }
                 break;
             }
             default: {
-                LOGE("Unknown command in command vector - will not be printed");
+                const OperatorInfo *op = findBinaryOperator(opcode);
+                if (!op) {
+                    LOGE("Unknown instruction in bytecode - will not be printed");
+                    break;
+                }
+
+                // Operators are left associative, so the right operand with the same precedence needs parentheses
+                const Operand rhs = popOperand();
+                const Operand lhs = popOperand();
+                operands.push_back({wrap(lhs, lhs.precedence < op->precedence) + " " + op->token + " " + wrap(rhs, rhs.precedence <= op->precedence), op->precedence});
             }
         }
-
-        // Add newline before the next command
-        scriptStr += "\n";
     }
 
     // Remove the last newline character
@@ -477,48 +2539,35 @@ std::string Script::toString() {
     return scriptStr;
 }
 
-std::vector<uint8_t> Script::serialize() {
+std::vector<uint8_t> Script::serialize() const {
     std::vector<uint8_t> serialized{};
 
-    for (const auto &command : commands) {
-        switch (std::get<0>(command)) {
-            case Command::StringWrite: {
-                const std::string &str = std::any_cast<std::string>(std::get<1>(command));
-                serialized.push_back(static_cast<uint8_t>(Command::StringWrite));
-                serialized.push_back(static_cast<uint8_t>(str.length()));
-
-                for(const auto& chr : str){
-                    serialized.push_back(static_cast<uint8_t>(chr));
-                }
-
-                break;
-            }
-            case Command::KeyStroke: {
-                const std::vector<uint8_t> &keyCodes = std::any_cast<std::vector<uint8_t>>(std::get<1>(command));
-                serialized.push_back(static_cast<uint8_t>(Command::KeyStroke));
-                serialized.push_back(static_cast<uint8_t>(keyCodes.size()));
-
-                for(const auto& keyCode : keyCodes){
-                    serialized.push_back(static_cast<uint8_t>(keyCode));
-                }
-
-                break;
-            }
-            case Command::Delay: {
-                uint32_t delay = std::any_cast<uint32_t>(std::get<1>(command));
-                serialized.push_back(static_cast<uint8_t>(Command::Delay));
-
-                uint8_t *bytePtr = reinterpret_cast<uint8_t*>(&delay);
-                for(size_t byteIdx = 0u; byteIdx < sizeof(delay); ++byteIdx){
-                    serialized.push_back(static_cast<uint8_t>(bytePtr[byteIdx]));
-                }
+    // Header: magic, version, layout and code size
+    // The layout is required to interpret the key codes of the script
+    serialized.insert(serialized.end(), std::begin(SERIALIZED_MAGIC), std::end(SERIALIZED_MAGIC));
+    serialized.push_back(SERIALIZED_VERSION);
+    serialized.push_back(static_cast<uint8_t>(layoutId));
+    serialized.push_back(static_cast<uint8_t>(code.size()));
+    serialized.push_back(static_cast<uint8_t>(code.size() >> 8u));
+
+    serialized.insert(serialized.end(), code.begin(), code.end());
+
+    // Symbols are required only to print the script back in the source form, the parser limits their length
+    auto addString = [&serialized](const std::string &str) {
+        serialized.push_back(static_cast<uint8_t>(str.size()));
+        serialized.insert(serialized.end(), str.begin(), str.end());
+    };
+
+    serialized.push_back(static_cast<uint8_t>(variableNames.size()));
+    for (const auto &name : variableNames) {
+        addString(name);
+    }
 
-                break;
-            }
-            default: {
-                LOGE("Unknown command in command vector - it will not be included in serialized data");
-            }
-        }
+    serialized.push_back(static_cast<uint8_t>(functions.size()));
+    for (const auto &function : functions) {
+        serialized.push_back(static_cast<uint8_t>(function.address));
+        serialized.push_back(static_cast<uint8_t>(function.address >> 8u));
+        addString(function.name);
     }
 
     return serialized;
@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+#include "ScriptStore.hpp"
+#include "Logger.hpp"
+
+namespace {
+    char getSlotName(std::size_t slotIdx) {
+        return static_cast<char>('A' + slotIdx);
+    }
+
+    // The sequence wraps, the newer one is less than half of the range ahead
+    bool isNewer(uint32_t sequence, uint32_t other) {
+        return static_cast<int32_t>(sequence - other) > 0;
+    }
+}
+
+ScriptStore::ScriptStore(const char *partitionLabel)
+:partitionLabel(partitionLabel),
+partition(nullptr),
+slotSize(0u),
+activeSlot(NO_SLOT),
+sequence(0u),
+isWriting(false)
+{}
+
+std::size_t ScriptStore::getSlotOffset(std::size_t slotIdx) const {
+    return slotIdx * slotSize;
+}
+
+std::optional<ScriptStore::Header> ScriptStore::readHeader(std::size_t slotIdx) const {
+    Header header{};
+    esp_err_t ret = esp_partition_read(partition, getSlotOffset(slotIdx), &header, sizeof(header));
+    if (ESP_OK != ret) {
+        LOGE("Failed to read the header of the script slot %c with error: (%s)", getSlotName(slotIdx), esp_err_to_name(ret));
+        return std::nullopt;
+    }
+
+    // The erased slot has all bits set, so it does not match the magic
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&header);
+    if ((MAGIC != header.magic) ||
+        (header.headerCrc != Utils::crc32(std::span<const uint8_t>(bytes, offsetof(Header, headerCrc)))) ||
+        (header.size > getCapacity())) {
+        return std::nullopt;
+    }
+
+    return header;
+}
+
+std::optional<uint32_t> ScriptStore::readCrc(std::size_t offset, std::size_t size) const {
+    std::array<uint8_t, CHUNK_SIZE> chunk{};
+    uint32_t crc = 0u;
+    for (std::size_t chunkOffset = 0u; chunkOffset < size; chunkOffset += CHUNK_SIZE) {
+        const std::size_t chunkSize = std::min(size - chunkOffset, CHUNK_SIZE);
+        if (ESP_OK != esp_partition_read(partition, offset + chunkOffset, chunk.data(), chunkSize)) {
+            return std::nullopt;
+        }
+        crc = Utils::crc32(std::span<const uint8_t>(chunk.data(), chunkSize), crc);
+    }
+
+    return crc;
+}
+
+bool ScriptStore::isProgrammed(std::size_t offset, std::span<const uint8_t> data) const {
+    std::array<uint8_t, CHUNK_SIZE> chunk{};
+    for (std::size_t chunkOffset = 0u; chunkOffset < data.size(); chunkOffset += CHUNK_SIZE) {
+        const std::size_t chunkSize = std::min(data.size() - chunkOffset, CHUNK_SIZE);
+        if ((ESP_OK != esp_partition_read(partition, offset + chunkOffset, chunk.data(), chunkSize)) ||
+            (0 != std::memcmp(chunk.data(), &data[chunkOffset], chunkSize))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+ErrorCode ScriptStore::writeSlot(std::size_t slotIdx, std::span<const uint8_t> data) {
+    const std::size_t slotOffset = getSlotOffset(slotIdx);
+    const std::size_t sectorSize = partition->erase_size;
+
+    // The header sector is always erased, which invalidates the slot until the new header is written. The other
+    // sectors still hold the script saved two times ago, the unchanged ones are kept.
+    std::size_t erasedSectorNum = 0u;
+    std::size_t sectorNum = 0u;
+    for (std::size_t sectorStart = 0u; sectorStart < HEADER_SIZE + data.size(); sectorStart += sectorSize, ++sectorNum) {
+        const std::size_t dataStart = (0u == sectorStart) ? 0u : sectorStart - HEADER_SIZE;
+        const std::size_t dataEnd = std::min(data.size(), sectorStart + sectorSize - HEADER_SIZE);
+        const std::size_t dataOffset = slotOffset + HEADER_SIZE + dataStart;
+        const auto sectorData = data.subspan(dataStart, dataEnd - dataStart);
+        if ((0u != sectorStart) && isProgrammed(dataOffset, sectorData)) {
+            continue;
+        }
+
+        esp_err_t ret = esp_partition_erase_range(partition, slotOffset + sectorStart, sectorSize);
+        if (ESP_OK == ret) {
+            ret = esp_partition_write(partition, dataOffset, sectorData.data(), sectorData.size());
+        }
+        if (ESP_OK != ret) {
+            LOGE("Failed to write the script slot %c with error: (%s)", getSlotName(slotIdx), esp_err_to_name(ret));
+            return ErrorCode::GeneralError;
+        }
+        ++erasedSectorNum;
+    }
+
+    // The header is only written for the verified data
+    const uint32_t dataCrc = Utils::crc32(data);
+    if (dataCrc != readCrc(slotOffset + HEADER_SIZE, data.size())) {
+        LOGE("Verification of the script slot %c failed", getSlotName(slotIdx));
+        return ErrorCode::GeneralError;
+    }
+
+    Header header{};
+    std::memset(header.reserved, 0xFF, sizeof(header.reserved));
+    header.magic = MAGIC;
+    header.sequence = sequence + 1u;
+    header.size = static_cast<uint32_t>(data.size());
+    header.dataCrc = dataCrc;
+    header.headerCrc = Utils::crc32(std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(&header), offsetof(Header, headerCrc)));
+
+    esp_err_t ret = esp_partition_write(partition, slotOffset, &header, sizeof(header));
+    if ((ESP_OK != ret) || !readHeader(slotIdx)) {
+        LOGE("Failed to write the header of the script slot %c with error: (%s)", getSlotName(slotIdx), esp_err_to_name(ret));
+        return ErrorCode::GeneralError;
+    }
+
+    sequence = header.sequence;
+    activeSlot = static_cast<uint32_t>(slotIdx);
+
+    LOGI("Script of %zu bytes stored in the slot %c (sequence %lu), %zu of %zu sectors erased", data.size(),
+        getSlotName(slotIdx), static_cast<unsigned long>(sequence), erasedSectorNum, sectorNum);
+
+    return ErrorCode::Success;
+}
+
+ErrorCode ScriptStore::init() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partitionLabel);
+    if (!partition) {
+        LOGE("Failed to find the '%s' partition", partitionLabel);
+        return ErrorCode::GeneralError;
+    }
+
+    slotSize = (partition->size / SLOT_NUM) / partition->erase_size * partition->erase_size;
+    if (slotSize < partition->erase_size) {
+        LOGE("The '%s' partition is too small for %zu script slots", partitionLabel, SLOT_NUM);
+        partition = nullptr;
+        return ErrorCode::GeneralError;
+    }
+
+    std::array<std::optional<Header>, SLOT_NUM> headers{};
+    for (std::size_t slotIdx = 0u; slotIdx < SLOT_NUM; ++slotIdx) {
+        headers[slotIdx] = readHeader(slotIdx);
+    }
+
+    // The newest slot is used unless its data are damaged, e.g. by a failure of the flash
+    std::array<std::size_t, SLOT_NUM> order{};
+    for (std::size_t slotIdx = 0u; slotIdx < SLOT_NUM; ++slotIdx) {
+        order[slotIdx] = slotIdx;
+    }
+    std::sort(order.begin(), order.end(), [&headers](std::size_t slotIdx, std::size_t otherIdx) {
+        return headers[slotIdx] && (!headers[otherIdx] || isNewer(headers[slotIdx]->sequence, headers[otherIdx]->sequence));
+    });
+
+    // The sequence continues after the newest header, even if its data are damaged
+    if (headers[order[0u]]) {
+        sequence = headers[order[0u]]->sequence;
+    }
+
+    for (std::size_t slotIdx : order) {
+        const auto &header = headers[slotIdx];
+        if (!header) {
+            continue;
+        }
+
+        if (header->dataCrc != readCrc(getSlotOffset(slotIdx) + HEADER_SIZE, header->size)) {
+            LOGW("Script slot %c (sequence %lu) is damaged", getSlotName(slotIdx), static_cast<unsigned long>(header->sequence));
+            continue;
+        }
+
+        activeSlot = static_cast<uint32_t>(slotIdx);
+        LOGI("Using the script slot %c (sequence %lu, %lu bytes)", getSlotName(slotIdx),
+            static_cast<unsigned long>(header->sequence), static_cast<unsigned long>(header->size));
+        break;
+    }
+
+    return ErrorCode::Success;
+}
+
+bool ScriptStore::isAvailable() const {
+    return nullptr != partition;
+}
+
+bool ScriptStore::isEmpty() const {
+    return NO_SLOT == activeSlot;
+}
+
+std::size_t ScriptStore::getCapacity() const {
+    return (slotSize > HEADER_SIZE) ? slotSize - HEADER_SIZE : 0u;
+}
+
+ErrorCode ScriptStore::read(std::vector<uint8_t> &data) const {
+    data.clear();
+
+    const uint32_t slotIdx = activeSlot;
+    if (!partition || (NO_SLOT == slotIdx)) {
+        return ErrorCode::Success;
+    }
+
+    const auto header = readHeader(slotIdx);
+    if (!header) {
+        LOGE("Header of the script slot %c is not valid", getSlotName(slotIdx));
+        return ErrorCode::GeneralError;
+    }
+
+    data.resize(header->size);
+    esp_err_t ret = esp_partition_read(partition, getSlotOffset(slotIdx) + HEADER_SIZE, data.data(), data.size());
+    if (ESP_OK != ret) {
+        LOGE("Failed to read the script slot %c with error: (%s)", getSlotName(slotIdx), esp_err_to_name(ret));
+        data.clear();
+        return ErrorCode::GeneralError;
+    }
+
+    if (header->dataCrc != Utils::crc32(data)) {
+        LOGE("Script slot %c does not match its CRC", getSlotName(slotIdx));
+        data.clear();
+        return ErrorCode::GeneralError;
+    }
+
+    return ErrorCode::Success;
+}
+
+ErrorCode ScriptStore::write(std::span<const uint8_t> data) {
+    if (!partition) {
+        LOGE("Script store is not available");
+        return ErrorCode::GeneralError;
+    }
+
+    if (data.empty() || (data.size() > getCapacity())) {
+        LOGE("Script of %zu bytes does not fit the script slot of %zu bytes", data.size(), getCapacity());
+        return ErrorCode::InvalidArgument;
+    }
+
+    if (isWriting.exchange(true)) {
+        LOGE("Another script is being stored");
+        return ErrorCode::GeneralError;
+    }
+
+    // The active slot is never written, so it stays valid until the new header is written
+    const uint32_t currentSlot = activeSlot;
+    const std::size_t slotIdx = (NO_SLOT == currentSlot) ? 0u : (currentSlot + 1u) % SLOT_NUM;
+    const ErrorCode err = writeSlot(slotIdx, data);
+    isWriting = false;
+
+    return err;
+}
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "ScriptStream.hpp"
+#include "Logger.hpp"
+
+ScriptStream::ScriptStream(const std::string &relativePath, KeyboardLayout::Id layoutId)
+:path(std::string(STORAGE_BASE_PATH) + "/" + relativePath),
+layoutId(layoutId),
+file(nullptr),
+blocks(),
+freeBlocks(nullptr),
+filledBlocks(nullptr),
+abortFlag(false),
+pendingLine(),
+lineNumber(0u),
+isInRemBlock(false),
+isReaderFinished(true),
+timing(Script::DEFAULT_TIMING),
+previousScript(std::nullopt)
+{}
+
+ScriptStream::~ScriptStream() {
+    // The reader task never outlives the run() call, so it is safe to release the resources here
+    if (file) {
+        fclose(file);
+    }
+    if (freeBlocks) {
+        vQueueDelete(freeBlocks);
+    }
+    if (filledBlocks) {
+        vQueueDelete(filledBlocks);
+    }
+}
+
+bool ScriptStream::isValidPath(const std::string &relativePath) {
+    if (relativePath.empty() || relativePath.front() == '/') {
+        return false;
+    }
+
+    // Do not allow escaping from the storage base path
+    return relativePath.find("..") == std::string::npos;
+}
+
+void ScriptStream::readerTask(void *arg) {
+    ScriptStream *stream = static_cast<ScriptStream *>(arg);
+
+    for (;;) {
+        uint8_t blockIdx = 0u;
+        (void)xQueueReceive(stream->freeBlocks, &blockIdx, portMAX_DELAY);
+
+        BlockMessage message = {
+            .blockIdx = blockIdx,
+            .status = ErrorCode::Success,
+            .endOfFile = false
+        };
+
+        Block &block = stream->blocks[blockIdx];
+
+        if (stream->abortFlag) {
+            // Consumer requested to stop - report end of file without reading any more data
+            block.length = 0u;
+            message.endOfFile = true;
+        }
+        else {
+            // Fill the free block while the consumer is busy typing the other one
+            block.length = fread(block.data.data(), 1u, block.data.size(), stream->file);
+            if (ferror(stream->file)) {
+                message.status = ErrorCode::GeneralError;
+            }
+            message.endOfFile = (block.length < block.data.size()) || (ErrorCode::Success != message.status);
+        }
+
+        (void)xQueueSend(stream->filledBlocks, &message, portMAX_DELAY);
+
+        if (message.endOfFile) {
+            // The stream object must not be accessed after the last message is sent
+            break;
+        }
+    }
+
+    vTaskDelete(nullptr);
+}
+
+ErrorCode ScriptStream::run(UsbDevice &usbDevice) {
+    file = fopen(path.c_str(), "r");
+    if (!file) {
+        LOGE("Failed to open script file '%s'", path.c_str());
+        return ErrorCode::InvalidArgument;
+    }
+
+    freeBlocks = xQueueCreate(BLOCK_NUM, sizeof(uint8_t));
+    filledBlocks = xQueueCreate(BLOCK_NUM, sizeof(BlockMessage));
+    if (!freeBlocks || !filledBlocks) {
+        LOGE("Failed to create script stream queues");
+        return ErrorCode::GeneralError;
+    }
+
+    // Initially all of the blocks are free for the reader
+    for (uint8_t blockIdx = 0u; blockIdx < BLOCK_NUM; ++blockIdx) {
+        (void)xQueueSend(freeBlocks, &blockIdx, 0u);
+    }
+
+    // Run the reader with the priority of the caller, so it can fill the next block during the typing delays
+    isReaderFinished = false;
+    if (pdPASS != xTaskCreate(readerTask, "scriptStream", READER_TASK_STACK_SIZE, this, uxTaskPriorityGet(nullptr), nullptr)) {
+        LOGE("Failed to create script stream reader task");
+        isReaderFinished = true;
+        return ErrorCode::GeneralError;
+    }
+
+    LOGI("Streaming script from '%s'...", path.c_str());
+
+    ErrorCode errorCode = ErrorCode::Success;
+    while (!isReaderFinished) {
+        BlockMessage message{};
+        (void)xQueueReceive(filledBlocks, &message, portMAX_DELAY);
+        isReaderFinished = message.endOfFile;
+
+        if (ErrorCode::Success != message.status) {
+            LOGE("Failed to read script file '%s'", path.c_str());
+            errorCode = message.status;
+            break;
+        }
+
+        errorCode = processBlock(blocks[message.blockIdx], usbDevice);
+        if (ErrorCode::Success != errorCode) {
+            break;
+        }
+
+        // Give the block back to the reader
+        (void)xQueueSend(freeBlocks, &message.blockIdx, portMAX_DELAY);
+    }
+
+    if (ErrorCode::Success != errorCode) {
+        drain();
+        return errorCode;
+    }
+
+    // Handle the last line if the file does not end with a newline
+    if (!pendingLine.empty()) {
+        errorCode = processLine(pendingLine, usbDevice);
+        pendingLine.clear();
+    }
+
+    if (ErrorCode::Success == errorCode) {
+        LOGI("Script stream finished after %zu lines", lineNumber);
+    }
+
+    return errorCode;
+}
+
+void ScriptStream::drain() {
+    abortFlag = true;
+
+    // Keep returning the blocks until the reader acknowledges the abort request
+    while (!isReaderFinished) {
+        BlockMessage message{};
+        (void)xQueueReceive(filledBlocks, &message, portMAX_DELAY);
+        isReaderFinished = message.endOfFile;
+        (void)xQueueSend(freeBlocks, &message.blockIdx, portMAX_DELAY);
+    }
+}
+
+ErrorCode ScriptStream::processBlock(const Block &block, UsbDevice &usbDevice) {
+    for (std::size_t chrIdx = 0u; chrIdx < block.length; ++chrIdx) {
+        const char chr = block.data[chrIdx];
+
+        if (chr != '\n') {
+            if (pendingLine.size() >= MAX_LINE_LENGTH) {
+                LOGE("Line %zu exceeds the maximum length of %zu characters", lineNumber + 1u, MAX_LINE_LENGTH);
+                return ErrorCode::InvalidArgument;
+            }
+            pendingLine += chr;
+            continue;
+        }
+
+        ErrorCode errorCode = processLine(pendingLine, usbDevice);
+        // Keep the capacity of the line buffer, so the memory usage stays constant
+        pendingLine.clear();
+
+        if (ErrorCode::Success != errorCode) {
+            return errorCode;
+        }
+    }
+
+    return ErrorCode::Success;
+}
+
+ErrorCode ScriptStream::processLine(std::string &line, UsbDevice &usbDevice) {
+    ++lineNumber;
+
+    // Accept files with Windows line endings
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+
+    const std::size_t firstChrIdx = line.find_first_not_of(" \t");
+    if (std::string::npos == firstChrIdx) {
+        // Empty line - nothing to do
+        return ErrorCode::Success;
+    }
+
+    // REM_BLOCK comments may span multiple lines, so they are skipped here instead of the parser
+    if (isInRemBlock) {
+        isInRemBlock = (line.find("END_REM") == std::string::npos);
+        return ErrorCode::Success;
+    }
+    if (line.compare(firstChrIdx, std::strlen("REM_BLOCK"), "REM_BLOCK") == 0) {
+        isInRemBlock = (line.find("END_REM", firstChrIdx) == std::string::npos);
+        return ErrorCode::Success;
+    }
+
+    // Single line comments are skipped as well, so REPEAT refers to the last command
+    if (line.compare(firstChrIdx, std::strlen("REM "), "REM ") == 0) {
+        return ErrorCode::Success;
+    }
+
+    // REPEAT refers to the previous line, which was compiled as a separate script
+    const std::size_t keywordEnd = firstChrIdx + std::strlen("REPEAT");
+    if ((line.compare(firstChrIdx, std::strlen("REPEAT"), "REPEAT") == 0) &&
+        ((line.size() == keywordEnd) || (' ' == line[keywordEnd]) || ('\t' == line[keywordEnd]))) {
+        return processRepeat(line, firstChrIdx, usbDevice);
+    }
+
+    previousScript = Script::parse(line, layoutId);
+    if (!previousScript) {
+        LOGE("Failed to parse line %zu of script file '%s'", lineNumber, path.c_str());
+        return ErrorCode::InvalidArgument;
+    }
+
+    ErrorCode errorCode = previousScript->run(usbDevice, timing);
+    if (ErrorCode::Success != errorCode) {
+        LOGE("Failed to run line %zu of script file '%s'", lineNumber, path.c_str());
+    }
+
+    return errorCode;
+}
+
+ErrorCode ScriptStream::processRepeat(const std::string &line, std::size_t firstChrIdx, UsbDevice &usbDevice) {
+    // The count is accepted in the same form as by the compiler - no sign, no leading zeros and nine digits at most
+    const std::size_t countIdx = line.find_first_not_of(" \t", firstChrIdx + std::strlen("REPEAT"));
+    const char *countStr = line.c_str() + std::min(countIdx, line.size());
+    const char *lineEnd = line.c_str() + line.size();
+    uint32_t count = 0u;
+    const auto [countEnd, countErr] = std::from_chars(countStr, lineEnd, count);
+
+    if ((std::errc() != countErr) || (count > Script::MAX_REPEAT_COUNT) || (('0' == *countStr) && (countEnd - countStr > 1)) ||
+        (line.find_first_not_of(" \t", countEnd - line.c_str()) != std::string::npos)) {
+        LOGE("Invalid REPEAT count on line %zu of script file '%s'", lineNumber, path.c_str());
+        return ErrorCode::InvalidArgument;
+    }
+    if (!previousScript) {
+        LOGE("REPEAT on line %zu of script file '%s' does not follow a command", lineNumber, path.c_str());
+        return ErrorCode::InvalidArgument;
+    }
+
+    // REPEAT may not follow another REPEAT, as in the compiled scripts
+    const auto repeatedScript = std::move(previousScript);
+    previousScript.reset();
+    for (uint32_t repetition = 0u; repetition < count; ++repetition) {
+        ErrorCode errorCode = repeatedScript->run(usbDevice, timing);
+        if (ErrorCode::Success != errorCode) {
+            LOGE("Failed to run REPEAT on line %zu of script file '%s'", lineNumber, path.c_str());
+            return errorCode;
+        }
+    }
+
+    return ErrorCode::Success;
+}
@@ -0,0 +1,179 @@
+#include <algorithm>
+
+#include "TextCodec.hpp"
+
+// Fragments are joined without separators, the matches may span the neighbouring fragments
+const std::string_view TextCodec::dictionary =
+    "powershell -NoProfile -NonInteractive -WindowStyle Hidden -ExecutionPolicy Bypass -Command "
+    "Invoke-WebRequest -Uri Invoke-Expression (New-Object System.Net.WebClient).DownloadString('"
+    ").DownloadFile('Start-Process -Verb RunAs Set-ItemProperty -Path Get-ChildItem -Recurse "
+    "Remove-Item -Force Out-File -FilePath Add-MpPreference -ExclusionPath "
+    "$env:TEMP\\$env:USERPROFILE\\$env:APPDATA\\C:\\Windows\\System32\\cmd.exe /c "
+    "reg add HKCU\\Software\\Microsoft\\Windows\\CurrentVersion\\Run "
+    "HKEY_LOCAL_MACHINE\\SOFTWARE\\ netsh wlan show profile name= key=clear "
+    "bitsadmin /transfer notepad.exe explorer.exe taskkill /F /IM rundll32 "
+    "https://www.http://localhost:.com/.html.txt.bat.exe.ps1 "
+    "/bin/bash -c \"$(curl -fsSL wget -q -O - | sudo sh chmod +x /dev/null 2>&1 &\n"
+    "osascript -e 'tell application \"Terminal\" to do script "
+    "echo Hello, World!\nexit\nThe quick brown fox jumps over the lazy dog. "
+    "the and that this with from your have for you are not ing tion ment ";
+
+TextCodec::Decoder::Decoder(std::span<const uint8_t> packed, std::size_t textSize)
+:packed(packed),
+packedIdx(0u),
+remainingSize(textSize),
+window(),
+decodedSize(0u),
+tokenType(TokenType::None),
+tokenRemaining(0u),
+copyIdx(0u),
+isCorrupted(false)
+{}
+
+bool TextCodec::Decoder::readToken() {
+    if (packedIdx >= packed.size()) {
+        return false;
+    }
+
+    const uint8_t header = packed[packedIdx++];
+    const std::size_t available = packed.size() - packedIdx;
+    if (0u == (header & 0x80u)) {
+        tokenType = TokenType::Literal;
+        tokenRemaining = (header & 0x7Fu) + 1u;
+        return tokenRemaining <= available;
+    }
+
+    if (0u == (header & 0x40u)) {
+        // The distance may not reach before the start of the text or out of the window
+        if (available < 1u) {
+            return false;
+        }
+        const std::size_t distance = packed[packedIdx++] + 1u;
+        if (distance > std::min(decodedSize, WINDOW_SIZE)) {
+            return false;
+        }
+        tokenType = TokenType::Window;
+        tokenRemaining = (header & 0x3Fu) + MIN_WINDOW_MATCH;
+        copyIdx = decodedSize - distance;
+        return true;
+    }
+
+    if (available < 2u) {
+        return false;
+    }
+    const std::size_t offset = packed[packedIdx] | (static_cast<std::size_t>(packed[packedIdx + 1u]) << 8u);
+    packedIdx += 2u;
+    tokenType = TokenType::Dictionary;
+    tokenRemaining = (header & 0x3Fu) + MIN_DICTIONARY_MATCH;
+    copyIdx = offset;
+    return offset + tokenRemaining <= dictionary.size();
+}
+
+std::optional<char> TextCodec::Decoder::next() {
+    if (isCorrupted || (0u == remainingSize)) {
+        return std::nullopt;
+    }
+    if ((0u == tokenRemaining) && !readToken()) {
+        isCorrupted = true;
+        return std::nullopt;
+    }
+
+    char c = '\0';
+    switch (tokenType) {
+        case TokenType::Literal: {
+            c = static_cast<char>(packed[packedIdx++]);
+            break;
+        }
+        case TokenType::Window: {
+            // The copy may overlap the bytes it produces, e.g. for the repeated characters
+            c = window[copyIdx++ % WINDOW_SIZE];
+            break;
+        }
+        case TokenType::Dictionary: {
+            c = dictionary[copyIdx++];
+            break;
+        }
+        default: {
+            isCorrupted = true;
+            return std::nullopt;
+        }
+    }
+
+    --tokenRemaining;
+    --remainingSize;
+    window[decodedSize++ % WINDOW_SIZE] = c;
+    return c;
+}
+
+bool TextCodec::Decoder::isFinished() const {
+    return !isCorrupted && (0u == remainingSize) && (0u == tokenRemaining) && (packedIdx == packed.size());
+}
+
+void TextCodec::compress(std::string_view text, std::pmr::vector<uint8_t> &packed, bool useDictionary) {
+    auto matchLength = [&text](std::string_view source, std::size_t sourceIdx, std::size_t textIdx, std::size_t maxLength) {
+        std::size_t length = 0u;
+        while ((length < maxLength) && (sourceIdx + length < source.size()) && (source[sourceIdx + length] == text[textIdx + length])) {
+            ++length;
+        }
+        return length;
+    };
+
+    std::size_t literalStart = 0u;
+    auto emitLiterals = [&text, &packed, &literalStart](std::size_t end) {
+        while (literalStart < end) {
+            const std::size_t length = std::min(end - literalStart, MAX_LITERAL_LENGTH);
+            packed.push_back(static_cast<uint8_t>(length - 1u));
+            packed.insert(packed.end(), text.begin() + literalStart, text.begin() + literalStart + length);
+            literalStart += length;
+        }
+    };
+
+    // Greedy search of the longest match, the strings are short enough for the exhaustive search
+    std::size_t textIdx = 0u;
+    while (textIdx < text.size()) {
+        const std::size_t maxLength = std::min(text.size() - textIdx, MAX_MATCH_LENGTH);
+        std::size_t bestGain = 0u;
+        std::size_t bestLength = 0u;
+        std::size_t bestDistance = 0u;
+        std::optional<std::size_t> bestOffset{};
+
+        // The window match reads the text itself, so it may overlap the bytes being matched
+        for (std::size_t distance = 1u; distance <= std::min(textIdx, WINDOW_SIZE); ++distance) {
+            const std::size_t length = matchLength(text, textIdx - distance, textIdx, maxLength);
+            if ((length >= MIN_WINDOW_MATCH) && (length - 2u > bestGain)) {
+                bestGain = length - 2u;
+                bestLength = length;
+                bestDistance = distance;
+            }
+        }
+        if (useDictionary) {
+            for (std::size_t offset = 0u; offset < dictionary.size(); ++offset) {
+                const std::size_t length = matchLength(dictionary, offset, textIdx, maxLength);
+                if ((length >= MIN_DICTIONARY_MATCH) && (length - 3u > bestGain)) {
+                    bestGain = length - 3u;
+                    bestLength = length;
+                    bestOffset = offset;
+                }
+            }
+        }
+
+        if (0u == bestLength) {
+            ++textIdx;
+            continue;
+        }
+
+        emitLiterals(textIdx);
+        if (bestOffset) {
+            packed.push_back(static_cast<uint8_t>(0xC0u | (bestLength - MIN_DICTIONARY_MATCH)));
+            packed.push_back(static_cast<uint8_t>(*bestOffset));
+            packed.push_back(static_cast<uint8_t>(*bestOffset >> 8u));
+        }
+        else {
+            packed.push_back(static_cast<uint8_t>(0x80u | (bestLength - MIN_WINDOW_MATCH)));
+            packed.push_back(static_cast<uint8_t>(bestDistance - 1u));
+        }
+        textIdx += bestLength;
+        literalStart = textIdx;
+    }
+    emitLiterals(text.size());
+}
@@ -1,13 +1,13 @@
 #include "UsbDevice.hpp"
 
 uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance){
-    // We use only one interface and one HID report descriptor, so we can ignore parameter 'instance'
+    // Each HID interface has its own report descriptor
     UsbDevice* usbDevice = UsbDevice::getInstance(0);
     if (nullptr == usbDevice) {
         return nullptr;
     }
     
-    return usbDevice->getReportDescriptor();
+    return usbDevice->getReportDescriptor(instance);
 }
 
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen){
@@ -21,5 +21,23 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_t
 }
 
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize){
-    return;
+    // The only output report is the keyboard LED state
+    if ((HID_REPORT_TYPE_OUTPUT != report_type) || (UsbDevice::HID_KEYBOARD_INSTANCE != instance) ||
+        (UsbDevice::HID_KEYBOARD_REPORT_ID != report_id)) {
+        return;
+    }
+
+    // Depending on the TinyUSB version, the report ID may still be the first byte of the buffer
+    if ((0u != report_id) && (bufsize > 1u) && (report_id == buffer[0u])) {
+        ++buffer;
+        --bufsize;
+    }
+    if (bufsize < 1u) {
+        return;
+    }
+
+    UsbDevice* usbDevice = UsbDevice::getInstance(0);
+    if (nullptr != usbDevice) {
+        usbDevice->hidSetLedState(buffer[0u]);
+    }
 }
@@ -6,12 +6,26 @@
 #include "esp_partition.h"
 
 #include "UsbDevice.hpp"
+#include "PowerManager.hpp"
+#include "BootTimeline.hpp"
 #include "Logger.hpp"
 
+// Shorter delays than the tick period would not block at all
+static_assert(pdMS_TO_TICKS(UsbDevice::HID_POLLING_INTERVAL) > 0u, "The HID polling interval must not be shorter than the FreeRTOS tick period");
+#if CONFIG_ESP_DUCKY_HID_BOOT_KEYBOARD && (CFG_TUD_HID < 2)
+#error "The boot protocol keyboard needs two HID interfaces (CONFIG_TINYUSB_HID_COUNT)"
+#endif
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL && (CFG_TUD_CDC < 1)
+#error "The CDC channel needs the TinyUSB CDC-ACM class (CONFIG_TINYUSB_CDC_ENABLED)"
+#endif
+
 std::vector<UsbDevice*> UsbDevice::instances{};
 
 UsbDevice::UsbDevice() :
 isStartedFlag(false),
+isJtagEnabledFlag(false),
+isCdcEnabledFlag(false),
+deviceClass(DeviceClass::SerialJtag),
 wl_handle(WL_INVALID_HANDLE),
 interfaceCount(0u),
 configurationDescriptorTotalLength(0u),
@@ -31,10 +45,20 @@ deviceDescriptor({
     .iSerialNumber = 0x03u,
     .bNumConfigurations = 0x01u
 }),
-reportDescriptor({
-    TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(HID_ITF_PROTOCOL_KEYBOARD)),
-    TUD_HID_REPORT_DESC_MOUSE(HID_REPORT_ID(HID_ITF_PROTOCOL_MOUSE))
-}),
+#if CONFIG_ESP_DUCKY_HID_BOOT_KEYBOARD
+// The boot protocol keyboard report must not contain the report ID
+reportDescriptors({{
+    {TUD_HID_REPORT_DESC_KEYBOARD()},
+    {TUD_HID_REPORT_DESC_MOUSE()}
+}}),
+#else
+reportDescriptors({{
+    {
+        TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(HID_ITF_PROTOCOL_KEYBOARD)),
+        TUD_HID_REPORT_DESC_MOUSE(HID_REPORT_ID(HID_ITF_PROTOCOL_MOUSE))
+    }
+}}),
+#endif
 stringDescriptor({
     // array of pointer to string descriptors
     (char[]){0x09, 0x04},  // 0: is supported language is English (0x0409)
@@ -51,8 +75,17 @@ configurationDescriptor({
     //TUD_HID_DESCRIPTOR(0, 4, false, reportDescriptor.size(), 0x81, 16, 10),
     // Interface number, string index, EP Out & EP In address, EP size
     //TUD_MSC_DESCRIPTOR(1, 4, 0x01, 0x82, 64),
-})
+}),
+hidLedState(0u),
+hidAbortFlag(false),
+cdcRxCallback()
 {
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    // The two interfaces of the CDC-ACM function are grouped by the interface association descriptor
+    deviceDescriptor.bDeviceClass = TUSB_CLASS_MISC;
+    deviceDescriptor.bDeviceSubClass = MISC_SUBCLASS_COMMON;
+    deviceDescriptor.bDeviceProtocol = MISC_PROTOCOL_IAD;
+#endif
     instances.push_back(this);
 }
 
@@ -68,30 +101,35 @@ UsbDevice::~UsbDevice() {
 }
 
 void UsbDevice::enableHID() {
-    // add the HID interface descriptor to the configuration descriptor
+    // add the HID interface descriptors to the configuration descriptor
     std::vector<uint8_t> hidDescriptor = {
+#if CONFIG_ESP_DUCKY_HID_BOOT_KEYBOARD
         // Interface number, string index, boot protocol, report descriptor len, EP In address, size & polling interval
-        TUD_HID_DESCRIPTOR(interfaceCount++, 4, false, reportDescriptor.size(), 0x81, 16, 10),
+        TUD_HID_DESCRIPTOR(interfaceCount++, 4, HID_ITF_PROTOCOL_KEYBOARD, reportDescriptors[HID_KEYBOARD_INSTANCE].size(), 0x81, 8, HID_POLLING_INTERVAL),
+        TUD_HID_DESCRIPTOR(interfaceCount++, 4, HID_ITF_PROTOCOL_NONE, reportDescriptors[HID_MOUSE_INSTANCE].size(), 0x83, 8, HID_POLLING_INTERVAL),
+#else
+        // Interface number, string index, boot protocol, report descriptor len, EP In address, size & polling interval
+        TUD_HID_DESCRIPTOR(interfaceCount++, 4, false, reportDescriptors[HID_KEYBOARD_INSTANCE].size(), 0x81, 16, HID_POLLING_INTERVAL),
+#endif
     };
 
     configurationDescriptor.insert(configurationDescriptor.end(), hidDescriptor.begin(), hidDescriptor.end());
 
-    // add the length of the HID descriptor to the total length of the configuration descriptor
-    configurationDescriptorTotalLength += TUD_HID_DESC_LEN;
+    // add the length of the HID descriptors to the total length of the configuration descriptor
+    configurationDescriptorTotalLength += HID_INSTANCE_NUM * TUD_HID_DESC_LEN;
 }
 
-void UsbDevice::enableMSC() {
-    static wl_handle_t wl_handle = WL_INVALID_HANDLE;
-    
+ErrorCode UsbDevice::enableMSC() {
     const esp_partition_t *data_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT, NULL);
     if(data_partition == NULL) {
         LOGE("Failed to find data partition");
-        return;
+        return ErrorCode::GeneralError;
     }
 
     if( wl_mount(data_partition, &wl_handle) != ESP_OK) {
         LOGE("Failed to mount data partition");
-        return;
+        wl_handle = WL_INVALID_HANDLE;
+        return ErrorCode::GeneralError;
     }
 
     tinyusb_msc_spiflash_config_t config_spi = {
@@ -109,12 +147,15 @@ void UsbDevice::enableMSC() {
 
     if(tinyusb_msc_storage_init_spiflash(&config_spi) != ESP_OK) {
         LOGE("Failed to initialize TinyUSB storage");
-        return;
+        (void)wl_unmount(wl_handle);
+        wl_handle = WL_INVALID_HANDLE;
+        return ErrorCode::GeneralError;
     }
 
     if(tinyusb_msc_storage_mount("/data") != ESP_OK) {
         LOGE("Failed to mount TinyUSB storage");
-        return;
+        disableMSC();
+        return ErrorCode::GeneralError;
     }
 
     // add the MSC interface descriptor to the configuration descriptor
@@ -127,14 +168,89 @@ void UsbDevice::enableMSC() {
 
     // add the length of the MSC descriptor to the total length of the configuration descriptor
     configurationDescriptorTotalLength += TUD_MSC_DESC_LEN;
+
+    return ErrorCode::Success;
+}
+
+void UsbDevice::disableMSC() {
+    if(WL_INVALID_HANDLE == wl_handle) {
+        return;
+    }
+
+    // Release the storage, so that it can be mounted again by the next device class or by the application
+    (void)tinyusb_msc_storage_unmount();
+    tinyusb_msc_storage_deinit();
+    if(wl_unmount(wl_handle) != ESP_OK) {
+        LOGW("Failed to unmount data partition");
+    }
+    wl_handle = WL_INVALID_HANDLE;
+}
+
+void UsbDevice::enableCDC() {
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    // add the CDC-ACM interface descriptors to the configuration descriptor
+    std::vector<uint8_t> cdcDescriptor = {
+        // Interface number, string index, EP notification address and size, EP Out & EP In address, EP size
+        TUD_CDC_DESCRIPTOR(interfaceCount, 4, 0x84, 8, 0x05, 0x85, CDC_ENDPOINT_SIZE)
+    };
+    // The function consists of the communication and the data interface
+    interfaceCount += 2u;
+
+    configurationDescriptor.insert(configurationDescriptor.end(), cdcDescriptor.begin(), cdcDescriptor.end());
+
+    // add the length of the CDC descriptor to the total length of the configuration descriptor
+    configurationDescriptorTotalLength += TUD_CDC_DESC_LEN;
+#endif
+}
+
+ErrorCode UsbDevice::startCDC() {
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    const tinyusb_config_cdcacm_t cdcConfig = {
+        .usb_dev = TINYUSB_USBDEV_0,
+        .cdc_port = TINYUSB_CDC_ACM_0,
+        .callback_rx = handleCdcRx,
+        .callback_rx_wanted_char = NULL,
+        .callback_line_state_changed = NULL,
+        .callback_line_coding_changed = NULL
+    };
+
+    esp_err_t err = tinyusb_cdcacm_init(&cdcConfig);
+    if (err) {
+        LOGE("Failed to initialize the CDC-ACM interface with code: %d", err);
+        return ErrorCode::GeneralError;
+    }
+
+    isCdcEnabledFlag = true;
+#endif
+    return ErrorCode::Success;
+}
+
+void UsbDevice::resetConfiguration() {
+    // The descriptor is built from scratch on every start
+    configurationDescriptor.clear();
+    interfaceCount = 0u;
+    configurationDescriptorTotalLength = 0u;
 }
 
 ErrorCode UsbDevice::start(UsbDevice::DeviceClass deviceClass) {
+    if(isStartedFlag) {
+        LOGE("USB device is already started");
+        return ErrorCode::GeneralError;
+    }
+
+    if(!isSupported(deviceClass)) {
+        LOGE("USB device class %d does not fit the endpoints together with the boot keyboard and the CDC channel", static_cast<int>(deviceClass));
+        return ErrorCode::InvalidArgument;
+    }
+
+    resetConfiguration();
 
+    ErrorCode res = ErrorCode::Success;
     switch(deviceClass) {
         case DeviceClass::SerialJtag:
             LOGI("Starting USB Serial JTAG device...");
             // No additional configuration needed for Serial JTAG
+            this->deviceClass = deviceClass;
             return ErrorCode::Success;
         case DeviceClass::Hid:
             LOGI("Starting USB HID device...");
@@ -142,17 +258,22 @@ ErrorCode UsbDevice::start(UsbDevice::DeviceClass deviceClass) {
             break;
         case DeviceClass::Msc:
             LOGI("Starting USB MSC device...");
-            enableMSC();
+            res = enableMSC();
             break;
         case DeviceClass::HidMsc:
             LOGI("Starting USB HID + MSC device...");
             enableHID();
-            enableMSC();
+            res = enableMSC();
             break;
         default:
             LOGE("Invalid USB device class: %d", static_cast<int>(deviceClass));
             return ErrorCode::InvalidArgument;
     }
+    if(ErrorCode::Success != res) {
+        return res;
+    }
+
+    enableCDC();
 
     // Add the length of the configuration descriptor header to the total length of the configuration descriptor
     configurationDescriptorTotalLength += TUD_CONFIG_DESC_LEN;
@@ -185,27 +306,85 @@ ErrorCode UsbDevice::start(UsbDevice::DeviceClass deviceClass) {
     esp_err_t err = tinyusb_driver_install(&tusb_cfg);
     if (err) {
         LOGE("Failed to initialize TinyUSB driver with code: %d", err);
+        disableMSC();
         return ErrorCode::GeneralError;
     }
 
+    // The channel is optional - the device works without it
+    (void)startCDC();
+
     isStartedFlag = true;
+    this->deviceClass = deviceClass;
+    // The light sleep would stop the USB peripheral and the host would drop the device
+    PowerManager::acquire(PowerManager::Lock::NoLightSleep);
     LOGI("USB device started successfully");
     return ErrorCode::Success;
 }
 
 ErrorCode UsbDevice::stop(){
+    if(!isStartedFlag) {
+        // Nothing is installed in the Serial JTAG mode
+        return ErrorCode::Success;
+    }
+
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    if(isCdcEnabledFlag) {
+        (void)tinyusb_cdcacm_deinit(TINYUSB_CDC_ACM_0);
+        isCdcEnabledFlag = false;
+    }
+#endif
+
     esp_err_t err = tinyusb_driver_uninstall();
     if (err) {
         LOGE("Failed to uninstall TinyUSB driver with code: %d", err);
         return ErrorCode::GeneralError;
     }
 
+    disableMSC();
+    resetConfiguration();
+    // The lock key state belongs to the host session which has ended
+    hidLedState = 0u;
+
     isStartedFlag = false;
+    PowerManager::release(PowerManager::Lock::NoLightSleep);
     LOGI("TinyUSB driver uninstalled successfully");
 
     return ErrorCode::Success;
 }
 
+ErrorCode UsbDevice::restart(UsbDevice::DeviceClass deviceClass) {
+    // Rejected before the current device is stopped
+    if(!isSupported(deviceClass)) {
+        LOGE("USB device class %d does not fit the endpoints together with the boot keyboard and the CDC channel", static_cast<int>(deviceClass));
+        return ErrorCode::InvalidArgument;
+    }
+
+    ErrorCode res = stop();
+    if(ErrorCode::Success != res) {
+        return res;
+    }
+
+    if(isJtagEnabledFlag) {
+        esp_err_t err = usb_serial_jtag_driver_uninstall();
+        if (err) {
+            LOGE("Failed to uninstall USB Serial JTAG driver with code: %d", err);
+            return ErrorCode::GeneralError;
+        }
+        isJtagEnabledFlag = false;
+    }
+
+    if(DeviceClass::SerialJtag == deviceClass) {
+        // The PHY is released by the stopped device, so hand it over to the Serial JTAG controller
+        res = start(deviceClass);
+        return (ErrorCode::Success == res) ? enableJTAG() : res;
+    }
+
+    // Keep the bus idle long enough for the host to drop the previous device
+    Utils::delay(RESTART_DETACH_TIME);
+
+    return start(deviceClass);
+}
+
 bool UsbDevice::isStarted() const{
     return isStartedFlag;
 }
@@ -214,11 +393,22 @@ bool UsbDevice::isMounted() const{
     return tud_mounted();
 }
 
-const uint8_t *UsbDevice::getReportDescriptor() const{
-    return reportDescriptor.data();
+UsbDevice::DeviceClass UsbDevice::getDeviceClass() const{
+    return deviceClass;
+}
+
+const uint8_t *UsbDevice::getReportDescriptor(uint8_t instance) const{
+    if(instance >= reportDescriptors.size()) {
+        return nullptr;
+    }
+    return reportDescriptors[instance].data();
 }
 
 ErrorCode UsbDevice::enableJTAG(){
+    if(isJtagEnabledFlag) {
+        return ErrorCode::Success;
+    }
+
     usb_serial_jtag_driver_config_t usb_serial_jtag_config = USB_SERIAL_JTAG_DRIVER_CONFIG_DEFAULT();
     esp_err_t err = usb_serial_jtag_driver_install(&usb_serial_jtag_config);
     if (err) {
@@ -226,11 +416,30 @@ ErrorCode UsbDevice::enableJTAG(){
         return ErrorCode::GeneralError;
     }
 
+    isJtagEnabledFlag = true;
+    deviceClass = DeviceClass::SerialJtag;
     LOGI("USB Serial JTAG driver installed successfully");
     return ErrorCode::Success;
 }
 
-void UsbDevice::hidSendKeyboardReport(const std::vector<uint8_t> &keysList, uint8_t modifier) {
+bool UsbDevice::hidWaitReady(uint8_t instance) {
+    // A new report is rejected until the host polled the previous one, which would drop e.g. the key release
+    const TickType_t startTicks = xTaskGetTickCount();
+    const TickType_t timeoutTicks = pdMS_TO_TICKS(HID_READY_TIMEOUT);
+
+    while (!tud_hid_n_ready(instance)) {
+        if (!tud_mounted() || ((xTaskGetTickCount() - startTicks) >= timeoutTicks)) {
+            return false;
+        }
+        vTaskDelay(1u);
+    }
+
+    return true;
+}
+
+void UsbDevice::hidSendKeyboardReport(std::span<const uint8_t> keysList, uint8_t modifier) {
+    (void)hidWaitReady(HID_KEYBOARD_INSTANCE);
+    BootTimeline::record(BootTimeline::Event::FirstKeystroke);
     if(keysList.size() > 0 && keysList.size() <= 6) {
         uint8_t keycode[6] = {0};
         uint8_t i = 0;
@@ -238,19 +447,163 @@ void UsbDevice::hidSendKeyboardReport(const std::vector<uint8_t> &keysList, uint
                 keycode[i] = key;
                 i++;
         }
-        (void)tud_hid_keyboard_report(HID_ITF_PROTOCOL_KEYBOARD, modifier, keycode);
+        (void)tud_hid_n_keyboard_report(HID_KEYBOARD_INSTANCE, HID_KEYBOARD_REPORT_ID, modifier, keycode);
     } 
     else {
-        (void)tud_hid_keyboard_report(HID_ITF_PROTOCOL_KEYBOARD, modifier, NULL);
+        (void)tud_hid_n_keyboard_report(HID_KEYBOARD_INSTANCE, HID_KEYBOARD_REPORT_ID, modifier, NULL);
     }
 }
 
-void UsbDevice::hidKeyStroke(const std::vector<uint8_t> &keysList, uint8_t modifier, uint32_t delay) {
+void UsbDevice::hidKeyStroke(std::span<const uint8_t> keysList, uint8_t modifier, uint32_t delay) {
     hidSendKeyboardReport(keysList, modifier);
-    Utils::delay(delay);
-    (void)tud_hid_keyboard_report(HID_ITF_PROTOCOL_KEYBOARD, 0, NULL);
-    Utils::delay(delay);
+    (void)hidDelay(delay);
+    hidSendKeyboardReport({});
+    (void)hidDelay(delay);
+}
+
+void UsbDevice::hidKeyPress(uint8_t keyCode, uint8_t modifier, uint32_t delay) {
+    hidSendKeyboardReport({&keyCode, 1u}, modifier);
+    (void)hidDelay(delay);
+    hidSendKeyboardReport({});
+    (void)hidDelay(delay);
+}
+
+void UsbDevice::hidSendMouseReport(uint8_t buttons, int8_t x, int8_t y, int8_t vertical, int8_t horizontal) {
+    (void)hidWaitReady(HID_MOUSE_INSTANCE);
+    (void)tud_hid_n_mouse_report(HID_MOUSE_INSTANCE, HID_MOUSE_REPORT_ID, buttons, x, y, vertical, horizontal);
+}
+
+void UsbDevice::hidMouseMove(int8_t x, int8_t y, int8_t vertical) {
+    // Relative reports must not be overwritten before the host polls them, so send one report per polling interval
+    hidSendMouseReport(0u, x, y, vertical);
+    (void)hidDelay(HID_POLLING_INTERVAL);
+}
+
+void UsbDevice::hidMouseClick(uint8_t buttons, uint32_t delay) {
+    hidSendMouseReport(buttons, 0, 0);
+    (void)hidDelay(delay);
+    hidSendMouseReport(0u, 0, 0);
+    (void)hidDelay(delay);
+}
+
+void UsbDevice::hidSetLedState(uint8_t leds) {
+    // Called from the TinyUSB task when the host sends the keyboard output report
+    hidLedState = leds;
+}
+
+uint8_t UsbDevice::hidGetLedState() const {
+    return hidLedState;
+}
+
+bool UsbDevice::hidWaitForLedState(uint8_t mask, uint8_t state, uint32_t timeout) {
+    // Zero timeout waits until the state is reached
+    const TickType_t startTicks = xTaskGetTickCount();
+    const TickType_t timeoutTicks = pdMS_TO_TICKS(timeout);
+
+    while ((hidLedState & mask) != (state & mask)) {
+        if (hidAbortFlag || ((timeout != 0u) && ((xTaskGetTickCount() - startTicks) >= timeoutTicks))) {
+            return false;
+        }
+        vTaskDelay(1u);
+    }
+
+    return true;
+}
+
+bool UsbDevice::hidSyncHost(uint32_t timeout, uint32_t delay) {
+    // The host handles the input in order, so once it reflects the CAPS LOCK toggle in the LEDs
+    // all of the previous key strokes were processed as well
+    const uint8_t capsKeyCode = HID_KEY_CAPS_LOCK;
+    const uint8_t initialState = hidLedState & KEYBOARD_LED_CAPSLOCK;
+
+    hidKeyStroke({&capsKeyCode, 1u}, 0u, delay);
+    if (!hidWaitForLedState(KEYBOARD_LED_CAPSLOCK, initialState ^ KEYBOARD_LED_CAPSLOCK, timeout)) {
+        // The toggle may still be processed later, so restore the state only after the host reported it
+        return false;
+    }
+
+    // Restore the original CAPS LOCK state
+    hidKeyStroke({&capsKeyCode, 1u}, 0u, delay);
+    return hidWaitForLedState(KEYBOARD_LED_CAPSLOCK, initialState, timeout);
+}
+
+bool UsbDevice::hidDelay(uint32_t delay) {
+    // Wait in the polling interval steps, so that the abort request is handled before the next report
+    while ((delay > 0u) && !hidAbortFlag) {
+        const uint32_t step = std::min<uint32_t>(delay, HID_POLLING_INTERVAL);
+        Utils::delay(step);
+        delay -= step;
+    }
+
+    return !hidAbortFlag;
+}
+
+void UsbDevice::hidAbort() {
+    hidAbortFlag = true;
+}
+
+void UsbDevice::hidClearAbort() {
+    hidAbortFlag = false;
+}
+
+bool UsbDevice::hidIsAborted() const {
+    return hidAbortFlag;
+}
+
+bool UsbDevice::cdcIsConnected() const {
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    // The terminal sets DTR once it opens the port
+    return isCdcEnabledFlag && tud_cdc_n_connected(TINYUSB_CDC_ACM_0);
+#else
+    return false;
+#endif
+}
+
+std::size_t UsbDevice::cdcRead(std::span<uint8_t> buffer) {
+    std::size_t readSize = 0u;
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    if(isCdcEnabledFlag && (ESP_OK != tinyusb_cdcacm_read(TINYUSB_CDC_ACM_0, buffer.data(), buffer.size(), &readSize))) {
+        readSize = 0u;
+    }
+#endif
+    return readSize;
+}
+
+bool UsbDevice::cdcWrite(std::span<const uint8_t> data) {
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    if(!cdcIsConnected() || (tud_cdc_n_write_available(TINYUSB_CDC_ACM_0) < data.size())) {
+        return false;
+    }
+    return tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, data.data(), data.size()) == data.size();
+#else
+    return false;
+#endif
+}
+
+void UsbDevice::cdcFlush() {
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+    if(cdcIsConnected()) {
+        // Zero timeout only starts the transfer, it never waits for the host
+        (void)tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, 0u);
+    }
+#endif
+}
+
+void UsbDevice::cdcSetRxCallback(std::function<void()> &&callback) {
+    cdcRxCallback = std::move(callback);
+}
+
+#if CONFIG_ESP_DUCKY_CDC_CHANNEL
+void UsbDevice::handleCdcRx(int itf, cdcacm_event_t *event) {
+    (void)itf;
+    (void)event;
+
+    UsbDevice* usbDevice = UsbDevice::getInstance(0);
+    if ((nullptr != usbDevice) && usbDevice->cdcRxCallback) {
+        usbDevice->cdcRxCallback();
+    }
 }
+#endif
 
 UsbDevice* UsbDevice::getInstance(uint8_t instanceIdx)
 {
@@ -8,4 +8,14 @@ namespace Utils
     void delay(uint32_t ms) {
         vTaskDelay(ms / portTICK_PERIOD_MS);
     }
+
+    uint16_t crc16(std::span<const uint8_t> data, uint16_t crc) {
+        for (uint8_t byte : data) {
+            crc ^= static_cast<uint16_t>(byte) << 8u;
+            for (uint8_t bitIdx = 0u; bitIdx < 8u; bitIdx++) {
+                crc = (crc & 0x8000u) ? static_cast<uint16_t>((crc << 1u) ^ 0x1021u) : static_cast<uint16_t>(crc << 1u);
+            }
+        }
+        return crc;
+    }
 }
\ No newline at end of file
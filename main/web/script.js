@@ -4,17 +4,58 @@ const scriptTextarea = document.getElementById('scriptTextarea');
 const scriptRunButton = document.getElementById('scriptRunButton');
 const scriptLoadButton = document.getElementById('scriptLoadButton');
 const scriptSaveButton = document.getElementById('scriptSaveButton');
+const scriptCheckButton = document.getElementById('scriptCheckButton');
 const armingStateSelect = document.getElementById('armingStateSelect');
 const usbDeviceTypeSelect = document.getElementById('usbDeviceTypeSelect');
+const keyboardLayoutSelect = document.getElementById('keyboardLayoutSelect');
+const payloadSlotSelect = document.getElementById('payloadSlotSelect');
 const configSaveButton = document.getElementById('configSaveButton');
 
 const themeToggle = document.getElementById("themeToggle");
 
 const SCRIPT_ACTION_RUN = 0;
 const SCRIPT_ACTION_SAVE = 1;
+const SCRIPT_ACTION_COMPILE = 3;
+
+// Last script accepted by the device, the following requests only send the changed lines
+let lastSentScript = null;
+
+// FNV-1a hash of the UTF-8 encoded text, the device checks the patched script with it
+function fnv1a32(text) {
+	let hash = 0x811c9dc5;
+	for (const byte of new TextEncoder().encode(text)) {
+		hash = Math.imul(hash ^ byte, 0x01000193);
+	}
+	return hash | 0;
+}
+
+// Range of lines replaced in the last sent script, every inserted line is terminated by a newline
+function diffScript(base, script, action) {
+	const baseLines = base.split("\n");
+	const lines = script.split("\n");
+
+	let start = 0;
+	while (start < baseLines.length && start < lines.length && baseLines[start] === lines[start]) {
+		start++;
+	}
+	let suffix = 0;
+	while (suffix < baseLines.length - start && suffix < lines.length - start &&
+		baseLines[baseLines.length - 1 - suffix] === lines[lines.length - 1 - suffix]) {
+		suffix++;
+	}
+
+	return {
+		"action": action,
+		"start": start,
+		"remove": baseLines.length - start - suffix,
+		"insert": lines.slice(start, lines.length - suffix).map((line) => line + "\n").join(""),
+		"hash": fnv1a32(script),
+	};
+}
 
-function postScript(btn, script, action) {
-	console.log("Sending POST /script endpoint");
+function postScript(btn, script, action, isDiff = lastSentScript !== null) {
+	const endpoint = isDiff ? "script/diff" : "script";
+	console.log("Sending POST /" + endpoint + " endpoint");
 
 	let spinner = btn.querySelector('.spinner');
 	spinner.classList.remove('hidden');
@@ -22,10 +63,10 @@ function postScript(btn, script, action) {
 
 	// unregister subscription from the server
 	let xhr = new XMLHttpRequest();
-	xhr.open("POST", "script", true);
+	xhr.open("POST", endpoint, true);
 	xhr.setRequestHeader("Content-Type", "application/json");
 
-	let scriptReq = {
+	let scriptReq = isDiff ? diffScript(lastSentScript, script, action) : {
         "script": script,
         "action": action,
     };
@@ -38,11 +79,27 @@ function postScript(btn, script, action) {
 			{
 				//var json = JSON.parse(xhr.responseText);
 				//console.log(xhr.responseText);
-				console.log("POST /script endpoint response: " + xhr.responseText);
+				console.log("POST /" + endpoint + " endpoint response: " + xhr.responseText);
+				lastSentScript = script;
+				if(action === SCRIPT_ACTION_COMPILE)
+				{
+					var json = JSON.parse(xhr.responseText);
+					alert("Compiled size: " + json.size + " B\n" +
+						"Commands: " + json.commands + "\n" +
+						"Keystrokes: " + json.keystrokes + "\n" +
+						"Estimated duration: " + (json.duration / 1000).toFixed(1) + " s" + (json.durationBounded ? "" : " (at least)"));
+				}
+			}
+			else if(isDiff && xhr.status === 404)
+			{
+				// The device does not have the base of the diff, e.g. after a restart
+				console.log("POST /" + endpoint + " base not found, sending the whole script");
+				lastSentScript = null;
+				postScript(btn, script, action, false);
 			}
 			else
 			{
-				console.error("POST /script endpoint error: " + xhr.statusText);
+				console.error("POST /" + endpoint + " endpoint error: " + xhr.statusText);
 				alert("Error: " + xhr.status + " (" + xhr.statusText + ")");
 			}
 		}
@@ -101,6 +158,15 @@ function getConfig() {
 				console.log("GET /config endpoint response: " + xhr.responseText);
 				armingStateSelect.value = json.armingState;
 				usbDeviceTypeSelect.value = json.usbDeviceType;
+				keyboardLayoutSelect.value = json.keyboardLayout;
+				// Slots of the payload ROM linked into the firmware
+				(json.payloadRom || []).forEach(function (name, idx) {
+					let option = document.createElement('option');
+					option.value = idx + 1;
+					option.textContent = "ROM: " + name;
+					payloadSlotSelect.appendChild(option);
+				});
+				payloadSlotSelect.value = json.payloadSlot || 0;
 			}
 			else
 			{
@@ -128,6 +194,8 @@ function postConfig(btn) {
 	let configReq = {
 		"armingState": parseInt(armingStateSelect.value),
 		"usbDeviceType": parseInt(usbDeviceTypeSelect.value),
+		"keyboardLayout": parseInt(keyboardLayoutSelect.value),
+		"payloadSlot": parseInt(payloadSlotSelect.value),
 	};
 
 	xhr.onreadystatechange = function () {
@@ -161,6 +229,7 @@ scriptTextarea.addEventListener('input', () => autoGrow(scriptTextarea));
 scriptRunButton.addEventListener('click', () => postScript(scriptRunButton, scriptTextarea.value, SCRIPT_ACTION_RUN));
 scriptSaveButton.addEventListener('click', () => postScript(scriptSaveButton, scriptTextarea.value, SCRIPT_ACTION_SAVE));
 scriptLoadButton.addEventListener('click', () => getScript(scriptLoadButton));
+scriptCheckButton.addEventListener('click', () => postScript(scriptCheckButton, scriptTextarea.value, SCRIPT_ACTION_COMPILE));
 configSaveButton.addEventListener('click', () => postConfig(configSaveButton));
 
 // Theme toggle functionality